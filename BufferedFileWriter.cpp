@@ -0,0 +1,169 @@
+#include "BufferedFileWriter.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+
+const quint64 powersOfTen[] = {1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull,
+                               1000000ull, 10000000ull, 100000000ull, 1000000000ull};
+
+// Write the decimal digits of value at the end of out, returns the number of digits
+int formatUnsigned(quint64 value, char* out)
+{
+    char digits[20];
+    int count = 0;
+    do
+    {
+        digits[count++] = '0' + (char)(value % 10);
+        value /= 10;
+    } while(value != 0);
+    for(int k=0 ; k<count ; k++)
+    {
+        out[k] = digits[count-1-k];
+    }
+    return count;
+}
+
+}
+
+BufferedFileWriter::BufferedFileWriter() :
+    mBuffer(BUFFERED_FILE_WRITER_CAPACITY, 0), mSize(0), mHasError(false)
+{
+}
+
+BufferedFileWriter::~BufferedFileWriter()
+{
+    if(mFile.isOpen())
+    {
+        close();
+    }
+}
+
+bool BufferedFileWriter::open(QString filename)
+{
+    mFile.setFileName(filename);
+    // We do our own buffering
+    if(!mFile.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered))
+    {
+        mErrorString = mFile.errorString();
+        return false;
+    }
+    mSize = 0;
+    mHasError = false;
+    return true;
+}
+
+bool BufferedFileWriter::close()
+{
+    flush();
+    mFile.close();
+    return !mHasError;
+}
+
+void BufferedFileWriter::write(const char* text)
+{
+    write(text, (int)strlen(text));
+}
+
+void BufferedFileWriter::write(const char* text, int length)
+{
+    if(length > BUFFERED_FILE_WRITER_CAPACITY)
+    {
+        flush();
+        if(mFile.write(text, length) != length)
+        {
+            mHasError = true;
+            mErrorString = mFile.errorString();
+        }
+        return;
+    }
+    reserve(length);
+    memcpy(mBuffer.data() + mSize, text, length);
+    mSize += length;
+}
+
+void BufferedFileWriter::write(char c)
+{
+    reserve(1);
+    mBuffer.data()[mSize++] = c;
+}
+
+void BufferedFileWriter::writeInt(qint64 value)
+{
+    reserve(21);
+    char* out = mBuffer.data() + mSize;
+    if(value < 0)
+    {
+        *out++ = '-';
+        mSize++;
+        mSize += formatUnsigned((quint64)(-(value+1)) + 1, out);
+    }
+    else
+    {
+        mSize += formatUnsigned((quint64)value, out);
+    }
+}
+
+void BufferedFileWriter::writeReal(double value, int decimals)
+{
+    decimals = qBound(0, decimals, 9);
+    reserve(32);
+    char* out = mBuffer.data() + mSize;
+    if(!std::isfinite(value))
+    {
+        // Neither JSON nor SVG have a number for NaN or infinity
+        write("null");
+        return;
+    }
+    double scaled = std::fabs(value)*powersOfTen[decimals];
+    if(scaled >= 9e18)
+    {
+        // Out of range of the fast path
+        mSize += snprintf(out, 32, "%.17g", value);
+        return;
+    }
+    quint64 rounded = (quint64)(scaled + 0.5);
+    quint64 integerPart = rounded / powersOfTen[decimals];
+    quint64 fractionalPart = rounded % powersOfTen[decimals];
+    int length = 0;
+    if(value < 0 && rounded != 0)
+    {
+        out[length++] = '-';
+    }
+    length += formatUnsigned(integerPart, out + length);
+    if(fractionalPart != 0)
+    {
+        // Remove trailing zeros
+        int digits = decimals;
+        while(fractionalPart % 10 == 0)
+        {
+            fractionalPart /= 10;
+            digits--;
+        }
+        out[length++] = '.';
+        for(int k=digits-1 ; k>=0 ; k--)
+        {
+            out[length+k] = '0' + (char)(fractionalPart % 10);
+            fractionalPart /= 10;
+        }
+        length += digits;
+    }
+    mSize += length;
+}
+
+void BufferedFileWriter::flush()
+{
+    if(mSize == 0)
+    {
+        return;
+    }
+    if(mFile.write(mBuffer.constData(), mSize) != mSize)
+    {
+        mHasError = true;
+        mErrorString = mFile.errorString();
+    }
+    mSize = 0;
+}
@@ -0,0 +1,67 @@
+#ifndef BUFFEREDFILEWRITER_H
+#define BUFFEREDFILEWRITER_H
+
+#include <QFile>
+#include <QString>
+#include <QByteArray>
+
+// Size of the output buffer, in bytes
+#define BUFFERED_FILE_WRITER_CAPACITY (1 << 20)
+
+// Writes text to a file through a fixed-size buffer,
+// with fast number formatting. Used to stream large documents
+// without building them in memory.
+class BufferedFileWriter
+{
+public:
+    BufferedFileWriter();
+    ~BufferedFileWriter();
+
+    // Create the file. Returns false on error
+    bool open(QString filename);
+    // Flush the buffer and close the file.
+    // Returns false if any write failed
+    bool close();
+
+    // Append a null-terminated string
+    void write(const char* text);
+    // Append a string of known length
+    void write(const char* text, int length);
+    // Append a single character
+    void write(char c);
+    // Append an integer in decimal notation
+    void writeInt(qint64 value);
+    // Append a real number in fixed notation, with at most
+    // 'decimals' digits after the point (trailing zeros are removed)
+    // NaN and infinity are written as null
+    void writeReal(double value, int decimals = 6);
+
+    // Returns the description of the last error
+    QString errorString() const {return mErrorString;}
+
+private:
+
+    // Write the buffer content to the file
+    void flush();
+    // Make sure 'length' bytes can be appended to the buffer
+    void reserve(int length)
+    {
+        if(mSize + length > BUFFERED_FILE_WRITER_CAPACITY)
+        {
+            flush();
+        }
+    }
+
+    // Output file
+    QFile mFile;
+    // Output buffer
+    QByteArray mBuffer;
+    // Number of bytes used in the buffer
+    int mSize;
+    // Holds whether a write failed
+    bool mHasError;
+    // Description of the last error
+    QString mErrorString;
+};
+
+#endif // BUFFEREDFILEWRITER_H
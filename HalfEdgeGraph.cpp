@@ -0,0 +1,359 @@
+#include "HalfEdgeGraph.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+// Angle of the direction from the first point of the range
+// to the first point that differs from it
+float leavingAngle(const QVector<QPointF>& points, bool forward)
+{
+    int n = points.size();
+    QPointF origin = forward ? points.first() : points.last();
+    for(int k=1 ; k<n ; k++)
+    {
+        QPointF d = (forward ? points[k] : points[n-1-k]) - origin;
+        if(!isFuzzyNull(d.x()) || !isFuzzyNull(d.y()))
+        {
+            return std::atan2(d.y(), d.x());
+        }
+    }
+    return 0;
+}
+
+}
+
+HalfEdgeGraph::HalfEdgeGraph() :
+    mAliveFaceCount(0)
+{
+}
+
+void HalfEdgeGraph::clear()
+{
+    mHalfEdges.clear();
+    mFreeHalfEdges.clear();
+    mOutgoing.clear();
+    mRoadHalfEdges.clear();
+    mFaces.clear();
+    mAliveFaceCount = 0;
+    mDirtyHalfEdges.clear();
+}
+
+void HalfEdgeGraph::build(const QMap<int,Node>& nodes, const QMap<int,Road>& roads)
+{
+    Q_UNUSED(nodes);
+    clear();
+    mHalfEdges.reserve(2*roads.size());
+    QMap<int,Road>::const_iterator itr = roads.constBegin(), itr_end = roads.constEnd();
+    for(; itr != itr_end ; itr++)
+    {
+        int forward = createHalfEdges(*itr);
+        if(forward != -1)
+        {
+            mOutgoing[mHalfEdges[forward].origin].push_back(forward);
+            mOutgoing[mHalfEdges[forward+1].origin].push_back(forward+1);
+        }
+    }
+    // Sort each node's half-edges once, then link them all
+    QHash<int, QVector<int> >::iterator ito = mOutgoing.begin(), ito_end = mOutgoing.end();
+    for(; ito != ito_end ; ito++)
+    {
+        QVector<int>& outgoing = ito.value();
+        const QVector<HalfEdge>& halfEdges = mHalfEdges;
+        std::sort(outgoing.begin(), outgoing.end(), [&halfEdges](int a, int b)
+        {
+            return halfEdges[a].angle < halfEdges[b].angle
+                    || (halfEdges[a].angle == halfEdges[b].angle && a < b);
+        });
+        for(int k=0 ; k<outgoing.size() ; k++)
+        {
+            linkAround(outgoing, k);
+        }
+    }
+    traceDirtyFaces();
+}
+
+void HalfEdgeGraph::addRoad(const Road& road)
+{
+    if(mRoadHalfEdges.contains(road.ID))
+    {
+        removeRoad(road.ID);
+    }
+    int forward = createHalfEdges(road);
+    if(forward == -1)
+    {
+        return;
+    }
+    insertOutgoing(forward);
+    insertOutgoing(mHalfEdges[forward].twin);
+    traceDirtyFaces();
+}
+
+void HalfEdgeGraph::removeRoad(int roadID)
+{
+    if(!mRoadHalfEdges.contains(roadID))
+    {
+        return;
+    }
+    int forward = mRoadHalfEdges.take(roadID);
+    int backward = mHalfEdges[forward].twin;
+    invalidateFace(forward);
+    invalidateFace(backward);
+    removeOutgoing(forward);
+    removeOutgoing(backward);
+    mHalfEdges[forward].origin = -1;
+    mHalfEdges[backward].origin = -1;
+    mFreeHalfEdges.push_back(forward);
+    traceDirtyFaces();
+}
+
+void HalfEdgeGraph::splitRoad(int roadID, const Road& firstPart, const Road& secondPart)
+{
+    removeRoad(roadID);
+    addRoad(firstPart);
+    addRoad(secondPart);
+}
+
+QVector<int> HalfEdgeGraph::faceIndices(bool boundedOnly) const
+{
+    QVector<int> indices;
+    for(int k=0 ; k<mFaces.size() ; k++)
+    {
+        if(mFaces[k].isAlive && (!boundedOnly || mFaces[k].area > 0))
+        {
+            indices.push_back(k);
+        }
+    }
+    return indices;
+}
+
+int HalfEdgeGraph::leftFaceOfRoad(int roadID) const
+{
+    QHash<int,int>::const_iterator it = mRoadHalfEdges.constFind(roadID);
+    if(it == mRoadHalfEdges.constEnd())
+    {
+        return -1;
+    }
+    return mHalfEdges[it.value()].face;
+}
+
+QVector<int> HalfEdgeGraph::faceRoadIDs(int faceIndex) const
+{
+    QVector<int> roadIDs;
+    const PlanarFace& f = mFaces[faceIndex];
+    int e = f.firstHalfEdge;
+    for(int k=0 ; k<f.edgeCount ; k++)
+    {
+        roadIDs.push_back(mHalfEdges[e].roadID);
+        e = mHalfEdges[e].next;
+    }
+    return roadIDs;
+}
+
+QVector<QPointF> HalfEdgeGraph::facePolygon(int faceIndex, const QMap<int,Road>& roads) const
+{
+    QVector<QPointF> polygon;
+    const PlanarFace& f = mFaces[faceIndex];
+    int e = f.firstHalfEdge;
+    for(int k=0 ; k<f.edgeCount ; k++)
+    {
+        const HalfEdge& halfEdge = mHalfEdges[e];
+        QMap<int,Road>::const_iterator road = roads.constFind(halfEdge.roadID);
+        if(road != roads.constEnd())
+        {
+            const QVector<QPointF>& points = road->segments;
+            int n = points.size();
+            // The last point is the first point of the next half-edge
+            for(int p=0 ; p<n-1 ; p++)
+            {
+                polygon.push_back(halfEdge.forward ? points[p] : points[n-1-p]);
+            }
+        }
+        e = halfEdge.next;
+    }
+    return polygon;
+}
+
+int HalfEdgeGraph::createHalfEdges(const Road& road)
+{
+    if(road.segments.size() < 2)
+    {
+        return -1;
+    }
+    // Half-edges are allocated in pairs, the forward one first
+    int forward;
+    if(!mFreeHalfEdges.isEmpty())
+    {
+        forward = mFreeHalfEdges.takeLast();
+    }
+    else
+    {
+        forward = mHalfEdges.size();
+        mHalfEdges.resize(mHalfEdges.size()+2);
+    }
+    int backward = forward+1;
+
+    // The terms are computed in double, not with the float det2D(): they
+    // mostly cancel out, and the area of a small block far from the origin is lost
+    double doubleArea = 0;
+    for(int k=1 ; k<road.segments.size() ; k++)
+    {
+        const QPointF& A = road.segments[k-1];
+        const QPointF& B = road.segments[k];
+        doubleArea += A.x()*B.y() - A.y()*B.x();
+    }
+    double length = computePathLength(road.segments);
+
+    HalfEdge& f = mHalfEdges[forward];
+    f.origin = road.nodeID1;
+    f.twin = backward;
+    f.next = backward;
+    f.face = -1;
+    f.roadID = road.ID;
+    f.forward = true;
+    f.angle = leavingAngle(road.segments, true);
+    f.doubleArea = doubleArea;
+    f.length = length;
+
+    HalfEdge& b = mHalfEdges[backward];
+    b.origin = road.nodeID2;
+    b.twin = forward;
+    b.next = forward;
+    b.face = -1;
+    b.roadID = road.ID;
+    b.forward = false;
+    b.angle = leavingAngle(road.segments, false);
+    b.doubleArea = -doubleArea;
+    b.length = length;
+
+    mRoadHalfEdges.insert(road.ID, forward);
+    mDirtyHalfEdges.push_back(forward);
+    mDirtyHalfEdges.push_back(backward);
+    return forward;
+}
+
+void HalfEdgeGraph::insertOutgoing(int halfEdge)
+{
+    QVector<int>& outgoing = mOutgoing[mHalfEdges[halfEdge].origin];
+    const QVector<HalfEdge>& halfEdges = mHalfEdges;
+    QVector<int>::iterator position = std::lower_bound(outgoing.begin(), outgoing.end(), halfEdge,
+                                                       [&halfEdges](int a, int b)
+    {
+        return halfEdges[a].angle < halfEdges[b].angle
+                || (halfEdges[a].angle == halfEdges[b].angle && a < b);
+    });
+    int p = position - outgoing.begin();
+    outgoing.insert(p, halfEdge);
+    // The half-edge arriving through the new one, and the one
+    // arriving through its counter-clockwise neighbor change their next
+    linkAround(outgoing, p);
+    linkAround(outgoing, (p+1) % outgoing.size());
+}
+
+void HalfEdgeGraph::removeOutgoing(int halfEdge)
+{
+    int origin = mHalfEdges[halfEdge].origin;
+    QVector<int>& outgoing = mOutgoing[origin];
+    int p = outgoing.indexOf(halfEdge);
+    if(p == -1)
+    {
+        return;
+    }
+    outgoing.remove(p);
+    if(outgoing.isEmpty())
+    {
+        mOutgoing.remove(origin);
+        return;
+    }
+    linkAround(outgoing, p % outgoing.size());
+}
+
+void HalfEdgeGraph::linkAround(const QVector<int>& outgoing, int position)
+{
+    // The face on the left of an arriving half-edge continues with
+    // the first half-edge clockwise from its twin
+    int d = outgoing.size();
+    int arriving = mHalfEdges[outgoing[position]].twin;
+    mHalfEdges[arriving].next = outgoing[(position-1+d) % d];
+    invalidateFace(arriving);
+}
+
+void HalfEdgeGraph::invalidateFace(int halfEdge)
+{
+    int f = mHalfEdges[halfEdge].face;
+    if(f != -1)
+    {
+        if(mFaces[f].isAlive)
+        {
+            mFaces[f].isAlive = false;
+            mAliveFaceCount--;
+        }
+        mHalfEdges[halfEdge].face = -1;
+    }
+    mDirtyHalfEdges.push_back(halfEdge);
+}
+
+void HalfEdgeGraph::traceDirtyFaces()
+{
+    for(int k=0 ; k<mDirtyHalfEdges.size() ; k++)
+    {
+        int start = mDirtyHalfEdges[k];
+        if(mHalfEdges[start].origin == -1 || mHalfEdges[start].face != -1)
+        {
+            continue;
+        }
+        // Face slots aren't reused here: half-edges that haven't been
+        // traced yet may still point to the removed faces
+        int faceIndex = mFaces.size();
+        mFaces.resize(mFaces.size()+1);
+        PlanarFace& face = mFaces[faceIndex];
+        face.firstHalfEdge = start;
+        face.edgeCount = 0;
+        face.area = 0;
+        face.perimeter = 0;
+        face.isAlive = true;
+        mAliveFaceCount++;
+        int e = start;
+        do
+        {
+            HalfEdge& halfEdge = mHalfEdges[e];
+            halfEdge.face = faceIndex;
+            face.area += halfEdge.doubleArea;
+            face.perimeter += halfEdge.length;
+            face.edgeCount++;
+            e = halfEdge.next;
+        } while(e != start && face.edgeCount <= mHalfEdges.size());
+        face.area /= 2.0;
+    }
+    mDirtyHalfEdges.clear();
+
+    // Drop the removed faces once they outnumber the live ones
+    if(mFaces.size() - mAliveFaceCount > qMax(1024, mAliveFaceCount))
+    {
+        compactFaces();
+    }
+}
+
+void HalfEdgeGraph::compactFaces()
+{
+    QVector<int> newIndices(mFaces.size(), -1);
+    int count = 0;
+    for(int f=0 ; f<mFaces.size() ; f++)
+    {
+        if(mFaces[f].isAlive)
+        {
+            newIndices[f] = count;
+            mFaces[count++] = mFaces[f];
+        }
+    }
+    mFaces.resize(count);
+    for(int e=0 ; e<mHalfEdges.size() ; e++)
+    {
+        if(mHalfEdges[e].origin != -1 && mHalfEdges[e].face != -1)
+        {
+            mHalfEdges[e].face = newIndices[mHalfEdges[e].face];
+        }
+    }
+}
@@ -0,0 +1,116 @@
+#ifndef HALFEDGEGRAPH_H
+#define HALFEDGEGRAPH_H
+
+#include <QHash>
+#include <QMap>
+#include <QPointF>
+#include <QVector>
+
+#include "StreetGraph.h"
+
+// Structure to store a half-edge: one direction of a road
+struct HalfEdge {
+    // Node the half-edge leaves from
+    int origin;
+    // Index of the opposite half-edge
+    int twin;
+    // Index of the next half-edge around the face on its left
+    int next;
+    // Index of the face on its left, -1 if it must be traced again
+    int face;
+    // Road the half-edge runs along, and whether it follows the road points order
+    int roadID;
+    bool forward;
+    // Angle of the first road segment leaving the origin, in ]-pi,pi]
+    float angle;
+    // Contribution to twice the signed area of the face (shoelace sum)
+    double doubleArea;
+    // Length of the road
+    double length;
+};
+
+// Structure to store a face of the planar graph.
+// Bounded faces (city blocks) have a positive area, the outer
+// boundary of each connected component has a negative area
+struct PlanarFace {
+    int firstHalfEdge;
+    int edgeCount;
+    double area;
+    double perimeter;
+    bool isAlive;
+};
+
+// Half-edge representation of the street graph, with the half-edges
+// leaving each node sorted by angle. Faces are traced by following
+// the next pointers, and kept up to date when roads are added,
+// removed or split: only the faces touching the modified nodes
+// are traced again.
+class HalfEdgeGraph
+{
+public:
+    HalfEdgeGraph();
+
+    // Build the graph from scratch. O(E log d)
+    void build(const QMap<int,Node>& nodes, const QMap<int,Road>& roads);
+    // Remove every half-edge and face
+    void clear();
+
+    // Insert the two half-edges of a road, and update the faces around it.
+    // O(log d) per end node, plus the size of the modified faces
+    void addRoad(const Road& road);
+    // Remove the two half-edges of a road, and update the faces around it
+    void removeRoad(int roadID);
+    // Replace a road by the two roads it was split into
+    void splitRoad(int roadID, const Road& firstPart, const Road& secondPart);
+
+    // Returns whether the road is in the graph
+    bool containsRoad(int roadID) const {return mRoadHalfEdges.contains(roadID);}
+    // Returns the indices of the live faces. If boundedOnly is true,
+    // the outer faces (negative area) are left out
+    QVector<int> faceIndices(bool boundedOnly = true) const;
+    // Returns a face
+    const PlanarFace& face(int index) const {return mFaces[index];}
+    // Returns the index of the face on the left of a road, following its points order
+    int leftFaceOfRoad(int roadID) const;
+    // Returns the IDs of the roads bounding a face, in order
+    QVector<int> faceRoadIDs(int faceIndex) const;
+    // Returns the polygon of a face, in counter-clockwise order for blocks
+    QVector<QPointF> facePolygon(int faceIndex, const QMap<int,Road>& roads) const;
+
+private:
+
+    // Create the two half-edges of a road, without linking them.
+    // Returns the index of the forward half-edge, or -1 if the road is degenerate
+    int createHalfEdges(const Road& road);
+    // Insert a half-edge in the sorted list of its origin,
+    // and update the next pointers around it
+    void insertOutgoing(int halfEdge);
+    // Remove a half-edge from the sorted list of its origin,
+    // and update the next pointers around it
+    void removeOutgoing(int halfEdge);
+    // Set the next pointer of the half-edge arriving at a node
+    // through the twin of outgoing[position]
+    void linkAround(const QVector<int>& outgoing, int position);
+    // Mark the face of a half-edge for tracing
+    void invalidateFace(int halfEdge);
+    // Trace the faces of the half-edges marked for tracing
+    void traceDirtyFaces();
+    // Remove the dead faces from the face list, and renumber the others
+    void compactFaces();
+
+    // Half-edges. Removed ones have origin == -1
+    QVector<HalfEdge> mHalfEdges;
+    // Indices of removed half-edges, reused by new ones
+    QVector<int> mFreeHalfEdges;
+    // Half-edges leaving each node, sorted by angle
+    QHash<int, QVector<int> > mOutgoing;
+    // Forward half-edge of each road
+    QHash<int,int> mRoadHalfEdges;
+    // Faces. Removed ones are not alive
+    QVector<PlanarFace> mFaces;
+    int mAliveFaceCount;
+    // Half-edges whose face must be traced again
+    QVector<int> mDirtyHalfEdges;
+};
+
+#endif // HALFEDGEGRAPH_H
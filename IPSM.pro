@@ -4,10 +4,15 @@
 #
 #-------------------------------------------------
 
-QT       += core gui
+QT       += core gui concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
+CONFIG += c++11
+
+# zlib compresses the exported PNG images
+LIBS += -lz
+
 TARGET = IPSM
 TEMPLATE = app
 
@@ -15,10 +20,30 @@ TEMPLATE = app
 SOURCES += main.cpp\
         mainwindow.cpp \
     TensorField.cpp \
-    StreetGraph.cpp
+    TensorStorage.cpp \
+    TileCache.cpp \
+    StreetGraph.cpp \
+    StripImageWriter.cpp \
+    BufferedFileWriter.cpp \
+    StreetGraphFile.cpp \
+    HalfEdgeGraph.cpp \
+    OccupancyGrid.cpp \
+    LoopDetector.cpp \
+    TraceCache.cpp \
+    SegmentBuffer.cpp
 
 HEADERS  += mainwindow.h \
     TensorField.h \
-    StreetGraph.h
+    TensorStorage.h \
+    TileCache.h \
+    StreetGraph.h \
+    StripImageWriter.h \
+    BufferedFileWriter.h \
+    StreetGraphFile.h \
+    HalfEdgeGraph.h \
+    OccupancyGrid.h \
+    LoopDetector.h \
+    TraceCache.h \
+    SegmentBuffer.h
 
 FORMS    += mainwindow.ui
@@ -0,0 +1,74 @@
+#include "LoopDetector.h"
+
+#include <cmath>
+
+LoopDetector::LoopDetector(float step) :
+    mCellSize(qMax(LOOP_TOLERANCE_IN_STEPS*step, 1e-6f))
+{
+}
+
+void LoopDetector::insert(QPointF point)
+{
+    float arcLength = 0;
+    if(!mPoints.isEmpty())
+    {
+        QPointF d = point - mPoints.last();
+        arcLength = mArcLengths.last() + std::sqrt(QPointF::dotProduct(d,d));
+    }
+    int i = (int)std::floor(point.y()/mCellSize);
+    int j = (int)std::floor(point.x()/mCellSize);
+    mCells[cellKey(i,j)].push_back(mPoints.size());
+    mPoints.push_back(point);
+    mArcLengths.push_back(arcLength);
+}
+
+bool LoopDetector::isApproachingEarlierPoint(QPointF position) const
+{
+    int n = mPoints.size();
+    if(n < 2)
+    {
+        return false;
+    }
+    // The tolerance follows the actual step, which scales with the eigenvalues
+    float lastStep = mArcLengths[n-1] - mArcLengths[n-2];
+    float tolerance = LOOP_TOLERANCE_IN_STEPS*lastStep;
+    if(tolerance <= 0)
+    {
+        return false;
+    }
+    QPointF d = position - mPoints.last();
+    float arcLength = mArcLengths.last() + std::sqrt(QPointF::dotProduct(d,d));
+    // Points closer than this along the road are neighbors, not a loop
+    float minArcDistance = 2.0f*tolerance;
+    float squaredTolerance = tolerance*tolerance;
+
+    int rings = (int)std::ceil(tolerance/mCellSize);
+    int ci = (int)std::floor(position.y()/mCellSize);
+    int cj = (int)std::floor(position.x()/mCellSize);
+    for(int i=ci-rings ; i<=ci+rings ; i++)
+    {
+        for(int j=cj-rings ; j<=cj+rings ; j++)
+        {
+            QHash<qint64, QVector<int> >::const_iterator cell = mCells.constFind(cellKey(i,j));
+            if(cell == mCells.constEnd())
+            {
+                continue;
+            }
+            const QVector<int>& indices = cell.value();
+            for(int k=0 ; k<indices.size() ; k++)
+            {
+                int index = indices[k];
+                if(arcLength - mArcLengths[index] < minArcDistance)
+                {
+                    continue;
+                }
+                QPointF e = mPoints[index] - position;
+                if(QPointF::dotProduct(e,e) < squaredTolerance)
+                {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
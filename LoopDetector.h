@@ -0,0 +1,43 @@
+#ifndef LOOPDETECTOR_H
+#define LOOPDETECTOR_H
+
+#include <QHash>
+#include <QPointF>
+#include <QVector>
+
+// Distance under which a road is considered back on itself,
+// as a multiple of the length of its last step.
+// A road orbiting a center drifts outward by about pi steps per revolution
+#define LOOP_TOLERANCE_IN_STEPS 4.0f
+
+// Spatial hash of the points of the road being grown, used to stop it
+// when it loops, orbits or comes back close to itself.
+// Each query only looks at the few cells around the position
+class LoopDetector
+{
+public:
+    // step is the nominal integration step, used to size the cells
+    explicit LoopDetector(float step);
+
+    // Add the next point of the road
+    void insert(QPointF point);
+    // Returns whether the position is closer than the tolerance from an
+    // earlier point of the road. The points just behind the last one,
+    // along the road, are skipped
+    bool isApproachingEarlierPoint(QPointF position) const;
+
+private:
+
+    // Returns the key of the cell (i,j)
+    static qint64 cellKey(int i, int j) {return ((qint64)i << 32) ^ (quint32)j;}
+
+    // Size of the cells
+    float mCellSize;
+    // Points of the road, and their distance from the first one along the road
+    QVector<QPointF> mPoints;
+    QVector<float> mArcLengths;
+    // Indices of the points in each non empty cell
+    QHash<qint64, QVector<int> > mCells;
+};
+
+#endif // LOOPDETECTOR_H
@@ -0,0 +1,163 @@
+#include "OccupancyGrid.h"
+
+#include <algorithm>
+#include <cmath>
+
+OccupancyGrid::OccupancyGrid() :
+    mCellSize(1.0f), mWidth(0), mHeight(0)
+{
+}
+
+void OccupancyGrid::reset(QRectF region, float cellSize)
+{
+    mRegion = region;
+    mCellSize = qMax(cellSize, 1e-6f);
+    // Keep the grid to a reasonable size
+    mCellSize = qMax(mCellSize, (float)qMax(region.width(), region.height())/1024.0f);
+    mWidth = qMax(1, (int)std::ceil(region.width()/mCellSize));
+    mHeight = qMax(1, (int)std::ceil(region.height()/mCellSize));
+    mCells = QVector<QVector<RoadSample> >(mWidth*mHeight);
+    mRoadCells.clear();
+}
+
+void OccupancyGrid::clear()
+{
+    for(int k=0 ; k<mCells.size() ; k++)
+    {
+        mCells[k].clear();
+    }
+    mRoadCells.clear();
+}
+
+void OccupancyGrid::insert(QPointF position, int roadID, bool isMajor)
+{
+    if(mCells.isEmpty())
+    {
+        return;
+    }
+    int i, j;
+    cellCoordinates(position, i, j);
+    int cell = i*mWidth + j;
+    RoadSample sample;
+    sample.position = position;
+    sample.roadID = roadID;
+    sample.isMajor = isMajor;
+    mCells[cell].push_back(sample);
+    // Consecutive samples are mostly in the same cell
+    QVector<int>& roadCells = mRoadCells[roadID];
+    if(roadCells.isEmpty() || roadCells.last() != cell)
+    {
+        roadCells.push_back(cell);
+    }
+}
+
+void OccupancyGrid::insertRoad(const QVector<QPointF>& points, int roadID, bool isMajor)
+{
+    for(int k=0 ; k<points.size() ; k++)
+    {
+        insert(points[k], roadID, isMajor);
+    }
+}
+
+void OccupancyGrid::removeRoad(int roadID)
+{
+    if(!mRoadCells.contains(roadID))
+    {
+        return;
+    }
+    QVector<int> roadCells = mRoadCells.take(roadID);
+    for(int k=0 ; k<roadCells.size() ; k++)
+    {
+        QVector<RoadSample>& samples = mCells[roadCells[k]];
+        samples.erase(std::remove_if(samples.begin(), samples.end(), [roadID](const RoadSample& sample)
+        {
+            return sample.roadID == roadID;
+        }), samples.end());
+    }
+}
+
+bool OccupancyGrid::findRoadFamily(int roadID, bool& isMajor) const
+{
+    QHash<int, QVector<int> >::const_iterator roadCells = mRoadCells.constFind(roadID);
+    if(roadCells == mRoadCells.constEnd() || roadCells->isEmpty())
+    {
+        return false;
+    }
+    const QVector<RoadSample>& samples = mCells[roadCells->first()];
+    for(int k=0 ; k<samples.size() ; k++)
+    {
+        if(samples[k].roadID == roadID)
+        {
+            isMajor = samples[k].isMajor;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool OccupancyGrid::hasSampleWithin(QPointF position, float distance, bool isMajor,
+                                    const QVector<int>& ignoredRoadIDs) const
+{
+    if(mCells.isEmpty())
+    {
+        return false;
+    }
+    int i, j;
+    cellCoordinates(position, i, j);
+    // 1 ring of cells as long as the distance doesn't exceed the cell size
+    int rings = qMax(1, (int)std::ceil(distance/mCellSize));
+    float squaredDistance = distance*distance;
+    for(int ci=qMax(0, i-rings) ; ci<=qMin(mHeight-1, i+rings) ; ci++)
+    {
+        for(int cj=qMax(0, j-rings) ; cj<=qMin(mWidth-1, j+rings) ; cj++)
+        {
+            const QVector<RoadSample>& samples = mCells[ci*mWidth + cj];
+            for(int k=0 ; k<samples.size() ; k++)
+            {
+                const RoadSample& sample = samples[k];
+                if(sample.isMajor != isMajor)
+                {
+                    continue;
+                }
+                QPointF d = sample.position - position;
+                if(QPointF::dotProduct(d,d) < squaredDistance
+                        && !ignoredRoadIDs.contains(sample.roadID))
+                {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+float OccupancyGrid::distanceToClosestSample(QPointF position, float maxDistance) const
+{
+    if(mCells.isEmpty())
+    {
+        return maxDistance;
+    }
+    int i, j;
+    cellCoordinates(position, i, j);
+    int rings = qMax(1, (int)std::ceil(maxDistance/mCellSize));
+    float squaredDistance = maxDistance*maxDistance;
+    for(int ci=qMax(0, i-rings) ; ci<=qMin(mHeight-1, i+rings) ; ci++)
+    {
+        for(int cj=qMax(0, j-rings) ; cj<=qMin(mWidth-1, j+rings) ; cj++)
+        {
+            const QVector<RoadSample>& samples = mCells[ci*mWidth + cj];
+            for(int k=0 ; k<samples.size() ; k++)
+            {
+                QPointF d = samples[k].position - position;
+                squaredDistance = qMin(squaredDistance, (float)QPointF::dotProduct(d,d));
+            }
+        }
+    }
+    return std::sqrt(squaredDistance);
+}
+
+void OccupancyGrid::cellCoordinates(QPointF position, int& i, int& j) const
+{
+    i = qBound(0, (int)std::floor((position.y()-mRegion.top())/mCellSize), mHeight-1);
+    j = qBound(0, (int)std::floor((position.x()-mRegion.left())/mCellSize), mWidth-1);
+}
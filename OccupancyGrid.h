@@ -0,0 +1,72 @@
+#ifndef OCCUPANCYGRID_H
+#define OCCUPANCYGRID_H
+
+#include <QHash>
+#include <QPointF>
+#include <QRectF>
+#include <QVector>
+
+// Structure to store a point traced on a road
+struct RoadSample {
+    QPointF position;
+    int roadID;
+    // Holds whether the road follows the major eigenvectors
+    bool isMajor;
+};
+
+// Uniform grid over the region, storing in each cell the road samples
+// it contains. With cells as large as the test distance, finding
+// whether a sample is near a point only looks at the 3x3 cells around it.
+class OccupancyGrid
+{
+public:
+    OccupancyGrid();
+
+    // Remove every sample and cover the region with cells of size cellSize
+    void reset(QRectF region, float cellSize);
+    // Remove every sample, keeping the cells
+    void clear();
+
+    // Add a sample of a road
+    void insert(QPointF position, int roadID, bool isMajor);
+    // Add every point of a road
+    void insertRoad(const QVector<QPointF>& points, int roadID, bool isMajor);
+    // Remove every sample of a road
+    void removeRoad(int roadID);
+
+    // Returns whether a sample of the same family (major or minor) is closer
+    // than distance from the position. The samples of the roads in
+    // ignoredRoadIDs (the road being grown, and the ones it starts from) are skipped
+    bool hasSampleWithin(QPointF position, float distance, bool isMajor,
+                         const QVector<int>& ignoredRoadIDs) const;
+
+    // Returns the distance from the position to the closest sample of any road,
+    // or maxDistance if there is none closer
+    float distanceToClosestSample(QPointF position, float maxDistance) const;
+
+    // Find the family of a road from its samples.
+    // Returns false if the road has no sample
+    bool findRoadFamily(int roadID, bool& isMajor) const;
+
+    // Returns the size of the cells
+    float cellSize() const {return mCellSize;}
+
+private:
+
+    // Returns the coordinates of the cell containing the position, clamped to the grid
+    void cellCoordinates(QPointF position, int& i, int& j) const;
+
+    // Region covered by the grid
+    QRectF mRegion;
+    // Size of the cells
+    float mCellSize;
+    // Number of cells
+    int mWidth;
+    int mHeight;
+    // Samples in each cell, row by row
+    QVector<QVector<RoadSample> > mCells;
+    // Cells containing samples of each road
+    QHash<int, QVector<int> > mRoadCells;
+};
+
+#endif // OCCUPANCYGRID_H
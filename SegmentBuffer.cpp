@@ -0,0 +1,352 @@
+#include "SegmentBuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// The AVX kernel is compiled for AVX whatever the build flags,
+// and only run when the CPU has it
+#include <immintrin.h>
+#define SEGMENT_BUFFER_AVX
+#define SEGMENT_BUFFER_AVX_TARGET __attribute__((target("avx")))
+#elif defined(__AVX__)
+#include <immintrin.h>
+#define SEGMENT_BUFFER_AVX
+#define SEGMENT_BUFFER_AVX_TARGET
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SEGMENT_BUFFER_SSE2
+#endif
+
+namespace
+{
+
+#if defined(SEGMENT_BUFFER_AVX)
+bool cpuHasAvx()
+{
+#if defined(__AVX__)
+    return true;
+#else
+    static const bool hasAvx = __builtin_cpu_supports("avx");
+    return hasAvx;
+#endif
+}
+
+// Test the segments [begin,end) 8 at a time, and call visitCandidate on the
+// ones that may be crossed by AB. Returns the first segment left untested
+template<typename Visitor>
+SEGMENT_BUFFER_AVX_TARGET
+int visitCandidatesAvx(const float* startX, const float* startY, const float* endX, const float* endY,
+                       QPointF A, QPointF B, int begin, int end, Visitor visitCandidate)
+{
+    int k = begin;
+    const __m256 ax = _mm256_set1_ps(A.x());
+    const __m256 ay = _mm256_set1_ps(A.y());
+    const __m256 bx = _mm256_set1_ps(B.x());
+    const __m256 by = _mm256_set1_ps(B.y());
+    const __m256 dx = _mm256_sub_ps(bx, ax);
+    const __m256 dy = _mm256_sub_ps(by, ay);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 signBit = _mm256_set1_ps(-0.0f);
+    for(; k+8 <= end ; k += 8)
+    {
+        __m256 px = _mm256_loadu_ps(startX + k);
+        __m256 py = _mm256_loadu_ps(startY + k);
+        __m256 rx = _mm256_sub_ps(_mm256_loadu_ps(endX + k), px);
+        __m256 ry = _mm256_sub_ps(_mm256_loadu_ps(endY + k), py);
+        __m256 wx = _mm256_sub_ps(ax, px);
+        __m256 wy = _mm256_sub_ps(ay, py);
+        __m256 vx = _mm256_sub_ps(bx, px);
+        __m256 vy = _mm256_sub_ps(by, py);
+        // Sides of A and B, and position of the crossing along the segment
+        __m256 sideA = _mm256_sub_ps(_mm256_mul_ps(rx, wy), _mm256_mul_ps(ry, wx));
+        __m256 sideB = _mm256_sub_ps(_mm256_mul_ps(rx, vy), _mm256_mul_ps(ry, vx));
+        __m256 numerator = _mm256_sub_ps(_mm256_mul_ps(wx, dy), _mm256_mul_ps(wy, dx));
+        __m256 denominator = _mm256_sub_ps(sideB, sideA);
+        __m256 opposite = _mm256_cmp_ps(_mm256_mul_ps(sideA, sideB), zero, _CMP_LT_OQ);
+        __m256 sameSign = _mm256_cmp_ps(_mm256_mul_ps(numerator, denominator), zero, _CMP_GT_OQ);
+        __m256 inside = _mm256_cmp_ps(_mm256_andnot_ps(signBit, numerator),
+                                      _mm256_andnot_ps(signBit, denominator), _CMP_LT_OQ);
+        int mask = _mm256_movemask_ps(_mm256_and_ps(opposite, _mm256_and_ps(sameSign, inside)));
+        for(int lane=0 ; mask != 0 && lane<8 ; lane++)
+        {
+            if(mask & (1<<lane))
+            {
+                visitCandidate(k+lane);
+            }
+        }
+    }
+    return k;
+}
+#endif
+
+#if defined(SEGMENT_BUFFER_SSE2)
+// Test the segments [begin,end) 4 at a time, and call visitCandidate on the
+// ones that may be crossed by AB. Returns the first segment left untested
+template<typename Visitor>
+int visitCandidatesSse2(const float* startX, const float* startY, const float* endX, const float* endY,
+                        QPointF A, QPointF B, int begin, int end, Visitor visitCandidate)
+{
+    int k = begin;
+    const __m128 ax = _mm_set1_ps(A.x());
+    const __m128 ay = _mm_set1_ps(A.y());
+    const __m128 bx = _mm_set1_ps(B.x());
+    const __m128 by = _mm_set1_ps(B.y());
+    const __m128 dx = _mm_sub_ps(bx, ax);
+    const __m128 dy = _mm_sub_ps(by, ay);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 signBit = _mm_set1_ps(-0.0f);
+    for(; k+4 <= end ; k += 4)
+    {
+        __m128 px = _mm_loadu_ps(startX + k);
+        __m128 py = _mm_loadu_ps(startY + k);
+        __m128 rx = _mm_sub_ps(_mm_loadu_ps(endX + k), px);
+        __m128 ry = _mm_sub_ps(_mm_loadu_ps(endY + k), py);
+        __m128 wx = _mm_sub_ps(ax, px);
+        __m128 wy = _mm_sub_ps(ay, py);
+        __m128 vx = _mm_sub_ps(bx, px);
+        __m128 vy = _mm_sub_ps(by, py);
+        // Sides of A and B, and position of the crossing along the segment
+        __m128 sideA = _mm_sub_ps(_mm_mul_ps(rx, wy), _mm_mul_ps(ry, wx));
+        __m128 sideB = _mm_sub_ps(_mm_mul_ps(rx, vy), _mm_mul_ps(ry, vx));
+        __m128 numerator = _mm_sub_ps(_mm_mul_ps(wx, dy), _mm_mul_ps(wy, dx));
+        __m128 denominator = _mm_sub_ps(sideB, sideA);
+        __m128 opposite = _mm_cmplt_ps(_mm_mul_ps(sideA, sideB), zero);
+        __m128 sameSign = _mm_cmpgt_ps(_mm_mul_ps(numerator, denominator), zero);
+        __m128 inside = _mm_cmplt_ps(_mm_andnot_ps(signBit, numerator),
+                                     _mm_andnot_ps(signBit, denominator));
+        int mask = _mm_movemask_ps(_mm_and_ps(opposite, _mm_and_ps(sameSign, inside)));
+        for(int lane=0 ; mask != 0 && lane<4 ; lane++)
+        {
+            if(mask & (1<<lane))
+            {
+                visitCandidate(k+lane);
+            }
+        }
+    }
+    return k;
+}
+#endif
+
+}
+
+SegmentBuffer::SegmentBuffer() :
+    mRemovedSegmentCount(0), mMaxRangeWidth(0.0)
+{
+}
+
+void SegmentBuffer::clear()
+{
+    mStartX.clear();
+    mStartY.clear();
+    mEndX.clear();
+    mEndY.clear();
+    mRoadIDs.clear();
+    mSegmentEnds.clear();
+    mRanges.clear();
+    mRoadRanges.clear();
+    mRemovedSegmentCount = 0;
+    mMaxRangeWidth = 0.0;
+}
+
+void SegmentBuffer::reserve(int size)
+{
+    mStartX.reserve(size);
+    mStartY.reserve(size);
+    mEndX.reserve(size);
+    mEndY.reserve(size);
+    mRoadIDs.reserve(size);
+    mSegmentEnds.reserve(size);
+}
+
+void SegmentBuffer::insertRoad(const QVector<QPointF>& polyline, int roadID, QRectF bounds)
+{
+    removeRoad(roadID);
+    if(polyline.size() < 2)
+    {
+        return;
+    }
+    SegmentRange range;
+    range.bounds = bounds;
+    range.begin = size();
+    range.end = size() + polyline.size()-1;
+    mRanges.insert(std::upper_bound(mRanges.begin(), mRanges.end(), range, rangeStartsBefore), range);
+    mRoadRanges.insert(roadID, range);
+    mMaxRangeWidth = qMax(mMaxRangeWidth, bounds.width());
+    for(int j=1 ; j<polyline.size() ; j++)
+    {
+        mStartX.push_back(polyline[j-1].x());
+        mStartY.push_back(polyline[j-1].y());
+        mEndX.push_back(polyline[j].x());
+        mEndY.push_back(polyline[j].y());
+        mRoadIDs.push_back(roadID);
+        mSegmentEnds.push_back(j);
+    }
+}
+
+void SegmentBuffer::removeRoad(int roadID)
+{
+    QHash<int, SegmentRange>::iterator itr = mRoadRanges.find(roadID);
+    if(itr == mRoadRanges.end())
+    {
+        return;
+    }
+    // Several roads may start at the same x
+    QVector<SegmentRange>::iterator range = std::lower_bound(mRanges.begin(), mRanges.end(),
+                                                             itr.value(), rangeStartsBefore);
+    while(range != mRanges.end() && range->begin != itr->begin)
+    {
+        range++;
+    }
+    if(range != mRanges.end())
+    {
+        mRanges.erase(range);
+    }
+    mRemovedSegmentCount += itr->end - itr->begin;
+    mRoadRanges.erase(itr);
+    if(mRemovedSegmentCount > size()/2)
+    {
+        compact();
+    }
+}
+
+void SegmentBuffer::compact()
+{
+    int count = size() - mRemovedSegmentCount;
+    QVector<float> startX, startY, endX, endY;
+    QVector<int> roadIDs, segmentEnds;
+    startX.reserve(count);
+    startY.reserve(count);
+    endX.reserve(count);
+    endY.reserve(count);
+    roadIDs.reserve(count);
+    segmentEnds.reserve(count);
+    mMaxRangeWidth = 0.0;
+    // The ranges are visited along x, which also groups the segments
+    // of nearby roads in the arrays
+    for(int r=0 ; r<mRanges.size() ; r++)
+    {
+        SegmentRange& range = mRanges[r];
+        int begin = startX.size();
+        for(int k=range.begin ; k<range.end ; k++)
+        {
+            startX.push_back(mStartX[k]);
+            startY.push_back(mStartY[k]);
+            endX.push_back(mEndX[k]);
+            endY.push_back(mEndY[k]);
+            roadIDs.push_back(mRoadIDs[k]);
+            segmentEnds.push_back(mSegmentEnds[k]);
+        }
+        range.begin = begin;
+        range.end = startX.size();
+        mRoadRanges[roadIDs[begin]] = range;
+        mMaxRangeWidth = qMax(mMaxRangeWidth, range.bounds.width());
+    }
+    mStartX = startX;
+    mStartY = startY;
+    mEndX = endX;
+    mEndY = endY;
+    mRoadIDs = roadIDs;
+    mSegmentEnds = segmentEnds;
+    mRemovedSegmentCount = 0;
+}
+
+int SegmentBuffer::findFirstCrossing(QPointF A, QPointF B, const QVector<int>& ignoredRoadIDs,
+                                     float& stepParameter, QPointF& intersectionPoint) const
+{
+    int firstSegment = -1;
+    float firstParameter = std::numeric_limits<float>::max();
+    // Broad phase: the roads are sorted by the left side of their box, so only the
+    // ones starting between the step left side minus the widest box and the step
+    // right side can overlap the box of the step
+    QRectF step = QRectF(A, B).normalized();
+    SegmentRange lowest;
+    lowest.bounds = QRectF(step.left() - mMaxRangeWidth, 0.0, 0.0, 0.0);
+    QVector<SegmentRange>::const_iterator range = std::lower_bound(mRanges.constBegin(), mRanges.constEnd(),
+                                                                   lowest, rangeStartsBefore);
+    for(; range != mRanges.constEnd() && range->bounds.left() <= step.right() ; range++)
+    {
+        const QRectF& bounds = range->bounds;
+        if(bounds.right() >= step.left() && bounds.top() <= step.bottom() && bounds.bottom() >= step.top()
+                && !ignoredRoadIDs.contains(mRoadIDs[range->begin]))
+        {
+            findFirstCrossingInRange(A, B, range->begin, range->end, firstSegment, firstParameter);
+        }
+    }
+    if(firstSegment != -1)
+    {
+        stepParameter = firstParameter;
+        intersectionPoint = A + firstParameter*(B-A);
+    }
+    return firstSegment;
+}
+
+void SegmentBuffer::findFirstCrossingInRange(QPointF A, QPointF B, int begin, int end,
+                                             int& firstSegment, float& firstParameter) const
+{
+    int k = begin;
+
+    // The vector units only find the candidate segments, which are rare:
+    // their crossing parameter is computed again one by one
+    auto testCandidate = [&](int segment)
+    {
+        findFirstCrossingScalar(A, B, segment, segment+1, firstSegment, firstParameter);
+    };
+#if defined(SEGMENT_BUFFER_AVX)
+    if(cpuHasAvx())
+    {
+        k = visitCandidatesAvx(mStartX.constData(), mStartY.constData(), mEndX.constData(), mEndY.constData(),
+                               A, B, begin, end, testCandidate);
+    }
+#endif
+#if defined(SEGMENT_BUFFER_SSE2)
+    k = visitCandidatesSse2(mStartX.constData(), mStartY.constData(), mEndX.constData(), mEndY.constData(),
+                            A, B, k, end, testCandidate);
+#endif
+    // Remaining segments
+    findFirstCrossingScalar(A, B, k, end, firstSegment, firstParameter);
+}
+
+void SegmentBuffer::findFirstCrossingScalar(QPointF A, QPointF B, int begin, int end,
+                                            int& firstSegment, float& firstParameter) const
+{
+    for(int k=begin ; k<end ; k++)
+    {
+        float t = crossingParameter(A, B, k);
+        if(t >= 0.0f && t < firstParameter)
+        {
+            firstSegment = k;
+            firstParameter = t;
+        }
+    }
+}
+
+float SegmentBuffer::crossingParameter(QPointF A, QPointF B, int k) const
+{
+    // Segment P + s*r and step A + t*d cross for s and t in ]0,1[
+    float px = mStartX[k], py = mStartY[k];
+    float rx = mEndX[k] - px, ry = mEndY[k] - py;
+    float wx = (float)A.x() - px, wy = (float)A.y() - py;
+    float vx = (float)B.x() - px, vy = (float)B.y() - py;
+    float dx = (float)B.x() - (float)A.x(), dy = (float)B.y() - (float)A.y();
+    float sideA = rx*wy - ry*wx;
+    float sideB = rx*vy - ry*vx;
+    if(!(sideA*sideB < 0.0f))
+    {
+        return -1.0f;
+    }
+    float numerator = wx*dy - wy*dx;
+    float denominator = sideB - sideA;
+    if(!(numerator*denominator > 0.0f) || std::fabs(numerator) >= std::fabs(denominator))
+    {
+        return -1.0f;
+    }
+    return sideA/(sideA - sideB);
+}
+
+bool rangeStartsBefore(const SegmentRange& range1, const SegmentRange& range2)
+{
+    return range1.bounds.left() < range2.bounds.left();
+}
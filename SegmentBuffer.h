@@ -0,0 +1,93 @@
+#ifndef SEGMENTBUFFER_H
+#define SEGMENTBUFFER_H
+
+#include <QHash>
+#include <QPointF>
+#include <QRectF>
+#include <QVector>
+
+// Segments of one road in a segment buffer, with the bounding box of the road
+struct SegmentRange {
+    QRectF bounds;
+    int begin;
+    int end;
+};
+
+// Segments of roads stored as a structure of arrays of floats, so that
+// a moving step can be tested against many segments at once with
+// SIMD instructions (AVX when the CPU has it, else SSE2).
+// Each segment keeps the ID of its road and the index of its end point.
+// The segments of a road are contiguous, and only the roads whose bounding
+// box overlaps the box of the step are tested (sweep along x).
+// Roads are inserted and removed one by one as the street graph changes.
+// The segments of removed roads stay in the arrays until they are
+// the majority, then the arrays are compacted
+class SegmentBuffer
+{
+public:
+    SegmentBuffer();
+
+    // Remove every segment
+    void clear();
+    // Reserve space for size segments
+    void reserve(int size);
+    // Add the segments of a road, whose points are inside bounds,
+    // replacing its previous segments
+    void insertRoad(const QVector<QPointF>& polyline, int roadID, QRectF bounds);
+    // Remove the segments of a road
+    void removeRoad(int roadID);
+    // Returns whether the segments of a road are in the buffer
+    bool containsRoad(int roadID) const {return mRoadRanges.contains(roadID);}
+
+    // Returns the number of segments, including the ones of removed roads
+    int size() const {return mStartX.size();}
+    // Returns the ID of the road of segment k
+    int roadID(int k) const {return mRoadIDs[k];}
+    // Returns the index, in its road, of the end point of segment k
+    int segmentEnd(int k) const {return mSegmentEnds[k];}
+
+    // Find the segment crossed first by the step AB: A and B must be strictly
+    // on different sides of it, and the crossing strictly inside it.
+    // Returns the index of the segment, or -1. stepParameter is the position
+    // of the crossing along AB, in ]0,1[. The roads in ignoredRoadIDs are skipped
+    int findFirstCrossing(QPointF A, QPointF B, const QVector<int>& ignoredRoadIDs,
+                          float& stepParameter, QPointF& intersectionPoint) const;
+
+private:
+
+    // Move the segments of the roads still in the buffer to the start of the arrays
+    void compact();
+    // Test the segments [begin,end), several at once when possible,
+    // keeping the earliest crossing
+    void findFirstCrossingInRange(QPointF A, QPointF B, int begin, int end,
+                                  int& firstSegment, float& firstParameter) const;
+    // Test the segments [begin,end) one by one, keeping the earliest crossing
+    void findFirstCrossingScalar(QPointF A, QPointF B, int begin, int end,
+                                 int& firstSegment, float& firstParameter) const;
+    // Returns the parameter along AB of the crossing of segment k,
+    // or a negative value if AB doesn't cross it
+    float crossingParameter(QPointF A, QPointF B, int k) const;
+
+    // Coordinates of the start and end points of the segments
+    QVector<float> mStartX;
+    QVector<float> mStartY;
+    QVector<float> mEndX;
+    QVector<float> mEndY;
+    // Road of each segment
+    QVector<int> mRoadIDs;
+    // Index of the end point of each segment in its road
+    QVector<int> mSegmentEnds;
+    // Roads of the segments, sorted by the left side of their box
+    QVector<SegmentRange> mRanges;
+    // Range of each road, by ID
+    QHash<int, SegmentRange> mRoadRanges;
+    // Number of segments of the removed roads
+    int mRemovedSegmentCount;
+    // Width of the widest road box. Not reduced when roads are removed
+    qreal mMaxRangeWidth;
+};
+
+// Returns whether the box of range1 starts on the left of the box of range2
+bool rangeStartsBefore(const SegmentRange& range1, const SegmentRange& range2);
+
+#endif // SEGMENTBUFFER_H
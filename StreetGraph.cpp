@@ -1,21 +1,137 @@
 #include <iostream>
+#include <algorithm>
 #include <cmath>
+#include <limits>
 #include <QPainter>
 #include <QDateTime>
-#include <QCoreApplication>
-#include <QProgressDialog>
+#include <QPolygonF>
+#include <QFileDialog>
+#include <QInputDialog>
+#include <QFileInfo>
+#include <QtConcurrent>
+#include <QSet>
+#include <queue>
 
 #include "StreetGraph.h"
+#include "StripImageWriter.h"
+#include "BufferedFileWriter.h"
+#include "StreetGraphFile.h"
+#include "HalfEdgeGraph.h"
+#include "LoopDetector.h"
+#include "TraceCache.h"
+#include "SegmentBuffer.h"
 
 StreetGraph::StreetGraph(QPointF bottomLeft, QPointF topRight, TensorField *field, float distSeparation, QObject *parent) :
     QObject(parent), mTensorField(field), mBottomLeft(bottomLeft), mTopRight(topRight), mSeparationDistance(distSeparation)
 {
     mRegionSize.rwidth() = (topRight-bottomLeft).x();
     mRegionSize.rheight() = (topRight-bottomLeft).y();
+    mFieldRegion = QRectF(mBottomLeft, mRegionSize);
     mLastNodeID = 0;
     mLastRoadID = 0;
     mSeedInitMethod = 0;
+    mRandomSeed = 0;
     mDrawNodes = false;
+    mSimplifyRoads = true;
+    mSimplificationRatio = 0.02f;
+    mGenerateSecondaryRoads = false;
+    mPrincipalSeparationFactor = 4.0f;
+    mGrownRoadType = Principal;
+    mCancelRequested.store(0);
+    mLastStreamedRoadID = 0;
+    mParentGraph = NULL;
+    mTiledGeneration = false;
+    mTileSizeInSeparations = 16.0f;
+    qRegisterMetaType<QVector<QPolygonF> >("QVector<QPolygonF>");
+    QObject::connect(&mGenerationWatcher, SIGNAL(finished()),
+                     this, SLOT(generationFinished()));
+    QObject::connect(&mExportWatcher, SIGNAL(finished()),
+                     this, SLOT(exportFinished()));
+    mPlanarGraph = new HalfEdgeGraph();
+    mCandidateSegments = new SegmentBuffer();
+    mLoadedFile = NULL;
+    mTraceCache = QSharedPointer<TraceCache>(new TraceCache());
+    mFieldVersion = -1;
+    mUseDensityStoppingCondition = true;
+    mDensityTestRatio = 0.5f;
+    mMinSeparationRatio = 0.25f;
+    mShoreSetback = 0.0f;
+    mLockstepGrowth = false;
+    mCoarseTracing = false;
+    mMaxActiveFronts = 32;
+    mStepsPerRound = 4;
+    mOccupancyGrid.reset(QRectF(mBottomLeft, mTopRight), mSeparationDistance);
+}
+
+StreetGraph::~StreetGraph()
+{
+    // The generation thread uses the street graph until it returns
+    cancelGeneration();
+    mGenerationWatcher.waitForFinished();
+    mExportWatcher.waitForFinished();
+    delete mPlanarGraph;
+    delete mCandidateSegments;
+    delete mLoadedFile;
+}
+
+template<typename Function>
+void StreetGraph::forEachRoad(Function function) const
+{
+    RoadRecord record;
+    if(mLoadedFile != NULL)
+    {
+        for(int k=0 ; k<mLoadedFile->roadCount() ; k++)
+        {
+            const StreetGraphFileRoad& road = mLoadedFile->road(k);
+            record.ID = road.ID;
+            record.nodeID1 = road.nodeID1;
+            record.nodeID2 = road.nodeID2;
+            record.type = (RoadType)road.type;
+            record.straightLength = road.straightLength;
+            record.pathLength = road.pathLength;
+            record.points = mLoadedFile->roadPoints(road);
+            record.pointCount = (int)road.pointCount;
+            function(record);
+        }
+        return;
+    }
+    QMap<int,Road>::const_iterator itr = mRoads.constBegin(), itr_end = mRoads.constEnd();
+    for(; itr != itr_end ; itr++)
+    {
+        record.ID = itr.key();
+        record.nodeID1 = itr->nodeID1;
+        record.nodeID2 = itr->nodeID2;
+        record.type = itr->type;
+        record.straightLength = itr->straightLength;
+        record.pathLength = itr->pathLength;
+        record.points = itr->segments.constData();
+        record.pointCount = itr->segments.size();
+        function(record);
+    }
+}
+
+template<typename Function>
+void StreetGraph::forEachNode(Function function) const
+{
+    NodeRecord record;
+    if(mLoadedFile != NULL)
+    {
+        for(int k=0 ; k<mLoadedFile->nodeCount() ; k++)
+        {
+            const StreetGraphFileNode& node = mLoadedFile->node(k);
+            record.ID = node.ID;
+            record.position = QPointF(node.x, node.y);
+            function(record);
+        }
+        return;
+    }
+    QMap<int,Node>::const_iterator itn = mNodes.constBegin(), itn_end = mNodes.constEnd();
+    for(; itn != itn_end ; itn++)
+    {
+        record.ID = itn.key();
+        record.position = itn->position;
+        function(record);
+    }
 }
 
 void StreetGraph::createRandomSeedList(int numberOfSeeds, bool append)
@@ -24,7 +140,8 @@ void StreetGraph::createRandomSeedList(int numberOfSeeds, bool append)
     {
         mSeeds.clear();
     }
-    qsrand(QDateTime::currentDateTime().toTime_t());
+    mRandomSeed = QDateTime::currentDateTime().toTime_t();
+    qsrand(mRandomSeed);
     for(int i=0 ; i < numberOfSeeds ; i++)
     {
         float randX = qrand()/(float)RAND_MAX;
@@ -41,7 +158,8 @@ void StreetGraph::createDensityConstrainedSeedList(int numberOfSeeds, bool appen
     {
         mSeeds.clear();
     }
-    qsrand(QDateTime::currentDateTime().toTime_t());
+    mRandomSeed = QDateTime::currentDateTime().toTime_t();
+    qsrand(mRandomSeed);
     for(int i=0 ; i < numberOfSeeds ; i++)
     {
         int counter = 0;
@@ -71,7 +189,7 @@ int StreetGraph::createGridSeedList(double separationDistance, bool append)
     }
     int Nv = (int)(mRegionSize.height()/separationDistance);
     int Nu = (int)(mRegionSize.width()/separationDistance);
-    QPointF origin(separationDistance/2.0f,separationDistance/2.0f);
+    QPointF origin = mBottomLeft + QPointF(separationDistance/2.0f,separationDistance/2.0f);
     for(int i=0 ; i<Nv ; i++)
     {
         for(int j=0 ; j<Nu ; j++)
@@ -83,6 +201,60 @@ int StreetGraph::createGridSeedList(double separationDistance, bool append)
     return Nv*Nu;
 }
 
+int StreetGraph::createSeparatrixSeedList(double separationDistance, bool append)
+{
+    if(!append)
+    {
+        mSeeds.clear();
+    }
+    int seedCount = mSeeds.size();
+    if(mTensorField == NULL)
+    {
+        return 0;
+    }
+    QSize fieldSize = mTensorField->getFieldSize();
+    float cellSize = mFieldRegion.width()/qMax(1, fieldSize.width()-1);
+    QRectF region(mBottomLeft, mRegionSize);
+    QVector<DegeneratePoint> points = mTensorField->getDegeneratePoints();
+    for(int p=0 ; p<points.size() ; p++)
+    {
+        QPointF center = fieldCellToPosition(points[p].position);
+        for(int s=0 ; s<points[p].separatrixAngles.size() ; s++)
+        {
+            // Follow the separatrix from a bit away from the point,
+            // leaving it in the direction of the separatrix
+            float angle = points[p].separatrixAngles[s];
+            QVector2D direction(cos(angle), sin(angle));
+            QPointF start = center + 2.0f*cellSize*direction.toPointF();
+            if(fieldBoundaryStoppingCondition(start))
+            {
+                continue;
+            }
+            int i, j;
+            positionToFieldIndex(start, i, j);
+            bool opposite = QVector2D::dotProduct(mTensorField->getMajorEigenVector(i,j), direction) < 0;
+            StreamlineTrace trace = traceStreamline(start, true, opposite, TRACE_MAX_LENGTH);
+            // A seed every separation distance along it
+            float length = separationDistance/2.0f;
+            for(int k=1 ; k<trace.points.size() ; k++)
+            {
+                length += QVector2D(trace.points[k]-trace.points[k-1]).length();
+                if(length < separationDistance)
+                {
+                    continue;
+                }
+                length = 0.0f;
+                if(region.contains(trace.points[k])
+                        && pointRespectSeedSeparationDistance(trace.points[k], separationDistance/2.0f))
+                {
+                    mSeeds.push_back(trace.points[k]);
+                }
+            }
+        }
+    }
+    return mSeeds.size() - seedCount;
+}
+
 void StreetGraph::generateSeedListWithUIMethod()
 {
     switch(mSeedInitMethod)
@@ -96,6 +268,13 @@ void StreetGraph::generateSeedListWithUIMethod()
     case 2:
         createDensityConstrainedSeedList(100, false);
         break;
+    case 3:
+        if(createSeparatrixSeedList(mSeparationDistance, false) == 0)
+        {
+            qWarning()<<"No separatrix in the field, seeding a regular grid";
+            createGridSeedList(mSeparationDistance, false);
+        }
+        break;
     default:
         qWarning()<<"Unrecognized seed initialization method";
         break;
@@ -128,7 +307,6 @@ void StreetGraph::computeMajorHyperstreamlines(bool clearStorage)
     // Generate the seeds
     createRandomSeedList(500, false);
 
-    QSize fieldSize = mTensorField->getFieldSize();
     for(int k=0 ; k<mSeeds.size() ; k++)
     {
         // Create a node
@@ -143,7 +321,9 @@ void StreetGraph::computeMajorHyperstreamlines(bool clearStorage)
         node1.connectedRoadIDs.push_back(mLastRoadID);
         road.nodeID1 = mLastNodeID;
 
-        float step = mRegionSize.height()/100.0f; // Should be function of curvature
+        float step = mFieldRegion.height()/100.0f; // Should be function of curvature
+        // Earlier points of the road, to detect loops
+        LoopDetector loopDetector(step);
 
         // The road contains also the position of its extreme nodes
         // Start from the node position
@@ -156,12 +336,10 @@ void StreetGraph::computeMajorHyperstreamlines(bool clearStorage)
             {
                 currentDirection = QVector2D(currentPosition-road.segments.last());
             }
-            road.segments.push_back(currentPosition);
-            // TODO: Make a function for that
-            int i = round((currentPosition.y()-mBottomLeft.y())/mRegionSize.height()*
-                        (fieldSize.height()-1));
-            int j = round((currentPosition.x()-mBottomLeft.x())/mRegionSize.width()*
-                        (fieldSize.width()-1));
+            appendRoadPoint(road, currentPosition);
+            loopDetector.insert(currentPosition);
+            int i, j;
+            positionToFieldIndex(currentPosition, i, j);
             QVector2D majorDirection = mTensorField->getMajorEigenVector(i,j);
             if(QVector2D::dotProduct(majorDirection,currentDirection) < 0)
             {
@@ -170,7 +348,7 @@ void StreetGraph::computeMajorHyperstreamlines(bool clearStorage)
             QPointF nextPosition = currentPosition + (step*majorDirection).toPointF();
             stopGrowth = boundaryStoppingCondition(nextPosition)
                       || degeneratePointStoppingCondition(i,j)
-                      || loopStoppingCondition(nextPosition,road.segments);
+                      || loopStoppingCondition(nextPosition,loopDetector);
             currentPosition = nextPosition;
         }
     }
@@ -257,275 +435,1480 @@ void StreetGraph::computeStreetGraph3(bool clearStorage)
     }
     // Generate the seeds
     generateSeedListWithUIMethod();
+    growSeeds(0);
+}
 
-    QProgressDialog progress("Creating Street Graph...",NULL, 0, mSeeds.size()-1);
-    progress.setMinimumDuration(0);
-
+void StreetGraph::growSeeds(int firstSeed, const QVector<QRectF>& seedRegion)
+{
     bool majorGrowth = true;
-    for(int k=0 ; k<mSeeds.size() ; k++)
+    for(int k=firstSeed ; k<mSeeds.size() && !isGenerationCanceled() ; k++)
     {
-        progress.setValue(k);
-        progress.setRange(0, mSeeds.size()-1);
-        QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents);
-
-        // Create a node
-        Node& node1 = mNodes[++mLastNodeID];
-        node1.ID = mLastNodeID;
-        node1.position = mSeeds[k];
-
-        Road& road = mRoads[++mLastRoadID];
-        road.ID = mLastRoadID;
-        node1.connectedRoadIDs.push_back(mLastRoadID);
-        road.type = Principal;
-        road.nodeID1 = mLastNodeID;
-
-        Road& road2 = mRoads[++mLastRoadID];
-        road2.ID = mLastRoadID;
-        node1.connectedRoadIDs.push_back(mLastRoadID);
-        road2.type = Principal;
-        road2.nodeID1 = mLastNodeID;
-
-        bool useExceedLength = true;
-        growRoadAndConnect(road, node1, majorGrowth, false, useExceedLength);
-        growRoadAndConnect(road2, node1, majorGrowth, true, useExceedLength);
+        if(!seedRegion.isEmpty() && !regionContains(seedRegion, mSeeds[k]))
+        {
+            continue;
+        }
+        growRoadsFromSeed(mSeeds[k], majorGrowth);
 
         majorGrowth = !majorGrowth;
 
-        // Draw each time a road is added
-        drawStreetGraph(mDrawNodes, false);
-        QCoreApplication::processEvents();
+        // Send the new roads to the display from time to time
+        streamNewRoads(k-firstSeed, mSeeds.size()-firstSeed, false);
     }
+    streamNewRoads(1, 1, true);
 }
 
-Node& StreetGraph::growRoad(Road& road, Node& startNode, bool growInMajorDirection,
-                            bool growInOppositeDirection, bool useExceedLenStopCond)
+void StreetGraph::computeLockstepStreetGraph(bool clearStorage)
 {
-    // Grow a road starting from this node using the tensor eigen vector
-    // until one of the condition is reached
-    float step = mRegionSize.height()/100.0f; // Should be function of curvature
-    QSize fieldSize = mTensorField->getFieldSize();
+    if(clearStorage)
+    {
+        clearStoredStreetGraph();
+    }
+    if(mTensorField == NULL)
+    {
+        qCritical()<<"ERROR: Tensor field is empty";
+        return;
+    }
+    // Generate the seeds
+    generateSeedListWithUIMethod();
+    growSeedsInLockstep(0);
+}
 
-    // The road contains also the position of its extreme nodes
-    // Start from the node position
-    QPointF currentPosition = startNode.position;
-    // Holds wether road stopped because it was too long or not
-    bool tooLong = false;
-    bool stopGrowth = false;
-    int preventInfiniteLoop = 0;
-    while(!stopGrowth && preventInfiniteLoop < 1000)
+void StreetGraph::growSeedsInLockstep(int firstSeed, const QVector<QRectF>& seedRegion)
+{
+    // Seeds by decreasing distance to the roads. The distances only decrease
+    // as roads grow, so they are computed again when a seed reaches the top
+    std::priority_queue<QPair<float,int> > seedQueue;
+    int queuedSeedCount = firstSeed;
+    int startedSeedCount = 0;
+    QVector<RoadFront> fronts;
+    bool majorGrowth = true;
+    while(!isGenerationCanceled())
     {
-        QVector2D currentDirection;
-        if(preventInfiniteLoop != 0)
+        // Seeds replanted at the end of the roads that were too long
+        for(; queuedSeedCount<mSeeds.size() ; queuedSeedCount++)
         {
-            currentDirection = QVector2D(currentPosition-road.segments.last());
+            if(seedRegion.isEmpty() || regionContains(seedRegion, mSeeds[queuedSeedCount]))
+            {
+                seedQueue.push(qMakePair(seedPriority(mSeeds[queuedSeedCount]), queuedSeedCount));
+            }
         }
-        road.segments.push_back(currentPosition);
-        int i = round((currentPosition.y()-mBottomLeft.y())/mRegionSize.height()*
-                    (fieldSize.height()-1));
-        int j = round((currentPosition.x()-mBottomLeft.x())/mRegionSize.width()*
-                    (fieldSize.width()-1));
-        QVector2D majorDirection;
-        if(growInMajorDirection)
+        while(fronts.size()+2 <= mMaxActiveFronts && !seedQueue.empty())
         {
-            majorDirection = mTensorField->getMajorEigenVector(i,j);
+            int seed = seedQueue.top().second;
+            seedQueue.pop();
+            float priority = seedPriority(mSeeds[seed]);
+            if(!seedQueue.empty() && priority < seedQueue.top().first)
+            {
+                seedQueue.push(qMakePair(priority, seed));
+                continue;
+            }
+            startedSeedCount++;
+            if(startFrontsFromSeed(mSeeds[seed], majorGrowth, fronts))
+            {
+                majorGrowth = !majorGrowth;
+            }
         }
-        else
+        if(fronts.isEmpty())
         {
-            majorDirection = mTensorField->getMinorEigenVector(i,j);
+            break;
         }
-        // First condition is to not grow backwards
-        // Second condition is applicable only at the beginning.
-        // It allows to grow the road in the 2 opposite directions
-        if(QVector2D::dotProduct(majorDirection,currentDirection) < 0
-                || (preventInfiniteLoop == 0 && growInOppositeDirection))
+
+        // Advance every road by a few steps
+        for(int f=0 ; f<fronts.size() ; f++)
         {
-            majorDirection *= -1;
+            if(advanceFront(fronts[f], mStepsPerRound, fronts))
+            {
+                // Its parts join the candidate segments
+                finishFront(fronts[f]);
+            }
         }
-        QPointF nextPosition = currentPosition + (step*majorDirection).toPointF();
-        if(useExceedLenStopCond)
+        int lowestGrowingRoadID = mLastRoadID+1;
+        for(int f=fronts.size()-1 ; f>=0 ; f--)
         {
-            tooLong = exceedingLengthStoppingCondition(road.segments);
+            if(fronts[f].isDone)
+            {
+                fronts.remove(f);
+            }
+            else
+            {
+                lowestGrowingRoadID = qMin(lowestGrowingRoadID, fronts[f].roadID);
+            }
         }
-        stopGrowth = boundaryStoppingCondition(nextPosition)
-                  || degeneratePointStoppingCondition(i,j)
-                  || loopStoppingCondition(nextPosition,road.segments)
-                  || tooLong;
-        currentPosition = nextPosition;
-        preventInfiniteLoop++;
-    }
-
-    // Fill road lengths
-    road.pathLength = computePathLength(road.segments);
-    road.straightLength = computeStraightLength(road.segments);
-
-    // Connect Nodes and Roads
-    Node& node2 = mNodes[++mLastNodeID];
-    node2.ID = mLastNodeID;
-    node2.position = road.segments.last();
-    node2.connectedNodeIDs.push_back(startNode.ID);
-    node2.connectedRoadIDs.push_back(road.ID);
-    startNode.connectedNodeIDs.push_back(node2.ID);
-    road.nodeID2 = node2.ID;
 
-    if(tooLong)
+        // Send the complete roads to the display from time to time
+        streamNewRoads(startedSeedCount, mSeeds.size()-firstSeed, false, lowestGrowingRoadID-1);
+    }
+    // When the generation is canceled, the roads still growing end where they are
+    for(int f=0 ; f<fronts.size() ; f++)
     {
-        // Replant a seed only if it's not too close from another seed
-        if(pointRespectSeedSeparationDistance(road.segments.last(),mSeparationDistance/4.0f))
-        {
-            mSeeds.push_back(node2.position);
-        }
+        fronts[f].metRoadID = -1;
+        fronts[f].tooLong = false;
+        finishFront(fronts[f]);
     }
-    return node2;
+    streamNewRoads(1, 1, true);
 }
 
-Node& StreetGraph::growRoadAndConnect(Road& road, Node& startNode, bool growInMajorDirection,
-                            bool growInOppositeDirection, bool useExceedLenStopCond)
+void StreetGraph::computeTiledStreetGraph(bool clearStorage)
 {
-    // Grow a road starting from this node using the tensor eigen vector
-    // until one of the condition is reached
-    float step = mRegionSize.height()/100.0f; // Should be function of curvature
-    QSize fieldSize = mTensorField->getFieldSize();
-
-    // The road contains also the position of its extreme nodes
-    // Start from the node position
-    QPointF currentPosition = startNode.position;
-    // Road meeting
-    bool meetOtherRoad = false;
-    int metRoadID, closestPointID;
-    QPointF intersectionPoint;
-    // Holds wether road stopped because it was too long or not
-    bool tooLong = false;
-    bool stopGrowth = false;
-    int preventInfiniteLoop = 0;
-    while(!stopGrowth && preventInfiniteLoop < 1000)
+    if(clearStorage)
     {
-        QVector2D currentDirection;
-        if(preventInfiniteLoop != 0)
-        {
-            currentDirection = QVector2D(currentPosition-road.segments.last());
-        }
-        road.segments.push_back(currentPosition);
-        int i = round((currentPosition.y()-mBottomLeft.y())/mRegionSize.height()*
-                    (fieldSize.height()-1));
-        int j = round((currentPosition.x()-mBottomLeft.x())/mRegionSize.width()*
-                    (fieldSize.width()-1));
-        QVector2D majorDirection;
-        if(growInMajorDirection)
-        {
-            majorDirection = mTensorField->getMajorEigenVector(i,j);
-        }
-        else
-        {
-            majorDirection = mTensorField->getMinorEigenVector(i,j);
-        }
-        // First condition is to not grow backwards
-        // Second condition is applicable only at the beginning.
-        // It allows to grow the road in the 2 opposite directions
-        if(QVector2D::dotProduct(majorDirection,currentDirection) < 0
-                || (preventInfiniteLoop == 0 && growInOppositeDirection))
+        clearStoredStreetGraph();
+    }
+    if(mTensorField == NULL || !(mTensorField->isFieldFilled()))
+    {
+        qCritical()<<"computeTiledStreetGraph(): Tensor field is empty";
+        return;
+    }
+    // Tiles overlap by one separation distance on each side,
+    // so that roads crossing a seam are traced on both sides of it
+    float tileSize = mTileSizeInSeparations*mSeparationDistance;
+    float overlap = mSeparationDistance;
+    int tilesX = qMax(1, (int)std::ceil(mRegionSize.width()/tileSize));
+    int tilesY = qMax(1, (int)std::ceil(mRegionSize.height()/tileSize));
+    QRectF region(mBottomLeft, mRegionSize);
+    QVector<StreetGraphTile> tiles(tilesX*tilesY);
+    for(int i=0 ; i<tilesY ; i++)
+    {
+        for(int j=0 ; j<tilesX ; j++)
         {
-            majorDirection *= -1;
+            QRectF core(mBottomLeft.x() + j*tileSize, mBottomLeft.y() + i*tileSize, tileSize, tileSize);
+            tiles[i*tilesX + j].core = core.intersected(region);
         }
-        QPointF nextPosition = currentPosition + (step*majorDirection).toPointF();
-        if(useExceedLenStopCond)
+    }
+
+    // Tiles are independent, generate them concurrently
+    QAtomicInt generatedTiles(0);
+    int tileCount = tiles.size();
+    QtConcurrent::blockingMap(tiles, [&](StreetGraphTile& tile)
+    {
+        if(!isGenerationCanceled())
         {
-            tooLong = exceedingLengthStoppingCondition(road.segments);
+            generateTile(tile, overlap);
+            emit generationProgress(generatedTiles.fetchAndAddOrdered(1)+1, tileCount);
         }
-        meetOtherRoad = meetsAnotherRoadAndFindIntersection(road.ID, nextPosition, metRoadID,
-                                                            closestPointID, intersectionPoint);
-        stopGrowth = boundaryStoppingCondition(nextPosition)
-                  || degeneratePointStoppingCondition(i,j)
-                  || loopStoppingCondition(nextPosition,road.segments)
-                  || tooLong
-                  || meetOtherRoad;
-        currentPosition = nextPosition;
-        preventInfiniteLoop++;
+    });
+    if(isGenerationCanceled())
+    {
+        return;
     }
 
-    // Connect Nodes and Roads
-    if(meetOtherRoad)
+    // Merge the tiles, snapping the seam nodes to the ones
+    // of the previous tiles on the other side of the seam
+    float snapDistance = mSeparationDistance/2.0f;
+    QHash<qint64, QVector<int> > seamNodeCells;
+    QSet<int> snappedNodeIDs;
+    for(int t=0 ; t<tiles.size() ; t++)
     {
-        Road &metRoad = mRoads[metRoadID];
-        int secondNodeID = -1;
-        if(closestPointID == 0)
+        const StreetGraphTile& tile = tiles[t];
+        QVector<int> nodeIDs(tile.nodes.size());
+        QVector<int> tileSeamNodeIDs;
+        for(int n=0 ; n<tile.nodes.size() ; n++)
         {
-            road.nodeID2 = metRoad.nodeID1;
-            secondNodeID = metRoad.nodeID1;
-            startNode.connectedNodeIDs.push_back(metRoad.nodeID1);
+            QPointF position = tile.nodes[n].position;
+            int snappedNodeID = -1;
+            if(tile.isSeamNode[n])
+            {
+                int ci = (int)std::floor(position.y()/snapDistance);
+                int cj = (int)std::floor(position.x()/snapDistance);
+                float closestDistance = snapDistance;
+                for(int i=ci-1 ; i<=ci+1 ; i++)
+                {
+                    for(int j=cj-1 ; j<=cj+1 ; j++)
+                    {
+                        const QVector<int> candidates = seamNodeCells.value(((qint64)i << 32) ^ (quint32)j);
+                        for(int k=0 ; k<candidates.size() ; k++)
+                        {
+                            float distance = QVector2D(mNodes[candidates[k]].position - position).length();
+                            if(distance < closestDistance && !snappedNodeIDs.contains(candidates[k]))
+                            {
+                                closestDistance = distance;
+                                snappedNodeID = candidates[k];
+                            }
+                        }
+                    }
+                }
+            }
+            if(snappedNodeID != -1)
+            {
+                snappedNodeIDs.insert(snappedNodeID);
+                nodeIDs[n] = snappedNodeID;
+                continue;
+            }
+            Node& node = mNodes[++mLastNodeID];
+            node.ID = mLastNodeID;
+            node.position = position;
+            nodeIDs[n] = mLastNodeID;
+            if(tile.isSeamNode[n])
+            {
+                tileSeamNodeIDs.push_back(mLastNodeID);
+            }
         }
-        else if(closestPointID == metRoad.segments.size()-1)
+        // The seam nodes of a tile are only snapped by the next tiles
+        for(int k=0 ; k<tileSeamNodeIDs.size() ; k++)
         {
-            road.nodeID2 = metRoad.nodeID2;
-            secondNodeID = metRoad.nodeID2;
-            startNode.connectedNodeIDs.push_back(metRoad.nodeID2);
+            QPointF position = mNodes[tileSeamNodeIDs[k]].position;
+            int ci = (int)std::floor(position.y()/snapDistance);
+            int cj = (int)std::floor(position.x()/snapDistance);
+            seamNodeCells[((qint64)ci << 32) ^ (quint32)cj].push_back(tileSeamNodeIDs[k]);
         }
-        else
+
+        for(int r=0 ; r<tile.roads.size() ; r++)
         {
-            Node& node2 = mNodes[++mLastNodeID];
-            node2.ID = mLastNodeID;
-//            node2.position = metRoad.segments[closestPointID];
-            node2.position = intersectionPoint;
-            node2.connectedNodeIDs.push_back(startNode.ID);
+            const Road& tileRoad = tile.roads[r];
+            Road& road = mRoads[++mLastRoadID];
+            road = tileRoad;
+            road.ID = mLastRoadID;
+            road.nodeID1 = nodeIDs[tileRoad.nodeID1];
+            road.nodeID2 = nodeIDs[tileRoad.nodeID2];
+            Node& node1 = mNodes[road.nodeID1];
+            Node& node2 = mNodes[road.nodeID2];
+            // Move the ends of the roads to the snapped nodes
+            road.segments.first() = node1.position;
+            road.segments.last() = node2.position;
+            road.pathLength = computePathLength(road.segments);
+            road.straightLength = computeStraightLength(road.segments);
+            road.bounds = computeBoundingBox(road.segments);
+            node1.connectedRoadIDs.push_back(road.ID);
+            node1.connectedNodeIDs.push_back(road.nodeID2);
             node2.connectedRoadIDs.push_back(road.ID);
-            road.segments.push_back(node2.position);
-            road.nodeID2 = startNode.ID;
-            startNode.connectedNodeIDs.push_back(node2.ID);
-            secondNodeID = node2.ID;
-            // TODO: Separate the crossed road in 2, and reconnect everything
+            node2.connectedNodeIDs.push_back(road.nodeID1);
+            mPlanarGraph->addRoad(road);
+            mCandidateSegments->insertRoad(road.segments, road.ID, road.bounds);
         }
+    }
+    rebuildOccupancyGrid();
+    streamNewRoads(tileCount, tileCount, true);
+}
 
-        // Fill road lengths
-        road.pathLength = computePathLength(road.segments);
-        road.straightLength = computeStraightLength(road.segments);
-
-        return mNodes[secondNodeID];
+void StreetGraph::generateTile(StreetGraphTile& tile, float overlap) const
+{
+    // Generate the tile with a street graph of its own, covering the tile
+    // and its overlap, and reading the field through the whole region
+    QRectF region(mBottomLeft, mRegionSize);
+    QRectF tileRegion = tile.core.adjusted(-overlap, -overlap, overlap, overlap).intersected(region);
+    StreetGraph tileGraph(tileRegion.topLeft(), tileRegion.bottomRight(), mTensorField, mSeparationDistance);
+    copyGrowthParameters(tileGraph);
+    tileGraph.mGenerateSecondaryRoads = mGenerateSecondaryRoads;
+    tileGraph.mPrincipalSeparationFactor = mPrincipalSeparationFactor;
+    if(mGenerateSecondaryRoads)
+    {
+        tileGraph.computeHierarchicalStreetGraph(true);
+    }
+    else if(mLockstepGrowth)
+    {
+        tileGraph.computeLockstepStreetGraph(true);
     }
     else
     {
-        // Create a new node on last point of the road
-        Node& node2 = mNodes[++mLastNodeID];
-        node2.ID = mLastNodeID;
-        node2.position = road.segments.last();
-        node2.connectedNodeIDs.push_back(startNode.ID);
-        node2.connectedRoadIDs.push_back(road.ID);
-        startNode.connectedNodeIDs.push_back(node2.ID);
-        road.nodeID2 = node2.ID;
+        tileGraph.computeStreetGraph3(true);
+    }
 
-        if(tooLong)
+    // Keep the parts of the roads inside the core of the tile.
+    // Roads leaving the core end on a seam node
+    QHash<int,int> nodeIndices;
+    QMap<int,Road>::const_iterator itr = tileGraph.mRoads.constBegin(), itr_end = tileGraph.mRoads.constEnd();
+    for(; itr != itr_end ; itr++)
+    {
+        const QVector<QPointF>& segments = itr->segments;
+        Road piece;
+        piece.type = itr->type;
+        bool pieceIsOpen = false;
+        for(int k=1 ; k<segments.size() ; k++)
         {
-                mSeeds.push_back(node2.position);
+            QPointF A = segments[k-1];
+            QPointF B = segments[k];
+            if(!clipSegmentToRect(A, B, tile.core))
+            {
+                continue;
+            }
+            if(!pieceIsOpen)
+            {
+                pieceIsOpen = true;
+                piece.segments.clear();
+                piece.segments.push_back(A);
+                bool startsOnNode = (k == 1 && A == segments[0]);
+                piece.nodeID1 = addTileNode(tile, A, startsOnNode ? itr->nodeID1 : -1, nodeIndices);
+            }
+            piece.segments.push_back(B);
+            bool leavesCore = (B != segments[k]);
+            bool endsOnNode = (k == segments.size()-1 && !leavesCore);
+            if(leavesCore || endsOnNode)
+            {
+                pieceIsOpen = false;
+                piece.nodeID2 = addTileNode(tile, B, endsOnNode ? itr->nodeID2 : -1, nodeIndices);
+                piece.pathLength = computePathLength(piece.segments);
+                piece.straightLength = computeStraightLength(piece.segments);
+                piece.bounds = computeBoundingBox(piece.segments);
+                piece.ID = tile.roads.size();
+                tile.roads.push_back(piece);
+            }
         }
-        // Fill road lengths
-        road.pathLength = computePathLength(road.segments);
-        road.straightLength = computeStraightLength(road.segments);
-
-        return node2;
     }
 }
 
-
-void StreetGraph::generateStreetGraph()
+void StreetGraph::copyGrowthParameters(StreetGraph& graph) const
 {
-    // Compute the street graph
-    computeStreetGraph3(true);
-//    computeMajorHyperstreamlines(true);
+    graph.mParentGraph = this;
+    graph.mFieldRegion = mFieldRegion;
+    graph.mTraceCache = mTraceCache;
+    graph.mSeedInitMethod = mSeedInitMethod;
+    graph.mSimplifyRoads = mSimplifyRoads;
+    graph.mSimplificationRatio = mSimplificationRatio;
+    graph.mUseDensityStoppingCondition = mUseDensityStoppingCondition;
+    graph.mDensityTestRatio = mDensityTestRatio;
+    graph.mSeparationMap = mSeparationMap;
+    graph.mMinSeparationRatio = mMinSeparationRatio;
+    graph.mShoreSetback = mShoreSetback;
+    graph.mLockstepGrowth = mLockstepGrowth;
+    graph.mCoarseTracing = mCoarseTracing;
+    graph.mMaxActiveFronts = mMaxActiveFronts;
+    graph.mStepsPerRound = mStepsPerRound;
+}
 
-    drawStreetGraph(mDrawNodes, false);
+int StreetGraph::addTileNode(StreetGraphTile& tile, QPointF position, int nodeID,
+                             QHash<int,int>& nodeIndices) const
+{
+    // Nodes of the tile graph are shared by the roads ending on them
+    if(nodeID != -1 && nodeIndices.contains(nodeID))
+    {
+        return nodeIndices.value(nodeID);
+    }
+    Node node;
+    node.ID = tile.nodes.size();
+    node.position = position;
+    tile.nodes.push_back(node);
+    tile.isSeamNode.push_back(nodeID == -1);
+    if(nodeID != -1)
+    {
+        nodeIndices.insert(nodeID, node.ID);
+    }
+    return node.ID;
 }
 
-QPixmap StreetGraph::drawStreetGraph(bool showNodes, bool showSeeds)
+void StreetGraph::growRoadsFromSeed(QPointF seed, bool majorGrowth)
 {
-    // Draw it in an image
-    QSize imageSize(512,512);
-    QImage pixmap(imageSize, QImage::Format_ARGB32);
-    pixmap.fill(QColor::fromRgb(230,230,230));
+    // Don't start a road next to a parallel one
+    if(mUseDensityStoppingCondition
+            && exceedingDensityStoppingCondition(seed, majorGrowth, QVector<int>()))
+    {
+        return;
+    }
+    // Nor in the water or too close to it
+    if(shorelineStoppingCondition(seed))
+    {
+        return;
+    }
+    // Create a node
+    Node& node1 = mNodes[++mLastNodeID];
+    node1.ID = mLastNodeID;
+    node1.position = seed;
+
+    Road& road = mRoads[++mLastRoadID];
+    road.ID = mLastRoadID;
+    node1.connectedRoadIDs.push_back(mLastRoadID);
+    road.type = mGrownRoadType;
+    road.nodeID1 = mLastNodeID;
+
+    Road& road2 = mRoads[++mLastRoadID];
+    road2.ID = mLastRoadID;
+    node1.connectedRoadIDs.push_back(mLastRoadID);
+    road2.type = mGrownRoadType;
+    road2.nodeID1 = mLastNodeID;
+
+    bool useExceedLength = true;
+    growRoadAndConnect(road, node1, majorGrowth, false, useExceedLength);
+    growRoadAndConnect(road2, node1, majorGrowth, true, useExceedLength);
+}
 
-    if(mTensorField->isWatermapLoaded())
+bool StreetGraph::startFrontsFromSeed(QPointF seed, bool majorGrowth, QVector<RoadFront>& fronts)
+{
+    // Don't start a road next to a parallel one, nor in the water
+    if((mUseDensityStoppingCondition
+            && exceedingDensityStoppingCondition(seed, majorGrowth, QVector<int>()))
+            || shorelineStoppingCondition(seed))
     {
-        QString filename = mTensorField->getWatermapFilename();
-        mWatermap = QImage(filename);
-        if(mWatermap.isNull())
-        {
+        return false;
+    }
+    Node& node1 = mNodes[++mLastNodeID];
+    node1.ID = mLastNodeID;
+    node1.position = seed;
+    for(int direction=0 ; direction<2 ; direction++)
+    {
+        Road& road = mRoads[++mLastRoadID];
+        road.ID = mLastRoadID;
+        node1.connectedRoadIDs.push_back(mLastRoadID);
+        road.type = mGrownRoadType;
+        road.nodeID1 = mLastNodeID;
+        fronts.push_back(startFront(road.ID, node1.ID, majorGrowth, direction == 1, true));
+    }
+    return true;
+}
+
+float StreetGraph::seedPriority(QPointF seed) const
+{
+    // Beyond a few separation distances, all the seeds are as far from the roads
+    return mOccupancyGrid.distanceToClosestSample(seed, 4.0f*separationDistanceAt(seed));
+}
+
+void StreetGraph::regenerateDirtyRegion()
+{
+    if(mTensorField == NULL || !(mTensorField->isFieldFilled()))
+    {
+        qCritical()<<"regenerateDirtyRegion(): Tensor field is empty";
+        return;
+    }
+    QVector<QRect> dirtyCells = mTensorField->getDirtyRegionSince(mFieldVersion);
+    mFieldVersion = mTensorField->getVersion();
+    if(dirtyCells.isEmpty())
+    {
+        return;
+    }
+    // Simplified roads may be off their traced points by the tolerance
+    float tolerance = mSimplifyRoads ? mSimplificationRatio*mSeparationDistance : 0.0f;
+    QVector<QRectF> dirtyRegion;
+    for(int k=0 ; k<dirtyCells.size() ; k++)
+    {
+        dirtyRegion.push_back(fieldCellsToRegion(dirtyCells[k]).adjusted(-tolerance, -tolerance,
+                                                                          tolerance, tolerance));
+    }
+
+    // Remove the roads passing through the dirty region
+    QVector<int> removedRoadIDs;
+    QMap<int,Road>::const_iterator itr = mRoads.constBegin(), itr_end = mRoads.constEnd();
+    for(; itr != itr_end ; itr++)
+    {
+        const QVector<QPointF>& segments = itr->segments;
+        bool isDirty = false;
+        for(int r=0 ; r<dirtyRegion.size() && !isDirty ; r++)
+        {
+            if(segments.size() == 1)
+            {
+                isDirty = dirtyRegion[r].contains(segments.first());
+            }
+            for(int k=1 ; k<segments.size() && !isDirty ; k++)
+            {
+                isDirty = segmentIntersectsRect(segments[k-1], segments[k], dirtyRegion[r]);
+            }
+        }
+        if(isDirty)
+        {
+            removedRoadIDs.push_back(itr.key());
+        }
+    }
+    QSet<int> touchedNodeIDs;
+    for(int k=0 ; k<removedRoadIDs.size() ; k++)
+    {
+        const Road& road = mRoads[removedRoadIDs[k]];
+        touchedNodeIDs.insert(road.nodeID1);
+        touchedNodeIDs.insert(road.nodeID2);
+        removeRoad(removedRoadIDs[k]);
+    }
+    // Display the remaining roads
+    streamNewRoads(0, 1, true);
+
+    // The seeds of the dirty region were those of the removed roads
+    int keptSeedCount = 0;
+    for(int k=0 ; k<mSeeds.size() ; k++)
+    {
+        if(!regionContains(dirtyRegion, mSeeds[k]))
+        {
+            mSeeds[keptSeedCount++] = mSeeds[k];
+        }
+    }
+    mSeeds.resize(keptSeedCount);
+    int firstSeed = mSeeds.size();
+
+    // Continue the remaining roads that ended on a removed road,
+    // so that they reconnect to the new ones
+    QSet<int>::const_iterator itn = touchedNodeIDs.constBegin(), itn_end = touchedNodeIDs.constEnd();
+    for(; itn != itn_end && !isGenerationCanceled() ; itn++)
+    {
+        NodeMapIterator node = mNodes.find(*itn);
+        if(node == mNodes.end() || node->connectedRoadIDs.size() != 1)
+        {
+            continue;
+        }
+        const Road& remainingRoad = mRoads[node->connectedRoadIDs.first()];
+        const QVector<QPointF>& segments = remainingRoad.segments;
+        if(segments.size() < 2)
+        {
+            continue;
+        }
+        // Direction of the remaining road when it arrives at the node
+        QVector2D direction = (remainingRoad.nodeID2 == node->ID)
+                ? QVector2D(segments.last() - segments[segments.size()-2])
+                : QVector2D(segments.first() - segments[1]);
+        int i, j;
+        positionToFieldIndex(node->position, i, j);
+        QVector2D majorDirection = mTensorField->getMajorEigenVector(i,j);
+        QVector2D minorDirection = mTensorField->getMinorEigenVector(i,j);
+        bool majorGrowth = qAbs(QVector2D::dotProduct(majorDirection, direction))
+                        >= qAbs(QVector2D::dotProduct(minorDirection, direction));
+        QVector2D eigenDirection = majorGrowth ? majorDirection : minorDirection;
+        if(eigenDirection.isNull())
+        {
+            continue;
+        }
+        Road& road = mRoads[++mLastRoadID];
+        road.ID = mLastRoadID;
+        road.type = mGrownRoadType;
+        road.nodeID1 = node->ID;
+        node->connectedRoadIDs.push_back(road.ID);
+        growRoadAndConnect(road, *node, majorGrowth,
+                           QVector2D::dotProduct(eigenDirection, direction) < 0, true);
+    }
+
+    // Seed the dirty region with the configured method, keeping the seeds
+    // a full generation would have placed there
+    QVector<QPointF> seeds = mSeeds;
+    generateSeedListWithUIMethod();
+    for(int k=0 ; k<mSeeds.size() ; k++)
+    {
+        if(regionContains(dirtyRegion, mSeeds[k]))
+        {
+            seeds.push_back(mSeeds[k]);
+        }
+    }
+    mSeeds = seeds;
+
+    // Grow the new roads like the full generation. The seeds replanted outside
+    // of the dirty region are ignored, the roads there are still valid
+    if(mLockstepGrowth)
+    {
+        growSeedsInLockstep(firstSeed, dirtyRegion);
+    }
+    else
+    {
+        growSeeds(firstSeed, dirtyRegion);
+    }
+    keptSeedCount = firstSeed;
+    for(int k=firstSeed ; k<mSeeds.size() ; k++)
+    {
+        if(regionContains(dirtyRegion, mSeeds[k]))
+        {
+            mSeeds[keptSeedCount++] = mSeeds[k];
+        }
+    }
+    mSeeds.resize(keptSeedCount);
+}
+
+void StreetGraph::removeRoad(int roadID)
+{
+    RoadMapIterator road = mRoads.find(roadID);
+    if(road == mRoads.end())
+    {
+        return;
+    }
+    int nodeIDs[2] = {road->nodeID1, road->nodeID2};
+    for(int k=0 ; k<2 ; k++)
+    {
+        NodeMapIterator node = mNodes.find(nodeIDs[k]);
+        if(node == mNodes.end())
+        {
+            continue;
+        }
+        int index = node->connectedRoadIDs.indexOf(roadID);
+        if(index != -1)
+        {
+            node->connectedRoadIDs.remove(index);
+        }
+        index = node->connectedNodeIDs.indexOf(nodeIDs[1-k]);
+        if(index != -1)
+        {
+            node->connectedNodeIDs.remove(index);
+        }
+        // Remove the nodes left without roads
+        if(node->connectedRoadIDs.isEmpty())
+        {
+            mNodes.erase(node);
+        }
+    }
+    mPlanarGraph->removeRoad(roadID);
+    mCandidateSegments->removeRoad(roadID);
+    mOccupancyGrid.removeRoad(roadID);
+    mRoads.erase(road);
+}
+
+QRectF StreetGraph::fieldCellsToRegion(QRect cells) const
+{
+    // Field cell (i,j) covers the positions rounded to it
+    QSize fieldSize = mTensorField->getFieldSize();
+    double cellWidth = mFieldRegion.width()/qMax(1, fieldSize.width()-1);
+    double cellHeight = mFieldRegion.height()/qMax(1, fieldSize.height()-1);
+    return QRectF(mFieldRegion.left() + (cells.left()-0.5)*cellWidth,
+                  mFieldRegion.top() + (cells.top()-0.5)*cellHeight,
+                  cells.width()*cellWidth, cells.height()*cellHeight);
+}
+
+QPointF StreetGraph::positionToFieldCell(QPointF position) const
+{
+    QSize fieldSize = mTensorField->getFieldSize();
+    return QPointF((position.x()-mFieldRegion.left())/mFieldRegion.width()*(fieldSize.width()-1),
+                   (position.y()-mFieldRegion.top())/mFieldRegion.height()*(fieldSize.height()-1));
+}
+
+int StreetGraph::tracingPyramidLevel() const
+{
+    if(!mCoarseTracing)
+    {
+        return 0;
+    }
+    // Several cells per step and per quarter of the separation distance
+    QSize fieldSize = mTensorField->getFieldSize();
+    float cellSize = mFieldRegion.height()/qMax(1, fieldSize.height()-1);
+    float step = mFieldRegion.height()/100.0f;
+    return mTensorField->getPyramidLevelForScale(qMin(step, mSeparationDistance/4.0f)/cellSize);
+}
+
+QPointF StreetGraph::fieldCellToPosition(QPointF cell) const
+{
+    QSize fieldSize = mTensorField->getFieldSize();
+    return QPointF(mFieldRegion.left() + cell.x()/qMax(1, fieldSize.width()-1)*mFieldRegion.width(),
+                   mFieldRegion.top() + cell.y()/qMax(1, fieldSize.height()-1)*mFieldRegion.height());
+}
+
+void StreetGraph::computeHierarchicalStreetGraph(bool clearStorage)
+{
+    if(mTensorField == NULL || !(mTensorField->isFieldFilled()))
+    {
+        qCritical()<<"computeHierarchicalStreetGraph(): Tensor field is empty";
+        return;
+    }
+    // Principal roads, with a larger separation distance
+    float separationDistance = mSeparationDistance;
+    mSeparationDistance = separationDistance*mPrincipalSeparationFactor;
+    computeStreetGraph3(clearStorage);
+    mSeparationDistance = separationDistance;
+    if(isGenerationCanceled())
+    {
+        return;
+    }
+
+    // Blocks enclosed by the principal roads
+    BlockLabelGrid grid;
+    QVector<StreetBlock> blocks = extractPrincipalBlocks(separationDistance/4.0f, grid);
+
+    // Distribute the seeds of a regular grid in the blocks
+    QHash<int,int> blockIndices;
+    for(int k=0 ; k<blocks.size() ; k++)
+    {
+        blockIndices.insert(blocks[k].label, k);
+    }
+    int Nv = (int)(mRegionSize.height()/separationDistance);
+    int Nu = (int)(mRegionSize.width()/separationDistance);
+    QPointF origin = mBottomLeft + QPointF(separationDistance/2.0f,separationDistance/2.0f);
+    for(int i=0 ; i<Nv ; i++)
+    {
+        for(int j=0 ; j<Nu ; j++)
+        {
+            QPointF seed = origin + QPointF(j*separationDistance, i*separationDistance);
+            int cell = grid.cellIndex(seed);
+            if(cell != -1 && blockIndices.contains(grid.labels[cell]))
+            {
+                blocks[blockIndices.value(grid.labels[cell])].seeds.push_back(seed);
+            }
+        }
+    }
+
+    // Blocks are independent, grow them concurrently
+    QtConcurrent::blockingMap(blocks, [&](StreetBlock& block)
+    {
+        if(!isGenerationCanceled())
+        {
+            growSecondaryRoadsInBlock(block, separationDistance);
+        }
+    });
+    if(isGenerationCanceled())
+    {
+        return;
+    }
+
+    // Merge the blocks in the street graph. Secondary roads ending on a
+    // principal road share a node with it, so the principal road is split there
+    QHash<int, QVector<int> > principalParts;
+    for(int k=0 ; k<blocks.size() ; k++)
+    {
+        const StreetBlock& block = blocks[k];
+        QVector<int> nodeIDs(block.nodes.size());
+        for(int n=0 ; n<block.nodes.size() ; n++)
+        {
+            QHash<int,int>::const_iterator junction = block.junctions.constFind(n);
+            if(junction != block.junctions.constEnd() && mRoads.contains(junction.value()))
+            {
+                QVector<int>& partIDs = principalParts[junction.value()];
+                if(partIDs.isEmpty())
+                {
+                    partIDs.push_back(junction.value());
+                }
+                nodeIDs[n] = insertJunction(partIDs, block.nodes[n].position);
+                continue;
+            }
+            Node& node = mNodes[++mLastNodeID];
+            node.ID = mLastNodeID;
+            node.position = block.nodes[n].position;
+            nodeIDs[n] = mLastNodeID;
+        }
+        for(int r=0 ; r<block.roads.size() ; r++)
+        {
+            const Road& blockRoad = block.roads[r];
+            if(blockRoad.segments.size() < 2)
+            {
+                continue;
+            }
+            Road& road = mRoads[++mLastRoadID];
+            road = blockRoad;
+            road.ID = mLastRoadID;
+            road.nodeID1 = nodeIDs[blockRoad.nodeID1];
+            road.nodeID2 = nodeIDs[blockRoad.nodeID2];
+            Node& node1 = mNodes[road.nodeID1];
+            Node& node2 = mNodes[road.nodeID2];
+            node1.connectedRoadIDs.push_back(road.ID);
+            node1.connectedNodeIDs.push_back(road.nodeID2);
+            node2.connectedRoadIDs.push_back(road.ID);
+            node2.connectedNodeIDs.push_back(road.nodeID1);
+            mPlanarGraph->addRoad(road);
+            mCandidateSegments->insertRoad(road.segments, road.ID, road.bounds);
+        }
+    }
+    // The principal roads were sampled with the principal separation distance
+    rebuildOccupancyGrid();
+    streamNewRoads(1, 1, true);
+}
+
+QVector<StreetBlock> StreetGraph::extractPrincipalBlocks(float cellSize, BlockLabelGrid& grid) const
+{
+    // Keep the grid to a reasonable size
+    cellSize = qMax(cellSize, (float)qMax(mRegionSize.width(), mRegionSize.height())/2048.0f);
+    grid.origin = mBottomLeft;
+    grid.cellSize = cellSize;
+    grid.width = qMax(1, (int)std::ceil(mRegionSize.width()/cellSize));
+    grid.height = qMax(1, (int)std::ceil(mRegionSize.height()/cellSize));
+    grid.labels = QVector<int>(grid.width*grid.height, BLOCK_LABEL_NONE);
+    grid.roadIDs = QVector<int>(grid.width*grid.height, -1);
+
+    // Rasterize the principal roads, sampling each segment every half cell
+    QMap<int,Road>::const_iterator itr = mRoads.constBegin(), itr_end = mRoads.constEnd();
+    for(; itr != itr_end ; itr++)
+    {
+        if(itr->type != Principal)
+        {
+            continue;
+        }
+        for(int k=1 ; k<itr->segments.size() ; k++)
+        {
+            QPointF A = itr->segments[k-1];
+            QPointF B = itr->segments[k];
+            int samples = (int)std::ceil(QVector2D(B-A).length()/(cellSize/2.0f)) + 1;
+            for(int n=0 ; n<=samples ; n++)
+            {
+                int cell = grid.cellIndex(A + (B-A)*((double)n/samples));
+                if(cell != -1)
+                {
+                    grid.labels[cell] = BLOCK_LABEL_ROAD;
+                    grid.roadIDs[cell] = itr.key();
+                }
+            }
+        }
+    }
+
+    // Flood fill the other cells, 4-connected
+    QVector<StreetBlock> blocks;
+    QVector<int> queue;
+    for(int start=0 ; start<grid.labels.size() ; start++)
+    {
+        if(grid.labels[start] != BLOCK_LABEL_NONE)
+        {
+            continue;
+        }
+        StreetBlock block;
+        block.label = blocks.size();
+        block.cellCount = 0;
+        int iMin = start / grid.width, iMax = iMin;
+        int jMin = start % grid.width, jMax = jMin;
+        QSet<int> boundaryRoadIDs;
+        queue.clear();
+        queue.push_back(start);
+        grid.labels[start] = block.label;
+        for(int q=0 ; q<queue.size() ; q++)
+        {
+            int cell = queue[q];
+            block.cellCount++;
+            int ci = cell / grid.width;
+            int cj = cell % grid.width;
+            iMin = qMin(iMin, ci);
+            iMax = qMax(iMax, ci);
+            jMin = qMin(jMin, cj);
+            jMax = qMax(jMax, cj);
+            int neighbors[4] = {ci > 0 ? cell-grid.width : -1,
+                                ci < grid.height-1 ? cell+grid.width : -1,
+                                cj > 0 ? cell-1 : -1,
+                                cj < grid.width-1 ? cell+1 : -1};
+            for(int n=0 ; n<4 ; n++)
+            {
+                int neighbor = neighbors[n];
+                if(neighbor == -1)
+                {
+                    continue;
+                }
+                if(grid.labels[neighbor] == BLOCK_LABEL_NONE)
+                {
+                    grid.labels[neighbor] = block.label;
+                    queue.push_back(neighbor);
+                }
+                else if(grid.labels[neighbor] == BLOCK_LABEL_ROAD)
+                {
+                    boundaryRoadIDs.insert(grid.roadIDs[neighbor]);
+                }
+            }
+        }
+        QSet<int>::const_iterator itb = boundaryRoadIDs.constBegin(), itb_end = boundaryRoadIDs.constEnd();
+        for(; itb != itb_end ; itb++)
+        {
+            block.boundaryRoadIDs.push_back(*itb);
+        }
+        // The boundary roads lie in the cells around the block
+        block.bounds = QRectF(grid.origin.x() + (jMin-2)*cellSize, grid.origin.y() + (iMin-2)*cellSize,
+                              (jMax-jMin+5)*cellSize, (iMax-iMin+5)*cellSize);
+        blocks.push_back(block);
+    }
+    return blocks;
+}
+
+void StreetGraph::growSecondaryRoadsInBlock(StreetBlock& block, float separationDistance) const
+{
+    // Grow the block with a street graph of its own, so that the secondary roads
+    // keep their separation distance and reuse the traces like the principal ones
+    QRectF blockRegion = block.bounds.intersected(QRectF(mBottomLeft, mRegionSize));
+    StreetGraph blockGraph(blockRegion.topLeft(), blockRegion.bottomRight(), mTensorField, separationDistance);
+    copyGrowthParameters(blockGraph);
+    blockGraph.mGrownRoadType = Secondary;
+
+    // The boundary roads stop the secondary roads, which end on them
+    for(int k=0 ; k<block.boundaryRoadIDs.size() ; k++)
+    {
+        QMap<int,Road>::const_iterator boundaryRoad = mRoads.constFind(block.boundaryRoadIDs[k]);
+        if(boundaryRoad == mRoads.constEnd() || boundaryRoad->segments.size() < 2)
+        {
+            continue;
+        }
+        Road& road = blockGraph.mRoads[++blockGraph.mLastRoadID];
+        road = *boundaryRoad;
+        road.ID = blockGraph.mLastRoadID;
+        road.type = Principal;
+        int nodeIDs[2];
+        for(int n=0 ; n<2 ; n++)
+        {
+            Node& node = blockGraph.mNodes[++blockGraph.mLastNodeID];
+            node.ID = blockGraph.mLastNodeID;
+            node.position = (n == 0) ? road.segments.first() : road.segments.last();
+            node.connectedRoadIDs.push_back(road.ID);
+            nodeIDs[n] = node.ID;
+        }
+        road.nodeID1 = nodeIDs[0];
+        road.nodeID2 = nodeIDs[1];
+        blockGraph.mNodes[nodeIDs[0]].connectedNodeIDs.push_back(nodeIDs[1]);
+        blockGraph.mNodes[nodeIDs[1]].connectedNodeIDs.push_back(nodeIDs[0]);
+        blockGraph.mPlanarGraph->addRoad(road);
+        blockGraph.mCandidateSegments->insertRoad(road.segments, road.ID, road.bounds);
+    }
+
+    blockGraph.mSeeds = block.seeds;
+    if(mLockstepGrowth)
+    {
+        blockGraph.growSeedsInLockstep(0);
+    }
+    else
+    {
+        blockGraph.growSeeds(0);
+    }
+
+    // Keep the secondary roads, and the nodes they end on
+    QHash<int,int> nodeIndices;
+    QMap<int,Road>::const_iterator itr = blockGraph.mRoads.constBegin(), itr_end = blockGraph.mRoads.constEnd();
+    for(; itr != itr_end ; itr++)
+    {
+        if(itr->type != Secondary || itr->segments.size() < 2)
+        {
+            continue;
+        }
+        Road road = *itr;
+        road.ID = block.roads.size();
+        int endNodeIDs[2] = {itr->nodeID1, itr->nodeID2};
+        for(int n=0 ; n<2 ; n++)
+        {
+            if(!nodeIndices.contains(endNodeIDs[n]))
+            {
+                const Node& blockNode = blockGraph.mNodes[endNodeIDs[n]];
+                Node node;
+                node.ID = block.nodes.size();
+                node.position = blockNode.position;
+                nodeIndices.insert(endNodeIDs[n], node.ID);
+                block.nodes.push_back(node);
+                // A node shared with a part of a boundary road is a junction
+                // with the closest boundary road
+                bool isJunction = false;
+                for(int r=0 ; r<blockNode.connectedRoadIDs.size() && !isJunction ; r++)
+                {
+                    isJunction = blockGraph.mRoads.value(blockNode.connectedRoadIDs[r]).type == Principal;
+                }
+                int closestRoadID = -1;
+                float closestDistance = std::numeric_limits<float>::max();
+                for(int k=0 ; k<block.boundaryRoadIDs.size() && isJunction ; k++)
+                {
+                    QMap<int,Road>::const_iterator boundaryRoad = mRoads.constFind(block.boundaryRoadIDs[k]);
+                    float distance;
+                    if(boundaryRoad != mRoads.constEnd()
+                            && findClosestSegment(boundaryRoad->segments, node.position, distance) != -1
+                            && distance < closestDistance)
+                    {
+                        closestDistance = distance;
+                        closestRoadID = boundaryRoad.key();
+                    }
+                }
+                if(closestRoadID != -1)
+                {
+                    block.junctions.insert(node.ID, closestRoadID);
+                }
+            }
+        }
+        road.nodeID1 = nodeIndices.value(itr->nodeID1);
+        road.nodeID2 = nodeIndices.value(itr->nodeID2);
+        block.nodes[road.nodeID1].connectedRoadIDs.push_back(road.ID);
+        block.nodes[road.nodeID1].connectedNodeIDs.push_back(road.nodeID2);
+        block.nodes[road.nodeID2].connectedRoadIDs.push_back(road.ID);
+        block.nodes[road.nodeID2].connectedNodeIDs.push_back(road.nodeID1);
+        block.roads.push_back(road);
+    }
+}
+
+Node& StreetGraph::growRoad(Road& road, Node& startNode, bool growInMajorDirection,
+                            bool growInOppositeDirection, bool useExceedLenStopCond)
+{
+    // Grow a road starting from this node along the streamline of the tensor
+    // eigen vector, until one of the condition is reached. The streamline
+    // only depends on the field, the other conditions are checked on its points
+    StreamlineTrace trace = traceStreamline(startNode.position, growInMajorDirection,
+                                            growInOppositeDirection, TRACE_INITIAL_LENGTH);
+
+    // The road contains also the position of its extreme nodes
+    // Holds wether road stopped because it was too long or not
+    bool tooLong = false;
+    bool stopGrowth = false;
+    float pathLength = 0.0f;
+    for(int k=0 ; !stopGrowth ; k++)
+    {
+        if(k+1 == trace.points.size())
+        {
+            trace = traceStreamline(startNode.position, growInMajorDirection,
+                                    growInOppositeDirection, 2*k);
+        }
+        // Start exactly on the node, the trace may come from a nearby seed
+        QPointF currentPosition = (k == 0 ? startNode.position : trace.points[k]);
+        QPointF nextPosition = trace.points[k+1];
+        if(!road.segments.isEmpty())
+        {
+            pathLength += QVector2D(currentPosition - road.segments.last()).length();
+        }
+        appendRoadPoint(road, currentPosition);
+        mOccupancyGrid.insert(currentPosition, road.ID, growInMajorDirection);
+        if(useExceedLenStopCond)
+        {
+            tooLong = exceedingLengthStoppingCondition(pathLength, road.segments.first());
+        }
+        stopGrowth = (trace.isComplete && k+2 == trace.points.size())
+                  || boundaryStoppingCondition(nextPosition)
+                  || shorelineStoppingCondition(nextPosition)
+                  || tooLong
+                  || (mUseDensityStoppingCondition
+                      && exceedingDensityStoppingCondition(nextPosition, growInMajorDirection,
+                                                           startNode.connectedRoadIDs));
+    }
+
+    // Simplify the road and fill its lengths
+    finalizeRoad(road);
+
+    // Connect Nodes and Roads
+    Node& node2 = mNodes[++mLastNodeID];
+    node2.ID = mLastNodeID;
+    node2.position = road.segments.last();
+    node2.connectedNodeIDs.push_back(startNode.ID);
+    node2.connectedRoadIDs.push_back(road.ID);
+    startNode.connectedNodeIDs.push_back(node2.ID);
+    road.nodeID2 = node2.ID;
+
+    if(tooLong)
+    {
+        // Replant a seed only if it's not too close from another seed
+        if(pointRespectSeedSeparationDistance(road.segments.last(),mSeparationDistance/4.0f))
+        {
+            mSeeds.push_back(node2.position);
+        }
+    }
+    return node2;
+}
+
+Node& StreetGraph::growRoadAndConnect(Road& road, Node& startNode, bool growInMajorDirection,
+                            bool growInOppositeDirection, bool useExceedLenStopCond)
+{
+    RoadFront front = startFront(road.ID, startNode.ID, growInMajorDirection,
+                                 growInOppositeDirection, useExceedLenStopCond);
+
+    // The other roads don't change while this one grows
+    while(!advanceFront(front, TRACE_MAX_LENGTH, QVector<RoadFront>()))
+    {
+    }
+    return mNodes[finishFront(front)];
+}
+
+RoadFront StreetGraph::startFront(int roadID, int startNodeID, bool growInMajorDirection,
+                                  bool growInOppositeDirection, bool useExceedLenStopCond)
+{
+    // Grow a road starting from this node along the streamline of the tensor
+    // eigen vector, until one of the condition is reached. The streamline
+    // only depends on the field, the other conditions are checked on its points
+    RoadFront front;
+    front.roadID = roadID;
+    front.startNodeID = startNodeID;
+    front.isMajor = growInMajorDirection;
+    front.isOpposite = growInOppositeDirection;
+    front.useExceedLength = useExceedLenStopCond;
+    front.trace = traceStreamline(mNodes[startNodeID].position, growInMajorDirection,
+                                  growInOppositeDirection, TRACE_INITIAL_LENGTH);
+    front.step = 0;
+    front.pathLength = 0.0f;
+    front.isDone = false;
+    front.tooLong = false;
+    front.metRoadID = -1;
+    front.metSegmentEnd = -1;
+    front.metRoadIsGrowing = false;
+    // The end node is only known once the road stops growing
+    mRoads[roadID].nodeID2 = -1;
+    return front;
+}
+
+bool StreetGraph::advanceFront(RoadFront& front, int stepCount, const QVector<RoadFront>& fronts)
+{
+    Road& road = mRoads[front.roadID];
+    const Node& startNode = mNodes[front.startNodeID];
+    // The road contains also the position of its extreme nodes
+    bool stopGrowth = false;
+    for(int n=0 ; n<stepCount && !stopGrowth ; n++)
+    {
+        int k = front.step;
+        if(k+1 == front.trace.points.size())
+        {
+            front.trace = traceStreamline(startNode.position, front.isMajor,
+                                          front.isOpposite, 2*k);
+        }
+        // Start exactly on the node, the trace may come from a nearby seed
+        QPointF currentPosition = (k == 0 ? startNode.position : front.trace.points[k]);
+        QPointF nextPosition = front.trace.points[k+1];
+        if(!road.segments.isEmpty())
+        {
+            front.pathLength += QVector2D(currentPosition - road.segments.last()).length();
+        }
+        appendRoadPoint(road, currentPosition);
+        mOccupancyGrid.insert(currentPosition, road.ID, front.isMajor);
+        if(front.useExceedLength)
+        {
+            front.tooLong = exceedingLengthStoppingCondition(front.pathLength, road.segments.first());
+        }
+        bool meetOtherRoad = meetsAnotherRoadAndFindIntersection(front, startNode.connectedRoadIDs,
+                                                                 fronts, nextPosition);
+        stopGrowth = (front.trace.isComplete && k+2 == front.trace.points.size())
+                  || boundaryStoppingCondition(nextPosition)
+                  || shorelineStoppingCondition(nextPosition)
+                  || front.tooLong
+                  || meetOtherRoad
+                  || (mUseDensityStoppingCondition
+                      && exceedingDensityStoppingCondition(nextPosition, front.isMajor,
+                                                           startNode.connectedRoadIDs));
+        front.step++;
+    }
+    return stopGrowth;
+}
+
+int StreetGraph::finishFront(RoadFront& front)
+{
+    Road& road = mRoads[front.roadID];
+    Node& startNode = mNodes[front.startNodeID];
+    front.isDone = true;
+
+    // Connect Nodes and Roads
+    int secondNodeID = -1;
+    if(front.metRoadID != -1)
+    {
+        Road &metRoad = mRoads[front.metRoadID];
+        if(!front.metRoadIsGrowing && front.metSegmentEnd == metRoad.segments.size()-1)
+        {
+            road.nodeID2 = metRoad.nodeID2;
+            secondNodeID = metRoad.nodeID2;
+            startNode.connectedNodeIDs.push_back(metRoad.nodeID2);
+            mNodes[secondNodeID].connectedNodeIDs.push_back(startNode.ID);
+            mNodes[secondNodeID].connectedRoadIDs.push_back(road.ID);
+        }
+        else
+        {
+            Node& node2 = mNodes[++mLastNodeID];
+            node2.ID = mLastNodeID;
+            node2.position = front.intersectionPoint;
+            node2.connectedNodeIDs.push_back(startNode.ID);
+            node2.connectedRoadIDs.push_back(road.ID);
+            appendRoadPoint(road, node2.position);
+            road.nodeID2 = node2.ID;
+            startNode.connectedNodeIDs.push_back(node2.ID);
+            secondNodeID = node2.ID;
+            if(front.metRoadIsGrowing)
+            {
+                // Its end node doesn't exist yet, split it once it stops growing
+                PendingJunction junction;
+                junction.nodeID = node2.ID;
+                junction.segmentEnd = front.metSegmentEnd;
+                mPendingJunctions.insert(front.metRoadID, junction);
+            }
+            else
+            {
+                // Separate the crossed road in 2 at the new node
+                splitRoad(front.metRoadID, front.metSegmentEnd, node2.ID);
+            }
+        }
+    }
+    else
+    {
+        // Create a new node on last point of the road
+        Node& node2 = mNodes[++mLastNodeID];
+        node2.ID = mLastNodeID;
+        node2.position = road.segments.last();
+        node2.connectedNodeIDs.push_back(startNode.ID);
+        node2.connectedRoadIDs.push_back(road.ID);
+        startNode.connectedNodeIDs.push_back(node2.ID);
+        road.nodeID2 = node2.ID;
+        secondNodeID = node2.ID;
+
+        if(front.tooLong)
+        {
+                mSeeds.push_back(node2.position);
+        }
+    }
+    resolvePendingJunctions(road.ID);
+    return secondNodeID;
+}
+
+void StreetGraph::resolvePendingJunctions(int roadID)
+{
+    QList<PendingJunction> junctions = mPendingJunctions.values(roadID);
+    mPendingJunctions.remove(roadID);
+    QVector<int> partIDs;
+    partIDs.push_back(roadID);
+    if(!junctions.isEmpty())
+    {
+        // Split from the end of the road, so that the earlier junctions
+        // stay on the part keeping the road ID
+        const QVector<QPointF> segments = mRoads[roadID].segments;
+        const QMap<int,Node>& nodes = mNodes;
+        std::sort(junctions.begin(), junctions.end(),
+                  [&segments, &nodes](const PendingJunction& a, const PendingJunction& b)
+        {
+            if(a.segmentEnd != b.segmentEnd)
+            {
+                return a.segmentEnd > b.segmentEnd;
+            }
+            QPointF segmentStart = segments[a.segmentEnd-1];
+            return QVector2D(nodes[a.nodeID].position - segmentStart).lengthSquared()
+                    > QVector2D(nodes[b.nodeID].position - segmentStart).lengthSquared();
+        });
+        for(int k=0 ; k<junctions.size() ; k++)
+        {
+            partIDs.push_back(splitRoad(roadID, junctions[k].segmentEnd, junctions[k].nodeID));
+        }
+    }
+    // Simplify the parts and fill their lengths
+    for(int k=0 ; k<partIDs.size() ; k++)
+    {
+        Road& part = mRoads[partIDs[k]];
+        finalizeRoad(part);
+        mPlanarGraph->addRoad(part);
+        mCandidateSegments->insertRoad(part.segments, part.ID, part.bounds);
+    }
+}
+
+int StreetGraph::splitRoad(int roadID, int segmentEnd, int nodeID)
+{
+    Road& firstPart = mRoads[roadID];
+    Node& middleNode = mNodes[nodeID];
+    Road& secondPart = mRoads[++mLastRoadID];
+    secondPart.ID = mLastRoadID;
+    secondPart.type = firstPart.type;
+    secondPart.nodeID1 = nodeID;
+    secondPart.nodeID2 = firstPart.nodeID2;
+    secondPart.segments.push_back(middleNode.position);
+    for(int k=segmentEnd ; k<firstPart.segments.size() ; k++)
+    {
+        secondPart.segments.push_back(firstPart.segments[k]);
+    }
+    firstPart.segments.resize(segmentEnd);
+    firstPart.segments.push_back(middleNode.position);
+    firstPart.nodeID2 = nodeID;
+    firstPart.bounds = computeBoundingBox(firstPart.segments);
+    secondPart.bounds = computeBoundingBox(secondPart.segments);
+
+    // Reconnect the end nodes through the middle node
+    Node& node1 = mNodes[firstPart.nodeID1];
+    Node& node2 = mNodes[secondPart.nodeID2];
+    int index = node1.connectedNodeIDs.indexOf(node2.ID);
+    if(index != -1)
+    {
+        node1.connectedNodeIDs[index] = nodeID;
+    }
+    index = node2.connectedNodeIDs.indexOf(node1.ID);
+    if(index != -1)
+    {
+        node2.connectedNodeIDs[index] = nodeID;
+    }
+    index = node2.connectedRoadIDs.indexOf(roadID);
+    if(index != -1)
+    {
+        node2.connectedRoadIDs[index] = secondPart.ID;
+    }
+    middleNode.connectedNodeIDs.push_back(node1.ID);
+    middleNode.connectedNodeIDs.push_back(node2.ID);
+    middleNode.connectedRoadIDs.push_back(roadID);
+    middleNode.connectedRoadIDs.push_back(secondPart.ID);
+
+    firstPart.pathLength = computePathLength(firstPart.segments);
+    firstPart.straightLength = computeStraightLength(firstPart.segments);
+    secondPart.pathLength = computePathLength(secondPart.segments);
+    secondPart.straightLength = computeStraightLength(secondPart.segments);
+
+    mPlanarGraph->splitRoad(roadID, firstPart, secondPart);
+    // A road still growing only joins the candidates once it is finalized
+    if(mCandidateSegments->containsRoad(roadID))
+    {
+        mCandidateSegments->insertRoad(firstPart.segments, firstPart.ID, firstPart.bounds);
+        mCandidateSegments->insertRoad(secondPart.segments, secondPart.ID, secondPart.bounds);
+    }
+    bool isMajor;
+    if(mOccupancyGrid.findRoadFamily(roadID, isMajor))
+    {
+        mOccupancyGrid.removeRoad(roadID);
+        mOccupancyGrid.insertRoad(firstPart.segments, firstPart.ID, isMajor);
+        mOccupancyGrid.insertRoad(secondPart.segments, secondPart.ID, isMajor);
+    }
+    return secondPart.ID;
+}
+
+int StreetGraph::insertJunction(QVector<int>& partIDs, QPointF position)
+{
+    int closestPartID = -1;
+    int segmentEnd = -1;
+    float closestDistance = std::numeric_limits<float>::max();
+    for(int k=0 ; k<partIDs.size() ; k++)
+    {
+        float distance;
+        int end = findClosestSegment(mRoads[partIDs[k]].segments, position, distance);
+        if(end != -1 && distance < closestDistance)
+        {
+            closestDistance = distance;
+            closestPartID = partIDs[k];
+            segmentEnd = end;
+        }
+    }
+    // Don't create an empty part when the junction is on an end of the road
+    float tolerance = 1e-4f*mSeparationDistance;
+    if(closestPartID != -1)
+    {
+        const Road& part = mRoads[closestPartID];
+        if(QVector2D(position - part.segments.first()).length() < tolerance)
+        {
+            return part.nodeID1;
+        }
+        if(QVector2D(position - part.segments.last()).length() < tolerance)
+        {
+            return part.nodeID2;
+        }
+    }
+    Node& node = mNodes[++mLastNodeID];
+    node.ID = mLastNodeID;
+    node.position = position;
+    if(closestPartID != -1)
+    {
+        partIDs.push_back(splitRoad(closestPartID, segmentEnd, node.ID));
+    }
+    return node.ID;
+}
+
+void StreetGraph::finalizeRoad(Road& road) const
+{
+    if(mSimplifyRoads)
+    {
+        simplifyPolyline(road.segments, mSimplificationRatio*mSeparationDistance);
+    }
+    road.pathLength = computePathLength(road.segments);
+    road.straightLength = computeStraightLength(road.segments);
+    road.bounds = computeBoundingBox(road.segments);
+}
+
+void StreetGraph::simplifyStreetGraph()
+{
+    copyLoadedStreetGraph();
+    QVector<Road*> roads;
+    roads.reserve(mRoads.size());
+    RoadMapIterator itr = mRoads.begin(), itr_end = mRoads.end();
+    for(; itr != itr_end ; itr++)
+    {
+        roads.push_back(&(*itr));
+    }
+    float tolerance = mSimplificationRatio*mSeparationDistance;
+    QtConcurrent::blockingMap(roads, [tolerance](Road* road)
+    {
+        simplifyPolyline(road->segments, tolerance);
+        road->pathLength = computePathLength(road->segments);
+        road->straightLength = computeStraightLength(road->segments);
+        road->bounds = computeBoundingBox(road->segments);
+    });
+    // The directions leaving the nodes may have changed
+    rebuildPlanarGraph();
+    rebuildCandidateSegments();
+}
+
+void StreetGraph::generateStreetGraph()
+{
+    startGeneration(false);
+}
+
+void StreetGraph::updateStreetGraph()
+{
+    // Secondary roads depend on the whole principal blocks,
+    // so they are always generated again
+    startGeneration(mFieldVersion != -1 && !mGenerateSecondaryRoads && !mTiledGeneration);
+}
+
+void StreetGraph::cancelGeneration()
+{
+    mCancelRequested.store(1);
+}
+
+bool StreetGraph::isGenerating() const
+{
+    return mGenerationWatcher.isRunning();
+}
+
+bool StreetGraph::isExporting() const
+{
+    return mExportWatcher.isRunning();
+}
+
+bool StreetGraph::isGenerationCanceled() const
+{
+    // Tiles are canceled with the street graph they belong to
+    return mCancelRequested.load() != 0
+            || (mParentGraph != NULL && mParentGraph->isGenerationCanceled());
+}
+
+void StreetGraph::startGeneration(bool onlyDirtyRegion)
+{
+    if(mGenerationWatcher.isRunning() || mExportWatcher.isRunning())
+    {
+        qWarning()<<"startGeneration(): The street graph is already being generated or exported";
+        return;
+    }
+    // The generation modifies the stored roads
+    copyLoadedStreetGraph();
+    if(mTensorField != NULL && mTensorField->isFieldFilled() && tracingPyramidLevel() > 0)
+    {
+        // The field belongs to this thread, the generation only reads it
+        mTensorField->updatePyramidLevel(tracingPyramidLevel());
+    }
+    mCancelRequested.store(0);
+    mLastStreamedRoadID = 0;
+    mStreamTimer.start();
+    emit generationStarted(QRectF(mBottomLeft, mTopRight));
+    mGenerationWatcher.setFuture(QtConcurrent::run(this, &StreetGraph::runGeneration, onlyDirtyRegion));
+}
+
+void StreetGraph::runGeneration(bool onlyDirtyRegion)
+{
+    // Compute the street graph
+    if(onlyDirtyRegion)
+    {
+        regenerateDirtyRegion();
+    }
+    else if(mTiledGeneration)
+    {
+        computeTiledStreetGraph(true);
+    }
+    else if(mGenerateSecondaryRoads)
+    {
+        computeHierarchicalStreetGraph(true);
+    }
+    else if(mLockstepGrowth)
+    {
+        computeLockstepStreetGraph(true);
+    }
+    else
+    {
+        computeStreetGraph3(true);
+    }
+//    computeMajorHyperstreamlines(true);
+    if(isGenerationCanceled())
+    {
+        // The graph is incomplete, the next update must start over
+        mFieldVersion = -1;
+    }
+    else if(mTensorField != NULL)
+    {
+        mFieldVersion = mTensorField->getVersion();
+    }
+}
+
+void StreetGraph::generationFinished()
+{
+    drawStreetGraph(mDrawNodes, false);
+    emit generationDone(isGenerationCanceled());
+}
+
+void StreetGraph::streamNewRoads(int progress, int maximum, bool force, int lastRoadID)
+{
+    if(!force && mStreamTimer.elapsed() < 100)
+    {
+        return;
+    }
+    mStreamTimer.restart();
+    if(lastRoadID == -1)
+    {
+        lastRoadID = mLastRoadID;
+    }
+    QVector<QPolygonF> roads;
+    QMap<int,Road>::const_iterator itr = mRoads.upperBound(mLastStreamedRoadID);
+    QMap<int,Road>::const_iterator itr_end = mRoads.upperBound(lastRoadID);
+    for(; itr != itr_end ; itr++)
+    {
+        if(itr->segments.size() >= 2)
+        {
+            roads.push_back(QPolygonF(itr->segments));
+        }
+    }
+    mLastStreamedRoadID = qMax(mLastStreamedRoadID, lastRoadID);
+    if(!roads.isEmpty())
+    {
+        emit newRoads(roads);
+    }
+    emit generationProgress(progress, maximum);
+}
+
+QPixmap StreetGraph::drawStreetGraph(bool showNodes, bool showSeeds)
+{
+    // Draw it in an image
+    QSize imageSize(512,512);
+    QImage pixmap(imageSize, QImage::Format_ARGB32);
+    pixmap.fill(QColor::fromRgb(230,230,230));
+
+    if(mTensorField->isWatermapLoaded())
+    {
+        QString filename = mTensorField->getWatermapFilename();
+        mWatermap = QImage(filename);
+        if(mWatermap.isNull())
+        {
             qCritical()<<"applyWaterMap(): File "<<filename<<" not found";
             return QPixmap();
         }
@@ -565,20 +1948,18 @@ QPixmap StreetGraph::drawStreetGraph(bool showNodes, bool showSeeds)
     painter.setPen(penRoad);
     drawRoads(painter, imageSize);
 
-    NodeMapIterator itn = mNodes.begin(), itn_end = mNodes.end();
-
     // Draw the nodes
     if(showNodes)
     {
-        for(; itn != itn_end ; itn++)
+        painter.setPen(penNode);
+        forEachNode([&](const NodeRecord& node)
         {
-            painter.setPen(penNode);
-            QPointF a = itn->position;
+            QPointF a = node.position;
             a.rx() *= imageSize.width()/mRegionSize.width();
             a.ry() *= imageSize.height()/mRegionSize.height();
             a.ry() = imageSize.height() - a.y();
             painter.drawPoint(a);
-        }
+        });
     }
     // Draw the seeds
     if(showSeeds)
@@ -636,84 +2017,696 @@ bool StreetGraph::meetsAnotherRoad(Road &road, int &intersectedRoadID, int &clos
     return false;
 }
 
-bool StreetGraph::meetsAnotherRoadAndFindIntersection(int roadID, QPointF nextPosition, int &intersectedRoadID,
-                                                      int &closestPointID, QPointF &intersectionPoint)
+void StreetGraph::rebuildCandidateSegments()
 {
-    QPointF roadEnd = mRoads[roadID].segments.last();
-    for(int i=0 ; i<mRoads.size() ; i++)
+    mCandidateSegments->clear();
+    QMap<int,Road>::const_iterator itr = mRoads.constBegin(), itr_end = mRoads.constEnd();
+    for(; itr != itr_end ; itr++)
     {
-        // To make it faster, first check something like :
-//        if(QVector2D(roadEnd - currentSegments.first()).length() > mDistSeparation
-//           && QVector2D(roadEnd - currentSegments.last()).length() > mDistSeparation)
-        const QVector<QPointF>& currentSegments = mRoads[i].segments;
-        bool isConnectedRoad = false;
-        QVector<int>& connectedRoadIDs = mNodes[mRoads[roadID].nodeID1].connectedRoadIDs;
-        for(int k=0 ; k<connectedRoadIDs.size() ; k++)
+        mCandidateSegments->insertRoad(itr->segments, itr.key(), itr->bounds);
+    }
+}
+
+bool StreetGraph::meetsAnotherRoadAndFindIntersection(RoadFront& front, const QVector<int>& ignoredRoadIDs,
+                                                      const QVector<RoadFront>& fronts,
+                                                      QPointF nextPosition) const
+{
+    // The road can't meet itself, nor the roads it starts from
+    QPointF roadEnd = mRoads.constFind(front.roadID)->segments.last();
+    float stepParameter = 1.0f;
+    QPointF intersectionPoint;
+    front.metRoadID = -1;
+    int segment = mCandidateSegments->findFirstCrossing(roadEnd, nextPosition, ignoredRoadIDs,
+                                                        stepParameter, intersectionPoint);
+    if(segment != -1)
+    {
+        front.metRoadID = mCandidateSegments->roadID(segment);
+        front.metSegmentEnd = mCandidateSegments->segmentEnd(segment);
+        front.intersectionPoint = intersectionPoint;
+        front.metRoadIsGrowing = false;
+    }
+    // The roads still growing aren't in the candidates, and change at each step
+    float stepLength = QVector2D(nextPosition - roadEnd).length();
+    for(int f=0 ; f<fronts.size() ; f++)
+    {
+        const RoadFront& other = fronts[f];
+        if(other.isDone || other.roadID == front.roadID || ignoredRoadIDs.contains(other.roadID))
+        {
+            continue;
+        }
+        const Road& otherRoad = *mRoads.constFind(other.roadID);
+        if(!segmentIntersectsRect(roadEnd, nextPosition, otherRoad.bounds))
         {
-            isConnectedRoad = isConnectedRoad || (i == connectedRoadIDs[k]);
+            continue;
         }
-        // If road isn't the one passed, or one connected to it
-        if(i != roadID && !isConnectedRoad && currentSegments.size() != 0 )
+        int segmentEnd = findPolylineCrossing(roadEnd, nextPosition, otherRoad.segments, intersectionPoint);
+        if(segmentEnd != -1)
         {
-            for(int j=1 ; j<currentSegments.size() ; j++)
+            float parameter = QVector2D(intersectionPoint - roadEnd).length()/stepLength;
+            if(parameter < stepParameter)
             {
-                // Find on which side of the current segments, the 2 points are
-                float sideOfLast = detPointLine(currentSegments[j-1], currentSegments[j], roadEnd);
-                float sideOfNext = detPointLine(currentSegments[j-1], currentSegments[j], nextPosition);
-                if(isFuzzyNull(sideOfNext))
-                {
-                    intersectionPoint = nextPosition;
-                }
-                // If road end point and next point are on different sides of the road
-                if(sideOfLast*sideOfNext < 0.0f)
+                stepParameter = parameter;
+                front.metRoadID = other.roadID;
+                front.metSegmentEnd = segmentEnd;
+                front.intersectionPoint = intersectionPoint;
+                front.metRoadIsGrowing = true;
+            }
+        }
+    }
+    return front.metRoadID != -1;
+}
+
+void StreetGraph::drawRoads(QPainter& painter, QSize imageSize, QRectF visibleRegion,
+                            const QHash<int,QRectF>* roadBounds) const
+{
+    // Draw the roads
+    forEachRoad([&](const RoadRecord& road)
+    {
+        // Skip the roads that are entirely outside of the visible region
+        if(roadBounds != NULL && !visibleRegion.isNull()
+                && !visibleRegion.intersects(roadBounds->value(road.ID)))
+        {
+            return;
+        }
+        for(int i=1 ; i < road.pointCount ; i++)
+        {
+            QPointF a = road.points[i-1];
+            QPointF b = road.points[i];
+            a.rx() *= imageSize.width()/mRegionSize.width();
+            a.ry() *= imageSize.height()/mRegionSize.height();
+            a.ry() = imageSize.height() - a.y();
+            b.rx() *= imageSize.width()/mRegionSize.width();
+            b.ry() *= imageSize.height()/mRegionSize.height();
+            b.ry() = imageSize.height() - b.y();
+            painter.drawLine(a,b);
+        }
+    });
+}
+
+bool StreetGraph::exportTiledImage(QString filename, QSize imageSize, int tileSize,
+                                   bool drawWater, bool drawTensors)
+{
+    if(mGenerationWatcher.isRunning() || mExportWatcher.isRunning())
+    {
+        qWarning()<<"exportTiledImage(): The street graph is being generated or exported";
+        return false;
+    }
+    if(!prepareTiledImageExport(imageSize, drawTensors))
+    {
+        return false;
+    }
+    mCancelRequested.store(0);
+    return writeTiledImage(filename, imageSize, tileSize, drawWater, drawTensors);
+}
+
+void StreetGraph::startTiledImageExport(QString filename, QSize imageSize, int tileSize,
+                                        bool drawWater, bool drawTensors)
+{
+    if(mGenerationWatcher.isRunning() || mExportWatcher.isRunning())
+    {
+        qWarning()<<"startTiledImageExport(): The street graph is being generated or exported";
+        return;
+    }
+    if(!prepareTiledImageExport(imageSize, drawTensors))
+    {
+        emit exportDone(false, false);
+        return;
+    }
+    mCancelRequested.store(0);
+    emit exportStarted();
+    mExportWatcher.setFuture(QtConcurrent::run(this, &StreetGraph::writeTiledImage, filename,
+                                               imageSize, tileSize, drawWater, drawTensors));
+}
+
+void StreetGraph::exportFinished()
+{
+    emit exportDone(mExportWatcher.result(), isGenerationCanceled());
+}
+
+bool StreetGraph::prepareTiledImageExport(QSize imageSize, bool drawTensors)
+{
+    if(mTensorField == NULL || !(mTensorField->isFieldFilled()))
+    {
+        qCritical()<<"exportTiledImage(): Tensor field is empty";
+        return false;
+    }
+    if(drawTensors)
+    {
+        // The glyphs are read from the level of the pyramid matching their spacing,
+        // brought up to date before the tiles draw them
+        int numberOfTensorsToDisplay = qMax(32, imageSize.width()/16);
+        mTensorField->updatePyramidLevel(mTensorField->getGlyphPyramidLevel(numberOfTensorsToDisplay));
+    }
+    return true;
+}
+
+bool StreetGraph::writeTiledImage(QString filename, QSize imageSize, int tileSize,
+                                  bool drawWater, bool drawTensors)
+{
+    StripImageWriter writer;
+    if(!writer.open(filename, imageSize))
+    {
+        qCritical()<<"exportTiledImage(): "<<writer.errorString();
+        return false;
+    }
+
+    // Bounding boxes of the roads, used to cull them per tile
+    QHash<int,QRectF> roadBounds;
+    forEachRoad([&roadBounds](const RoadRecord& road)
+    {
+        if(road.pointCount == 0)
+        {
+            return;
+        }
+        QPointF topLeft = road.points[0], bottomRight = road.points[0];
+        for(int i=1 ; i<road.pointCount ; i++)
+        {
+            topLeft.rx() = qMin(topLeft.x(), road.points[i].x());
+            topLeft.ry() = qMin(topLeft.y(), road.points[i].y());
+            bottomRight.rx() = qMax(bottomRight.x(), road.points[i].x());
+            bottomRight.ry() = qMax(bottomRight.y(), road.points[i].y());
+        }
+        // Points have no area, make sure intersects() still works
+        roadBounds.insert(road.ID, QRectF(topLeft, bottomRight).adjusted(-1e-3,-1e-3,1e-3,1e-3));
+    });
+
+    // The water layer is kept at the watermap resolution
+    // and scaled on the fly when drawing each tile
+    QImage waterLayer;
+    if(drawWater && mTensorField->isWatermapLoaded())
+    {
+        QImage watermap(mTensorField->getWatermapFilename());
+        if(!watermap.isNull())
+        {
+            waterLayer = QImage(watermap.size(), QImage::Format_ARGB32);
+            waterLayer.fill(Qt::transparent);
+            for(int i=0; i<watermap.height() ; i++)
+            {
+                for(int j=0; j<watermap.width() ; j++)
                 {
-                    // If taking the first closest one doesn't produce good results,
-                    // finish the loop and take the minimum
-                    QPointF intersection = computeIntersectionPoint(currentSegments[j-1], currentSegments[j], roadEnd, nextPosition);
-                    if(!intersection.isNull())
+                    if(qBlue(watermap.pixel(j,i)) > 0)
                     {
-                        intersectedRoadID = i;
-                        closestPointID = j;
-                        intersectionPoint = intersection;
-                        return true;
+                        waterLayer.setPixel(j,i, watermap.pixel(j,i) | 0xFF000000);
                     }
                 }
             }
         }
     }
-    intersectedRoadID = -1;
-    closestPointID = -1;
-    return false;
+
+    // Render one row of tiles at a time, in parallel, then
+    // hand the finished strip to the writer.
+    // Memory use only depends on the image width and the tile size.
+    int tilesPerRow = (imageSize.width() + tileSize - 1)/tileSize;
+    int stripCount = (imageSize.height() + tileSize - 1)/tileSize;
+    QVector<RasterTile> tiles(tilesPerRow);
+    for(int y=0 ; y<imageSize.height() ; y+=tileSize)
+    {
+        if(isGenerationCanceled())
+        {
+            writer.close();
+            QFile::remove(filename);
+            return false;
+        }
+        int stripHeight = qMin(tileSize, imageSize.height()-y);
+        for(int k=0 ; k<tilesPerRow ; k++)
+        {
+            int x = k*tileSize;
+            tiles[k].origin = QPoint(x,y);
+            tiles[k].image = QImage(qMin(tileSize, imageSize.width()-x), stripHeight,
+                                    QImage::Format_RGB32);
+        }
+        QtConcurrent::blockingMap(tiles, [&](RasterTile& tile)
+        {
+            renderImageTile(tile, imageSize, waterLayer, drawTensors, &roadBounds);
+        });
+
+        QImage strip(imageSize.width(), stripHeight, QImage::Format_RGB32);
+        for(int k=0 ; k<tilesPerRow ; k++)
+        {
+            const QImage& tileImage = tiles[k].image;
+            for(int i=0 ; i<stripHeight ; i++)
+            {
+                memcpy(strip.scanLine(i) + tiles[k].origin.x()*sizeof(QRgb),
+                       tileImage.constScanLine(i), tileImage.width()*sizeof(QRgb));
+            }
+        }
+        if(!writer.writeStrip(strip))
+        {
+            qCritical()<<"exportTiledImage(): "<<writer.errorString();
+            writer.close();
+            QFile::remove(filename);
+            return false;
+        }
+        emit exportProgress(y/tileSize + 1, stripCount);
+    }
+    if(!writer.close())
+    {
+        qCritical()<<"exportTiledImage(): "<<writer.errorString();
+        QFile::remove(filename);
+        return false;
+    }
+    return true;
+}
+
+bool StreetGraph::exportGeoJSON(QString filename) const
+{
+    BufferedFileWriter writer;
+    if(!writer.open(filename))
+    {
+        qCritical()<<"exportGeoJSON(): "<<writer.errorString();
+        return false;
+    }
+    QHash<int,int> nodeDegrees = computeNodeDegrees();
+
+    writer.write("{\"type\":\"FeatureCollection\",\"features\":[\n");
+    bool isFirstFeature = true;
+    // GeoJSON has no NaN or infinity: such roads and nodes are left out
+    int skippedFeatures = 0;
+    forEachRoad([&](const RoadRecord& road)
+    {
+        if(road.pointCount < 2)
+        {
+            return;
+        }
+        if(!isExportedRoad(road))
+        {
+            skippedFeatures++;
+            return;
+        }
+        if(!isFirstFeature)
+        {
+            writer.write(",\n");
+        }
+        isFirstFeature = false;
+        writer.write("{\"type\":\"Feature\",\"geometry\":{\"type\":\"LineString\",\"coordinates\":[");
+        for(int i=0 ; i<road.pointCount ; i++)
+        {
+            if(i != 0)
+            {
+                writer.write(',');
+            }
+            writer.write('[');
+            writer.writeReal(road.points[i].x());
+            writer.write(',');
+            writer.writeReal(road.points[i].y());
+            writer.write(']');
+        }
+        writer.write("]},\"properties\":{\"kind\":\"road\",\"id\":");
+        writer.writeInt(road.ID);
+        writer.write(",\"type\":");
+        writer.write(road.type == Principal ? "\"Principal\"" : "\"Secondary\"");
+        writer.write(",\"pathLength\":");
+        writer.writeReal(road.pathLength);
+        writer.write(",\"straightLength\":");
+        writer.writeReal(road.straightLength);
+        writer.write(",\"nodeID1\":");
+        writer.writeInt(road.nodeID1);
+        writer.write(",\"nodeID2\":");
+        writer.writeInt(road.nodeID2);
+        writer.write("}}");
+    });
+    forEachNode([&](const NodeRecord& node)
+    {
+        if(!isFinitePoint(node.position))
+        {
+            skippedFeatures++;
+            return;
+        }
+        if(!isFirstFeature)
+        {
+            writer.write(",\n");
+        }
+        isFirstFeature = false;
+        writer.write("{\"type\":\"Feature\",\"geometry\":{\"type\":\"Point\",\"coordinates\":[");
+        writer.writeReal(node.position.x());
+        writer.write(',');
+        writer.writeReal(node.position.y());
+        writer.write("]},\"properties\":{\"kind\":\"node\",\"id\":");
+        writer.writeInt(node.ID);
+        writer.write(",\"degree\":");
+        writer.writeInt(nodeDegrees.value(node.ID, 0));
+        writer.write("}}");
+    });
+    writer.write("\n]}\n");
+    if(skippedFeatures > 0)
+    {
+        qWarning()<<"exportGeoJSON():"<<skippedFeatures<<"roads or nodes with non-finite coordinates were left out";
+    }
+
+    if(!writer.close())
+    {
+        qCritical()<<"exportGeoJSON(): "<<writer.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool StreetGraph::exportSVG(QString filename) const
+{
+    BufferedFileWriter writer;
+    if(!writer.open(filename))
+    {
+        qCritical()<<"exportSVG(): "<<writer.errorString();
+        return false;
+    }
+    QHash<int,int> nodeDegrees = computeNodeDegrees();
+
+    // The document uses region coordinates, with the y axis flipped
+    // so that the origin is at the bottom left, like in the region
+    writer.write("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                 "<svg xmlns=\"http://www.w3.org/2000/svg\" viewBox=\"");
+    writer.writeReal(mBottomLeft.x());
+    writer.write(' ');
+    writer.writeReal(mBottomLeft.y());
+    writer.write(' ');
+    writer.writeReal(mRegionSize.width());
+    writer.write(' ');
+    writer.writeReal(mRegionSize.height());
+    writer.write("\">\n<style>"
+                 "polyline{fill:none;stroke-linecap:round;stroke-linejoin:round}"
+                 ".Principal{stroke:#000;stroke-width:");
+    writer.writeReal(mRegionSize.width()/256.0);
+    writer.write("}.Secondary{stroke:#444;stroke-width:");
+    writer.writeReal(mRegionSize.width()/512.0);
+    writer.write("}circle{fill:red}</style>\n<g transform=\"translate(0,");
+    writer.writeReal(2*mBottomLeft.y() + mRegionSize.height());
+    writer.write(") scale(1,-1)\">\n");
+
+    // SVG has no NaN or infinity either: such roads and nodes are left out
+    int skippedElements = 0;
+    forEachRoad([&writer, &skippedElements](const RoadRecord& road)
+    {
+        if(road.pointCount < 2)
+        {
+            return;
+        }
+        if(!isExportedRoad(road))
+        {
+            skippedElements++;
+            return;
+        }
+        writer.write("<polyline class=\"");
+        writer.write(road.type == Principal ? "Principal" : "Secondary");
+        writer.write("\" data-id=\"");
+        writer.writeInt(road.ID);
+        writer.write("\" data-path-length=\"");
+        writer.writeReal(road.pathLength, 3);
+        writer.write("\" data-straight-length=\"");
+        writer.writeReal(road.straightLength, 3);
+        writer.write("\" points=\"");
+        for(int i=0 ; i<road.pointCount ; i++)
+        {
+            if(i != 0)
+            {
+                writer.write(' ');
+            }
+            writer.writeReal(road.points[i].x(), 4);
+            writer.write(',');
+            writer.writeReal(road.points[i].y(), 4);
+        }
+        writer.write("\"/>\n");
+    });
+    double nodeRadius = mRegionSize.width()/400.0;
+    forEachNode([&writer, &nodeDegrees, &skippedElements, nodeRadius](const NodeRecord& node)
+    {
+        if(!isFinitePoint(node.position))
+        {
+            skippedElements++;
+            return;
+        }
+        writer.write("<circle data-id=\"");
+        writer.writeInt(node.ID);
+        writer.write("\" data-degree=\"");
+        writer.writeInt(nodeDegrees.value(node.ID, 0));
+        writer.write("\" cx=\"");
+        writer.writeReal(node.position.x(), 4);
+        writer.write("\" cy=\"");
+        writer.writeReal(node.position.y(), 4);
+        writer.write("\" r=\"");
+        writer.writeReal(nodeRadius, 4);
+        writer.write("\"/>\n");
+    });
+    writer.write("</g>\n</svg>\n");
+    if(skippedElements > 0)
+    {
+        qWarning()<<"exportSVG():"<<skippedElements<<"roads or nodes with non-finite coordinates were left out";
+    }
+
+    if(!writer.close())
+    {
+        qCritical()<<"exportSVG(): "<<writer.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool StreetGraph::saveStreetGraph(QString filename) const
+{
+    StreetGraphParameters parameters;
+    parameters.bottomLeft = mBottomLeft;
+    parameters.topRight = mTopRight;
+    parameters.separationDistance = mSeparationDistance;
+    parameters.seedInitMethod = mSeedInitMethod;
+    parameters.randomSeed = mRandomSeed;
+    parameters.fieldChecksum = (mTensorField != NULL) ? mTensorField->computeChecksum() : 0;
+    QString errorString;
+    bool saved = (mLoadedFile != NULL) ? writeStreetGraphFile(filename, parameters, *mLoadedFile, &errorString)
+                                       : writeStreetGraphFile(filename, parameters, mNodes, mRoads, &errorString);
+    if(!saved)
+    {
+        qCritical()<<"saveStreetGraph(): "<<errorString;
+        return false;
+    }
+    return true;
+}
+
+bool StreetGraph::loadStreetGraph(QString filename)
+{
+    StreetGraphFileView* view = new StreetGraphFileView();
+    if(!view->open(filename))
+    {
+        qCritical()<<"loadStreetGraph(): "<<view->errorString();
+        delete view;
+        return false;
+    }
+    if(!view->validate())
+    {
+        qCritical()<<"loadStreetGraph(): Corrupted street graph file";
+        delete view;
+        return false;
+    }
+    StreetGraphParameters parameters = view->parameters();
+    if(mTensorField != NULL && parameters.fieldChecksum != mTensorField->computeChecksum())
+    {
+        qWarning()<<"loadStreetGraph(): The street graph was generated from another tensor field";
+    }
+
+    clearStoredStreetGraph();
+    mBottomLeft = parameters.bottomLeft;
+    mTopRight = parameters.topRight;
+    mRegionSize.rwidth() = (mTopRight-mBottomLeft).x();
+    mRegionSize.rheight() = (mTopRight-mBottomLeft).y();
+    mFieldRegion = QRectF(mBottomLeft, mRegionSize);
+    mSeparationDistance = parameters.separationDistance;
+    mSeedInitMethod = parameters.seedInitMethod;
+    mRandomSeed = parameters.randomSeed;
+
+    // The nodes and roads are only copied out of the file once they are modified
+    mLoadedFile = view;
+    if(mTensorField != NULL)
+    {
+        mFieldVersion = mTensorField->getVersion();
+    }
+    drawStreetGraph(mDrawNodes, false);
+    return true;
+}
+
+void StreetGraph::copyLoadedStreetGraph()
+{
+    if(mLoadedFile == NULL)
+    {
+        return;
+    }
+    const StreetGraphFileView* view = mLoadedFile;
+    for(int k=0 ; k<view->nodeCount() ; k++)
+    {
+        const StreetGraphFileNode& record = view->node(k);
+        Node& node = mNodes[record.ID];
+        node.ID = record.ID;
+        node.position = QPointF(record.x, record.y);
+        const qint32* connectedNodeIDs = view->connectedNodeIDs(record);
+        node.connectedNodeIDs = QVector<int>(record.connectedNodeCount);
+        std::copy(connectedNodeIDs, connectedNodeIDs + record.connectedNodeCount,
+                  node.connectedNodeIDs.begin());
+        const qint32* connectedRoadIDs = view->connectedRoadIDs(record);
+        node.connectedRoadIDs = QVector<int>(record.connectedRoadCount);
+        std::copy(connectedRoadIDs, connectedRoadIDs + record.connectedRoadCount,
+                  node.connectedRoadIDs.begin());
+        mLastNodeID = qMax(mLastNodeID, node.ID);
+    }
+    for(int k=0 ; k<view->roadCount() ; k++)
+    {
+        const StreetGraphFileRoad& record = view->road(k);
+        Road& road = mRoads[record.ID];
+        road.ID = record.ID;
+        road.nodeID1 = record.nodeID1;
+        road.nodeID2 = record.nodeID2;
+        road.type = (RoadType)record.type;
+        road.straightLength = record.straightLength;
+        road.pathLength = record.pathLength;
+        const QPointF* points = view->roadPoints(record);
+        road.segments = QVector<QPointF>((int)record.pointCount);
+        std::copy(points, points + record.pointCount, road.segments.begin());
+        road.bounds = computeBoundingBox(road.segments);
+        mLastRoadID = qMax(mLastRoadID, road.ID);
+    }
+    delete mLoadedFile;
+    mLoadedFile = NULL;
+    rebuildPlanarGraph();
+    rebuildCandidateSegments();
+    rebuildOccupancyGrid();
+}
+
+QHash<int,int> StreetGraph::computeNodeDegrees() const
+{
+    QHash<int,int> degrees;
+    forEachRoad([&degrees](const RoadRecord& road)
+    {
+        if(isExportedRoad(road))
+        {
+            degrees[road.nodeID1]++;
+            degrees[road.nodeID2]++;
+        }
+    });
+    return degrees;
+}
+
+void StreetGraph::renderImageTile(RasterTile& tile, QSize imageSize, const QImage& waterLayer,
+                                  bool drawTensors, const QHash<int,QRectF>* roadBounds) const
+{
+    tile.image.fill(QColor::fromRgb(230,230,230));
+    QPainter painter(&tile.image);
+    painter.translate(-tile.origin);
+
+    // Pens are scaled so that the image looks like the 512x512 preview
+    float penScale = imageSize.width()/512.0f;
+    QPen penRoad(Qt::yellow);
+    penRoad.setWidthF(2*penScale);
+    QPen penRoadBlack(Qt::black);
+    penRoadBlack.setWidthF(4*penScale);
+    QPen penNode(Qt::red);
+    penNode.setWidthF(3*penScale);
+
+    QRectF visibleRect(tile.origin, tile.image.size());
+    if(!waterLayer.isNull())
+    {
+        painter.drawImage(QRectF(QPointF(0,0), imageSize), waterLayer);
+    }
+    if(drawTensors)
+    {
+        int numberOfTensorsToDisplay = qMax(32, imageSize.width()/16);
+        mTensorField->drawEigenVectors(painter, imageSize, visibleRect, true, true,
+                                       Qt::blue, Qt::red, numberOfTensorsToDisplay);
+    }
+
+    // Visible part of the tile in region coordinates, with
+    // a margin for the pen width
+    float margin = 4*penScale;
+    QRectF visibleRegion(QPointF((visibleRect.left()-margin)*mRegionSize.width()/imageSize.width(),
+                                 (imageSize.height()-visibleRect.bottom()-margin)*mRegionSize.height()/imageSize.height()),
+                         QPointF((visibleRect.right()+margin)*mRegionSize.width()/imageSize.width(),
+                                 (imageSize.height()-visibleRect.top()+margin)*mRegionSize.height()/imageSize.height()));
+
+    painter.setPen(penRoadBlack);
+    drawRoads(painter, imageSize, visibleRegion, roadBounds);
+    painter.setPen(penRoad);
+    drawRoads(painter, imageSize, visibleRegion, roadBounds);
+
+    if(mDrawNodes)
+    {
+        painter.setPen(penNode);
+        forEachNode([&](const NodeRecord& node)
+        {
+            if(!visibleRegion.contains(node.position))
+            {
+                return;
+            }
+            QPointF a = node.position;
+            a.rx() *= imageSize.width()/mRegionSize.width();
+            a.ry() *= imageSize.height()/mRegionSize.height();
+            a.ry() = imageSize.height() - a.y();
+            painter.drawPoint(a);
+        });
+    }
 }
 
-void StreetGraph::drawRoads(QPainter& painter, QSize imageSize)
+void StreetGraph::rebuildPlanarGraph()
 {
-    RoadMapIterator itr = mRoads.begin(), itr_end = mRoads.end();
+    copyLoadedStreetGraph();
+    mPlanarGraph->build(mNodes, mRoads);
+}
 
-    // Draw the roads
+void StreetGraph::rebuildOccupancyGrid()
+{
+    mOccupancyGrid.reset(QRectF(mBottomLeft, mTopRight), mSeparationDistance);
+    if(mTensorField == NULL || !(mTensorField->isFieldFilled()))
+    {
+        return;
+    }
+    // The family isn't stored, find it from the field along the first segment.
+    // The eigenvectors at the start of all the roads are fetched at once
+    QVector<int> roadIDs;
+    QVector<QPointF> startCells;
+    QMap<int,Road>::const_iterator itr = mRoads.constBegin(), itr_end = mRoads.constEnd();
     for(; itr != itr_end ; itr++)
     {
-        for(int i=1 ; i < itr->segments.size() ; i++)
+        if(itr->segments.size() >= 2)
         {
-            QPointF a = itr->segments[i-1];
-            QPointF b = itr->segments[i];
-            a.rx() *= imageSize.width()/mRegionSize.width();
-            a.ry() *= imageSize.height()/mRegionSize.height();
-            a.ry() = imageSize.height() - a.y();
-            b.rx() *= imageSize.width()/mRegionSize.width();
-            b.ry() *= imageSize.height()/mRegionSize.height();
-            b.ry() = imageSize.height() - b.y();
-            painter.drawLine(a,b);
+            roadIDs.push_back(itr.key());
+            startCells.push_back(positionToFieldCell(itr->segments.first()));
+        }
+    }
+    QVector<QVector2D> majorVectors(startCells.size()), minorVectors(startCells.size());
+    mTensorField->sampleEigenVectors(startCells.constData(), startCells.size(), true, majorVectors.data());
+    mTensorField->sampleEigenVectors(startCells.constData(), startCells.size(), false, minorVectors.data());
+    for(int k=0 ; k<roadIDs.size() ; k++)
+    {
+        const QVector<QPointF>& segments = mRoads[roadIDs[k]].segments;
+        QVector2D direction(segments[1]-segments[0]);
+        bool isMajor = qAbs(QVector2D::dotProduct(majorVectors[k], direction))
+                    >= qAbs(QVector2D::dotProduct(minorVectors[k], direction));
+        mOccupancyGrid.insertRoad(segments, roadIDs[k], isMajor);
+    }
+}
+
+QVector<QVector<QPointF> > StreetGraph::extractBlocks(double minArea, double maxArea) const
+{
+    QVector<QVector<QPointF> > blocks;
+    QVector<int> faces = mPlanarGraph->faceIndices(true);
+    for(int k=0 ; k<faces.size() ; k++)
+    {
+        double area = mPlanarGraph->face(faces[k]).area;
+        if(area >= minArea && area <= maxArea)
+        {
+            blocks.push_back(mPlanarGraph->facePolygon(faces[k], mRoads));
         }
     }
+    return blocks;
 }
 
 void StreetGraph::clearStoredStreetGraph()
 {
+    delete mLoadedFile;
+    mLoadedFile = NULL;
     mNodes.clear();
     mRoads.clear();
+    mPlanarGraph->clear();
+    mCandidateSegments->clear();
+    mOccupancyGrid.reset(QRectF(mBottomLeft, mTopRight), mSeparationDistance);
+    mFieldVersion = -1;
     mLastNodeID = 0;
     mLastRoadID = 0;
+    mPendingJunctions.clear();
 }
 
 void StreetGraph::setDrawNodes(bool drawNodes)
@@ -725,12 +2718,251 @@ void StreetGraph::setDrawNodes(bool drawNodes)
     }
 }
 
+void StreetGraph::actionExportStreetGraph()
+{
+    QString filename = QFileDialog::getSaveFileName(0, QString("Export Street Graph"), QString(),
+                                                    QString("Images (*.png *.tif *.tiff);;"
+                                                            "GeoJSON (*.geojson *.json);;"
+                                                            "SVG (*.svg);;"
+                                                            "Street graph (*.sgraph)"));
+    if(filename.isEmpty())
+    {
+        return;
+    }
+    QString suffix = QFileInfo(filename).suffix().toLower();
+    if(suffix == "geojson" || suffix == "json")
+    {
+        exportGeoJSON(filename);
+        return;
+    }
+    if(suffix == "svg")
+    {
+        exportSVG(filename);
+        return;
+    }
+    if(suffix == "sgraph")
+    {
+        saveStreetGraph(filename);
+        return;
+    }
+    bool ok = false;
+    int resolution = QInputDialog::getInt(0, QString("Export Street Graph"),
+                                          QString("Image width and height (pixels)"),
+                                          4096, 512, 32768, 512, &ok);
+    if(!ok)
+    {
+        return;
+    }
+    startTiledImageExport(filename, QSize(resolution,resolution), 512, true, false);
+}
+
+void StreetGraph::actionSimplifyStreetGraph()
+{
+    simplifyStreetGraph();
+    drawStreetGraph(mDrawNodes, false);
+}
+
+void StreetGraph::actionLoadStreetGraph()
+{
+    QString filename = QFileDialog::getOpenFileName(0, QString("Load Street Graph"), QString(),
+                                                    QString("Street graph (*.sgraph)"));
+    if(filename.isEmpty())
+    {
+        return;
+    }
+    loadStreetGraph(filename);
+}
+
 void StreetGraph::setSeparationDistance(double separationDistance)
 {
     mSeparationDistance = separationDistance;
 }
 
-bool StreetGraph::boundaryStoppingCondition(QPointF nextPosition)
+void StreetGraph::actionLoadSeparationMap()
+{
+    QString filename = QFileDialog::getOpenFileName(0, QString("Open Separation Map"));
+    if(filename.isEmpty())
+    {
+        return;
+    }
+    loadSeparationMap(filename);
+}
+
+bool StreetGraph::loadSeparationMap(QString filename)
+{
+    QImage separationMap(filename);
+    if(separationMap.isNull())
+    {
+        qCritical()<<"loadSeparationMap(): File "<<filename<<" not found";
+        return false;
+    }
+    mSeparationMap = separationMap;
+    return true;
+}
+
+float StreetGraph::separationDistanceAt(QPointF position) const
+{
+    if(mSeparationMap.isNull())
+    {
+        return mSeparationDistance;
+    }
+    // The map covers the region, its first row being the top of the region
+    int x = (int)((position.x()-mFieldRegion.left())/mFieldRegion.width()*mSeparationMap.width());
+    int y = (int)((position.y()-mFieldRegion.top())/mFieldRegion.height()*mSeparationMap.height());
+    x = qBound(0, x, mSeparationMap.width()-1);
+    y = mSeparationMap.height()-1 - qBound(0, y, mSeparationMap.height()-1);
+    float gray = qGray(mSeparationMap.pixel(x,y))/255.0f;
+    return (mMinSeparationRatio + (1.0f-mMinSeparationRatio)*gray)*mSeparationDistance;
+}
+
+float StreetGraph::waterDistanceAt(QPointF position) const
+{
+    if(mTensorField == NULL || !mTensorField->hasWaterDistance())
+    {
+        return std::numeric_limits<float>::max();
+    }
+    QSize fieldSize = mTensorField->getFieldSize();
+    int i, j;
+    positionToFieldIndex(position, i, j);
+    i = qBound(0, i, fieldSize.height()-1);
+    j = qBound(0, j, fieldSize.width()-1);
+    float cellSize = mFieldRegion.width()/(fieldSize.width()-1);
+    return mTensorField->getWaterDistance(i,j)*cellSize;
+}
+
+int BlockLabelGrid::cellIndex(QPointF position) const
+{
+    int i = (int)std::floor((position.y()-origin.y())/cellSize);
+    int j = (int)std::floor((position.x()-origin.x())/cellSize);
+    if(i < 0 || i >= height || j < 0 || j >= width)
+    {
+        return -1;
+    }
+    return i*width + j;
+}
+
+StreamlineTrace StreetGraph::traceStreamline(QPointF seed, bool growInMajorDirection,
+                                             bool growInOppositeDirection, int minLength) const
+{
+    float step = mFieldRegion.height()/100.0f; // Should be function of curvature
+    // With coarse tracing, read the coarsest level of the field pyramid
+    // that resolves the roads, if it was brought up to date
+    int level = tracingPyramidLevel();
+    while(level > 0 && !mTensorField->isPyramidLevelCurrent(level))
+    {
+        level--;
+    }
+    // Traces of an older field, or of a field placed elsewhere, are dropped
+    mTraceCache->setFieldVersion(mTensorField->getVersion(), mFieldRegion, step, level, mCoarseTracing);
+    TraceKey key = mTraceCache->key(seed, growInMajorDirection, growInOppositeDirection);
+    StreamlineTrace trace;
+    if(mTraceCache->find(key, trace))
+    {
+        if(trace.isComplete || trace.points.size()-1 >= minLength)
+        {
+            return trace;
+        }
+    }
+    else
+    {
+        trace.points.push_back(seed);
+        trace.isComplete = false;
+    }
+
+    // Resume from the last point: every earlier point was visited
+    LoopDetector loopDetector(step);
+    for(int k=0 ; k<trace.points.size()-1 ; k++)
+    {
+        loopDetector.insert(trace.points[k]);
+    }
+    QPointF currentPosition = trace.points.last();
+    trace.points.pop_back();
+    // The sampler is chosen once, so that analytic bases inline in the loop
+    switch(mTensorField->getAnalyticBasis())
+    {
+    case GridAnalyticBasis:
+        extendStreamline(trace, currentPosition, loopDetector,
+                         createAnalyticSampler(mTensorField->getGridBasis(), mFieldRegion),
+                         growInMajorDirection, growInOppositeDirection, minLength, step);
+        break;
+    case RadialAnalyticBasis:
+        extendStreamline(trace, currentPosition, loopDetector,
+                         createAnalyticSampler(mTensorField->getRadialBasis(), mFieldRegion),
+                         growInMajorDirection, growInOppositeDirection, minLength, step);
+        break;
+    case RotatingAnalyticBasis:
+        extendStreamline(trace, currentPosition, loopDetector,
+                         createAnalyticSampler(mTensorField->getRotatingBasis(), mFieldRegion),
+                         growInMajorDirection, growInOppositeDirection, minLength, step);
+        break;
+    default:
+    {
+        GridSampler sampler;
+        sampler.field = mTensorField;
+        sampler.region = mFieldRegion;
+        sampler.size = mTensorField->getFieldSize();
+        sampler.level = level;
+        sampler.isClosedForm = mCoarseTracing;
+        extendStreamline(trace, currentPosition, loopDetector, sampler,
+                         growInMajorDirection, growInOppositeDirection, minLength, step);
+        break;
+    }
+    }
+    trace.points.push_back(currentPosition);
+    mTraceCache->insert(key, trace);
+    return trace;
+}
+
+template<class Sampler>
+void StreetGraph::extendStreamline(StreamlineTrace& trace, QPointF& currentPosition, LoopDetector& loopDetector,
+                                   const Sampler& sampler, bool growInMajorDirection,
+                                   bool growInOppositeDirection, int minLength, float step) const
+{
+    while(!trace.isComplete && trace.points.size() < minLength)
+    {
+        QVector2D currentDirection;
+        if(!trace.points.isEmpty())
+        {
+            currentDirection = QVector2D(currentPosition-trace.points.last());
+        }
+        trace.points.push_back(currentPosition);
+        loopDetector.insert(currentPosition);
+        QVector4D eigenVectors;
+        bool isRegular = sampler.sample(currentPosition, eigenVectors);
+        QVector2D majorDirection;
+        if(growInMajorDirection)
+        {
+            majorDirection = getFirstVector(eigenVectors);
+        }
+        else
+        {
+            majorDirection = getSecondVector(eigenVectors);
+        }
+        // First condition is to not grow backwards
+        // Second condition is applicable only at the beginning.
+        // It allows to grow the road in the 2 opposite directions
+        if(QVector2D::dotProduct(majorDirection,currentDirection) < 0
+                || (trace.points.size() == 1 && growInOppositeDirection))
+        {
+            majorDirection *= -1;
+        }
+        QPointF nextPosition = currentPosition + (step*majorDirection).toPointF();
+        trace.isComplete = fieldBoundaryStoppingCondition(nextPosition)
+                        || !isRegular
+                        || loopStoppingCondition(nextPosition,loopDetector)
+                        || trace.points.size() >= TRACE_MAX_LENGTH;
+        currentPosition = nextPosition;
+    }
+}
+
+void StreetGraph::positionToFieldIndex(QPointF position, int& i, int& j) const
+{
+    QSize fieldSize = mTensorField->getFieldSize();
+    i = round((position.y()-mFieldRegion.top())/mFieldRegion.height()*(fieldSize.height()-1));
+    j = round((position.x()-mFieldRegion.left())/mFieldRegion.width()*(fieldSize.width()-1));
+}
+
+bool StreetGraph::boundaryStoppingCondition(QPointF nextPosition) const
 {
     if(nextPosition.x() <= mBottomLeft.x()
         || nextPosition.x() >= mTopRight.x()
@@ -742,69 +2974,117 @@ bool StreetGraph::boundaryStoppingCondition(QPointF nextPosition)
     return false;
 }
 
-bool StreetGraph::degeneratePointStoppingCondition(int i, int j)
+bool StreetGraph::fieldBoundaryStoppingCondition(QPointF nextPosition) const
 {
-    if(isDegenerate(mTensorField->getTensor(i,j)))
+    // Tiles trace their streamlines over the whole field
+    if(nextPosition.x() <= mFieldRegion.left()
+        || nextPosition.x() >= mFieldRegion.right()
+        || nextPosition.y() <= mFieldRegion.top()
+        || nextPosition.y() >= mFieldRegion.bottom())
     {
         return true;
     }
     return false;
 }
 
-bool StreetGraph::loopStoppingCondition(QPointF nextPosition, const QVector<QPointF>& segments)
+bool StreetGraph::degeneratePointStoppingCondition(int i, int j) const
 {
-    // TODO : Look for a better way to compare
-    // It needs a larger span (maybe function of dSeperation)
-    if(isFuzzyEqual(nextPosition.x(),segments.first().x())
-       && isFuzzyEqual(nextPosition.y(),segments.first().y()))
+    if(isDegenerate(mTensorField->getTensor(i,j)))
     {
         return true;
     }
     return false;
 }
 
-bool StreetGraph::exceedingLengthStoppingCondition(const QVector<QPointF>& segments)
+bool StreetGraph::shorelineStoppingCondition(QPointF nextPosition) const
+{
+    // Stop before entering the water, or the setback band along the shore
+    return waterDistanceAt(nextPosition) <= mShoreSetback;
+}
+
+bool StreetGraph::loopStoppingCondition(QPointF nextPosition, const LoopDetector& loopDetector) const
 {
-    if(computePathLength(segments) > mSeparationDistance)
+    // Returning to the origin, or to any other earlier point of the road
+    return loopDetector.isApproachingEarlierPoint(nextPosition);
+}
+
+bool StreetGraph::exceedingLengthStoppingCondition(float pathLength, QPointF start) const
+{
+    if(pathLength > separationDistanceAt(start))
     {
         return true;
     }
     return false;
 }
 
-bool StreetGraph::exceedingDensityStoppingCondition()
+bool StreetGraph::exceedingDensityStoppingCondition(QPointF nextPosition, bool isMajor,
+                                                    const QVector<int>& ignoredRoadIDs) const
 {
-    Q_UNIMPLEMENTED();
-    return false;
+    float testDistance = mDensityTestRatio*separationDistanceAt(nextPosition);
+    return mOccupancyGrid.hasSampleWithin(nextPosition, testDistance, isMajor, ignoredRoadIDs);
 }
 
-std::ostream& operator<<(std::ostream& out, const Road r)
+std::ostream& operator<<(std::ostream& out, const Road& r)
 {
     out<<"Road type = ";
     out<<(r.type == Principal ? "Principal" : "Secondary");
-    out<<std::endl;
-    out<<"Path = ("<<r.segments.size()<<" points)"<<std::endl;
+    out<<'\n';
+    out<<"Path = ("<<r.segments.size()<<" points)\n";
     QVector<QPointF>::const_iterator it = r.segments.begin(), it_end = r.segments.end();
     for(; it != it_end ; it++)
     {
-        out<<"("<<it->x()<<","<<it->y()<<")"<<std::endl;
+        out<<"("<<it->x()<<","<<it->y()<<")\n";
     }
     return out;
 }
 
-std::ostream& operator<<(std::ostream& out, const Node n)
+std::ostream& operator<<(std::ostream& out, const Node& n)
 {
-    out<<"Node position = "<<n.position<<std::endl;
-    out<<"Number of connected roads = "<<n.connectedRoadIDs.size()<<std::endl;
+    out<<"Node position = "<<n.position<<'\n';
+    out<<"Number of connected roads = "<<n.connectedRoadIDs.size()<<'\n';
     return out;
 }
 
 std::ostream& operator<<(std::ostream& out, const QPointF p)
 {
-    out<<"("<<p.x()<<","<<p.y()<<")"<<std::endl;
+    out<<"("<<p.x()<<","<<p.y()<<")\n";
     return out;
 }
 
+void appendRoadPoint(Road& road, QPointF point)
+{
+    if(road.segments.isEmpty())
+    {
+        road.bounds = QRectF(point, QSizeF(0,0));
+    }
+    else
+    {
+        road.bounds.setLeft(qMin(road.bounds.left(), point.x()));
+        road.bounds.setRight(qMax(road.bounds.right(), point.x()));
+        road.bounds.setTop(qMin(road.bounds.top(), point.y()));
+        road.bounds.setBottom(qMax(road.bounds.bottom(), point.y()));
+    }
+    road.segments.push_back(point);
+}
+
+QRectF computeBoundingBox(const QVector<QPointF>& segments)
+{
+    if(segments.isEmpty())
+    {
+        return QRectF();
+    }
+    qreal left = segments[0].x(), right = left;
+    qreal top = segments[0].y(), bottom = top;
+    for(int i=1 ; i<segments.size() ; i++)
+    {
+        left = qMin(left, segments[i].x());
+        right = qMax(right, segments[i].x());
+        top = qMin(top, segments[i].y());
+        bottom = qMax(bottom, segments[i].y());
+    }
+    return QRectF(QPointF(left, top), QPointF(right, bottom));
+}
+
 float computePathLength(const QVector<QPointF>& segments)
 {
     float length = 0;
@@ -820,6 +3100,206 @@ float computeStraightLength(const QVector<QPointF>& segments)
     return QVector2D(segments[0]-segments[segments.size()-1]).length();
 }
 
+bool isFinitePoint(QPointF point)
+{
+    return std::isfinite(point.x()) && std::isfinite(point.y());
+}
+
+bool isFinitePolyline(const QVector<QPointF>& segments)
+{
+    for(int i=0 ; i<segments.size() ; i++)
+    {
+        if(!isFinitePoint(segments[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool regionContains(const QVector<QRectF>& region, QPointF point)
+{
+    for(int r=0 ; r<region.size() ; r++)
+    {
+        if(region[r].contains(point))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool isExportedRoad(const RoadRecord& road)
+{
+    if(road.pointCount < 2)
+    {
+        return false;
+    }
+    for(int i=0 ; i<road.pointCount ; i++)
+    {
+        if(!isFinitePoint(road.points[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void simplifyPolyline(QVector<QPointF>& points, float tolerance)
+{
+    int n = points.size();
+    if(n < 3)
+    {
+        return;
+    }
+    // Iterative Douglas-Peucker: keep the farthest point of each span
+    // from the chord joining its ends, until all the points of the span
+    // are within tolerance of the chord
+    QVector<bool> keep(n, false);
+    keep[0] = true;
+    keep[n-1] = true;
+    QVector<QPair<int,int> > spans;
+    spans.push_back(qMakePair(0, n-1));
+    float squaredTolerance = tolerance*tolerance;
+    while(!spans.isEmpty())
+    {
+        int first = spans.last().first;
+        int last = spans.last().second;
+        spans.removeLast();
+        QPointF A = points[first];
+        QPointF AB = points[last] - A;
+        float squaredLength = QPointF::dotProduct(AB,AB);
+        float maxSquaredDistance = 0;
+        int farthest = -1;
+        for(int k=first+1 ; k<last ; k++)
+        {
+            QPointF AP = points[k] - A;
+            // Distance to the segment, not the line, so that
+            // U-turns aren't flattened
+            float t = 0;
+            if(squaredLength > 0)
+            {
+                t = qBound(0.0f, (float)(QPointF::dotProduct(AP,AB)/squaredLength), 1.0f);
+            }
+            QPointF d = AP - t*AB;
+            float squaredDistance = QPointF::dotProduct(d,d);
+            if(squaredDistance > maxSquaredDistance)
+            {
+                maxSquaredDistance = squaredDistance;
+                farthest = k;
+            }
+        }
+        if(farthest != -1 && maxSquaredDistance > squaredTolerance)
+        {
+            keep[farthest] = true;
+            spans.push_back(qMakePair(first, farthest));
+            spans.push_back(qMakePair(farthest, last));
+        }
+    }
+    int count = 0;
+    for(int k=0 ; k<n ; k++)
+    {
+        if(keep[k])
+        {
+            points[count++] = points[k];
+        }
+    }
+    points.resize(count);
+}
+
+int findClosestSegment(const QVector<QPointF>& polyline, QPointF point, float& distance)
+{
+    int closestSegmentEnd = -1;
+    distance = std::numeric_limits<float>::max();
+    for(int j=1 ; j<polyline.size() ; j++)
+    {
+        QVector2D AB(polyline[j] - polyline[j-1]);
+        QVector2D AM(point - polyline[j-1]);
+        float lengthSquared = AB.lengthSquared();
+        float t = (lengthSquared > 0.0f) ? qBound(0.0f, QVector2D::dotProduct(AM, AB)/lengthSquared, 1.0f) : 0.0f;
+        float segmentDistance = (AM - t*AB).length();
+        if(segmentDistance < distance)
+        {
+            distance = segmentDistance;
+            closestSegmentEnd = j;
+        }
+    }
+    return closestSegmentEnd;
+}
+
+int findPolylineCrossing(QPointF A, QPointF B, const QVector<QPointF>& polyline,
+                         QPointF& intersectionPoint)
+{
+    for(int j=1 ; j<polyline.size() ; j++)
+    {
+        // A and B must be on different sides of the segment
+        float sideOfA = detPointLine(polyline[j-1], polyline[j], A);
+        float sideOfB = detPointLine(polyline[j-1], polyline[j], B);
+        if(sideOfA*sideOfB < 0.0f)
+        {
+            QPointF intersection = computeIntersectionPoint(polyline[j-1], polyline[j], A, B);
+            if(!intersection.isNull())
+            {
+                intersectionPoint = intersection;
+                return j;
+            }
+        }
+    }
+    return -1;
+}
+
+bool segmentIntersectsRect(QPointF A, QPointF B, QRectF rect)
+{
+    return clipSegmentToRect(A, B, rect);
+}
+
+bool clipSegmentToRect(QPointF& A, QPointF& B, QRectF rect)
+{
+    // Liang-Barsky: clip the parameter range of AB by each side of the rectangle
+    double t0 = 0, t1 = 1;
+    QPointF AB = B - A;
+    double p[4] = {-AB.x(), AB.x(), -AB.y(), AB.y()};
+    double q[4] = {A.x()-rect.left(), rect.right()-A.x(), A.y()-rect.top(), rect.bottom()-A.y()};
+    for(int k=0 ; k<4 ; k++)
+    {
+        if(p[k] == 0)
+        {
+            // Parallel to this side, and outside of it
+            if(q[k] < 0)
+            {
+                return false;
+            }
+        }
+        else
+        {
+            double t = q[k]/p[k];
+            if(p[k] < 0)
+            {
+                t0 = qMax(t0, t);
+            }
+            else
+            {
+                t1 = qMin(t1, t);
+            }
+            if(t0 > t1)
+            {
+                return false;
+            }
+        }
+    }
+    // The ends inside the rectangle are left untouched
+    QPointF start = A;
+    if(t0 > 0)
+    {
+        A = start + t0*AB;
+    }
+    if(t1 < 1)
+    {
+        B = start + t1*AB;
+    }
+    return true;
+}
+
 float det2D(QPointF V1, QPointF V2)
 {
     return V1.x()*V2.y() - V1.y()*V2.x();
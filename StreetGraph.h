@@ -5,10 +5,24 @@
 #include <QPointF>
 #include <QSize>
 #include <QMap>
+#include <QHash>
+#include <QSet>
+#include <QImage>
+#include <QPolygonF>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QSharedPointer>
 
 #include "TensorField.h"
+#include "OccupancyGrid.h"
+#include "TraceCache.h"
 
 struct Node;
+class HalfEdgeGraph;
+class LoopDetector;
+class SegmentBuffer;
+class StreetGraphFileView;
 
 enum RoadType {
     Principal,
@@ -24,6 +38,8 @@ struct Road {
     RoadType type;
     float straightLength;
     float pathLength;
+    // Bounding box of the points
+    QRectF bounds;
 };
 
 // Structure to store an intersection (node)
@@ -34,6 +50,109 @@ struct Node {
     QVector<int> connectedRoadIDs;
 };
 
+// Road read from the stored roads, or in place from a loaded street graph file
+struct RoadRecord {
+    int ID;
+    int nodeID1;
+    int nodeID2;
+    RoadType type;
+    float straightLength;
+    float pathLength;
+    const QPointF* points;
+    int pointCount;
+};
+
+// Node read from the stored nodes, or in place from a loaded street graph file
+struct NodeRecord {
+    int ID;
+    QPointF position;
+};
+
+// Grid labelling the region cells with the block they belong to.
+// Cells covered by a road have the label BLOCK_LABEL_ROAD
+struct BlockLabelGrid {
+    QPointF origin;
+    float cellSize;
+    int width;
+    int height;
+    QVector<int> labels;
+    QVector<int> roadIDs;
+    // Returns the index of the cell containing the position, or -1 if outside
+    int cellIndex(QPointF position) const;
+};
+
+#define BLOCK_LABEL_ROAD -1
+#define BLOCK_LABEL_NONE -2
+
+// Number of steps first traced from a seed. Roads are usually shorter
+#define TRACE_INITIAL_LENGTH 64
+// Maximum number of steps of a trace
+#define TRACE_MAX_LENGTH 1000
+
+// Road being grown by the lockstep scheduler. Its growth is suspended
+// after a few steps, and resumed at the next round
+struct RoadFront {
+    int roadID;
+    int startNodeID;
+    bool isMajor;
+    bool isOpposite;
+    bool useExceedLength;
+    // Streamline followed by the road, and index in it of the next point
+    StreamlineTrace trace;
+    int step;
+    // Length of the road grown so far
+    float pathLength;
+    // Holds whether the road stopped growing, and why
+    bool isDone;
+    bool tooLong;
+    // Road met, -1 if none, the end of its crossed segment, and the crossing
+    int metRoadID;
+    int metSegmentEnd;
+    QPointF intersectionPoint;
+    // Holds whether the met road was still growing
+    bool metRoadIsGrowing;
+};
+
+// Junction of a road with a road that was still growing.
+// The met road is split at the node once it stops growing
+struct PendingJunction {
+    int nodeID;
+    int segmentEnd;
+};
+
+// Structure to store a city block enclosed by principal roads,
+// and the secondary roads grown inside it.
+// Nodes and roads IDs are indices in the block containers.
+struct StreetBlock {
+    int label;
+    int cellCount;
+    QVector<int> boundaryRoadIDs;
+    // Area covered by the cells of the block
+    QRectF bounds;
+    QVector<QPointF> seeds;
+    QVector<Node> nodes;
+    QVector<Road> roads;
+    // Block nodes ending on a boundary road, with the ID of that road
+    QHash<int,int> junctions;
+};
+
+// Structure to store a tile of a street graph generated in tiles.
+// Nodes and roads IDs are indices in the tile containers
+struct StreetGraphTile {
+    // Part of the region the tile is responsible for, without the overlap
+    QRectF core;
+    QVector<Node> nodes;
+    QVector<Road> roads;
+    // Holds whether each node is where a road leaves the core
+    QVector<bool> isSeamNode;
+};
+
+// Structure to store a tile of an image rendered in tiles
+struct RasterTile {
+    QPoint origin;
+    QImage image;
+};
+
 // Convenience typedefs
 typedef QMap<int,Node>::iterator NodeMapIterator;
 typedef QMap<int,Road>::iterator RoadMapIterator;
@@ -44,6 +163,7 @@ class StreetGraph : public QObject
 public:
     // Construct a StreetGraph object within limits passed
     explicit StreetGraph(QPointF bottomLeft, QPointF topRight, TensorField * field, float distSeparation, QObject *parent = 0);
+    ~StreetGraph();
 
     // Create a random seed list
     void createRandomSeedList(int numberOfSeeds, bool append);
@@ -54,6 +174,10 @@ public:
     // Create a list of seeds spread in a grid pattern on the region
     int createGridSeedList(double separationDistance, bool append);
 
+    // Create a list of seeds along the separatrices leaving the degenerate points
+    // of the field, separationDistance apart. Returns the number of seeds added
+    int createSeparatrixSeedList(double separationDistance, bool append);
+
     // Create a list of seeds following the method asked by the user in the UI
     void generateSeedListWithUIMethod();
 
@@ -71,59 +195,309 @@ public:
     // 2 : Checks for segments being too long. Replants seeds
     // 3 : Seeds grow in both directions
 
+    // Grow the roads of all the seeds together, a few steps per round, so that
+    // no road claims the whole region. New roads start from the seed farthest
+    // from the existing roads
+    void computeLockstepStreetGraph(bool clearStorage);
+
+    // Compute principal roads with a large separation distance, then
+    // secondary roads inside each block they enclose, blocks in parallel
+    void computeHierarchicalStreetGraph(bool clearStorage);
+
+    // Remove the roads passing through the field cells edited since the street graph
+    // was grown, and grow new roads in these areas only, connected to the remaining ones.
+    // The areas are seeded and grown like a full generation
+    void regenerateDirtyRegion();
+
+    // Split the region into overlapping tiles, generate them concurrently,
+    // then merge them, stitching the roads across the seams
+    void computeTiledStreetGraph(bool clearStorage);
+
     // Grow a road until it leaves the field, is too long, or other stopping condition
     Node& growRoad(Road& road, Node& startNode, bool growInMajorDirection, bool growInOppositeDirection, bool useExceedLenStopCond);
 
     // Grow a road and connects it to the first road it crosses
     Node& growRoadAndConnect(Road& road, Node& startNode, bool growInMajorDirection, bool growInOppositeDirection, bool useExceedLenStopCond);
 
+    // Simplify every stored road in parallel, with the current tolerance
+    void simplifyStreetGraph();
+    // Enable or disable the simplification of roads when they are finalized
+    void setSimplifyRoads(bool simplify) {mSimplifyRoads = simplify;}
+    // Set the simplification tolerance, as a fraction of the separation distance
+    void setSimplificationRatio(float ratio) {mSimplificationRatio = ratio;}
+
     // Draw an image with major hyperstreamlines
     QPixmap drawStreetGraph(bool showNodes, bool showSeeds);
 
-    // Draw the road network using the painter
-    void drawRoads(QPainter& painter, QSize imageSize);
+    // Draw the road network using the painter.
+    // If roadBounds is passed, the roads whose bounding box doesn't
+    // intersect visibleRegion (in region coordinates) are skipped
+    void drawRoads(QPainter& painter, QSize imageSize, QRectF visibleRegion = QRectF(),
+                   const QHash<int,QRectF>* roadBounds = NULL) const;
+
+    // Stream the roads (as LineStrings) and the nodes (as Points)
+    // to a GeoJSON file. Roads and nodes with non-finite coordinates are left out
+    bool exportGeoJSON(QString filename) const;
+    // Stream the roads (as polylines) and the nodes (as circles)
+    // to an SVG file
+    bool exportSVG(QString filename) const;
+
+    // Save the nodes, the roads and the generation parameters
+    // to a binary street graph file
+    bool saveStreetGraph(QString filename) const;
+    // Replace the stored street graph by the one saved in a file,
+    // and restore the generation parameters. The file stays mapped and is read
+    // in place to draw, export and save the graph, until the graph is modified
+    bool loadStreetGraph(QString filename);
+
+    // Render the street graph, and optionally the water and the tensor field,
+    // in an image of any size, written to disk strip by strip.
+    // Tiles of tileSize x tileSize pixels are rendered in parallel,
+    // so memory use doesn't depend on the image height.
+    // The format (PNG or TIFF) is chosen from the filename suffix
+    bool exportTiledImage(QString filename, QSize imageSize, int tileSize,
+                          bool drawWater, bool drawTensors);
+    // Same as exportTiledImage(), in the background. The export reports its
+    // progress, can be canceled with cancelGeneration(), and fires exportDone()
+    void startTiledImageExport(QString filename, QSize imageSize, int tileSize,
+                               bool drawWater, bool drawTensors);
+
+    // Returns the half-edge representation of the stored street graph.
+    // Its bounded faces are the city blocks
+    const HalfEdgeGraph& planarGraph() const {return *mPlanarGraph;}
+    // Build the half-edge representation again from the stored nodes and roads
+    void rebuildPlanarGraph();
+    // Returns the polygons of the city blocks whose area is within [minArea, maxArea].
+    // A loaded graph has no planar graph until rebuildPlanarGraph() is called
+    QVector<QVector<QPointF> > extractBlocks(double minArea, double maxArea) const;
 
     // Clear the stored street graph (Nodes, Roads)
     // Warning: Doesn't clear the seed list
     void clearStoredStreetGraph();
 
+    // Load an image scaling the separation distance over the region:
+    // black areas are the densest, white areas use the separation distance
+    bool loadSeparationMap(QString filename);
+    // Use the separation distance everywhere
+    void clearSeparationMap() {mSeparationMap = QImage();}
+    // Returns the separation distance between roads at the position
+    float separationDistanceAt(QPointF position) const;
+
+    // Returns the signed distance from the position to the water of the watermap,
+    // negative in the water. Returns the largest float if there is no watermap
+    float waterDistanceAt(QPointF position) const;
+
     // Set the tensor field to compute street graph from
     void setTensorField(TensorField * field) {mTensorField = field;}
 
+    // Returns whether the street graph is being generated in the background
+    bool isGenerating() const;
+    // Returns whether an image is being exported in the background
+    bool isExporting() const;
+    // Returns whether the running generation or export has been asked to stop.
+    // Checked by the generation loops between seeds, and by the export between strips
+    bool isGenerationCanceled() const;
+
 signals:
 
     // Fired when a new image is drawn
     void newStreetGraphImage(QPixmap);
+    // Fired when a generation starts in the background, with the region it covers
+    void generationStarted(QRectF region);
+    // Fired from the generation thread with the roads completed since the last batch,
+    // in region coordinates
+    void newRoads(QVector<QPolygonF> roads);
+    // Fired from the generation thread to report its progress
+    void generationProgress(int value, int maximum);
+    // Fired when the generation is over and the final image has been drawn
+    void generationDone(bool canceled);
+    // Fired when an image export starts in the background
+    void exportStarted();
+    // Fired from the export thread after each strip of the image
+    void exportProgress(int value, int maximum);
+    // Fired when the background export is over. The file is removed
+    // if the export failed or was canceled
+    void exportDone(bool succeeded, bool canceled);
 
 public slots:
 
-    // Main function : compute and draw the street graph
+    // Main function : compute and draw the street graph, in the background
     void generateStreetGraph();
+    // Update the street graph after tensor field edits, and draw it.
+    // Only the edited areas are grown again when possible
+    void updateStreetGraph();
+    // Simplify the stored roads and draw the street graph again
+    void actionSimplifyStreetGraph();
+    // Ask the running generation or image export to stop as soon as possible
+    void cancelGeneration();
+    // Get a filename and export the street graph as an image,
+    // a vector file or a binary street graph file
+    void actionExportStreetGraph();
+    // Get a filename and load a binary street graph file
+    void actionLoadStreetGraph();
     // Change method to initialize seeds
     void changeSeedInitMethod(int index) {mSeedInitMethod = index;}
     // Set the variable for drawing nodes or not
     void setDrawNodes(bool drawNodes);
     // Set the density variable
     void setSeparationDistance(double separationDistance);
+    // Get a filename and load a separation map
+    void actionLoadSeparationMap();
+    // Set whether secondary roads are generated inside principal road blocks
+    void setGenerateSecondaryRoads(bool generate) {mGenerateSecondaryRoads = generate;}
+    // Set whether the street graph is generated in tiles
+    void setTiledGeneration(bool tiled) {mTiledGeneration = tiled;}
+    // Set whether the roads of all the seeds grow together
+    void setLockstepGrowth(bool lockstep) {mLockstepGrowth = lockstep;}
+    // Set whether the roads are traced on a coarser level of the field pyramid,
+    // matching the scale of the steps, instead of the field itself
+    void setCoarseTracing(bool coarse) {mCoarseTracing = coarse;}
+    // Set the distance kept between the roads and the water
+    void setShoreSetback(double shoreSetback) {mShoreSetback = shoreSetback;}
+
+private slots:
+
+    // Draw the street graph once the background generation is over
+    void generationFinished();
+    // Report the end of the background export
+    void exportFinished();
 
 private:
 
+    // Run the generation in another thread, unless one is already running
+    void startGeneration(bool onlyDirtyRegion);
+    // Check that an image can be exported, and bring the tensor field up to date
+    // for it. Runs in the thread the field belongs to
+    bool prepareTiledImageExport(QSize imageSize, bool drawTensors);
+    // Render the tiles and write the image, strip by strip.
+    // Stops and removes the file if the export is canceled
+    bool writeTiledImage(QString filename, QSize imageSize, int tileSize,
+                         bool drawWater, bool drawTensors);
+    // Generate the whole street graph, or only the dirty region.
+    // Runs in the generation thread
+    void runGeneration(bool onlyDirtyRegion);
+    // Emit the roads created since the last batch, and the progress.
+    // Unless force is true, batches are sent at most every 100 ms.
+    // Only the roads up to lastRoadID are sent, -1 for all of them
+    void streamNewRoads(int progress, int maximum, bool force, int lastRoadID = -1);
+    // Generate the roads of a tile, clipped to its core. Only reads the shared state,
+    // so tiles can be generated concurrently
+    void generateTile(StreetGraphTile& tile, float overlap) const;
+    // Give a street graph generating a part of this one (tile, block)
+    // the same field, trace cache and growth parameters
+    void copyGrowthParameters(StreetGraph& graph) const;
+    // Grow the roads of the seeds from firstSeed on, one seed after the other,
+    // or all of them together with lockstep growth.
+    // Only the seeds inside seedRegion are grown, when it isn't empty
+    void growSeeds(int firstSeed, const QVector<QRectF>& seedRegion = QVector<QRectF>());
+    void growSeedsInLockstep(int firstSeed, const QVector<QRectF>& seedRegion = QVector<QRectF>());
+    // Add a node to a tile, or returns the one already added for nodeID
+    // (-1 for a seam node). Returns its index
+    int addTileNode(StreetGraphTile& tile, QPointF position, int nodeID,
+                    QHash<int,int>& nodeIndices) const;
+    // Create a node on the seed, and grow 2 roads from it in opposite directions
+    void growRoadsFromSeed(QPointF seed, bool majorGrowth);
+    // Create a node on the seed, and start 2 fronts from it in opposite directions.
+    // Returns false if the seed is too close to a parallel road or to the water
+    bool startFrontsFromSeed(QPointF seed, bool majorGrowth, QVector<RoadFront>& fronts);
+    // Prepare the growth of a road from its start node
+    RoadFront startFront(int roadID, int startNodeID, bool growInMajorDirection,
+                         bool growInOppositeDirection, bool useExceedLenStopCond);
+    // Grow a road by at most stepCount steps. Crossings are searched in the candidate
+    // segments, and in the roads of the fronts still growing.
+    // Returns whether the road stopped growing
+    bool advanceFront(RoadFront& front, int stepCount, const QVector<RoadFront>& fronts);
+    // Connect a road that stopped growing to the road it met, or end it on a new node.
+    // Returns the ID of its end node
+    int finishFront(RoadFront& front);
+    // Split a road that just stopped growing at the junctions other roads made
+    // with it, and finalize its parts
+    void resolvePendingJunctions(int roadID);
+    // Returns the priority of a seed: its distance to the closest road
+    float seedPriority(QPointF seed) const;
+    // Remove a road, and the nodes it leaves without roads
+    void removeRoad(int roadID);
+    // Sample every stored road in the occupancy grid again
+    void rebuildOccupancyGrid();
+    // Returns the area of the region covered by a rectangle of field cells
+    QRectF fieldCellsToRegion(QRect cells) const;
+    // Returns the position of a point given in field cells (x = j, y = i)
+    QPointF fieldCellToPosition(QPointF cell) const;
+    // Returns the position in field cells (x = j, y = i) of a point
+    QPointF positionToFieldCell(QPointF position) const;
+    // Returns the level of the field pyramid the roads are traced on: the one
+    // matching the scale of the traces with coarse tracing, else the field itself
+    int tracingPyramidLevel() const;
+    // Returns the streamline of the eigen vectors from the seed, only stopped by
+    // the field, with at least minLength steps unless it's complete.
+    // Comes from the trace cache when the seed was traced on the same field
+    StreamlineTrace traceStreamline(QPointF seed, bool growInMajorDirection,
+                                    bool growInOppositeDirection, int minLength) const;
+    // Step the trace from currentPosition until it is complete or minLength
+    // points long, sampling the eigenvectors with the sampler
+    template<class Sampler>
+    void extendStreamline(StreamlineTrace& trace, QPointF& currentPosition, LoopDetector& loopDetector,
+                          const Sampler& sampler, bool growInMajorDirection,
+                          bool growInOppositeDirection, int minLength, float step) const;
+    // Returns the indices of the tensor field cell containing the position
+    void positionToFieldIndex(QPointF position, int& i, int& j) const;
     // 1st condition: Reaching boundary
-    bool boundaryStoppingCondition(QPointF nextPosition);
+    bool boundaryStoppingCondition(QPointF nextPosition) const;
+    // Check if a position is out of the tensor field
+    bool fieldBoundaryStoppingCondition(QPointF nextPosition) const;
     // 2nd condition: Reaching a degenerate point
-    bool degeneratePointStoppingCondition(int i, int j);
-    // 3rd condition: Returning to origin
-    bool loopStoppingCondition(QPointF nextPosition, const QVector<QPointF> &segments);
-    // 4th condition: Exceeding user-defined max length
-    bool exceedingLengthStoppingCondition(const QVector<QPointF>& segments);
-    // 5th condition: Too close to other hyperstreamline
-    bool exceedingDensityStoppingCondition();
+    bool degeneratePointStoppingCondition(int i, int j) const;
+    // Reaching the water, or the setback distance from the shore
+    bool shorelineStoppingCondition(QPointF nextPosition) const;
+    // 3rd condition: Returning to origin, or close to an earlier point of the road
+    bool loopStoppingCondition(QPointF nextPosition, const LoopDetector& loopDetector) const;
+    // 4th condition: Exceeding user-defined max length.
+    // The length is kept up to date while the road grows
+    bool exceedingLengthStoppingCondition(float pathLength, QPointF start) const;
+    // 5th condition: Too close to other hyperstreamline of the same family.
+    // The roads in ignoredRoadIDs are the ones the road starts from
+    bool exceedingDensityStoppingCondition(QPointF nextPosition, bool isMajor,
+                                           const QVector<int>& ignoredRoadIDs) const;
     // Check if road is meeting another one. Find the closest point of the met road
     bool meetsAnotherRoad(Road &road, int &intersectedRoadID, int &closestPointID, float minDistance);
-    // Check if road is meeting another one. Find the intersection of the two meeting road.
+    // Gather the segments of every stored road in the candidate segments again
+    void rebuildCandidateSegments();
+    // Check if the road of a front is meeting one of the candidate segments, or one of the
+    // roads still growing, on its next step. Find the intersection with the first one met
+    // along the step, and store it in the front.
     // The intersection isn't necessarily a point of the met road, unlike in meetsAnotherRoad().
-    bool meetsAnotherRoadAndFindIntersection(int roadID, QPointF nextPosition, int &intersectedRoadID,
-                            int &closestPointID, QPointF &intersectionPoint);
+    bool meetsAnotherRoadAndFindIntersection(RoadFront& front, const QVector<int>& ignoredRoadIDs,
+                                             const QVector<RoadFront>& fronts,
+                                             QPointF nextPosition) const;
+    // Label the blocks enclosed by the principal roads on a grid
+    // of cells of size cellSize. Returns the blocks found
+    QVector<StreetBlock> extractPrincipalBlocks(float cellSize, BlockLabelGrid& grid) const;
+    // Grow the secondary roads of a block from its seeds, with a street graph
+    // of its own where the boundary roads are met like any other road.
+    // Only reads the shared state, so blocks can be processed concurrently
+    void growSecondaryRoadsInBlock(StreetBlock& block, float separationDistance) const;
+    // Split a road in 2 at a new node placed on its segment ending at segmentEnd.
+    // The road keeps its ID for the first part. Returns the ID of the second part
+    int splitRoad(int roadID, int segmentEnd, int nodeID);
+    // Connect a new node to the road it lies on, among the parts of a split road.
+    // The part is split at the node, or the node of its end is returned when
+    // the position is already there
+    int insertJunction(QVector<int>& partIDs, QPointF position);
+    // Simplify a road that stopped growing, and fill its lengths
+    void finalizeRoad(Road& road) const;
+    // Returns the number of road ends at each node, counting only the exported roads
+    QHash<int,int> computeNodeDegrees() const;
+    // Call function with a RoadRecord (or NodeRecord) for every road (or node),
+    // read in place from the loaded file if there is one
+    template<typename Function> void forEachRoad(Function function) const;
+    template<typename Function> void forEachNode(Function function) const;
+    // Copy the street graph of the loaded file to the stored nodes and roads,
+    // and close the file. Done before the street graph is modified
+    void copyLoadedStreetGraph();
+    // Render one tile of an image of size imageSize. waterLayer is drawn
+    // scaled to the whole image if it isn't null
+    void renderImageTile(RasterTile& tile, QSize imageSize, const QImage& waterLayer,
+                         bool drawTensors, const QHash<int,QRectF>* roadBounds) const;
 
 
     // Tensor field
@@ -132,6 +506,45 @@ private:
     QMap<int,Node> mNodes;
     // Container for roads
     QMap<int,Road> mRoads;
+    // Street graph file read in place instead of mNodes and mRoads, NULL if none
+    StreetGraphFileView * mLoadedFile;
+    // Holds if the street graph is generated in tiles
+    bool mTiledGeneration;
+    // Size of the tiles, as a multiple of the separation distance
+    float mTileSizeInSeparations;
+    // Street graph a tile belongs to, NULL if it isn't a tile
+    const StreetGraph * mParentGraph;
+    // Watches the background generation
+    QFutureWatcher<void> mGenerationWatcher;
+    // Watches the background image export
+    QFutureWatcher<bool> mExportWatcher;
+    // Set to stop the background generation
+    QAtomicInt mCancelRequested;
+    // Last road ID sent in a batch of new roads
+    int mLastStreamedRoadID;
+    // Time since the last batch of new roads
+    QElapsedTimer mStreamTimer;
+    // Version of the tensor field the street graph was grown from, -1 if none
+    int mFieldVersion;
+    // Road samples, for the density stopping condition
+    OccupancyGrid mOccupancyGrid;
+    // Holds if roads stop when they get too close to a parallel road
+    bool mUseDensityStoppingCondition;
+    // Distance to the closest parallel road that stops a road,
+    // as a fraction of the separation distance
+    float mDensityTestRatio;
+    // Optional image scaling the separation distance over the region
+    QImage mSeparationMap;
+    // Separation distance ratio in the black areas of the separation map
+    float mMinSeparationRatio;
+    // Distance kept between the roads and the water, 0 to stop at the shore
+    float mShoreSetback;
+    // Half-edge representation of the nodes and roads
+    HalfEdgeGraph * mPlanarGraph;
+    // Segments of the roads that stopped growing, which the growing roads can meet
+    SegmentBuffer * mCandidateSegments;
+    // Streamlines traced by the previous generations, shared with the tiles
+    QSharedPointer<TraceCache> mTraceCache;
     // Container for seeds
     QVector<QPointF> mSeeds;
     // Height and width of the region
@@ -140,6 +553,9 @@ private:
     QPointF mBottomLeft;
     // Coordinates of the top right point
     QPointF mTopRight;
+    // Region covered by the tensor field and the separation map.
+    // Only differs from the street graph region for the tiles of a tiled generation
+    QRectF mFieldRegion;
     // Last IDs for Nodes and Roads
     int mLastNodeID;
     int mLastRoadID;
@@ -149,22 +565,74 @@ private:
     QImage mWatermap;
     // Method to use for seed initialization
     int mSeedInitMethod;
+    // Seed of the random generator used for the last random seed list
+    uint mRandomSeed;
     // Holds if nodes should be drawn in the street graph image
     bool mDrawNodes;
+    // Holds if roads are simplified when they are finalized
+    bool mSimplifyRoads;
+    // Simplification tolerance, as a fraction of the separation distance
+    float mSimplificationRatio;
+    // Holds if the roads of all the seeds grow together
+    bool mLockstepGrowth;
+    // Holds if the roads are traced on a coarser level of the field pyramid
+    bool mCoarseTracing;
+    // Number of roads growing together in a lockstep generation
+    int mMaxActiveFronts;
+    // Number of steps each road grows in a round
+    int mStepsPerRound;
+    // Junctions with the roads still growing, by met road
+    QMultiHash<int,PendingJunction> mPendingJunctions;
+    // Holds if secondary roads are generated inside principal road blocks
+    bool mGenerateSecondaryRoads;
+    // Type of the roads grown from the seeds. Secondary in the graph of a block
+    RoadType mGrownRoadType;
+    // Separation of principal roads, as a multiple of the separation distance,
+    // when secondary roads are generated
+    float mPrincipalSeparationFactor;
 
 };
 
 // Overloads writing Road to std stream
-std::ostream& operator<<(std::ostream& out, const Road r);
+std::ostream& operator<<(std::ostream& out, const Road& r);
 // Overloads writing Node to std stream
-std::ostream& operator<<(std::ostream& out, const Node n);
+std::ostream& operator<<(std::ostream& out, const Node& n);
 // Overloads writing QPointF to std stream
 std::ostream& operator<<(std::ostream& out, const QPointF p);
 
+// Add a point at the end of a road, and extend its bounding box
+void appendRoadPoint(Road& road, QPointF point);
+// Compute the bounding box of a road
+QRectF computeBoundingBox(const QVector<QPointF>& segments);
 // Compute the length of a road
 float computePathLength(const QVector<QPointF>& segments);
 // Compute the length between the 2 endpoints of a road
 float computeStraightLength(const QVector<QPointF>& segments);
+// Returns whether both coordinates of a point are finite
+bool isFinitePoint(QPointF point);
+// Returns whether all the points of a road are finite
+bool isFinitePolyline(const QVector<QPointF>& segments);
+// Returns whether one of the rectangles of a region contains the point
+bool regionContains(const QVector<QRectF>& region, QPointF point);
+// Returns whether a road is written by the exporters:
+// it has at least 2 points, all of them finite
+bool isExportedRoad(const RoadRecord& road);
+// Remove the points of a polyline that are closer than tolerance
+// from the simplified polyline (Douglas-Peucker).
+// The first and last points are always kept
+void simplifyPolyline(QVector<QPointF>& points, float tolerance);
+// Find the segment of the polyline closest to a point, and the distance to it.
+// Returns the index of the end of the segment, or -1
+int findClosestSegment(const QVector<QPointF>& polyline, QPointF point, float& distance);
+// Find the first segment of the polyline crossed by segment AB.
+// Returns the index of the end of the crossed segment, or -1
+int findPolylineCrossing(QPointF A, QPointF B, const QVector<QPointF>& polyline,
+                         QPointF& intersectionPoint);
+// Returns whether segment AB intersects the rectangle
+bool segmentIntersectsRect(QPointF A, QPointF B, QRectF rect);
+// Clip segment AB to the rectangle.
+// Returns false if it doesn't intersect it
+bool clipSegmentToRect(QPointF& A, QPointF& B, QRectF rect);
 // Compute det(AB, AM) which determines if M is in, on the left,
 // or on the right of AB
 float detPointLine(QPointF A, QPointF B, QPointF M);
@@ -0,0 +1,332 @@
+#include "StreetGraphFile.h"
+
+#include <climits>
+#include <cstring>
+#include <QSaveFile>
+#include <QVector>
+
+Q_STATIC_ASSERT(sizeof(StreetGraphFileHeader) == 136);
+Q_STATIC_ASSERT(sizeof(StreetGraphFileNode) == 48);
+Q_STATIC_ASSERT(sizeof(StreetGraphFileRoad) == 40);
+Q_STATIC_ASSERT(sizeof(QPointF) == 2*sizeof(double));
+Q_STATIC_ASSERT(Q_BYTE_ORDER == Q_LITTLE_ENDIAN);
+
+namespace
+{
+
+// Round up to the next multiple of 8
+quint64 align8(quint64 value)
+{
+    return (value + 7) & ~Q_UINT64_C(7);
+}
+
+bool writeArray(QSaveFile& file, const void* data, qint64 size)
+{
+    return file.write((const char*)data, size) == size;
+}
+
+bool writePadding(QSaveFile& file)
+{
+    static const char zeros[8] = {0,0,0,0,0,0,0,0};
+    qint64 padding = align8(file.pos()) - file.pos();
+    return file.write(zeros, padding) == padding;
+}
+
+StreetGraphFileHeader createHeader(const StreetGraphParameters& parameters, quint64 nodeCount,
+                                   quint64 roadCount, quint64 idCount, quint64 pointCount)
+{
+    StreetGraphFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, STREETGRAPH_FILE_MAGIC, sizeof(header.magic));
+    header.version = STREETGRAPH_FILE_VERSION;
+    header.headerSize = sizeof(header);
+    header.bottomLeftX = parameters.bottomLeft.x();
+    header.bottomLeftY = parameters.bottomLeft.y();
+    header.topRightX = parameters.topRight.x();
+    header.topRightY = parameters.topRight.y();
+    header.separationDistance = parameters.separationDistance;
+    header.seedInitMethod = parameters.seedInitMethod;
+    header.randomSeed = parameters.randomSeed;
+    header.fieldChecksum = parameters.fieldChecksum;
+    header.nodeOffset = align8(sizeof(header));
+    header.nodeCount = nodeCount;
+    header.roadOffset = align8(header.nodeOffset + header.nodeCount*sizeof(StreetGraphFileNode));
+    header.roadCount = roadCount;
+    header.idOffset = align8(header.roadOffset + header.roadCount*sizeof(StreetGraphFileRoad));
+    header.idCount = idCount;
+    header.pointOffset = align8(header.idOffset + header.idCount*sizeof(qint32));
+    header.pointCount = pointCount;
+    return header;
+}
+
+}
+
+bool writeStreetGraphFile(QString filename, const StreetGraphParameters& parameters,
+                          const QMap<int,Node>& nodes, const QMap<int,Road>& roads,
+                          QString* errorString)
+{
+    // Flatten the containers
+    QVector<StreetGraphFileNode> nodeRecords;
+    QVector<qint32> ids;
+    nodeRecords.reserve(nodes.size());
+    QMap<int,Node>::const_iterator itn = nodes.constBegin(), itn_end = nodes.constEnd();
+    for(; itn != itn_end ; itn++)
+    {
+        StreetGraphFileNode record;
+        memset(&record, 0, sizeof(record));
+        record.ID = itn.key();
+        record.x = itn->position.x();
+        record.y = itn->position.y();
+        record.firstConnectedNode = ids.size();
+        record.connectedNodeCount = itn->connectedNodeIDs.size();
+        ids += itn->connectedNodeIDs;
+        record.firstConnectedRoad = ids.size();
+        record.connectedRoadCount = itn->connectedRoadIDs.size();
+        ids += itn->connectedRoadIDs;
+        nodeRecords.push_back(record);
+    }
+    QVector<StreetGraphFileRoad> roadRecords;
+    roadRecords.reserve(roads.size());
+    quint64 pointCount = 0;
+    QMap<int,Road>::const_iterator itr = roads.constBegin(), itr_end = roads.constEnd();
+    for(; itr != itr_end ; itr++)
+    {
+        StreetGraphFileRoad record;
+        memset(&record, 0, sizeof(record));
+        record.ID = itr.key();
+        record.nodeID1 = itr->nodeID1;
+        record.nodeID2 = itr->nodeID2;
+        record.type = itr->type;
+        record.straightLength = itr->straightLength;
+        record.pathLength = itr->pathLength;
+        record.firstPoint = pointCount;
+        record.pointCount = itr->segments.size();
+        pointCount += itr->segments.size();
+        roadRecords.push_back(record);
+    }
+
+    StreetGraphFileHeader header = createHeader(parameters, nodeRecords.size(), roadRecords.size(),
+                                                ids.size(), pointCount);
+
+    QSaveFile file(filename);
+    if(!file.open(QIODevice::WriteOnly))
+    {
+        if(errorString != NULL)
+        {
+            *errorString = file.errorString();
+        }
+        return false;
+    }
+    bool ok = writeArray(file, &header, sizeof(header))
+            && writePadding(file)
+            && writeArray(file, nodeRecords.constData(), nodeRecords.size()*sizeof(StreetGraphFileNode))
+            && writePadding(file)
+            && writeArray(file, roadRecords.constData(), roadRecords.size()*sizeof(StreetGraphFileRoad))
+            && writePadding(file)
+            && writeArray(file, ids.constData(), ids.size()*sizeof(qint32))
+            && writePadding(file);
+    // Points are written road by road, straight from the road storage
+    for(itr = roads.constBegin() ; ok && itr != itr_end ; itr++)
+    {
+        ok = writeArray(file, itr->segments.constData(), itr->segments.size()*sizeof(QPointF));
+    }
+    if(!ok)
+    {
+        if(errorString != NULL)
+        {
+            *errorString = file.errorString();
+        }
+        file.cancelWriting();
+        return false;
+    }
+    if(!file.commit())
+    {
+        if(errorString != NULL)
+        {
+            *errorString = file.errorString();
+        }
+        return false;
+    }
+    return true;
+}
+
+bool writeStreetGraphFile(QString filename, const StreetGraphParameters& parameters,
+                          const StreetGraphFileView& view, QString* errorString)
+{
+    StreetGraphFileHeader header = createHeader(parameters, view.nodeCount(), view.roadCount(),
+                                                view.idCount(), view.pointCount());
+    QSaveFile file(filename);
+    if(!file.open(QIODevice::WriteOnly))
+    {
+        if(errorString != NULL)
+        {
+            *errorString = file.errorString();
+        }
+        return false;
+    }
+    // The arrays are copied as they are mapped
+    bool ok = writeArray(file, &header, sizeof(header))
+            && writePadding(file)
+            && writeArray(file, view.nodes(), header.nodeCount*sizeof(StreetGraphFileNode))
+            && writePadding(file)
+            && writeArray(file, view.roads(), header.roadCount*sizeof(StreetGraphFileRoad))
+            && writePadding(file)
+            && writeArray(file, view.ids(), header.idCount*sizeof(qint32))
+            && writePadding(file)
+            && writeArray(file, view.points(), header.pointCount*sizeof(QPointF));
+    if(!ok)
+    {
+        if(errorString != NULL)
+        {
+            *errorString = file.errorString();
+        }
+        file.cancelWriting();
+        return false;
+    }
+    if(!file.commit())
+    {
+        if(errorString != NULL)
+        {
+            *errorString = file.errorString();
+        }
+        return false;
+    }
+    return true;
+}
+
+StreetGraphFileView::StreetGraphFileView() :
+    mData(NULL), mSize(0), mHeader(NULL), mNodes(NULL), mRoads(NULL), mIDs(NULL), mPoints(NULL)
+{
+}
+
+StreetGraphFileView::~StreetGraphFileView()
+{
+    close();
+}
+
+bool StreetGraphFileView::open(QString filename)
+{
+    close();
+    mFile.setFileName(filename);
+    if(!mFile.open(QIODevice::ReadOnly))
+    {
+        mErrorString = mFile.errorString();
+        return false;
+    }
+    mSize = mFile.size();
+    if(mSize < (qint64)sizeof(StreetGraphFileHeader))
+    {
+        mErrorString = "File is too small";
+        close();
+        return false;
+    }
+    mData = mFile.map(0, mSize);
+    if(mData == NULL)
+    {
+        mErrorString = mFile.errorString();
+        close();
+        return false;
+    }
+    const StreetGraphFileHeader* header = (const StreetGraphFileHeader*)mData;
+    if(memcmp(header->magic, STREETGRAPH_FILE_MAGIC, sizeof(header->magic)) != 0)
+    {
+        mErrorString = "Not a street graph file";
+        close();
+        return false;
+    }
+    if(header->version != STREETGRAPH_FILE_VERSION || header->headerSize != sizeof(StreetGraphFileHeader))
+    {
+        mErrorString = QString("Unsupported street graph file version %1").arg(header->version);
+        close();
+        return false;
+    }
+    // Check that each array lies inside the file and is aligned. The counts are
+    // compared before being multiplied, so that a corrupted one can't overflow
+    quint64 size = mSize;
+    quint64 offsets[4] = {header->nodeOffset, header->roadOffset, header->idOffset, header->pointOffset};
+    quint64 counts[4] = {header->nodeCount, header->roadCount, header->idCount, header->pointCount};
+    quint64 elementSizes[4] = {sizeof(StreetGraphFileNode), sizeof(StreetGraphFileRoad),
+                               sizeof(qint32), sizeof(QPointF)};
+    for(int k=0 ; k<4 ; k++)
+    {
+        if(offsets[k] % 8 != 0 || offsets[k] > size || counts[k] > (size - offsets[k])/elementSizes[k])
+        {
+            mErrorString = "Corrupted street graph file index";
+            close();
+            return false;
+        }
+    }
+    if(header->nodeCount > INT_MAX || header->roadCount > INT_MAX)
+    {
+        mErrorString = "Street graph file is too large";
+        close();
+        return false;
+    }
+    mHeader = header;
+    mNodes = (const StreetGraphFileNode*)(mData + header->nodeOffset);
+    mRoads = (const StreetGraphFileRoad*)(mData + header->roadOffset);
+    mIDs = (const qint32*)(mData + header->idOffset);
+    mPoints = (const QPointF*)(mData + header->pointOffset);
+    return true;
+}
+
+void StreetGraphFileView::close()
+{
+    if(mData != NULL)
+    {
+        mFile.unmap(mData);
+    }
+    if(mFile.isOpen())
+    {
+        mFile.close();
+    }
+    mData = NULL;
+    mSize = 0;
+    mHeader = NULL;
+    mNodes = NULL;
+    mRoads = NULL;
+    mIDs = NULL;
+    mPoints = NULL;
+}
+
+bool StreetGraphFileView::validate() const
+{
+    if(mHeader == NULL)
+    {
+        return false;
+    }
+    for(quint64 k=0 ; k<mHeader->nodeCount ; k++)
+    {
+        const StreetGraphFileNode& n = mNodes[k];
+        if(n.firstConnectedNode > mHeader->idCount
+                || n.connectedNodeCount > mHeader->idCount - n.firstConnectedNode
+                || n.firstConnectedRoad > mHeader->idCount
+                || n.connectedRoadCount > mHeader->idCount - n.firstConnectedRoad)
+        {
+            return false;
+        }
+    }
+    for(quint64 k=0 ; k<mHeader->roadCount ; k++)
+    {
+        const StreetGraphFileRoad& r = mRoads[k];
+        if(r.firstPoint > mHeader->pointCount
+                || r.pointCount > mHeader->pointCount - r.firstPoint
+                || r.pointCount > INT_MAX)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+StreetGraphParameters StreetGraphFileView::parameters() const
+{
+    StreetGraphParameters parameters;
+    parameters.bottomLeft = QPointF(mHeader->bottomLeftX, mHeader->bottomLeftY);
+    parameters.topRight = QPointF(mHeader->topRightX, mHeader->topRightY);
+    parameters.separationDistance = mHeader->separationDistance;
+    parameters.seedInitMethod = mHeader->seedInitMethod;
+    parameters.randomSeed = mHeader->randomSeed;
+    parameters.fieldChecksum = mHeader->fieldChecksum;
+    return parameters;
+}
@@ -0,0 +1,148 @@
+#ifndef STREETGRAPHFILE_H
+#define STREETGRAPHFILE_H
+
+#include <QFile>
+#include <QMap>
+#include <QPointF>
+#include <QString>
+
+#include "StreetGraph.h"
+
+// Binary street graph container.
+// The file is a header followed by four flat arrays:
+// - nodes (StreetGraphFileNode)
+// - roads (StreetGraphFileRoad)
+// - connected IDs arena (qint32), referenced by the nodes
+// - points arena (QPointF), referenced by the roads
+// The header holds the offset and count of each array, and the
+// parameters used to generate the graph, so runs can be audited.
+// All values are little endian, and every array is 8-byte aligned,
+// so a mapped file can be used in place without parsing.
+
+#define STREETGRAPH_FILE_MAGIC "IPSMSGF"
+#define STREETGRAPH_FILE_VERSION 1
+
+struct StreetGraphFileHeader {
+    char magic[8];
+    quint32 version;
+    quint32 headerSize;
+    // Generation parameters
+    double bottomLeftX;
+    double bottomLeftY;
+    double topRightX;
+    double topRightY;
+    float separationDistance;
+    qint32 seedInitMethod;
+    quint32 randomSeed;
+    quint32 reserved;
+    quint64 fieldChecksum;
+    // Index of the arrays
+    quint64 nodeOffset;
+    quint64 nodeCount;
+    quint64 roadOffset;
+    quint64 roadCount;
+    quint64 idOffset;
+    quint64 idCount;
+    quint64 pointOffset;
+    quint64 pointCount;
+};
+
+struct StreetGraphFileNode {
+    qint32 ID;
+    quint32 connectedNodeCount;
+    double x;
+    double y;
+    quint64 firstConnectedNode;
+    quint64 firstConnectedRoad;
+    quint32 connectedRoadCount;
+    quint32 reserved;
+};
+
+struct StreetGraphFileRoad {
+    qint32 ID;
+    qint32 nodeID1;
+    qint32 nodeID2;
+    qint32 type;
+    float straightLength;
+    float pathLength;
+    quint64 firstPoint;
+    quint64 pointCount;
+};
+
+// Generation parameters stored in the file header
+struct StreetGraphParameters {
+    QPointF bottomLeft;
+    QPointF topRight;
+    float separationDistance;
+    int seedInitMethod;
+    quint32 randomSeed;
+    quint64 fieldChecksum;
+};
+
+// Write the nodes and roads to a binary street graph file
+bool writeStreetGraphFile(QString filename, const StreetGraphParameters& parameters,
+                          const QMap<int,Node>& nodes, const QMap<int,Road>& roads,
+                          QString* errorString = NULL);
+
+class StreetGraphFileView;
+// Write the street graph of a mapped file, with new parameters
+bool writeStreetGraphFile(QString filename, const StreetGraphParameters& parameters,
+                          const StreetGraphFileView& view, QString* errorString = NULL);
+
+// Read-only view on a memory-mapped street graph file.
+// Opening only checks the header, the arrays are used in place.
+class StreetGraphFileView
+{
+public:
+    StreetGraphFileView();
+    ~StreetGraphFileView();
+
+    // Map the file. Returns false if it isn't a valid street graph file
+    bool open(QString filename);
+    // Unmap the file. Pointers returned by the view become invalid
+    void close();
+    // Check that every record references valid ranges of the arenas.
+    // This is linear in the file size
+    bool validate() const;
+
+    // Returns the stored generation parameters
+    StreetGraphParameters parameters() const;
+
+    int nodeCount() const {return (int)mHeader->nodeCount;}
+    int roadCount() const {return (int)mHeader->roadCount;}
+    const StreetGraphFileNode& node(int index) const {return mNodes[index];}
+    const StreetGraphFileRoad& road(int index) const {return mRoads[index];}
+    // Returns the points of a road, road.pointCount of them
+    const QPointF* roadPoints(const StreetGraphFileRoad& road) const {return mPoints + road.firstPoint;}
+    // Returns the IDs of the nodes connected to a node, node.connectedNodeCount of them
+    const qint32* connectedNodeIDs(const StreetGraphFileNode& node) const {return mIDs + node.firstConnectedNode;}
+    // Returns the IDs of the roads connected to a node, node.connectedRoadCount of them
+    const qint32* connectedRoadIDs(const StreetGraphFileNode& node) const {return mIDs + node.firstConnectedRoad;}
+    // Returns the arrays, and the sizes of the arenas
+    const StreetGraphFileNode* nodes() const {return mNodes;}
+    const StreetGraphFileRoad* roads() const {return mRoads;}
+    const qint32* ids() const {return mIDs;}
+    const QPointF* points() const {return mPoints;}
+    quint64 idCount() const {return mHeader->idCount;}
+    quint64 pointCount() const {return mHeader->pointCount;}
+
+    // Returns the description of the last error
+    QString errorString() const {return mErrorString;}
+
+private:
+
+    // Mapped file
+    QFile mFile;
+    uchar* mData;
+    qint64 mSize;
+    // Arrays, pointing inside the mapped file
+    const StreetGraphFileHeader* mHeader;
+    const StreetGraphFileNode* mNodes;
+    const StreetGraphFileRoad* mRoads;
+    const qint32* mIDs;
+    const QPointF* mPoints;
+    // Description of the last error
+    QString mErrorString;
+};
+
+#endif // STREETGRAPHFILE_H
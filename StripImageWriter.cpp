@@ -0,0 +1,412 @@
+#include "StripImageWriter.h"
+
+#include <QFileInfo>
+
+// Compression level of the PNG image data. Huge images are written,
+// so the speed matters more than the last percents of size
+#define PNG_DEFLATE_LEVEL Z_BEST_SPEED
+// Size of the buffer the deflated data is written to
+#define PNG_DEFLATE_BUFFER_SIZE (256*1024)
+
+namespace
+{
+
+void appendBigEndian32(QByteArray& out, quint32 value)
+{
+    out.append((char)((value >> 24) & 0xFF));
+    out.append((char)((value >> 16) & 0xFF));
+    out.append((char)((value >> 8) & 0xFF));
+    out.append((char)(value & 0xFF));
+}
+
+void appendLittleEndian16(QByteArray& out, quint16 value)
+{
+    out.append((char)(value & 0xFF));
+    out.append((char)((value >> 8) & 0xFF));
+}
+
+void appendLittleEndian32(QByteArray& out, quint32 value)
+{
+    out.append((char)(value & 0xFF));
+    out.append((char)((value >> 8) & 0xFF));
+    out.append((char)((value >> 16) & 0xFF));
+    out.append((char)((value >> 24) & 0xFF));
+}
+
+// Append a 12-byte TIFF IFD entry
+void appendTiffEntry(QByteArray& out, quint16 tag, quint16 type, quint32 count, quint32 value)
+{
+    appendLittleEndian16(out, tag);
+    appendLittleEndian16(out, type);
+    appendLittleEndian32(out, count);
+    if(type == 3 && count == 1)
+    {
+        // Short values are left-justified in the value field
+        appendLittleEndian16(out, (quint16)value);
+        appendLittleEndian16(out, 0);
+    }
+    else
+    {
+        appendLittleEndian32(out, value);
+    }
+}
+
+// Convert one RGB32 scanline to packed 8-bit RGB
+void packRgbRow(const QRgb* row, int width, uchar* out)
+{
+    for(int j=0 ; j<width ; j++)
+    {
+        out[3*j] = qRed(row[j]);
+        out[3*j+1] = qGreen(row[j]);
+        out[3*j+2] = qBlue(row[j]);
+    }
+}
+
+// PackBits encoding of a single row, as specified by TIFF 6.0
+void packBitsRow(const uchar* data, int length, QByteArray& out)
+{
+    int i = 0;
+    while(i < length)
+    {
+        int run = 1;
+        while(i+run < length && run < 128 && data[i+run] == data[i])
+        {
+            run++;
+        }
+        if(run >= 2)
+        {
+            out.append((char)(1-run));
+            out.append((char)data[i]);
+            i += run;
+        }
+        else
+        {
+            int start = i;
+            i++;
+            while(i < length && i-start < 128
+                  && !(i+1 < length && data[i] == data[i+1]))
+            {
+                i++;
+            }
+            out.append((char)(i-start-1));
+            out.append((const char*)data+start, i-start);
+        }
+    }
+}
+
+}
+
+StripImageWriter::StripImageWriter() :
+    mFormat(PNG), mRowsWritten(0), mRowsPerStrip(0), mDeflateIsOpen(false)
+{
+}
+
+StripImageWriter::~StripImageWriter()
+{
+    endDeflate();
+    if(mFile.isOpen())
+    {
+        mFile.close();
+    }
+}
+
+bool StripImageWriter::open(QString filename, QSize imageSize)
+{
+    QString suffix = QFileInfo(filename).suffix().toLower();
+    if(suffix == "png")
+    {
+        mFormat = PNG;
+    }
+    else if(suffix == "tif" || suffix == "tiff")
+    {
+        mFormat = TIFF;
+    }
+    else
+    {
+        return fail(QString("Unsupported image format: %1").arg(suffix));
+    }
+    if(imageSize.isEmpty())
+    {
+        return fail("Image size is empty");
+    }
+    mFile.setFileName(filename);
+    if(!mFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        return fail(mFile.errorString());
+    }
+    mImageSize = imageSize;
+    mRowsWritten = 0;
+    mRowsPerStrip = 0;
+    mStripOffsets.clear();
+    mStripByteCounts.clear();
+
+    QByteArray header;
+    if(mFormat == PNG)
+    {
+        header.append("\x89PNG\r\n\x1a\n", 8);
+        if(mFile.write(header) != header.size())
+        {
+            return fail(mFile.errorString());
+        }
+        QByteArray ihdr;
+        appendBigEndian32(ihdr, imageSize.width());
+        appendBigEndian32(ihdr, imageSize.height());
+        ihdr.append((char)8);   // Bit depth
+        ihdr.append((char)2);   // Color type: RGB
+        ihdr.append((char)0);   // Compression: deflate
+        ihdr.append((char)0);   // Filter method
+        ihdr.append((char)0);   // No interlace
+        if(!writePngChunk("IHDR", ihdr))
+        {
+            return false;
+        }
+        endDeflate();
+        mDeflateStream.zalloc = Z_NULL;
+        mDeflateStream.zfree = Z_NULL;
+        mDeflateStream.opaque = Z_NULL;
+        if(deflateInit(&mDeflateStream, PNG_DEFLATE_LEVEL) != Z_OK)
+        {
+            return fail("Can't initialize the zlib stream");
+        }
+        mDeflateIsOpen = true;
+        return true;
+    }
+    else
+    {
+        // Little endian TIFF, the IFD offset is patched on close
+        header.append("II", 2);
+        appendLittleEndian16(header, 42);
+        appendLittleEndian32(header, 0);
+        if(mFile.write(header) != header.size())
+        {
+            return fail(mFile.errorString());
+        }
+        return true;
+    }
+}
+
+bool StripImageWriter::writeStrip(const QImage& strip)
+{
+    if(!mFile.isOpen())
+    {
+        return fail("File is not open");
+    }
+    if(strip.width() != mImageSize.width())
+    {
+        return fail("Strip width differs from the image width");
+    }
+    if(mRowsWritten + strip.height() > mImageSize.height())
+    {
+        return fail("Too many rows written");
+    }
+    if(mRowsPerStrip == 0)
+    {
+        mRowsPerStrip = strip.height();
+    }
+    else if(strip.height() != mRowsPerStrip
+            && mRowsWritten + strip.height() != mImageSize.height())
+    {
+        return fail("Only the last strip can have a different height");
+    }
+
+    QImage rgbStrip = strip;
+    if(rgbStrip.format() != QImage::Format_RGB32 && rgbStrip.format() != QImage::Format_ARGB32)
+    {
+        rgbStrip = strip.convertToFormat(QImage::Format_RGB32);
+    }
+    bool ok = (mFormat == PNG) ? writePngStrip(rgbStrip) : writeTiffStrip(rgbStrip);
+    if(ok)
+    {
+        mRowsWritten += strip.height();
+    }
+    return ok;
+}
+
+bool StripImageWriter::close()
+{
+    if(!mFile.isOpen())
+    {
+        return fail("File is not open");
+    }
+    if(mRowsWritten != mImageSize.height())
+    {
+        endDeflate();
+        mFile.close();
+        return fail("Image is incomplete");
+    }
+    bool ok = (mFormat == PNG) ? closePng() : closeTiff();
+    endDeflate();
+    mFile.close();
+    return ok;
+}
+
+bool StripImageWriter::writePngStrip(const QImage& strip)
+{
+    if(!mDeflateIsOpen)
+    {
+        return fail("zlib stream is not initialized");
+    }
+    int width = mImageSize.width();
+    int rowSize = 1 + 3*width;
+    // Raw scanlines, each preceded by the filter type (0: None)
+    QByteArray raw(rowSize*strip.height(), 0);
+    Bytef* rawData = (Bytef*)raw.data();
+    for(int i=0 ; i<strip.height() ; i++)
+    {
+        packRgbRow((const QRgb*)strip.constScanLine(i), width, rawData + i*rowSize + 1);
+    }
+
+    // The stream is only finished with the last strip, so that
+    // the strips are compressed as a single zlib stream
+    bool isLastStrip = (mRowsWritten + strip.height() == mImageSize.height());
+    mDeflateStream.next_in = rawData;
+    mDeflateStream.avail_in = raw.size();
+    QByteArray data(PNG_DEFLATE_BUFFER_SIZE, 0);
+    int status = Z_OK;
+    do
+    {
+        mDeflateStream.next_out = (Bytef*)data.data();
+        mDeflateStream.avail_out = data.size();
+        status = deflate(&mDeflateStream, isLastStrip ? Z_FINISH : Z_NO_FLUSH);
+        if(status == Z_STREAM_ERROR)
+        {
+            return fail("zlib stream error");
+        }
+        int length = data.size() - mDeflateStream.avail_out;
+        // Each filled buffer is written as its own IDAT chunk
+        if(length > 0 && !writePngChunk("IDAT", data.left(length)))
+        {
+            return false;
+        }
+    }
+    while(mDeflateStream.avail_out == 0 || (isLastStrip && status != Z_STREAM_END));
+    return true;
+}
+
+bool StripImageWriter::writeTiffStrip(const QImage& strip)
+{
+    int width = mImageSize.width();
+    QVector<uchar> row(3*width);
+    QByteArray data;
+    data.reserve(3*width*strip.height()/4);
+    for(int i=0 ; i<strip.height() ; i++)
+    {
+        packRgbRow((const QRgb*)strip.constScanLine(i), width, row.data());
+        packBitsRow(row.constData(), row.size(), data);
+    }
+    qint64 offset = mFile.pos();
+    if(offset + data.size() > Q_INT64_C(0xFFFFFFFF))
+    {
+        return fail("Image exceeds the 4GB limit of the TIFF format");
+    }
+    if(mFile.write(data) != data.size())
+    {
+        return fail(mFile.errorString());
+    }
+    mStripOffsets.push_back((quint32)offset);
+    mStripByteCounts.push_back((quint32)data.size());
+    return true;
+}
+
+bool StripImageWriter::closePng()
+{
+    return writePngChunk("IEND", QByteArray());
+}
+
+void StripImageWriter::endDeflate()
+{
+    if(mDeflateIsOpen)
+    {
+        deflateEnd(&mDeflateStream);
+        mDeflateIsOpen = false;
+    }
+}
+
+bool StripImageWriter::closeTiff()
+{
+    // Values too large to fit in the IFD entries go before the IFD
+    QByteArray values;
+    if(mFile.pos() % 2 != 0)
+    {
+        values.append((char)0);
+    }
+    quint32 valuesOffset = (quint32)(mFile.pos() + values.size());
+    quint32 bitsPerSampleOffset = valuesOffset;
+    for(int k=0 ; k<3 ; k++)
+    {
+        appendLittleEndian16(values, 8);
+    }
+    int stripCount = mStripOffsets.size();
+    quint32 stripOffsetsValue = mStripOffsets[0];
+    quint32 stripByteCountsValue = mStripByteCounts[0];
+    if(stripCount > 1)
+    {
+        stripOffsetsValue = (quint32)(mFile.pos() + values.size());
+        for(int k=0 ; k<stripCount ; k++)
+        {
+            appendLittleEndian32(values, mStripOffsets[k]);
+        }
+        stripByteCountsValue = (quint32)(mFile.pos() + values.size());
+        for(int k=0 ; k<stripCount ; k++)
+        {
+            appendLittleEndian32(values, mStripByteCounts[k]);
+        }
+    }
+    quint32 ifdOffset = (quint32)(mFile.pos() + values.size());
+
+    // Entries must be sorted by tag
+    QByteArray ifd;
+    appendLittleEndian16(ifd, 10);
+    appendTiffEntry(ifd, 256, 4, 1, mImageSize.width());     // ImageWidth
+    appendTiffEntry(ifd, 257, 4, 1, mImageSize.height());    // ImageLength
+    appendTiffEntry(ifd, 258, 3, 3, bitsPerSampleOffset);    // BitsPerSample
+    appendTiffEntry(ifd, 259, 3, 1, 32773);                  // Compression: PackBits
+    appendTiffEntry(ifd, 262, 3, 1, 2);                      // Photometric: RGB
+    appendTiffEntry(ifd, 273, 4, stripCount, stripOffsetsValue);
+    appendTiffEntry(ifd, 277, 3, 1, 3);                      // SamplesPerPixel
+    appendTiffEntry(ifd, 278, 4, 1, mRowsPerStrip);          // RowsPerStrip
+    appendTiffEntry(ifd, 279, 4, stripCount, stripByteCountsValue);
+    appendTiffEntry(ifd, 284, 3, 1, 1);                      // PlanarConfiguration
+    appendLittleEndian32(ifd, 0);
+
+    if(mFile.pos() + values.size() + ifd.size() > Q_INT64_C(0xFFFFFFFF))
+    {
+        return fail("Image exceeds the 4GB limit of the TIFF format");
+    }
+    if(mFile.write(values) != values.size() || mFile.write(ifd) != ifd.size())
+    {
+        return fail(mFile.errorString());
+    }
+    // Patch the offset of the first IFD in the header
+    QByteArray headerOffset;
+    appendLittleEndian32(headerOffset, ifdOffset);
+    if(!mFile.seek(4) || mFile.write(headerOffset) != headerOffset.size())
+    {
+        return fail(mFile.errorString());
+    }
+    return true;
+}
+
+bool StripImageWriter::writePngChunk(const char* type, const QByteArray& data)
+{
+    QByteArray lengthBytes;
+    appendBigEndian32(lengthBytes, data.size());
+    uLong crc = crc32(0, (const Bytef*)type, 4);
+    crc = crc32(crc, (const Bytef*)data.constData(), data.size());
+    QByteArray crcBytes;
+    appendBigEndian32(crcBytes, (quint32)crc);
+    if(mFile.write(lengthBytes) != 4
+            || mFile.write(type, 4) != 4
+            || mFile.write(data) != data.size()
+            || mFile.write(crcBytes) != 4)
+    {
+        return fail(mFile.errorString());
+    }
+    return true;
+}
+
+bool StripImageWriter::fail(QString error)
+{
+    mErrorString = error;
+    return false;
+}
@@ -0,0 +1,76 @@
+#ifndef STRIPIMAGEWRITER_H
+#define STRIPIMAGEWRITER_H
+
+#include <QFile>
+#include <QImage>
+#include <QSize>
+#include <QString>
+#include <QVector>
+
+#include <zlib.h>
+
+// Writes an RGB image to disk one horizontal strip at a time,
+// so that the whole image never has to be held in memory.
+// The format is chosen from the file suffix:
+// - .png : 8-bit RGB PNG, each strip deflated into the zlib stream as it comes
+// - .tif/.tiff : PackBits compressed 8-bit RGB TIFF, one strip per call
+// Strips must be written from top to bottom, and all of them
+// but the last one must have the same height.
+class StripImageWriter
+{
+public:
+    enum Format {
+        PNG,
+        TIFF
+    };
+
+    StripImageWriter();
+    ~StripImageWriter();
+
+    // Create the file and write the header. Returns false on error
+    bool open(QString filename, QSize imageSize);
+    // Append the strip below the previously written ones.
+    // The strip must be as wide as the image
+    bool writeStrip(const QImage& strip);
+    // Write the trailer and close the file.
+    // Returns false if the image is incomplete or on I/O error
+    bool close();
+
+    // Returns the description of the last error
+    QString errorString() const {return mErrorString;}
+
+private:
+
+    bool writePngStrip(const QImage& strip);
+    bool writeTiffStrip(const QImage& strip);
+    bool closePng();
+    bool closeTiff();
+    // Release the zlib stream, if any
+    void endDeflate();
+    // Write a PNG chunk with its length and CRC
+    bool writePngChunk(const char* type, const QByteArray& data);
+    // Set the error string and return false
+    bool fail(QString error);
+
+    // Output file
+    QFile mFile;
+    // Output format
+    Format mFormat;
+    // Size of the full image
+    QSize mImageSize;
+    // Number of rows already written
+    int mRowsWritten;
+    // Height of the first strip, used as RowsPerStrip in TIFF
+    int mRowsPerStrip;
+    // zlib stream of the PNG image data, kept open between the strips
+    z_stream mDeflateStream;
+    // Holds if mDeflateStream has been initialized and must be ended
+    bool mDeflateIsOpen;
+    // Offsets and sizes of the TIFF strips
+    QVector<quint32> mStripOffsets;
+    QVector<quint32> mStripByteCounts;
+    // Description of the last error
+    QString mErrorString;
+};
+
+#endif // STRIPIMAGEWRITER_H
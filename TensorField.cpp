@@ -6,42 +6,107 @@
 #include <QPainter>
 #include <QPen>
 #include <QFileDialog>
-#include <QCoreApplication>
-#include <QProgressDialog>
+#include <QtConcurrent>
+#include <limits>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
-TensorField::TensorField(QSize fieldSize, QObject *parent) :
-    QObject(parent), mFieldSize(fieldSize)
+
+TensorField::TensorField(QSize fieldSize, QObject *parent, FieldStorage storage) :
+    QObject(parent), mData(storage), mFieldSize(fieldSize)
 {
-    mData.resize(fieldSize.height());
-    for(int i=0 ; i < fieldSize.height() ; i++)
-    {
-        mData[i].resize(fieldSize.width());
-    }
+    mData.resize(fieldSize);
     mFieldIsFilled = false;
     mEigenIsComputed = false;
     mWaterMapIsLoaded = false;
+    mVersion = 0;
+    mEditLogStartVersion = 0;
+    mEigenVersion = -1;
+    mNumberOfDegeneratePoints = 0;
+    mDegeneratePointTilesX = 0;
+    mEigenVectorsImageVersion = -1;
+    mAnalyticBasis = NoAnalyticBasis;
+    mAnalyticEvaluation = false;
+    mMemoryLayout = RowMajorLayout;
+    mLayoutBlocksX = 0;
 }
 
-QVector4D TensorField::getTensor(int i, int j)
+QVector4D TensorField::getTensor(int i, int j) const
 {
-    return mData[i][j];
+    return mData.at(i,j);
 }
 
 void TensorField::setTensor(int i, int j, QVector4D tensor)
 {
-    mData[i][j] = tensor;
+    mData.set(i, j, tensor);
+    mAnalyticBasis = NoAnalyticBasis;
+    markRegionDirty(QRect(j, i, 1, 1));
 }
 
 void TensorField::setFieldSize(QSize fieldSize)
 {
+    if(fieldSize == mFieldSize)
+    {
+        mFieldIsFilled = false;
+        return;
+    }
     mFieldSize = fieldSize;
-    mData.resize(fieldSize.height());
-    for(int i=0 ; i < fieldSize.height() ; i++)
+    // The water distances no longer match the cells
+    mWaterDistance.clear();
+    mWaterDistanceTiles = TensorStorage();
+    mData.resize(fieldSize);
+    mFieldIsFilled = false;
+    markRegionDirty(QRect(QPoint(0,0), mFieldSize));
+}
+
+void TensorField::setStorage(FieldStorage storage)
+{
+    if(storage == mData.storage())
     {
-        mData[i].resize(fieldSize.width());
+        return;
     }
+    mData = TensorStorage(storage);
+    mData.resize(mFieldSize);
     mFieldIsFilled = false;
+    // The eigen data, the levels and the water distances are stored differently
+    mEigenIsComputed = false;
+    mEigenSize = QSize();
+    mEigenVectors.clear();
+    mEigenValues.clear();
+    mEigenAngles.clear();
+    mEigenMagnitudes.clear();
+    mPyramid.clear();
+    mWaterDistance.clear();
+    mWaterDistanceTiles = TensorStorage();
+    mAnalyticBasis = NoAnalyticBasis;
+    markRegionDirty(QRect(QPoint(0,0), mFieldSize));
+}
+
+int TensorField::getFillTileSize(const TensorStorage& storage)
+{
+    return (storage.storage() == SparseTiledStorage) ? SPARSE_TILE_SIZE : FIELD_CHANGE_TILE_SIZE;
+}
+
+template<typename Function>
+void TensorField::fillTilesConcurrently(TensorStorage& storage, Function function)
+{
+    int tileSize = getFillTileSize(storage);
+    int tilesX = (storage.width()+tileSize-1)/tileSize;
+    int tilesY = (storage.height()+tileSize-1)/tileSize;
+    // Rows are detached here, so that the tiles can write them concurrently
+    storage.detach();
+    QVector<int> tiles(tilesX*tilesY);
+    for(int t=0 ; t<tiles.size() ; t++)
+    {
+        tiles[t] = t;
+    }
+    QRect field(0, 0, storage.width(), storage.height());
+    QtConcurrent::blockingMap(tiles, [&function, tileSize, tilesX, field](int t)
+    {
+        function(t, QRect((t%tilesX)*tileSize, (t/tilesX)*tileSize, tileSize, tileSize).intersected(field));
+    });
 }
 
 void TensorField::applyWaterMap(QString filename)
@@ -57,54 +122,73 @@ void TensorField::applyWaterMap(QString filename)
         qCritical()<<"applyWaterMap(): Watermap must be of same size as the tensor field";
         return;
     }
-    for(int i=0; i<waterMap.height() ; i++)
+    TensorStorage previousData = mData;
+    TensorStorage& data = mData;
+    int height = mFieldSize.height();
+    fillTilesConcurrently(mData, [&data, &waterMap, height](int, QRect cells)
     {
-        for(int j=0; j<waterMap.width() ; j++)
+        for(int i=cells.top() ; i<=cells.bottom() ; i++)
         {
-            if(qBlue(waterMap.pixel(j,i)) > 0)
+            // The first row of the image is the top of the field
+            for(int j=cells.left() ; j<=cells.right() ; j++)
             {
-                mData[mFieldSize.height()-1-i][j] = QVector4D(0,0,0,0);
+                if(qBlue(waterMap.pixel(j,height-1-i)) > 0 && !data.at(i,j).isNull())
+                {
+                    data.set(i, j, QVector4D(0,0,0,0));
+                }
             }
         }
-    }
+    });
+    // The water isn't part of the basis definition
+    mAnalyticBasis = NoAnalyticBasis;
+    markChangedCells(previousData);
+    computeWaterDistance(waterMap);
     mWatermapFilename = filename;
     mWaterMapIsLoaded = true;
 }
 
 void TensorField::fillGridBasisField(float theta, float l)
 {
-    for(int i=0; i<mFieldSize.height() ; i++)
-    {
-        for(int j=0; j<mFieldSize.width() ; j++)
-        {
-            QVector4D tensor;
-            tensor.setX(cos(2.0*theta));
-            tensor.setY(sin(2.0*theta));
-            tensor.setZ(sin(2.0*theta));
-            tensor.setW(-cos(2.0*theta));
-            tensor *= l;
-            mData[i][j] = tensor;
-        }
-    }
+    TensorStorage previousData = mData;
+    QVector4D tensor;
+    tensor.setX(cos(2.0*theta));
+    tensor.setY(sin(2.0*theta));
+    tensor.setZ(sin(2.0*theta));
+    tensor.setW(-cos(2.0*theta));
+    tensor *= l;
+    // A sparse tiled field stores a single tensor per tile
+    mData.fill(tensor);
+    mAnalyticBasis = GridAnalyticBasis;
+    mGridBasis.a = l*cos(2.0*theta);
+    mGridBasis.b = l*sin(2.0*theta);
     mFieldIsFilled = true;
+    markChangedCells(previousData);
 }
 
 void TensorField::fillRotatingField()
 {
-    for(int i=0; i<mFieldSize.height() ; i++)
+    TensorStorage previousData = mData;
+    TensorStorage& data = mData;
+    QSize size = mFieldSize;
+    fillTilesConcurrently(mData, [&data, size](int, QRect cells)
     {
-        for(int j=0; j<mFieldSize.width() ; j++)
+        for(int i=cells.top() ; i<=cells.bottom() ; i++)
         {
-            float theta = M_PI*j/(mFieldSize.width()-1) + i*M_PI/4/(mFieldSize.height()-1);
-            QVector4D tensor;
-            tensor.setX(cos(2.0*theta));
-            tensor.setY(sin(2.0*theta));
-            tensor.setZ(sin(2.0*theta));
-            tensor.setW(-cos(2.0*theta));
-            mData[i][j] = tensor;
+            for(int j=cells.left() ; j<=cells.right() ; j++)
+            {
+                float theta = M_PI*j/(size.width()-1) + i*M_PI/4/(size.height()-1);
+                QVector4D tensor;
+                tensor.setX(cos(2.0*theta));
+                tensor.setY(sin(2.0*theta));
+                tensor.setZ(sin(2.0*theta));
+                tensor.setW(-cos(2.0*theta));
+                data.set(i, j, tensor);
+            }
         }
-    }
+    });
+    mAnalyticBasis = RotatingAnalyticBasis;
     mFieldIsFilled = true;
+    markChangedCells(previousData);
 }
 
 void TensorField::fillGridBasisField(QVector2D direction)
@@ -121,6 +205,7 @@ void TensorField::fillHeightBasisField(QString filename)
         qCritical()<<"fillHeightBasisField(): File "<<filename<<" not found";
         return;
     }
+    TensorStorage previousData = mData;
     this->setFieldSize(mHeightMap.size());
     QRgb currentPixel, nextPixelHoriz, nextPixelVert;
     QVector2D grad;
@@ -140,7 +225,7 @@ void TensorField::fillHeightBasisField(QString filename)
             // of degenerate
             if(nextPixelHoriz == currentPixel && nextPixelVert == currentPixel)
             {
-                mData[mFieldSize.width()-1-i][j] = QVector4D(1,0,0,-1);
+                mData.set(mFieldSize.width()-1-i, j, QVector4D(1,0,0,-1));
             }
             else
             {
@@ -155,11 +240,13 @@ void TensorField::fillHeightBasisField(QString filename)
                 tensor.setW(-cos(2.0*theta));
                 tensor *= r;
 
-                mData[mFieldSize.height()-1-i][j] = tensor;
+                mData.set(mFieldSize.height()-1-i, j, tensor);
             }
         }
     }
+    mAnalyticBasis = NoAnalyticBasis;
     mFieldIsFilled = true;
+    markChangedCells(previousData);
 }
 
 void TensorField::fillHeightBasisFieldSobel(QString filename)
@@ -170,6 +257,7 @@ void TensorField::fillHeightBasisFieldSobel(QString filename)
         qCritical()<<"fillHeightBasisField(): File "<<filename<<" not found";
         return;
     }
+    TensorStorage previousData = mData;
     this->setFieldSize(mHeightMap.size());
     QImage mapSobelX, mapSobelY;
     QColor pixSobelX, pixSobelY;
@@ -194,271 +282,1600 @@ void TensorField::fillHeightBasisFieldSobel(QString filename)
             tensor.setZ(sin(2.0*theta));
             tensor.setW(-cos(2.0*theta));
             tensor *= r;
-            mData[mFieldSize.width() -1 -i][j] = tensor;
+            mData.set(mFieldSize.width() -1 -i, j, tensor);
+        }
+    }
+    mAnalyticBasis = NoAnalyticBasis;
+    mFieldIsFilled = true;
+    markChangedCells(previousData);
+}
+
+void TensorField::fillRadialBasisField(QPointF center)
+{
+    TensorStorage previousData = mData;
+    TensorStorage& data = mData;
+    QSize size = mFieldSize;
+    fillTilesConcurrently(mData, [&data, size, center](int, QRect cells)
+    {
+        for(int i=cells.top() ; i<=cells.bottom() ; i++)
+        {
+            for(int j=cells.left() ; j<=cells.right() ; j++)
+            {
+                float x = ((float)j/(size.height()-1) - center.x());
+                float y = ((float)i/(size.width()-1) - center.y());
+                QVector4D tensor;
+                tensor.setX((std::pow(y,2.0)-std::pow(x,2.0)));
+                tensor.setY(-2*x*y);
+                tensor.setZ(-2*x*y);
+                tensor.setW(-(std::pow(y,2.0)-std::pow(x,2.0)));
+                data.set(i, j, tensor);
+            }
+        }
+    });
+    mAnalyticBasis = RadialAnalyticBasis;
+    mRadialBasis.center = center;
+    mFieldIsFilled = true;
+    markChangedCells(previousData);
+}
+
+void TensorField::fillDesignElementsField()
+{
+    if(mDesignElements.isEmpty())
+    {
+        qCritical()<<"fillDesignElementsField(): Add design elements first";
+        return;
+    }
+    TensorStorage previousData = mData;
+    int width = mFieldSize.width();
+    int height = mFieldSize.height();
+    // Indexed by the tiles the field is filled by
+    int tileSize = getFillTileSize(mData);
+    int tilesX = (width+tileSize-1)/tileSize;
+    int tilesY = (height+tileSize-1)/tileSize;
+
+    // Spatial index: the elements weighing on each tile
+    QVector<QVector<int> > tileElements(tilesX*tilesY);
+    for(int e=0 ; e<mDesignElements.size() ; e++)
+    {
+        QRectF bounds = getDesignElementBounds(mDesignElements[e]);
+        if(bounds.right() < 0.0 || bounds.left() > 1.0 || bounds.bottom() < 0.0 || bounds.top() > 1.0)
+        {
+            continue;
+        }
+        int left = floor(qMax(bounds.left(), 0.0)*(width-1));
+        int right = ceil(qMin(bounds.right(), 1.0)*(width-1));
+        int top = floor(qMax(bounds.top(), 0.0)*(height-1));
+        int bottom = ceil(qMin(bounds.bottom(), 1.0)*(height-1));
+        for(int ti=top/tileSize ; ti<=bottom/tileSize ; ti++)
+        {
+            for(int tj=left/tileSize ; tj<=right/tileSize ; tj++)
+            {
+                tileElements[ti*tilesX + tj].push_back(e);
+            }
+        }
+    }
+
+    const QVector<DesignElement>& elements = mDesignElements;
+    TensorStorage& data = mData;
+    fillTilesConcurrently(mData, [&data, &elements, &tileElements, width, height](int t, QRect cells)
+    {
+        const QVector<int>& tileList = tileElements[t];
+        for(int i=cells.top() ; i<=cells.bottom() ; i++)
+        {
+            for(int j=cells.left() ; j<=cells.right() ; j++)
+            {
+                QPointF position((qreal)j/qMax(1, width-1), (qreal)i/qMax(1, height-1));
+                QVector4D tensor;
+                for(int k=0 ; k<tileList.size() ; k++)
+                {
+                    tensor += evaluateDesignElement(elements[tileList[k]], position);
+                }
+                data.set(i, j, tensor);
+            }
+        }
+    });
+    mAnalyticBasis = NoAnalyticBasis;
+    mFieldIsFilled = true;
+    markChangedCells(previousData);
+}
+
+void TensorField::actionAddWatermap()
+{
+    if(!mFieldIsFilled)
+    {
+        qCritical()<<"actionApplyWatermap(): Tensor field is null. Initialize it first";
+        return;
+    }
+    QString filename = QFileDialog::getOpenFileName(0, QString("Open Image"));
+    if(filename.isEmpty())
+    {
+        return;
+    }
+    this->applyWaterMap(filename);
+
+    this->computeTensorsEigenDecomposition();
+    this->exportEigenVectorsImage(true, true);
+}
+
+void TensorField::generateGridTensorField()
+{
+    this->fillGridBasisField(M_PI/3, 1);
+
+    this->computeTensorsEigenDecomposition();
+    this->exportEigenVectorsImage(true, true);
+}
+
+void TensorField::generateHeightmapTensorField()
+{
+    QString filename = QFileDialog::getOpenFileName(0, QString("Open Image"));
+    if(filename.isEmpty())
+    {
+        return;
+    }
+    this->fillHeightBasisField(filename);
+
+    this->computeTensorsEigenDecomposition();
+    this->exportEigenVectorsImage(true, true);
+}
+
+void TensorField::generateMultiRotationTensorField()
+{
+    this->fillRotatingField();
+
+    this->computeTensorsEigenDecomposition();
+    this->exportEigenVectorsImage(true, true);
+}
+
+void TensorField::generateRadialTensorField()
+{
+    this->fillRadialBasisField(QPointF(0.5,0.5));
+
+    this->computeTensorsEigenDecomposition();
+    this->exportEigenVectorsImage(true, true);
+}
+
+void TensorField::generateDesignElementsTensorField()
+{
+    if(mDesignElements.isEmpty())
+    {
+        // A grid downtown around a radial square, and an avenue crossing them
+        addDesignElement(createGridElement(QPointF(0.5,0.5), 0.0f, M_PI/6, 0.2f));
+        addDesignElement(createRadialElement(QPointF(0.3,0.6), 30.0f));
+        addDesignElement(createGridElement(QPointF(0.7,0.3), 10.0f, M_PI/3));
+        QVector<QPointF> avenue;
+        avenue << QPointF(0.0,0.1) << QPointF(0.4,0.3) << QPointF(0.6,0.7) << QPointF(1.0,0.9);
+        addDesignElement(createPolylineElement(avenue, 100.0f));
+    }
+    this->fillDesignElementsField();
+
+    this->computeTensorsEigenDecomposition();
+    this->exportEigenVectorsImage(true, true);
+}
+
+quint64 TensorField::computeChecksum() const
+{
+    // 64-bit FNV-1a over the raw tensor values
+    quint64 hash = Q_UINT64_C(14695981039346656037);
+    auto hashBytes = [&hash](const uchar* bytes, int size)
+    {
+        for(int k=0 ; k<size ; k++)
+        {
+            hash = (hash ^ bytes[k]) * Q_UINT64_C(1099511628211);
+        }
+    };
+    if(mData.storage() == SparseTiledStorage)
+    {
+        // A tile of a single tensor is hashed as that tensor,
+        // the others as the rows of their page inside the field
+        for(int t=0 ; t<mData.tileCount() ; t++)
+        {
+            QVector4D tensor;
+            QSharedPointer<const QVector<QVector4D> > tensors = mData.tileTensors(t, tensor);
+            if(!tensors)
+            {
+                hashBytes((const uchar*)&tensor, sizeof(QVector4D));
+                continue;
+            }
+            QRect cells = mData.tileCells(t);
+            for(int i=0 ; i<cells.height() ; i++)
+            {
+                hashBytes((const uchar*)(tensors->constData() + i*SPARSE_TILE_SIZE),
+                          cells.width()*sizeof(QVector4D));
+            }
+        }
+        return hash;
+    }
+    for(int i=0; i<mData.height() ; i++)
+    {
+        hashBytes(mData.rowBytes(i), mData.rowByteCount(i));
+    }
+    return hash;
+}
+
+QVector<QRect> TensorField::getDirtyRegionSince(int version) const
+{
+    QVector<QRect> region;
+    if(version < mEditLogStartVersion)
+    {
+        region.push_back(QRect(QPoint(0,0), mFieldSize));
+        return region;
+    }
+    for(int k=0 ; k<mEditLog.size() ; k++)
+    {
+        if(mEditLog[k].version > version)
+        {
+            region.push_back(mEditLog[k].cells);
+        }
+    }
+    return region;
+}
+
+void TensorField::markRegionDirty(QRect rect)
+{
+    mVersion++;
+    if(!mEditLog.isEmpty())
+    {
+        // Merge with the last edit if the union isn't much larger,
+        // so that cell by cell edits don't flood the log
+        FieldEdit& last = mEditLog.last();
+        QRect united = last.cells.united(rect);
+        qint64 unitedArea = (qint64)united.width()*united.height();
+        qint64 area = (qint64)last.cells.width()*last.cells.height() + (qint64)rect.width()*rect.height();
+        if(unitedArea <= 2*area)
+        {
+            last.cells = united;
+            last.version = mVersion;
+            return;
+        }
+    }
+    FieldEdit edit;
+    edit.version = mVersion;
+    edit.cells = rect;
+    mEditLog.push_back(edit);
+    if(mEditLog.size() > FIELD_EDIT_LOG_SIZE)
+    {
+        mEditLogStartVersion = mEditLog.first().version;
+        mEditLog.remove(0);
+    }
+}
+
+void TensorField::markChangedCells(const TensorStorage& previousData)
+{
+    if(previousData.height() != mFieldSize.height() || previousData.width() != mFieldSize.width()
+            || previousData.storage() != mData.storage())
+    {
+        markRegionDirty(QRect(QPoint(0,0), mFieldSize));
+        return;
+    }
+    if(mData.storage() == SparseTiledStorage)
+    {
+        // Tiles whose page or single tensor is unchanged are skipped
+        QVector<QRect> changedTiles = mData.squeezeChangedTiles(previousData);
+        for(int k=0 ; k<changedTiles.size() ; k++)
+        {
+            markRegionDirty(changedTiles[k]);
+        }
+        return;
+    }
+    // Only the tiles of cells that actually changed are marked dirty
+    int tilesX = (mFieldSize.width()+FIELD_CHANGE_TILE_SIZE-1)/FIELD_CHANGE_TILE_SIZE;
+    int tilesY = (mFieldSize.height()+FIELD_CHANGE_TILE_SIZE-1)/FIELD_CHANGE_TILE_SIZE;
+    QVector<bool> changedTiles(tilesX*tilesY, false);
+    for(int i=0; i<mFieldSize.height() ; i++)
+    {
+        // Rows left untouched are still shared with the previous data
+        if(mData.sharesRow(i, previousData))
+        {
+            continue;
+        }
+        for(int j=0; j<mFieldSize.width() ; j++)
+        {
+            if(mData.at(i,j) != previousData.at(i,j))
+            {
+                changedTiles[(i/FIELD_CHANGE_TILE_SIZE)*tilesX + j/FIELD_CHANGE_TILE_SIZE] = true;
+            }
+        }
+    }
+    // Merge the changed tiles of each row of tiles
+    for(int ti=0 ; ti<tilesY ; ti++)
+    {
+        int tj = 0;
+        while(tj < tilesX)
+        {
+            if(!changedTiles[ti*tilesX + tj])
+            {
+                tj++;
+                continue;
+            }
+            int first = tj;
+            while(tj < tilesX && changedTiles[ti*tilesX + tj])
+            {
+                tj++;
+            }
+            QRect cells(first*FIELD_CHANGE_TILE_SIZE, ti*FIELD_CHANGE_TILE_SIZE,
+                        (tj-first)*FIELD_CHANGE_TILE_SIZE, FIELD_CHANGE_TILE_SIZE);
+            markRegionDirty(cells.intersected(QRect(QPoint(0,0), mFieldSize)));
+        }
+    }
+}
+
+float TensorField::getWaterDistance(int i, int j) const
+{
+    if(mData.storage() == SparseTiledStorage && mWaterDistanceTiles.height() > 0)
+    {
+        return mWaterDistanceTiles.at(i,j).x();
+    }
+    if(mWaterDistance.isEmpty())
+    {
+        return std::numeric_limits<float>::max();
+    }
+    return mWaterDistance[i*mFieldSize.width() + j];
+}
+
+void TensorField::computeWaterDistance(const QImage& waterMap)
+{
+    if(mData.storage() == SparseTiledStorage)
+    {
+        computeTiledWaterDistance(waterMap);
+        return;
+    }
+    int width = mFieldSize.width();
+    int height = mFieldSize.height();
+    qint64 cellCount = (qint64)width*height;
+    if(cellCount > std::numeric_limits<int>::max()/(int)sizeof(float))
+    {
+        qCritical()<<"computeWaterDistance(): The field is too large for a water distance map."
+                   <<"Use a sparse tiled field";
+        mWaterDistance.clear();
+        return;
+    }
+    QVector<bool> isWater(cellCount);
+    for(int i=0; i<height ; i++)
+    {
+        for(int j=0; j<width ; j++)
+        {
+            isWater[(height-1-i)*width + j] = qBlue(waterMap.pixel(j,i)) > 0;
+        }
+    }
+    // Distance to the water on land, and to the land in the water
+    QVector<float> toWater = computeSquaredDistanceTransform(isWater, mFieldSize, true);
+    QVector<float> toLand = computeSquaredDistanceTransform(isWater, mFieldSize, false);
+    mWaterDistance.resize(cellCount);
+    for(int k=0 ; k<cellCount ; k++)
+    {
+        mWaterDistance[k] = isWater[k] ? -std::sqrt(toLand[k]) : std::sqrt(toWater[k]);
+    }
+}
+
+void TensorField::computeTiledWaterDistance(const QImage& waterMap)
+{
+    int width = mFieldSize.width();
+    int height = mFieldSize.height();
+    const float farthest = std::numeric_limits<float>::max();
+    mWaterDistanceTiles = TensorStorage(SparseTiledStorage, mData.tileCache());
+    mWaterDistanceTiles.resize(mFieldSize);
+    mWaterDistanceTiles.fill(QVector4D(farthest,0,0,0));
+    TensorStorage landDistances = mWaterDistanceTiles;
+
+    // Each tile is written by a single thread
+    int tilesX = (width+SPARSE_TILE_SIZE-1)/SPARSE_TILE_SIZE;
+    int tilesY = (height+SPARSE_TILE_SIZE-1)/SPARSE_TILE_SIZE;
+    QVector<int> tiles(tilesX*tilesY);
+    for(int t=0 ; t<tiles.size() ; t++)
+    {
+        tiles[t] = t;
+    }
+    mWaterDistanceTiles.detach();
+    TensorStorage& distances = mWaterDistanceTiles;
+    QRect field(QPoint(0,0), mFieldSize);
+    QtConcurrent::blockingMap(tiles, [this, &waterMap, &distances, field, tilesX, farthest](int t)
+    {
+        QRect tile = QRect((t%tilesX)*SPARSE_TILE_SIZE, (t/tilesX)*SPARSE_TILE_SIZE,
+                           SPARSE_TILE_SIZE, SPARSE_TILE_SIZE).intersected(field);
+        // The shore within SPARSE_WATER_DISTANCE_MAX of a cell is in the window
+        QRect window = tile.adjusted(-SPARSE_WATER_DISTANCE_MAX, -SPARSE_WATER_DISTANCE_MAX,
+                                     SPARSE_WATER_DISTANCE_MAX, SPARSE_WATER_DISTANCE_MAX).intersected(field);
+        QVector<bool> isWater(window.width()*window.height());
+        int waterCells = 0;
+        for(int i=window.top() ; i<=window.bottom() ; i++)
+        {
+            for(int j=window.left() ; j<=window.right() ; j++)
+            {
+                bool water = qBlue(waterMap.pixel(j, field.height()-1-i)) > 0;
+                isWater[(i-window.top())*window.width() + j-window.left()] = water;
+                waterCells += water ? 1 : 0;
+            }
+        }
+        if(waterCells == 0)
+        {
+            return;
+        }
+        if(waterCells == isWater.size())
+        {
+            distances.fillTile(tile.top(), tile.left(), QVector4D(-farthest,0,0,0));
+            return;
+        }
+        QVector<float> toWater = computeSquaredDistanceTransform(isWater, window.size(), true, false);
+        QVector<float> toLand = computeSquaredDistanceTransform(isWater, window.size(), false, false);
+        for(int i=tile.top() ; i<=tile.bottom() ; i++)
+        {
+            for(int j=tile.left() ; j<=tile.right() ; j++)
+            {
+                int k = (i-window.top())*window.width() + j-window.left();
+                float distance = isWater[k] ? std::sqrt(toLand[k]) : std::sqrt(toWater[k]);
+                if(distance > SPARSE_WATER_DISTANCE_MAX)
+                {
+                    distance = farthest;
+                }
+                distances.set(i, j, QVector4D(isWater[k] ? -distance : distance, 0, 0, 0));
+            }
+        }
+    });
+    // Tiles away from the shore become a single distance again
+    mWaterDistanceTiles.squeezeChangedTiles(landDistances);
+}
+
+QVector<float> TensorField::computeSquaredDistanceTransform(const QVector<bool>& isWater, QSize size,
+                                                             bool toWater, bool parallel) const
+{
+    // Separable transform (Felzenszwalb and Huttenlocher): columns then rows,
+    // each line being independent
+    int width = size.width();
+    int height = size.height();
+    const float infinity = 1e20f;
+    QVector<float> distances(isWater.size());
+    for(int k=0 ; k<isWater.size() ; k++)
+    {
+        distances[k] = (isWater[k] == toWater) ? 0.0f : infinity;
+    }
+    QVector<int> columns(width);
+    for(int j=0 ; j<width ; j++)
+    {
+        columns[j] = j;
+    }
+    auto transformColumn = [&distances, width, height](int j)
+    {
+        QVector<float> f(height), d(height), z(height+1);
+        QVector<int> v(height);
+        for(int i=0 ; i<height ; i++)
+        {
+            f[i] = distances[i*width + j];
+        }
+        squaredDistanceTransform1D(f.constData(), d.data(), height, v.data(), z.data());
+        for(int i=0 ; i<height ; i++)
+        {
+            distances[i*width + j] = d[i];
+        }
+    };
+    QVector<int> rows(height);
+    for(int i=0 ; i<height ; i++)
+    {
+        rows[i] = i;
+    }
+    auto transformRow = [&distances, width](int i)
+    {
+        QVector<float> f(width), z(width+1);
+        QVector<int> v(width);
+        for(int j=0 ; j<width ; j++)
+        {
+            f[j] = distances[i*width + j];
+        }
+        squaredDistanceTransform1D(f.constData(), distances.data() + i*width, width, v.data(), z.data());
+    };
+    if(parallel)
+    {
+        QtConcurrent::blockingMap(columns, transformColumn);
+        QtConcurrent::blockingMap(rows, transformRow);
+    }
+    else
+    {
+        for(int j=0 ; j<width ; j++)
+        {
+            transformColumn(j);
+        }
+        for(int i=0 ; i<height ; i++)
+        {
+            transformRow(i);
+        }
+    }
+    return distances;
+}
+
+void TensorField::outputTensorField()
+{
+    for(int i=0; i<mFieldSize.height() ; i++)
+    {
+        for(int j=0; j<mFieldSize.width() ; j++)
+        {
+            qDebug()<<mData.at(i,j);
+        }
+        qDebug();
+    }
+}
+
+void TensorField::smoothTensorField()
+{
+    if(!mFieldIsFilled)
+    {
+        qCritical()<<"smoothTensorField(): Tensor field is null. Initialize it first";
+        return;
+    }
+
+    TensorStorage mDataSmooth = mData;
+    TensorStorage previousData = mData;
+
+    // The tiles of the smoothed copy are written concurrently,
+    // while all of them read the field
+    const TensorStorage& data = mData;
+    QRect inner(1, 1, mFieldSize.width()-2, mFieldSize.height()-2);
+    fillTilesConcurrently(mDataSmooth, [&data, &mDataSmooth, inner](int, QRect cells)
+    {
+        cells = cells.intersected(inner);
+        for(int i=cells.top() ; i<=cells.bottom() ; i++)
+        {
+            for(int j=cells.left() ; j<=cells.right() ; j++)
+            {
+                mDataSmooth.set(i, j, 1.0f/9.0f*(data.at(i+1,j-1) + data.at(i+1,j) + data.at(i+1,j+1) +
+                                                 data.at(i,j-1)   + data.at(i,j)   + data.at(i,j+1) +
+                                                 data.at(i-1,j-1) + data.at(i-1,j) + data.at(i-1,j+1)));
+            }
+        }
+    });
+    mData = mDataSmooth;
+    mAnalyticBasis = NoAnalyticBasis;
+    markChangedCells(previousData);
+
+    this->computeTensorsEigenDecomposition();
+    this->exportEigenVectorsImage(true, true);
+
+}
+
+void TensorField::setAnalyticEvaluation(bool analytic)
+{
+    if(analytic == mAnalyticEvaluation)
+    {
+        return;
+    }
+    mAnalyticEvaluation = analytic;
+    // The traced field changes, as if the whole grid was edited
+    if(mAnalyticBasis != NoAnalyticBasis)
+    {
+        markRegionDirty(QRect(QPoint(0,0), mFieldSize));
+    }
+}
+
+QPixmap TensorField::exportEigenVectorsImage(bool drawVector1, bool drawVector2,
+                                              QColor color1, QColor color2)
+{
+    int imageSize = 512;
+    if(!mFieldIsFilled)
+    {
+        QPixmap pixmap(imageSize,imageSize);
+        pixmap.fill();
+        qCritical()<<"exportEigenVectorsImage(): Tensor field is empty";
+        return pixmap;
+    }
+
+    bool sameGlyphs = mEigenVectorsImageVersion != -1
+            && mEigenVectorsImage.size() == QSize(imageSize,imageSize)
+            && mEigenVectorsImageDrawVector1 == drawVector1
+            && mEigenVectorsImageDrawVector2 == drawVector2
+            && mEigenVectorsImageColor1 == color1
+            && mEigenVectorsImageColor2 == color2;
+    if(sameGlyphs && mEigenVectorsImageVersion == mVersion)
+    {
+        // Nothing changed since the last image
+        return mEigenVectorsImage;
+    }
+
+    // The glyphs are read from the level of the pyramid matching their spacing
+    updatePyramidLevel(getGlyphPyramidLevel(32));
+
+    if(!sameGlyphs)
+    {
+        mEigenVectorsImage = QPixmap(imageSize,imageSize);
+        mEigenVectorsImage.fill();
+        QPainter painter(&mEigenVectorsImage);
+        drawEigenVectors(painter, QSize(imageSize,imageSize), QRectF(),
+                         drawVector1, drawVector2, color1, color2);
+    }
+    else
+    {
+        // Only redraw the glyphs around the edited cells. Clearing as far as
+        // a glyph reaches also removes the old glyphs of the edited cells
+        QPainter painter(&mEigenVectorsImage);
+        float dv = imageSize/(float)mFieldSize.height();
+        float du = imageSize/(float)mFieldSize.width();
+        float reachI = qMax(1, mFieldSize.height()/32)*dv;
+        float reachJ = qMax(1, mFieldSize.width()/32)*du;
+        QVector<QRect> dirtyRegion = getDirtyRegionSince(mEigenVectorsImageVersion);
+        for(int k=0 ; k<dirtyRegion.size() ; k++)
+        {
+            const QRect& cells = dirtyRegion[k];
+            // Rows are counted from the bottom of the image
+            QRectF rect(cells.left()*du, imageSize - (cells.bottom()+1)*dv,
+                        cells.width()*du, cells.height()*dv);
+            rect.adjust(-reachJ, -reachI, reachJ, reachI);
+            painter.setClipRect(rect);
+            painter.fillRect(rect, Qt::white);
+            drawEigenVectors(painter, QSize(imageSize,imageSize), rect,
+                             drawVector1, drawVector2, color1, color2);
+        }
+    }
+    mEigenVectorsImageVersion = mVersion;
+    mEigenVectorsImageDrawVector1 = drawVector1;
+    mEigenVectorsImageDrawVector2 = drawVector2;
+    mEigenVectorsImageColor1 = color1;
+    mEigenVectorsImageColor2 = color2;
+
+    emit newTensorFieldImage(mEigenVectorsImage);
+    return mEigenVectorsImage;
+}
+
+void TensorField::drawEigenVectors(QPainter& painter, QSize imageSize, QRectF visibleRect,
+                                   bool drawVector1, bool drawVector2,
+                                   QColor color1, QColor color2,
+                                   int numberOfTensorsToDisplay) const
+{
+    if(!mFieldIsFilled)
+    {
+        return;
+    }
+    QPen pen1(color1);
+    QPen pen2(color2);
+
+    float dv = imageSize.height()/(float)mFieldSize.height();
+    float du = imageSize.width()/(float)mFieldSize.width();
+    QVector2D origin(du/2.0f, dv/2.0f);
+
+    int scaleI = qMax(1, mFieldSize.height()/numberOfTensorsToDisplay);
+    int scaleJ = qMax(1, mFieldSize.width()/numberOfTensorsToDisplay);
+    // Each glyph shows the average of the cells around it, from the coarsest
+    // current level of the pyramid that is fine enough
+    int level = getGlyphPyramidLevel(numberOfTensorsToDisplay);
+    while(level > 0 && !isPyramidLevelCurrent(level))
+    {
+        level--;
+    }
+
+    // Only visit the glyphs that can touch the visible part of the image.
+    // A glyph spans at most one sampling interval around its base.
+    int iMin = 0, iMax = mFieldSize.height()-1;
+    int jMin = 0, jMax = mFieldSize.width()-1;
+    if(!visibleRect.isNull())
+    {
+        // Rows are counted from the bottom of the image
+        iMin = qMax(iMin, (int)std::floor((imageSize.height()-visibleRect.bottom())/dv) - scaleI);
+        iMax = qMin(iMax, (int)std::ceil((imageSize.height()-visibleRect.top())/dv) + scaleI);
+        jMin = qMax(jMin, (int)std::floor(visibleRect.left()/du) - scaleJ);
+        jMax = qMin(jMax, (int)std::ceil(visibleRect.right()/du) + scaleJ);
+        // Stay on the sampling grid
+        iMin -= iMin % scaleI;
+        jMin -= jMin % scaleJ;
+    }
+
+    // When the decomposition is current, the glyphs of a row are fetched at once
+    bool eigenIsCurrent = (level == 0 && isPyramidLevelCurrent(0));
+    QVector<QPointF> rowCells;
+    QVector<QVector2D> rowMajorVectors, rowMinorVectors;
+    for(int i=iMin; i<=iMax ; i=i+scaleI)
+    {
+        if(eigenIsCurrent)
+        {
+            rowCells.clear();
+            for(int j=jMin; j<=jMax ; j=j+scaleJ)
+            {
+                rowCells.push_back(QPointF(j,i));
+            }
+            rowMajorVectors.resize(rowCells.size());
+            rowMinorVectors.resize(rowCells.size());
+            sampleEigenVectors(rowCells.constData(), rowCells.size(), true, rowMajorVectors.data());
+            sampleEigenVectors(rowCells.constData(), rowCells.size(), false, rowMinorVectors.data());
+        }
+        for(int j=jMin, glyph=0; j<=jMax ; j=j+scaleJ, glyph++)
+        {
+            QVector2D majorVector, minorVector;
+            if(eigenIsCurrent)
+            {
+                majorVector = rowMajorVectors[glyph];
+                minorVector = rowMinorVectors[glyph];
+            }
+            else
+            {
+                QVector4D eigenVectors = (level > 0) ? getLevelEigenVectors(level, i >> level, j >> level)
+                                                     : getTensorEigenVectors(mData.at(i,j));
+                majorVector = getFirstVector(eigenVectors);
+                minorVector = getSecondVector(eigenVectors);
+            }
+            if(drawVector1)
+            {
+                painter.setPen(pen1);
+                QVector2D base = origin + QVector2D(j*du, i*dv);
+                QVector2D eigenVector = majorVector;
+                eigenVector.setX(eigenVector.x()*du/2.0f*scaleJ*0.8);
+                eigenVector.setY(eigenVector.y()*dv/2.0f*scaleI*0.8);
+                QVector2D tip = base + eigenVector;
+                base -= eigenVector;
+                roundVector2D(base);
+                roundVector2D(tip);
+                // Flip the y axis because the painter system has its origin
+                // on the top left corner and the y axis points down
+                painter.drawLine(base.x(),imageSize.height() - base.y(),
+                                 tip.x(),imageSize.height() - tip.y());
+            }
+            if(drawVector2)
+            {
+                painter.setPen(pen2);
+                QVector2D base = origin + QVector2D(j*du, i*dv);
+                QVector2D eigenVector = minorVector;
+                eigenVector.setX(eigenVector.x()*du/2.0f*scaleJ*0.8);
+                eigenVector.setY(eigenVector.y()*dv/2.0f*scaleI*0.8);
+                QVector2D tip = base + eigenVector;
+                base -= eigenVector;
+                roundVector2D(base);
+                roundVector2D(tip);
+                // Flip the y axis because the painter system has its origin
+                // on the top left corner and the y axis points down
+                painter.drawLine(base.x(),imageSize.height() - base.y(),
+                                 tip.x(),imageSize.height() - tip.y());
+            }
+        }
+    }
+}
+
+qint64 TensorField::computeTensorsEigenDecomposition()
+{
+    if(!mFieldIsFilled)
+    {
+        qCritical()<<"computeTensorsEigenDecomposition(): Fill the tensor field before computing the eigen vectors";
+        return -1;
+    }
+    if(mEigenIsComputed && mEigenVersion == mVersion)
+    {
+        // Nothing changed since the last decomposition
+        return mNumberOfDegeneratePoints;
+    }
+    // Only the edited cells are decomposed again, unless the containers
+    // have to be initialized or resized
+    QVector<QRect> dirtyRegion;
+    if(!mEigenIsComputed || mEigenSize != mFieldSize)
+    {
+        allocateEigenData();
+        if(mEigenSize != mFieldSize)
+        {
+            mEigenIsComputed = false;
+            return -1;
+        }
+        mDegeneratePointsPerRow.fill(0, mFieldSize.height());
+        dirtyRegion.push_back(QRect(QPoint(0,0), mFieldSize));
+    }
+    else
+    {
+        dirtyRegion = getDirtyRegionSince(mEigenVersion);
+    }
+
+    // Columns to decompose in each row
+    QVector<QVector<QPair<int,int> > > dirtyColumns(mFieldSize.height());
+    QRect field(QPoint(0,0), mFieldSize);
+    for(int k=0 ; k<dirtyRegion.size() ; k++)
+    {
+        QRect cells = dirtyRegion[k].intersected(field);
+        for(int i=cells.top() ; i<=cells.bottom() ; i++)
+        {
+            dirtyColumns[i].push_back(qMakePair(cells.left(), cells.right()));
+        }
+    }
+    QVector<int> rows;
+    for(int i=0; i<mFieldSize.height() ; i++)
+    {
+        if(!dirtyColumns[i].isEmpty())
+        {
+            rows.push_back(i);
+        }
+    }
+
+    // Fill the internal containers, rows in parallel. A sparse tiled field
+    // has none. The degenerate points of each row are counted again
+    bool compact = (mData.storage() == CompactStorage);
+    bool sparse = (mData.storage() == SparseTiledStorage);
+    QVector4D* eigenVectors = mEigenVectors.data();
+    QVector2D* eigenValues = mEigenValues.data();
+    quint16* angles = mEigenAngles.data();
+    quint16* magnitudes = mEigenMagnitudes.data();
+    QtConcurrent::blockingMap(rows, [this, &dirtyColumns, compact, sparse, eigenVectors, eigenValues,
+                                     angles, magnitudes](int i)
+    {
+        const QVector<QPair<int,int> >& columns = dirtyColumns[i];
+        for(int c=0 ; c<columns.size() && !sparse ; c++)
+        {
+            for(int j=columns[c].first; j<=columns[c].second ; j++)
+            {
+                int offset = getEigenOffset(i,j);
+                QVector4D tensor = mData.at(i,j);
+                if(compact)
+                {
+                    encodeEigenData(getTensorEigenVectors(tensor), getTensorEigenValues(tensor),
+                                    angles[offset], magnitudes[offset]);
+                }
+                else
+                {
+                    eigenVectors[offset] = getTensorEigenVectors(tensor);
+                    eigenValues[offset] = getTensorEigenValues(tensor);
+                }
+            }
+        }
+        int degeneratePoints = 0;
+        for(int j=0; j<mFieldSize.width() ; )
+        {
+            // The tiles of a single tensor are counted at once
+            QVector4D tensor;
+            int run = mData.uniformRun(i, j, tensor);
+            if(run > 0)
+            {
+                degeneratePoints += isDegenerate(tensor) ? run : 0;
+                j += run;
+                continue;
+            }
+            if(isDegenerate(readEigenVectors(i,j)))
+            {
+                degeneratePoints++;
+            }
+            j++;
+        }
+        mDegeneratePointsPerRow[i] = degeneratePoints;
+    });
+    mNumberOfDegeneratePoints = 0;
+    for(int i=0; i<mFieldSize.height() ; i++)
+    {
+        mNumberOfDegeneratePoints += mDegeneratePointsPerRow[i];
+    }
+    extractDegeneratePoints(dirtyRegion);
+    mEigenIsComputed = true;
+    mEigenVersion = mVersion;
+    return mNumberOfDegeneratePoints;
+}
+
+void TensorField::extractDegeneratePoints(const QVector<QRect>& dirtyRegion)
+{
+    int tilesX = (mFieldSize.width()+FIELD_CHANGE_TILE_SIZE-1)/FIELD_CHANGE_TILE_SIZE;
+    int tilesY = (mFieldSize.height()+FIELD_CHANGE_TILE_SIZE-1)/FIELD_CHANGE_TILE_SIZE;
+    QVector<bool> dirtyTiles(tilesX*tilesY, false);
+    if(mDegeneratePointTiles.size() != tilesX*tilesY || mDegeneratePointTilesX != tilesX)
+    {
+        mDegeneratePointTiles = QVector<QVector<DegeneratePoint> >(tilesX*tilesY);
+        mDegeneratePointTilesX = tilesX;
+        dirtyTiles.fill(true);
+    }
+    // The cells and the loops around the vertices reach the neighbouring cells
+    QRect field(QPoint(0,0), mFieldSize);
+    for(int k=0 ; k<dirtyRegion.size() ; k++)
+    {
+        QRect cells = dirtyRegion[k].adjusted(-1,-1,1,1).intersected(field);
+        if(cells.isEmpty())
+        {
+            continue;
+        }
+        for(int ti=cells.top()/FIELD_CHANGE_TILE_SIZE ; ti<=cells.bottom()/FIELD_CHANGE_TILE_SIZE ; ti++)
+        {
+            for(int tj=cells.left()/FIELD_CHANGE_TILE_SIZE ; tj<=cells.right()/FIELD_CHANGE_TILE_SIZE ; tj++)
+            {
+                dirtyTiles[ti*tilesX + tj] = true;
+            }
+        }
+    }
+    QVector<int> tiles;
+    for(int t=0 ; t<dirtyTiles.size() ; t++)
+    {
+        if(dirtyTiles[t])
+        {
+            tiles.push_back(t);
+        }
+    }
+    // Each tile only writes its own list
+    QtConcurrent::blockingMap(tiles, [this, tilesX](int t)
+    {
+        QRect tile((t%tilesX)*FIELD_CHANGE_TILE_SIZE, (t/tilesX)*FIELD_CHANGE_TILE_SIZE,
+                   FIELD_CHANGE_TILE_SIZE, FIELD_CHANGE_TILE_SIZE);
+        mDegeneratePointTiles[t] = extractTileDegeneratePoints(tile.intersected(QRect(QPoint(0,0), mFieldSize)));
+    });
+}
+
+QVector<DegeneratePoint> TensorField::extractTileDegeneratePoints(QRect tile) const
+{
+    QVector<DegeneratePoint> points;
+    int width = mFieldSize.width();
+    int height = mFieldSize.height();
+    // The cells and loops of the tile reach the next row and column. Tensors
+    // that are all equal have no degenerate point between them
+    QVector4D tensor;
+    if(mData.isUniform(tile.adjusted(-1,-1,1,1).intersected(QRect(QPoint(0,0), mFieldSize)), tensor))
+    {
+        return points;
+    }
+    QVector<QVector4D> loop(4);
+    for(int i=tile.top() ; i<=tile.bottom() ; i++)
+    {
+        for(int j=tile.left() ; j<=tile.right() ; j++)
+        {
+            int winding = 0;
+            QPointF position;
+            if(isDegenerate(mData.at(i,j)))
+            {
+                // Degenerate vertex: only an isolated one is a degenerate point,
+                // the others are in the water or in an empty area
+                if(i == 0 || j == 0 || i == height-1 || j == width-1)
+                {
+                    continue;
+                }
+                QVector<QVector4D> ring;
+                const int ringI[8] = {-1,-1,-1,0,1,1,1,0};
+                const int ringJ[8] = {-1,0,1,1,1,0,-1,-1};
+                bool isIsolated = true;
+                for(int k=0 ; k<8 && isIsolated ; k++)
+                {
+                    ring.push_back(mData.at(i+ringI[k], j+ringJ[k]));
+                    isIsolated = !isDegenerate(ring.last());
+                }
+                if(!isIsolated)
+                {
+                    continue;
+                }
+                winding = computeTensorWinding(ring);
+                position = QPointF(j, i);
+            }
+            else if(i < height-1 && j < width-1)
+            {
+                // Cell (i,j)-(i+1,j+1), its corners counterclockwise in (j,i)
+                loop[0] = mData.at(i,j);
+                loop[1] = mData.at(i,j+1);
+                loop[2] = mData.at(i+1,j+1);
+                loop[3] = mData.at(i+1,j);
+                if(isDegenerate(loop[1]) || isDegenerate(loop[2]) || isDegenerate(loop[3]))
+                {
+                    continue;
+                }
+                winding = computeTensorWinding(loop);
+                if(winding == 0)
+                {
+                    continue;
+                }
+                // Where the bilinear interpolation of (a,b) is null (Newton's method)
+                float u = 0.5f, v = 0.5f;
+                for(int iteration=0 ; iteration<8 ; iteration++)
+                {
+                    QVector4D f = (1-u)*(1-v)*loop[0] + u*(1-v)*loop[1] + u*v*loop[2] + (1-u)*v*loop[3];
+                    QVector4D fu = (1-v)*(loop[1]-loop[0]) + v*(loop[2]-loop[3]);
+                    QVector4D fv = (1-u)*(loop[3]-loop[0]) + u*(loop[2]-loop[1]);
+                    float determinant = fu.x()*fv.y() - fv.x()*fu.y();
+                    if(isFuzzyNull(determinant))
+                    {
+                        break;
+                    }
+                    u = qBound(0.0f, u - (f.x()*fv.y() - fv.x()*f.y())/determinant, 1.0f);
+                    v = qBound(0.0f, v - (fu.x()*f.y() - f.x()*fu.y())/determinant, 1.0f);
+                }
+                position = QPointF(j+u, i+v);
+            }
+            if(winding == 1 || winding == -1)
+            {
+                DegeneratePoint point;
+                point.position = position;
+                point.type = (winding == 1) ? Wedge : Trisector;
+                point.separatrixAngles = computeSeparatrixAngles(position);
+                points.push_back(point);
+            }
+        }
+    }
+    return points;
+}
+
+QVector<float> TensorField::computeSeparatrixAngles(QPointF position) const
+{
+    // Around the point, a separatrix leaves in the directions where the major
+    // eigenvector is radial. The major eigenvector of a tensor (a,b) makes
+    // the angle atan2(b,a)/2, found on a small circle around the point
+    const int sampleCount = 72;
+    const float radius = 1.5f;
+    QVector<float> angles;
+    QVector<float> offsets(sampleCount+1);
+    for(int k=0 ; k<=sampleCount ; k++)
+    {
+        float theta = 2*M_PI*k/sampleCount;
+        QVector4D tensor = getInterpolatedTensor(position + radius*QPointF(cos(theta), sin(theta)));
+        if(isDegenerate(tensor))
+        {
+            return QVector<float>();
+        }
+        // Angle between the eigenvector line and the radial direction, in ]-pi/2,pi/2]
+        float offset = 0.5f*atan2(tensor.y(), tensor.x()) - theta;
+        offset = offset - M_PI*ceil(offset/M_PI - 0.5f);
+        offsets[k] = offset;
+    }
+    for(int k=0 ; k<sampleCount ; k++)
+    {
+        // Sign changes, away from the jumps at pi/2 where the eigenvector is tangent
+        if(offsets[k]*offsets[k+1] <= 0 && fabs(offsets[k]) < M_PI/4 && fabs(offsets[k+1]) < M_PI/4
+                && offsets[k] != offsets[k+1])
+        {
+            float t = offsets[k]/(offsets[k]-offsets[k+1]);
+            angles.push_back(2*M_PI*(k+t)/sampleCount);
+        }
+    }
+    return angles;
+}
+
+QVector<DegeneratePoint> TensorField::getDegeneratePoints() const
+{
+    return getDegeneratePointsIn(QRectF(QPointF(0,0), QSizeF(mFieldSize)));
+}
+
+QVector<DegeneratePoint> TensorField::getDegeneratePointsIn(QRectF cells) const
+{
+    QVector<DegeneratePoint> points;
+    if(mDegeneratePointTilesX == 0 || cells.isEmpty())
+    {
+        return points;
+    }
+    int tilesY = mDegeneratePointTiles.size()/mDegeneratePointTilesX;
+    int tiMin = qMax(0, (int)floor(cells.top()/FIELD_CHANGE_TILE_SIZE));
+    int tiMax = qMin(tilesY-1, (int)floor(cells.bottom()/FIELD_CHANGE_TILE_SIZE));
+    int tjMin = qMax(0, (int)floor(cells.left()/FIELD_CHANGE_TILE_SIZE));
+    int tjMax = qMin(mDegeneratePointTilesX-1, (int)floor(cells.right()/FIELD_CHANGE_TILE_SIZE));
+    for(int ti=tiMin ; ti<=tiMax ; ti++)
+    {
+        for(int tj=tjMin ; tj<=tjMax ; tj++)
+        {
+            const QVector<DegeneratePoint>& tilePoints = mDegeneratePointTiles[ti*mDegeneratePointTilesX + tj];
+            for(int k=0 ; k<tilePoints.size() ; k++)
+            {
+                if(cells.contains(tilePoints[k].position))
+                {
+                    points.push_back(tilePoints[k]);
+                }
+            }
+        }
+    }
+    return points;
+}
+
+QVector4D TensorField::getInterpolatedTensor(QPointF position) const
+{
+    float x = qBound(0.0, position.x(), (double)mFieldSize.width()-1);
+    float y = qBound(0.0, position.y(), (double)mFieldSize.height()-1);
+    int j = qMin((int)x, mFieldSize.width()-2);
+    int i = qMin((int)y, mFieldSize.height()-2);
+    if(i < 0 || j < 0)
+    {
+        return mData.at(qMax(i,0),qMax(j,0));
+    }
+    float u = x - j, v = y - i;
+    return (1-u)*(1-v)*mData.at(i,j) + u*(1-v)*mData.at(i,j+1)
+            + (1-u)*v*mData.at(i+1,j) + u*v*mData.at(i+1,j+1);
+}
+
+QVector4D TensorField::readEigenVectors(int i, int j) const
+{
+    if(mData.storage() == SparseTiledStorage)
+    {
+        QVector4D tensor = mData.at(i,j);
+        return isDegenerate(tensor) ? QVector4D(0,0,0,0) : getTracelessEigenVectors(tensor);
+    }
+    int offset = getEigenOffset(i,j);
+    if(mData.storage() == CompactStorage)
+    {
+        return decodeEigenVectors(mEigenAngles[offset], mEigenMagnitudes[offset]);
+    }
+    return mEigenVectors[offset];
+}
+
+QVector4D TensorField::getEigenVectors(int i, int j) const
+{
+    if(!mEigenIsComputed)
+    {
+        qCritical()<<"Unable to get the eigen vectors."
+                   <<"First compute tensors Eigen decomposition";
+        return QVector4D();
+    }
+    else
+    {
+        return readEigenVectors(i,j);
+    }
+}
+
+QVector2D TensorField::getEigenValues(int i, int j) const
+{
+    if(!mEigenIsComputed)
+    {
+        qCritical()<<"getEigenValues(): Unable to get the eigen values."
+                   <<"First compute tensors Eigen decomposition";
+        return QVector2D();
+    }
+    else
+    {
+        if(mData.storage() == SparseTiledStorage)
+        {
+            return getTensorEigenValues(mData.at(i,j));
+        }
+        int offset = getEigenOffset(i,j);
+        if(mData.storage() == CompactStorage)
+        {
+            return decodeEigenValues(mEigenMagnitudes[offset]);
+        }
+        return mEigenValues[offset];
+    }
+}
+
+QVector2D TensorField::getMajorEigenVector(int i, int j) const
+{
+    return getFirstVector(this->getEigenVectors(i,j));
+}
+
+QVector2D TensorField::getMinorEigenVector(int i, int j) const
+{
+    return getSecondVector(this->getEigenVectors(i,j));
+}
+
+void TensorField::sampleEigenVectors(const QPointF* cells, int count, bool major, QVector2D* vectors) const
+{
+    if(!mEigenIsComputed)
+    {
+        qCritical()<<"sampleEigenVectors(): Unable to get the eigen vectors."
+                   <<"First compute tensors Eigen decomposition";
+        for(int k=0 ; k<count ; k++)
+        {
+            vectors[k] = QVector2D();
+        }
+        return;
+    }
+    if(mData.storage() != FullPrecisionStorage)
+    {
+        // The eigenvectors are decoded one by one from their angle, or their tensor
+        for(int k=0 ; k<count ; k++)
+        {
+            int i = qBound(0, qRound(cells[k].y()), mEigenSize.height()-1);
+            int j = qBound(0, qRound(cells[k].x()), mEigenSize.width()-1);
+            QVector4D eigenVectors = readEigenVectors(i,j);
+            vectors[k] = major ? getFirstVector(eigenVectors) : getSecondVector(eigenVectors);
+        }
+        return;
+    }
+    Q_STATIC_ASSERT(sizeof(QVector4D) == 4*sizeof(float));
+    const float* eigenVectors = reinterpret_cast<const float*>(mEigenVectors.constData());
+    // The major eigenvector is in the first two floats of a cell, the minor in the last two
+    int component = major ? 0 : 2;
+    int offsets[8];
+    int k = 0;
+    while(k < count)
+    {
+        int batch = qMin(8, count-k);
+        for(int b=0 ; b<batch ; b++)
+        {
+            int i = qBound(0, qRound(cells[k+b].y()), mEigenSize.height()-1);
+            int j = qBound(0, qRound(cells[k+b].x()), mEigenSize.width()-1);
+            offsets[b] = 4*getEigenOffset(i,j) + component;
+        }
+#if defined(__AVX2__)
+        if(batch == 8)
+        {
+            __m256i indices = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offsets));
+            __m256 x = _mm256_i32gather_ps(eigenVectors, indices, 4);
+            __m256 y = _mm256_i32gather_ps(eigenVectors + 1, indices, 4);
+            float xs[8], ys[8];
+            _mm256_storeu_ps(xs, x);
+            _mm256_storeu_ps(ys, y);
+            for(int b=0 ; b<8 ; b++)
+            {
+                vectors[k+b] = QVector2D(xs[b], ys[b]);
+            }
+            k += 8;
+            continue;
+        }
+#endif
+        for(int b=0 ; b<batch ; b++)
+        {
+            vectors[k+b] = QVector2D(eigenVectors[offsets[b]], eigenVectors[offsets[b]+1]);
+        }
+        k += batch;
+    }
+}
+
+void TensorField::setMemoryLayout(FieldMemoryLayout layout)
+{
+    if(layout == mMemoryLayout)
+    {
+        return;
+    }
+    if(mEigenSize.isEmpty() || mData.storage() == SparseTiledStorage)
+    {
+        mMemoryLayout = layout;
+        return;
+    }
+    QVector<QVector4D> eigenVectors = mEigenVectors;
+    QVector<QVector2D> eigenValues = mEigenValues;
+    QVector<quint16> angles = mEigenAngles;
+    QVector<quint16> magnitudes = mEigenMagnitudes;
+    QVector<int> previousOffsets;
+    previousOffsets.reserve(mEigenSize.width()*mEigenSize.height());
+    for(int i=0 ; i<mEigenSize.height() ; i++)
+    {
+        for(int j=0 ; j<mEigenSize.width() ; j++)
+        {
+            previousOffsets.push_back(getEigenOffset(i,j));
         }
     }
-    mFieldIsFilled = true;
-}
-
-void TensorField::fillRadialBasisField(QPointF center)
-{
-    float x;
-    float y;
-    for(int i=0; i<mFieldSize.height() ; i++)
+    mMemoryLayout = layout;
+    allocateEigenData();
+    for(int i=0 ; i<mEigenSize.height() ; i++)
     {
-        for(int j=0; j<mFieldSize.width() ; j++)
+        for(int j=0 ; j<mEigenSize.width() ; j++)
         {
-            x = ((float)j/(mFieldSize.height()-1) - center.x());
-            y = ((float)i/(mFieldSize.width()-1) - center.y());
-            QVector4D tensor;
-            tensor.setX((std::pow(y,2.0)-std::pow(x,2.0)));
-            tensor.setY(-2*x*y);
-            tensor.setZ(-2*x*y);
-            tensor.setW(-(std::pow(y,2.0)-std::pow(x,2.0)));
-            mData[i][j] = tensor;
+            int previousOffset = previousOffsets[i*mEigenSize.width() + j];
+            if(mData.storage() == CompactStorage)
+            {
+                mEigenAngles[getEigenOffset(i,j)] = angles[previousOffset];
+                mEigenMagnitudes[getEigenOffset(i,j)] = magnitudes[previousOffset];
+            }
+            else
+            {
+                mEigenVectors[getEigenOffset(i,j)] = eigenVectors[previousOffset];
+                mEigenValues[getEigenOffset(i,j)] = eigenValues[previousOffset];
+            }
         }
     }
-    mFieldIsFilled = true;
 }
 
-void TensorField::actionAddWatermap()
+void TensorField::allocateEigenData()
 {
-    if(!mFieldIsFilled)
+    mEigenSize = mFieldSize;
+    mLayoutBlocksX = (mFieldSize.width()+FIELD_LAYOUT_BLOCK_SIZE-1)/FIELD_LAYOUT_BLOCK_SIZE;
+    if(mData.storage() == SparseTiledStorage)
     {
-        qCritical()<<"actionApplyWatermap(): Tensor field is null. Initialize it first";
+        mEigenVectors.clear();
+        mEigenValues.clear();
+        mEigenAngles.clear();
+        mEigenMagnitudes.clear();
         return;
     }
-    QString filename = QFileDialog::getOpenFileName(0, QString("Open Image"));
-    if(filename.isEmpty())
+    qint64 size = (qint64)mFieldSize.width()*mFieldSize.height();
+    if(mMemoryLayout == BlockedLayout)
     {
-        return;
+        // The blocks on the right and bottom edges are padded
+        qint64 blocksY = (mFieldSize.height()+FIELD_LAYOUT_BLOCK_SIZE-1)/FIELD_LAYOUT_BLOCK_SIZE;
+        size = mLayoutBlocksX*blocksY*FIELD_LAYOUT_BLOCK_SIZE*FIELD_LAYOUT_BLOCK_SIZE;
+    }
+    if(size > std::numeric_limits<int>::max()/(int)sizeof(QVector4D))
+    {
+        qCritical()<<"allocateEigenData(): The field is too large for its eigen data."
+                   <<"Use a sparse tiled field";
+        size = 0;
+        mEigenSize = QSize();
+    }
+    if(mData.storage() == CompactStorage)
+    {
+        mEigenVectors.clear();
+        mEigenValues.clear();
+        mEigenAngles.fill(0, size);
+        mEigenMagnitudes.fill(0, size);
+    }
+    else
+    {
+        mEigenVectors.fill(QVector4D(), size);
+        mEigenValues.fill(QVector2D(), size);
+        mEigenAngles.clear();
+        mEigenMagnitudes.clear();
     }
-    this->applyWaterMap(filename);
-
-    this->computeTensorsEigenDecomposition();
-    this->exportEigenVectorsImage(true, true);
 }
 
-void TensorField::generateGridTensorField()
+int TensorField::getPyramidLevelCount() const
 {
-    this->fillGridBasisField(M_PI/3, 1);
-
-    this->computeTensorsEigenDecomposition();
-    this->exportEigenVectorsImage(true, true);
+    int levelCount = 1;
+    QSize size = mFieldSize;
+    while(size.width() > 1 || size.height() > 1)
+    {
+        size = QSize((size.width()+1)/2, (size.height()+1)/2);
+        levelCount++;
+    }
+    return levelCount;
 }
 
-void TensorField::generateHeightmapTensorField()
+QSize TensorField::getPyramidLevelSize(int level) const
 {
-    QString filename = QFileDialog::getOpenFileName(0, QString("Open Image"));
-    if(filename.isEmpty())
+    QSize size = mFieldSize;
+    for(int k=0 ; k<level ; k++)
     {
-        return;
+        size = QSize((size.width()+1)/2, (size.height()+1)/2);
     }
-    this->fillHeightBasisField(filename);
-
-    this->computeTensorsEigenDecomposition();
-    this->exportEigenVectorsImage(true, true);
+    return size;
 }
 
-void TensorField::generateMultiRotationTensorField()
+int TensorField::getPyramidLevelForScale(float cells) const
 {
-    this->fillRotatingField();
-
-    this->computeTensorsEigenDecomposition();
-    this->exportEigenVectorsImage(true, true);
+    int levelCount = getPyramidLevelCount();
+    int level = 0;
+    while(level+1 < levelCount && (1 << (level+1)) <= cells)
+    {
+        level++;
+    }
+    return level;
 }
 
-void TensorField::generateRadialTensorField()
+int TensorField::getGlyphPyramidLevel(int numberOfTensorsToDisplay) const
 {
-    this->fillRadialBasisField(QPointF(0.5,0.5));
-
-    this->computeTensorsEigenDecomposition();
-    this->exportEigenVectorsImage(true, true);
+    int scaleI = qMax(1, mFieldSize.height()/numberOfTensorsToDisplay);
+    int scaleJ = qMax(1, mFieldSize.width()/numberOfTensorsToDisplay);
+    return getPyramidLevelForScale(qMin(scaleI, scaleJ));
 }
 
-void TensorField::outputTensorField()
+void TensorField::updatePyramidLevel(int level)
 {
-    for(int i=0; i<mFieldSize.height() ; i++)
+    level = qMin(level, getPyramidLevelCount()-1);
+    if(level <= 0 || !mFieldIsFilled)
     {
-        for(int j=0; j<mFieldSize.width() ; j++)
+        return;
+    }
+    if(mPyramid.size() < level+1)
+    {
+        mPyramid.resize(level+1);
+    }
+    if(mData.storage() == SparseTiledStorage)
+    {
+        updateSparsePyramidLevel(level);
+        return;
+    }
+    // Each level averages the tensors of the previous one, so the
+    // eigenvectors of the levels in between aren't needed
+    for(int k=1 ; k<=level ; k++)
+    {
+        FieldLevel& current = mPyramid[k];
+        QSize size = getPyramidLevelSize(k);
+        QVector<QRect> dirtyRegion;
+        if(current.size != size)
         {
-            qDebug()<<mData[i][j];
+            qint64 cellCount = (qint64)size.width()*size.height();
+            if(cellCount > std::numeric_limits<int>::max()/(int)sizeof(QVector4D))
+            {
+                qCritical()<<"updatePyramidLevel(): The level is too large. Use a sparse tiled field";
+                return;
+            }
+            current.size = size;
+            current.tensors.fill(QVector4D(), cellCount);
+            current.sparseTensors = TensorStorage();
+            current.eigenVectors.clear();
+            current.eigenVersion = -1;
+            dirtyRegion.push_back(QRect(QPoint(0,0), mFieldSize));
         }
-        qDebug();
+        else if(current.version != mVersion)
+        {
+            dirtyRegion = getDirtyRegionSince(current.version);
+        }
+        else
+        {
+            continue;
+        }
+        QVector<QPair<int,int> > dirtyColumns = getLevelDirtyColumns(k, dirtyRegion);
+        QVector<int> rows;
+        for(int i=0 ; i<size.height() ; i++)
+        {
+            if(dirtyColumns[i].first <= dirtyColumns[i].second)
+            {
+                rows.push_back(i);
+            }
+        }
+        QSize finerSize = getPyramidLevelSize(k-1);
+        QVector4D* tensors = current.tensors.data();
+        QtConcurrent::blockingMap(rows, [this, tensors, &dirtyColumns, size, finerSize, k](int i)
+        {
+            for(int j=dirtyColumns[i].first ; j<=dirtyColumns[i].second ; j++)
+            {
+                // Average the tensors, not the eigenvectors. The cells on
+                // the last row or column may have fewer children
+                QVector4D sum;
+                int children = 0;
+                for(int ci=2*i ; ci<qMin(2*i+2, finerSize.height()) ; ci++)
+                {
+                    for(int cj=2*j ; cj<qMin(2*j+2, finerSize.width()) ; cj++)
+                    {
+                        sum += getLevelTensor(k-1, ci, cj);
+                        children++;
+                    }
+                }
+                tensors[i*size.width() + j] = sum/children;
+            }
+        });
+        current.version = mVersion;
     }
-}
 
-void TensorField::smoothTensorField()
-{
-    if(!mFieldIsFilled)
+    // Eigenvectors of the requested level only
+    FieldLevel& target = mPyramid[level];
+    if(target.eigenVersion == mVersion)
     {
-        qCritical()<<"smoothTensorField(): Tensor field is null. Initialize it first";
         return;
     }
-
-    QVector<QVector<QVector4D> > mDataSmooth;
-    mDataSmooth = mData;
-
-    for(int i=1; i<mFieldSize.height()-1 ; i++)
+    QVector<QRect> dirtyRegion;
+    if(target.eigenVersion == -1 || target.eigenVectors.size() != target.tensors.size())
+    {
+        target.eigenVectors.fill(QVector4D(), target.tensors.size());
+        dirtyRegion.push_back(QRect(QPoint(0,0), mFieldSize));
+    }
+    else
+    {
+        dirtyRegion = getDirtyRegionSince(target.eigenVersion);
+    }
+    QVector<QPair<int,int> > dirtyColumns = getLevelDirtyColumns(level, dirtyRegion);
+    QVector<int> rows;
+    for(int i=0 ; i<target.size.height() ; i++)
     {
-        for(int j=1; j<mFieldSize.width()-1 ; j++)
+        if(dirtyColumns[i].first <= dirtyColumns[i].second)
         {
-            mDataSmooth[i][j] = 1.0f/9.0f*(mData[i+1][j-1] + mData[i+1][j] + mData[i+1][j+1] +
-                                           mData[i][j-1]   + mData[i][j]   + mData[i][j+1] +
-                                           mData[i-1][j-1] + mData[i-1][j] + mData[i-1][j+1]);
+            rows.push_back(i);
         }
     }
-    mData = mDataSmooth;
-
-    this->computeTensorsEigenDecomposition();
-    this->exportEigenVectorsImage(true, true);
-
+    const QVector4D* tensors = target.tensors.constData();
+    QVector4D* eigenVectors = target.eigenVectors.data();
+    int width = target.size.width();
+    QtConcurrent::blockingMap(rows, [tensors, eigenVectors, &dirtyColumns, width](int i)
+    {
+        for(int j=dirtyColumns[i].first ; j<=dirtyColumns[i].second ; j++)
+        {
+            int k = i*width + j;
+            eigenVectors[k] = isDegenerate(tensors[k]) ? QVector4D() : getTracelessEigenVectors(tensors[k]);
+        }
+    });
+    target.eigenVersion = mVersion;
 }
 
-QPixmap TensorField::exportEigenVectorsImage(bool drawVector1, bool drawVector2,
-                                              QColor color1, QColor color2)
+void TensorField::updateSparsePyramidLevel(int level)
 {
-    int imageSize = 512;
-    QPixmap pixmap(imageSize,imageSize);
-    pixmap.fill();
-
-    if(!mFieldIsFilled)
+    // The levels in between would be too large: the level samples the field
+    // at the center of its cells instead of averaging them
+    FieldLevel& current = mPyramid[level];
+    QSize size = getPyramidLevelSize(level);
+    QVector<QRect> dirtyRegion;
+    if(current.size != size || current.sparseTensors.storage() != SparseTiledStorage)
     {
-        qCritical()<<"exportEigenVectorsImage(): Tensor field is empty";
-        return pixmap;
+        current.size = size;
+        current.tensors.clear();
+        current.eigenVectors.clear();
+        current.sparseTensors = TensorStorage(SparseTiledStorage, mData.tileCache());
+        current.sparseTensors.resize(size);
+        dirtyRegion.push_back(QRect(QPoint(0,0), mFieldSize));
+    }
+    else if(current.version != mVersion)
+    {
+        dirtyRegion = getDirtyRegionSince(current.version);
+    }
+    else
+    {
+        return;
     }
 
-    QPainter painter(&pixmap);
-    QPen pen1(color1);
-    QPen pen2(color2);
-
-    float dv = imageSize/(float)mFieldSize.height();
-    float du = imageSize/(float)mFieldSize.width();
-    QVector2D origin(du/2.0f, dv/2.0f);
-
-    int numberOfTensorsToDisplay = 32;
-    int scaleI = mFieldSize.height()/numberOfTensorsToDisplay;
-    int scaleJ = mFieldSize.width()/numberOfTensorsToDisplay;
-
-    for(int i=0; i<mFieldSize.width() ; i=i+scaleI)
+    // Tiles of the level covering the edited cells, each written by a single thread
+    int tilesX = (size.width()+SPARSE_TILE_SIZE-1)/SPARSE_TILE_SIZE;
+    int tilesY = (size.height()+SPARSE_TILE_SIZE-1)/SPARSE_TILE_SIZE;
+    QVector<bool> dirtyTiles(tilesX*tilesY, false);
+    QRect field(QPoint(0,0), mFieldSize);
+    for(int k=0 ; k<dirtyRegion.size() ; k++)
     {
-        for(int j=0; j<mFieldSize.height() ; j=j+scaleJ)
+        QRect cells = dirtyRegion[k].intersected(field);
+        if(cells.isEmpty())
         {
-            if(drawVector1)
-            {
-                painter.setPen(pen1);
-                QVector2D base = origin + QVector2D(j*dv, i*du);
-                QVector2D eigenVector = getTensorMajorEigenVector(mData[i][j]);
-                eigenVector.setX(eigenVector.x()*du/2.0f*scaleI*0.8);
-                eigenVector.setY(eigenVector.y()*dv/2.0f*scaleJ*0.8);
-                QVector2D tip = base + eigenVector;
-                base -= eigenVector;
-                roundVector2D(base);
-                roundVector2D(tip);
-                // Flip the y axis because the painter system has its origin
-                // on the top left corner and the y axis points down
-                painter.drawLine(base.x(),imageSize - base.y(),tip.x(),imageSize - tip.y());
-            }
-            if(drawVector2)
+            continue;
+        }
+        for(int ti=(cells.top() >> level)/SPARSE_TILE_SIZE ; ti<=(cells.bottom() >> level)/SPARSE_TILE_SIZE ; ti++)
+        {
+            for(int tj=(cells.left() >> level)/SPARSE_TILE_SIZE ; tj<=(cells.right() >> level)/SPARSE_TILE_SIZE ; tj++)
             {
-                painter.setPen(pen2);
-                QVector2D base = origin + QVector2D(j*dv, i*du);
-                QVector2D eigenVector = getTensorMinorEigenVector(mData[i][j]);
-                eigenVector.setX(eigenVector.x()*du/2.0f*scaleI*0.8);
-                eigenVector.setY(eigenVector.y()*dv/2.0f*scaleJ*0.8);
-                QVector2D tip = base + eigenVector;
-                base -= eigenVector;
-                roundVector2D(base);
-                roundVector2D(tip);
-                // Flip the y axis because the painter system has its origin
-                // on the top left corner and the y axis points down
-                painter.drawLine(base.x(),imageSize - base.y(),tip.x(),imageSize - tip.y());
+                dirtyTiles[ti*tilesX + tj] = true;
             }
         }
     }
-
-    emit newTensorFieldImage(pixmap);
-    return pixmap;
-}
-
-int TensorField::computeTensorsEigenDecomposition()
-{
-    if(!mFieldIsFilled)
-    {
-        qCritical()<<"computeTensorsEigenDecomposition(): Fill the tensor field before computing the eigen vectors";
-        return -1;
-    }
-    // Initialize the vectors and values internal containers if they aren't already
-    if(mEigenVectors.size() ==0 || mEigenValues.size() == 0)
+    QVector<int> tiles;
+    for(int t=0 ; t<dirtyTiles.size() ; t++)
     {
-        mEigenVectors.resize(mFieldSize.height());
-        mEigenValues.resize(mFieldSize.height());
-        for(int i=0 ; i < mFieldSize.height() ; i++)
+        if(dirtyTiles[t])
         {
-            mEigenVectors[i].resize(mFieldSize.width());
-            mEigenValues[i].resize(mFieldSize.width());
+            tiles.push_back(t);
         }
     }
-
-    QProgressDialog progress("Loading...",NULL, 0, mFieldSize.height()-1);
-    progress.setMinimumDuration(0);
-
-    // Fill the internal containers
-    int numberOfDegeneratePoints = 0;
-    for(int i=0; i<mFieldSize.height() ; i++)
+    TensorStorage previousTensors = current.sparseTensors;
+    current.sparseTensors.detach();
+    TensorStorage& tensors = current.sparseTensors;
+    int scale = 1 << level;
+    QtConcurrent::blockingMap(tiles, [this, &tensors, size, tilesX, scale](int t)
     {
-        progress.setValue(i);
-        QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents);
-        for(int j=0; j<mFieldSize.width() ; j++)
+        QRect tile = QRect((t%tilesX)*SPARSE_TILE_SIZE, (t/tilesX)*SPARSE_TILE_SIZE,
+                           SPARSE_TILE_SIZE, SPARSE_TILE_SIZE).intersected(QRect(QPoint(0,0), size));
+        // Field cell sampled by the cell (i,j) of the level
+        auto sampleRow = [this, scale](int i) {return qMin(i*scale + scale/2, mFieldSize.height()-1);};
+        auto sampleColumn = [this, scale](int j) {return qMin(j*scale + scale/2, mFieldSize.width()-1);};
+        QVector4D tensor;
+        QRect samples(QPoint(sampleColumn(tile.left()), sampleRow(tile.top())),
+                      QPoint(sampleColumn(tile.right()), sampleRow(tile.bottom())));
+        if(mData.isUniform(samples, tensor))
+        {
+            tensors.fillTile(tile.top(), tile.left(), tensor);
+            return;
+        }
+        for(int i=tile.top() ; i<=tile.bottom() ; i++)
         {
-            mEigenVectors[i][j] = getTensorEigenVectors(mData[i][j]);
-            mEigenValues[i][j] = getTensorEigenValues(mData[i][j]);
-            if(isDegenerate(mEigenVectors[i][j]))
+            for(int j=tile.left() ; j<=tile.right() ; j++)
             {
-                numberOfDegeneratePoints++;
+                tensors.set(i, j, mData.at(sampleRow(i), sampleColumn(j)));
             }
         }
-    }
-    mEigenIsComputed = true;
-    return numberOfDegeneratePoints;
+    });
+    tensors.squeezeChangedTiles(previousTensors);
+    current.version = mVersion;
+    current.eigenVersion = mVersion;
 }
 
-QVector4D TensorField::getEigenVectors(int i, int j)
+bool TensorField::isPyramidLevelCurrent(int level) const
 {
-    if(!mEigenIsComputed)
-    {
-        qCritical()<<"Unable to get the eigen vectors."
-                   <<"First compute tensors Eigen decomposition";
-        return QVector4D();
-    }
-    else
+    if(level == 0)
     {
-        return mEigenVectors[i][j];
+        return mEigenIsComputed && mEigenVersion == mVersion;
     }
+    return level < mPyramid.size() && mPyramid[level].size == getPyramidLevelSize(level)
+            && mPyramid[level].version == mVersion && mPyramid[level].eigenVersion == mVersion;
 }
 
-QVector2D TensorField::getEigenValues(int i, int j)
+QVector4D TensorField::getLevelTensor(int level, int i, int j) const
 {
-    if(!mEigenIsComputed)
+    if(level == 0)
     {
-        qCritical()<<"getEigenValues(): Unable to get the eigen values."
-                   <<"First compute tensors Eigen decomposition";
-        return QVector2D();
+        return mData.at(i,j);
     }
-    else
+    const FieldLevel& current = mPyramid[level];
+    if(mData.storage() == SparseTiledStorage)
     {
-        return mEigenValues[i][j];
+        return current.sparseTensors.at(i,j);
     }
+    return current.tensors[i*current.size.width() + j];
 }
 
-QVector2D TensorField::getMajorEigenVector(int i, int j)
+QVector4D TensorField::getLevelEigenVectors(int level, int i, int j) const
 {
-    return getFirstVector(this->getEigenVectors(i,j));
+    if(level == 0)
+    {
+        return getEigenVectors(i,j);
+    }
+    const FieldLevel& current = mPyramid[level];
+    if(mData.storage() == SparseTiledStorage)
+    {
+        QVector4D tensor = current.sparseTensors.at(i,j);
+        return isDegenerate(tensor) ? QVector4D() : getTracelessEigenVectors(tensor);
+    }
+    return current.eigenVectors[i*current.size.width() + j];
 }
 
-QVector2D TensorField::getMinorEigenVector(int i, int j)
+QVector<QPair<int,int> > TensorField::getLevelDirtyColumns(int level, const QVector<QRect>& dirtyRegion) const
 {
-    return getSecondVector(this->getEigenVectors(i,j));
+    QSize size = getPyramidLevelSize(level);
+    QVector<QPair<int,int> > dirtyColumns(size.height(), qMakePair(0,-1));
+    QRect field(QPoint(0,0), mFieldSize);
+    for(int k=0 ; k<dirtyRegion.size() ; k++)
+    {
+        QRect cells = dirtyRegion[k].intersected(field);
+        if(cells.isEmpty())
+        {
+            continue;
+        }
+        // Cell (i,j) of the field is in cell (i,j)/2^level of the level
+        for(int i=(cells.top() >> level) ; i<=(cells.bottom() >> level) ; i++)
+        {
+            QPair<int,int>& columns = dirtyColumns[i];
+            if(columns.first > columns.second)
+            {
+                columns = qMakePair(cells.left() >> level, cells.right() >> level);
+            }
+            else
+            {
+                columns.first = qMin(columns.first, cells.left() >> level);
+                columns.second = qMax(columns.second, cells.right() >> level);
+            }
+        }
+    }
+    return dirtyColumns;
 }
 
 
@@ -537,7 +1954,10 @@ QVector2D getTensorEigenValues(QVector4D tensor)
     m(0,1) = tensor.z();
     m(1,1) = tensor.w();
     Eigen::EigenSolver<Eigen::Matrix2f> es(m);
-    return QVector2D(es.eigenvalues()[0].real(),es.eigenvalues()[1].real());
+    // Eigen doesn't sort them: the major one comes first, as its eigenvector
+    float value1 = es.eigenvalues()[0].real();
+    float value2 = es.eigenvalues()[1].real();
+    return QVector2D(qMax(value1, value2), qMin(value1, value2));
 }
 
 QVector2D getTensorMajorEigenVector(QVector4D tensor)
@@ -660,6 +2080,21 @@ bool isDegenerate(QVector4D tensor)
             && isFuzzyNull(tensor.w());
 }
 
+int computeTensorWinding(const QVector<QVector4D>& loop)
+{
+    float turns = 0;
+    for(int k=0 ; k<loop.size() ; k++)
+    {
+        const QVector4D& t1 = loop[k];
+        const QVector4D& t2 = loop[(k+1)%loop.size()];
+        float delta = atan2(t2.y(), t2.x()) - atan2(t1.y(), t1.x());
+        // Smallest rotation between 2 consecutive tensors
+        delta = delta - 2*M_PI*floor(delta/(2*M_PI) + 0.5f);
+        turns += delta;
+    }
+    return (int)floor(turns/(2*M_PI) + 0.5f);
+}
+
 bool isFuzzyNull(float a)
 {
     return (fabs(a) < FLOAT_COMPARISON_EPSILON);
@@ -669,3 +2104,184 @@ bool isFuzzyEqual(float a, float b)
 {
     return (fabs(a - b) / FLOAT_COMPARISON_EPSILON <= fmin(fabs(a), fabs(b)));
 }
+
+QVector4D evaluateDesignElement(const DesignElement& element, QPointF position)
+{
+    // Distance to the element, and direction of its major eigenvector
+    QVector2D offset(position - element.center);
+    float squaredDistance = offset.lengthSquared();
+    float theta = element.theta;
+    if(element.type == PolylineElement)
+    {
+        squaredDistance = std::numeric_limits<float>::max();
+        for(int k=1 ; k<element.polyline.size() ; k++)
+        {
+            QVector2D segment(element.polyline[k] - element.polyline[k-1]);
+            QVector2D toPosition(position - element.polyline[k-1]);
+            float t = 0.0f;
+            if(segment.lengthSquared() > 0.0f)
+            {
+                t = qBound(0.0f, QVector2D::dotProduct(toPosition, segment)/segment.lengthSquared(), 1.0f);
+            }
+            float distance = (toPosition - t*segment).lengthSquared();
+            if(distance < squaredDistance)
+            {
+                squaredDistance = distance;
+                theta = std::atan2(segment.y(), segment.x());
+            }
+        }
+    }
+    // Cull before computing the exponential
+    static const float maxExponent = -std::log(DESIGN_ELEMENT_WEIGHT_THRESHOLD);
+    float exponent = element.decay*squaredDistance;
+    if(exponent > maxExponent)
+    {
+        return QVector4D();
+    }
+    float weight = element.amplitude*std::exp(-exponent);
+
+    QVector4D tensor;
+    switch(element.type)
+    {
+    case GridElement:
+    case PolylineElement:
+        tensor = QVector4D(cos(2.0*theta), sin(2.0*theta), sin(2.0*theta), -cos(2.0*theta));
+        break;
+    case RadialElement:
+    {
+        // Same as fillRadialBasisField, normalized
+        float x = offset.x();
+        float y = offset.y();
+        if(squaredDistance > 0.0f)
+        {
+            tensor = QVector4D(y*y-x*x, -2*x*y, -2*x*y, x*x-y*y)/squaredDistance;
+        }
+        break;
+    }
+    case HeightmapElement:
+    {
+        // Same as fillHeightBasisField, the image origin being top left
+        const QImage& map = element.heightMap;
+        if(map.width() < 2 || map.height() < 2)
+        {
+            break;
+        }
+        int pixelX = qMin((int)(position.x()*(map.width()-1)), map.width()-2);
+        int pixelY = qMin((int)((1.0-position.y())*(map.height()-1)), map.height()-2);
+        QRgb currentPixel = map.pixel(pixelX, pixelY);
+        QVector2D grad(qBlue(currentPixel)-qBlue(map.pixel(pixelX+1, pixelY)),
+                       qBlue(currentPixel)-qBlue(map.pixel(pixelX, pixelY+1)));
+        // A flat area leaves the other elements decide
+        if(!grad.isNull())
+        {
+            float gradientTheta = std::atan2(-grad.y(), grad.x()) + M_PI/2.0;
+            tensor = QVector4D(cos(2.0*gradientTheta), sin(2.0*gradientTheta),
+                               sin(2.0*gradientTheta), -cos(2.0*gradientTheta));
+            tensor *= grad.length()/255.0f;
+        }
+        break;
+    }
+    }
+    return weight*tensor;
+}
+
+QRectF getDesignElementBounds(const DesignElement& element)
+{
+    if(element.decay <= 0.0f)
+    {
+        return QRectF(0.0, 0.0, 1.0, 1.0);
+    }
+    // Distance at which the weight reaches the threshold
+    qreal radius = std::sqrt(-std::log(DESIGN_ELEMENT_WEIGHT_THRESHOLD)/element.decay);
+    QPointF topLeft = element.center;
+    QPointF bottomRight = element.center;
+    if(element.type == PolylineElement && !element.polyline.isEmpty())
+    {
+        topLeft = bottomRight = element.polyline[0];
+        for(int k=1 ; k<element.polyline.size() ; k++)
+        {
+            topLeft.rx() = qMin(topLeft.x(), element.polyline[k].x());
+            topLeft.ry() = qMin(topLeft.y(), element.polyline[k].y());
+            bottomRight.rx() = qMax(bottomRight.x(), element.polyline[k].x());
+            bottomRight.ry() = qMax(bottomRight.y(), element.polyline[k].y());
+        }
+    }
+    return QRectF(topLeft, bottomRight).adjusted(-radius, -radius, radius, radius);
+}
+
+DesignElement createGridElement(QPointF center, float decay, float theta, float amplitude)
+{
+    DesignElement element;
+    element.type = GridElement;
+    element.center = center;
+    element.decay = decay;
+    element.amplitude = amplitude;
+    element.theta = theta;
+    return element;
+}
+
+DesignElement createRadialElement(QPointF center, float decay, float amplitude)
+{
+    DesignElement element;
+    element.type = RadialElement;
+    element.center = center;
+    element.decay = decay;
+    element.amplitude = amplitude;
+    element.theta = 0.0f;
+    return element;
+}
+
+DesignElement createHeightmapElement(QImage heightMap, QPointF center, float decay, float amplitude)
+{
+    DesignElement element;
+    element.type = HeightmapElement;
+    element.center = center;
+    element.decay = decay;
+    element.amplitude = amplitude;
+    element.theta = 0.0f;
+    element.heightMap = heightMap;
+    return element;
+}
+
+DesignElement createPolylineElement(const QVector<QPointF>& polyline, float decay, float amplitude)
+{
+    DesignElement element;
+    element.type = PolylineElement;
+    element.center = polyline.isEmpty() ? QPointF() : polyline[0];
+    element.decay = decay;
+    element.amplitude = amplitude;
+    element.theta = 0.0f;
+    element.polyline = polyline;
+    return element;
+}
+
+void squaredDistanceTransform1D(const float* f, float* d, int n, int* v, float* z)
+{
+    // Lower envelope of the parabolas rooted at (q, f[q])
+    int k = 0;
+    v[0] = 0;
+    z[0] = -std::numeric_limits<float>::max();
+    z[1] = std::numeric_limits<float>::max();
+    for(int q=1 ; q<n ; q++)
+    {
+        float s = ((f[q]+q*q) - (f[v[k]]+v[k]*v[k]))/(2.0f*q - 2.0f*v[k]);
+        while(s <= z[k])
+        {
+            k--;
+            s = ((f[q]+q*q) - (f[v[k]]+v[k]*v[k]))/(2.0f*q - 2.0f*v[k]);
+        }
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k+1] = std::numeric_limits<float>::max();
+    }
+    k = 0;
+    for(int q=0 ; q<n ; q++)
+    {
+        while(z[k+1] < q)
+        {
+            k++;
+        }
+        d[q] = (q-v[k])*(q-v[k]) + f[v[k]];
+    }
+}
@@ -11,36 +11,178 @@
 #include <QColor>
 #include <QPixmap>
 #include <QSize>
+#include <QRect>
+#include <QRectF>
+#include <cmath>
+
+#include "TensorStorage.h"
+
+class QPainter;
 
 // Epsilon for float comparison
 #define FLOAT_COMPARISON_EPSILON 1e-5
+// Number of edits kept in the edit log of a tensor field
+#define FIELD_EDIT_LOG_SIZE 256
+// Size of the tiles of cells compared to find the edited parts of the field
+#define FIELD_CHANGE_TILE_SIZE 16
+// Side of the blocks of cells of the blocked memory layout
+#define FIELD_LAYOUT_BLOCK_SIZE 8
+// Weight under which a design element is ignored
+#define DESIGN_ELEMENT_WEIGHT_THRESHOLD 1e-3
+// Distance to the shore, in cells, up to which a sparse tiled field computes
+// the water distance. The cells farther away are at the largest float
+#define SPARSE_WATER_DISTANCE_MAX SPARSE_TILE_SIZE
+
+// Structure to store an edit of the tensor field: the rectangle
+// of cells (x = j, y = i) that changed, and the version it created
+struct FieldEdit {
+    int version;
+    QRect cells;
+};
+
+// Order of the cells of the eigen data in memory
+enum FieldMemoryLayout {
+    // Row by row
+    RowMajorLayout,
+    // Blocks of FIELD_LAYOUT_BLOCK_SIZE x FIELD_LAYOUT_BLOCK_SIZE cells, row by row,
+    // so that a streamline going in any direction stays in the same cache lines
+    BlockedLayout
+};
+
+// Level of the multi-resolution pyramid of a tensor field
+struct FieldLevel {
+    QSize size;
+    // Tensors averaged over the 2x2 cells of the finer level, row by row
+    QVector<QVector4D> tensors;
+    // Normalized major and minor eigenvectors of the tensors, row by row
+    QVector<QVector4D> eigenVectors;
+    // For a sparse tiled field, the tensors sampled at the center of the cells
+    // instead. Their eigenvectors are computed when read
+    TensorStorage sparseTensors;
+    // Versions of the field the tensors and the eigenvectors were computed from
+    int version;
+    int eigenVersion;
+};
+
+// Type of a degenerate point, from the index of the field around it
+enum DegeneratePointType {
+    // Index 1/2
+    Wedge,
+    // Index -1/2
+    Trisector
+};
+
+// Structure to store a degenerate point of the field, in cells (x = j, y = i)
+struct DegeneratePoint {
+    QPointF position;
+    DegeneratePointType type;
+    // Directions, in radians, of the major eigenvector separatrices leaving the point
+    QVector<float> separatrixAngles;
+};
+
+// Type of a design element of the field
+enum DesignElementType {
+    GridElement,
+    RadialElement,
+    HeightmapElement,
+    PolylineElement
+};
+
+// Structure to store a design element of the field.
+// Positions are in [0,1], (0,0) being the bottom left corner of the field.
+// The weight of the element at a point is exp(-decay*d^2), d being the distance
+// to its center, or to its polyline. A decay of 0 covers the whole field
+struct DesignElement {
+    DesignElementType type;
+    QPointF center;
+    float decay;
+    // Norm of the tensors of the element
+    float amplitude;
+    // Direction of a grid element, in radians
+    float theta;
+    // Heightmap of a heightmap element, stretched over the whole field
+    QImage heightMap;
+    // Points of a polyline element, that the major eigenvectors follow
+    QVector<QPointF> polyline;
+};
+
+// Basis field the tensors were filled from, that can be evaluated
+// at any position instead of reading the grid
+enum AnalyticBasisType {
+    NoAnalyticBasis,
+    GridAnalyticBasis,
+    RadialAnalyticBasis,
+    RotatingAnalyticBasis
+};
+
+// Basis fields, evaluated at a position in [0,1], (0,0) being the
+// bottom left corner of the field. Same tensors as the fill functions
+struct GridBasis {
+    // Constant tensor | a  b |
+    //                 | b -a |
+    float a;
+    float b;
+    QVector4D tensor(QPointF) const {return QVector4D(a, b, b, -a);}
+};
+struct RadialBasis {
+    QPointF center;
+    QVector4D tensor(QPointF position) const
+    {
+        float x = position.x() - center.x();
+        float y = position.y() - center.y();
+        return QVector4D(y*y-x*x, -2*x*y, -2*x*y, x*x-y*y);
+    }
+};
+struct RotatingBasis {
+    QVector4D tensor(QPointF position) const
+    {
+        float theta = M_PI*position.x() + position.y()*M_PI/4;
+        return QVector4D(std::cos(2.0*theta), std::sin(2.0*theta), std::sin(2.0*theta), -std::cos(2.0*theta));
+    }
+};
 
 class TensorField : public QObject
 {
     Q_OBJECT
 public:
-    explicit TensorField(QSize fieldsize = QSize(256,256), QObject *parent = 0);
+    explicit TensorField(QSize fieldsize = QSize(256,256), QObject *parent = 0,
+                         FieldStorage storage = FullPrecisionStorage);
 
     /** Getters and Setters **/
 
     // Get the Tensor at index (i,j)
-    QVector4D getTensor(int i, int j);
+    QVector4D getTensor(int i, int j) const;
     // Set the Tensor at index (i,j)
     void setTensor(int i, int j, QVector4D tensor);
 
     // Get the tensor field size
-    QSize getFieldSize() {return this->mFieldSize;}
+    QSize getFieldSize() const {return this->mFieldSize;}
     // Set the tensor field size
     void setFieldSize(QSize fieldSize);
 
     // Returns whether the field has been filled with non-zero values
-    bool isFieldFilled() {return mFieldIsFilled;}
+    bool isFieldFilled() const {return mFieldIsFilled;}
 
     // Returns whether the field has been filled with non-zero values
-    bool isWatermapLoaded() {return mWaterMapIsLoaded;}
+    bool isWatermapLoaded() const {return mWaterMapIsLoaded;}
 
     // Returns whether the field has been filled with non-zero values
-    QString getWatermapFilename() {return mWatermapFilename;}
+    QString getWatermapFilename() const {return mWatermapFilename;}
+
+    // Returns the degenerate points found by the last eigen decomposition
+    QVector<DegeneratePoint> getDegeneratePoints() const;
+    // Returns the degenerate points inside the rectangle of cells (x = j, y = i)
+    QVector<DegeneratePoint> getDegeneratePointsIn(QRectF cells) const;
+    // Returns the tensor bilinearly interpolated at a position in cells (x = j, y = i)
+    QVector4D getInterpolatedTensor(QPointF position) const;
+
+    // Returns whether the distances to the water have been computed
+    bool hasWaterDistance() const {return !mWaterDistance.isEmpty() || mWaterDistanceTiles.height() > 0;}
+    // Returns the distance, in cells, from the cell (i,j) to the closest water
+    // cell, or minus the distance to the closest land cell if it is water.
+    // Returns the largest float if there is no watermap. A sparse tiled field
+    // only knows the distances up to SPARSE_WATER_DISTANCE_MAX
+    float getWaterDistance(int i, int j) const;
 
     /** General Use Functions */
 
@@ -65,29 +207,109 @@ public:
     void fillRadialBasisField(QPointF center);
     // Test function to check the different angles
     void fillRotatingField();
+    // Generate the field as the weighted sum of the design elements.
+    // Each tile of cells only evaluates the elements that weigh on it
+    void fillDesignElementsField();
+
+    // Add a design element to the ones summed by fillDesignElementsField()
+    void addDesignElement(const DesignElement& element) {mDesignElements.push_back(element);}
+    // Remove all the design elements
+    void clearDesignElements() {mDesignElements.clear();}
+    // Returns the design elements
+    const QVector<DesignElement>& getDesignElements() const {return mDesignElements;}
+
+    // Returns the basis the tracer should evaluate instead of the grid:
+    // NoAnalyticBasis unless the analytic evaluation is enabled and the
+    // field was last filled from a basis with a known definition
+    AnalyticBasisType getAnalyticBasis() const {return mAnalyticEvaluation ? mAnalyticBasis : NoAnalyticBasis;}
+    // Returns the definition of the basis the field was filled from
+    const GridBasis& getGridBasis() const {return mGridBasis;}
+    const RadialBasis& getRadialBasis() const {return mRadialBasis;}
+    const RotatingBasis& getRotatingBasis() const {return mRotatingBasis;}
+
+    // Returns the version of the field, incremented by each edit
+    int getVersion() const {return mVersion;}
+    // Returns the rectangles of cells (x = j, y = i) edited after version.
+    // The whole field is returned if these edits are no longer logged
+    QVector<QRect> getDirtyRegionSince(int version) const;
+    // Record an edit of the cells in rect (x = j, y = i) as a new version
+    void markRegionDirty(QRect rect);
+    // Record the tiles of cells that differ from previousData as edits.
+    // The whole field is recorded if the size changed
+    void markChangedCells(const TensorStorage& previousData);
+
+    // Returns a checksum of the tensor values, used to tell fields apart
+    quint64 computeChecksum() const;
 
     // Output the tensor field to QDebug
     void outputTensorField();
 
-    // Display the tensor field with 2 vectors per point
+    // Display the tensor field with 2 vectors per point.
+    // Only the glyphs of the cells edited since the last image are redrawn
     QPixmap exportEigenVectorsImage(bool drawVector1 = true, bool drawVector2 = false,
                                      QColor color1 = Qt::blue, QColor color2 = Qt::red);
+    // Draw the eigenvector glyphs of the field on an image of size imageSize,
+    // using the painter. If visibleRect isn't null, only the glyphs that may
+    // intersect it (in image coordinates) are drawn
+    void drawEigenVectors(QPainter& painter, QSize imageSize, QRectF visibleRect,
+                          bool drawVector1, bool drawVector2,
+                          QColor color1, QColor color2,
+                          int numberOfTensorsToDisplay = 32) const;
+
+    // Returns the precision the tensors and the eigen data are stored with
+    FieldStorage getStorage() const {return mData.storage();}
+    // Change the precision the tensors and the eigen data are stored with.
+    // As when the size changes, the field has to be filled again
+    void setStorage(FieldStorage storage);
+    // Returns and change the number of bytes of tiles a sparse tiled field
+    // keeps in memory, the others are in a temporary file
+    qint64 getTileCacheMemoryCap() const {return mData.tileCacheMemoryCap();}
+    void setTileCacheMemoryCap(qint64 memoryCap) {mData.setTileCacheMemoryCap(memoryCap);}
+    // Returns the order of the cells of the eigen data in memory
+    FieldMemoryLayout getMemoryLayout() const {return mMemoryLayout;}
+    // Reorder the eigen data in memory. The values are unchanged
+    void setMemoryLayout(FieldMemoryLayout layout);
+
+    // Returns the number of levels of the pyramid: level 0 is the field,
+    // and each level halves the size of the previous one, down to 1 cell
+    int getPyramidLevelCount() const;
+    // Returns the size of a level of the pyramid
+    QSize getPyramidLevelSize(int level) const;
+    // Returns the coarsest level whose cells are at most cells wide,
+    // in cells of the field
+    int getPyramidLevelForScale(float cells) const;
+    // Bring the tensors of the levels up to level up to date with the field,
+    // and compute the eigenvectors of level. The other levels are left as they are
+    void updatePyramidLevel(int level);
+    // Returns whether the tensors and eigenvectors of a level match the field
+    bool isPyramidLevelCurrent(int level) const;
+    // Returns the tensor of cell (i,j) of a level of the pyramid
+    QVector4D getLevelTensor(int level, int i, int j) const;
+    // Returns the normalized eigenvectors of cell (i,j) of a level of the pyramid
+    QVector4D getLevelEigenVectors(int level, int i, int j) const;
+    // Returns the level glyphs are read from when drawing numberOfTensorsToDisplay
+    // glyphs along the field, if it is current
+    int getGlyphPyramidLevel(int numberOfTensorsToDisplay) const;
 
     // Returns the major and minor eigenvectors of the tensor at index (i,j).
     // They are normalized, then multiplied by their respective eigenvalue.
     // Warning : This only works if the tensor is traceless, real and symmetrical
-    QVector4D getEigenVectors(int i, int j);
+    QVector4D getEigenVectors(int i, int j) const;
     // Returns the major and minor eigenvalues of the tensor at index (i,j).
     // Warning : This only works if the tensor is traceless, real and symmetrical
-    QVector2D getEigenValues(int i, int j);
+    QVector2D getEigenValues(int i, int j) const;
     // Returns the major eigenvector of the tensor at index (i,j).
     // It is normalized, then multiplied by its eigenvalue.
     // Warning : This only works if the tensor is traceless, real and symmetrical
-    QVector2D getMajorEigenVector(int i, int j);
+    QVector2D getMajorEigenVector(int i, int j) const;
     // Returns the minor eigenvector of the tensor at index (i,j).
     // It is normalized, then multiplied by its eigenvalue.
     // Warning : This only works if the tensor is traceless, real and symmetrical
-    QVector2D getMinorEigenVector(int i, int j);
+    QVector2D getMinorEigenVector(int i, int j) const;
+    // Fill vectors with the major (or minor) eigenvectors of the cells closest
+    // to count positions given in cells (x = j, y = i), clamped to the field.
+    // The eigenvectors of several cells are gathered at once when possible
+    void sampleEigenVectors(const QPointF* cells, int count, bool major, QVector2D* vectors) const;
 
 
 signals:
@@ -108,15 +330,72 @@ public slots:
     void generateMultiRotationTensorField();
     // Generates a radial tensor field with default parameters
     void generateRadialTensorField();
+    // Generates a tensor field from the design elements,
+    // or from a default set of elements if there are none
+    void generateDesignElementsTensorField();
     // Compute the eigen vectors and values of each tensor in the field,
-    // and store them internally.
+    // and store them internally. Only the cells edited since the last
+    // decomposition are computed again.
     // Return the number of degenerate points (null eigenvectors)
-    int computeTensorsEigenDecomposition();
+    qint64 computeTensorsEigenDecomposition();
     // Tensor field smoothing using a Gaussian filter
     void smoothTensorField();
+    // Evaluate the basis definition instead of the grid when tracing
+    void setAnalyticEvaluation(bool analytic);
 
 private:
 
+    // Returns the index of cell (i,j) in the eigen data
+    int getEigenOffset(int i, int j) const
+    {
+        if(mMemoryLayout == BlockedLayout)
+        {
+            return ((i/FIELD_LAYOUT_BLOCK_SIZE)*mLayoutBlocksX + j/FIELD_LAYOUT_BLOCK_SIZE)
+                    *FIELD_LAYOUT_BLOCK_SIZE*FIELD_LAYOUT_BLOCK_SIZE
+                    + (i%FIELD_LAYOUT_BLOCK_SIZE)*FIELD_LAYOUT_BLOCK_SIZE + j%FIELD_LAYOUT_BLOCK_SIZE;
+        }
+        return i*mEigenSize.width() + j;
+    }
+    // Size the eigen data for the field size and the memory layout.
+    // A sparse tiled field has none
+    void allocateEigenData();
+    // Returns the eigenvectors of cell (i,j) from the eigen data, or from
+    // the tensor for a sparse tiled field
+    QVector4D readEigenVectors(int i, int j) const;
+
+    // Returns the side of the tiles a storage is filled by: SPARSE_TILE_SIZE in sparse
+    // tiled storage, whose tiles create their page when first written
+    static int getFillTileSize(const TensorStorage& storage);
+    // Detach a storage, then call function(t, cells) on each of its tiles of
+    // getFillTileSize() cells (x = j, y = i), row by row, concurrently.
+    // Each tile is written by a single thread
+    template<typename Function> static void fillTilesConcurrently(TensorStorage& storage, Function function);
+
+    // Bring the tiles of a level of a sparse tiled field up to date with the field
+    void updateSparsePyramidLevel(int level);
+    // Returns, for each row of a level of the pyramid, the first and last columns
+    // covering the rectangles of field cells. Untouched rows are (0,-1)
+    QVector<QPair<int,int> > getLevelDirtyColumns(int level, const QVector<QRect>& dirtyRegion) const;
+
+    // Find again the degenerate points of the tiles of cells touching the rectangles
+    void extractDegeneratePoints(const QVector<QRect>& dirtyRegion);
+    // Find the degenerate points of the cells whose top left corner is in the tile,
+    // to sub-cell accuracy, and classify them
+    QVector<DegeneratePoint> extractTileDegeneratePoints(QRect tile) const;
+    // Returns the directions of the major eigenvector separatrices leaving a degenerate point
+    QVector<float> computeSeparatrixAngles(QPointF position) const;
+
+    // Compute the signed distances to the water of the watermap
+    void computeWaterDistance(const QImage& waterMap);
+    // Compute them for a sparse tiled field, one tile at a time from the cells
+    // within SPARSE_WATER_DISTANCE_MAX of the tile
+    void computeTiledWaterDistance(const QImage& waterMap);
+    // Returns the squared distance from each cell of a grid of size cells to the
+    // closest water cell (or land cell if toWater is false), in linear time.
+    // The lines of the grid are transformed in parallel if parallel is true
+    QVector<float> computeSquaredDistanceTransform(const QVector<bool>& isWater, QSize size,
+                                                   bool toWater, bool parallel = true) const;
+
     // Tensor field
     // A tensor is stored with a QVector4D.
     // The coordinates are as follows:
@@ -125,21 +404,69 @@ private:
     // A traceless, real, symmetrical tensor is of the form:
     // | a  b |
     // | b -a |
-    QVector<QVector<QVector4D> > mData;
-    // Eigen vectors of each tensor matrix
-    QVector<QVector<QVector4D> > mEigenVectors;
-    // Eigen values of each tensor matrix
-    QVector<QVector<QVector2D> > mEigenValues;
+    // In compact storage, only a and b are kept, as half floats
+    TensorStorage mData;
+    // Eigen vectors of each tensor matrix, in the order of the memory layout
+    QVector<QVector4D> mEigenVectors;
+    // Eigen values of each tensor matrix, in the order of the memory layout
+    QVector<QVector2D> mEigenValues;
+    // In compact storage, the quantized major eigenvector angle and the half
+    // float eigenvalue of each tensor matrix, instead of the 2 previous ones
+    QVector<quint16> mEigenAngles;
+    QVector<quint16> mEigenMagnitudes;
+    // Order of the eigen data, the field size it was laid out for,
+    // and its number of blocks per row for the blocked layout
+    FieldMemoryLayout mMemoryLayout;
+    QSize mEigenSize;
+    int mLayoutBlocksX;
     // Holds wether the field has been initialized with non-zero values
     bool mFieldIsFilled;
     // Holds wether the eigen vectors and values has been computed
     bool mEigenIsComputed;
+    // Version of the field the eigen vectors and values were computed from
+    int mEigenVersion;
+    // Number of degenerate points in each row, and in the field
+    QVector<int> mDegeneratePointsPerRow;
+    qint64 mNumberOfDegeneratePoints;
+    // Degenerate points of each tile of FIELD_CHANGE_TILE_SIZE cells, row by row.
+    // A point belongs to the tile of the top left corner of its cell
+    QVector<QVector<DegeneratePoint> > mDegeneratePointTiles;
+    int mDegeneratePointTilesX;
+    // Levels of the pyramid. Level 0 is the field itself and is left empty
+    QVector<FieldLevel> mPyramid;
+    // Last eigen vectors image, the version it shows and how it was drawn
+    QPixmap mEigenVectorsImage;
+    int mEigenVectorsImageVersion;
+    bool mEigenVectorsImageDrawVector1;
+    bool mEigenVectorsImageDrawVector2;
+    QColor mEigenVectorsImageColor1;
+    QColor mEigenVectorsImageColor2;
     // Holds wether a watermap has been loaded
     bool mWaterMapIsLoaded;
     // Filename of the watermap
     QString mWatermapFilename;
+    // Signed distance from each cell to the shore, row by row
+    QVector<float> mWaterDistance;
+    // For a sparse tiled field, the signed distances as the x of the tensors
+    // of tiles paged through the cache of the field instead
+    TensorStorage mWaterDistanceTiles;
+    // Basis the field was last filled from, and its definition
+    AnalyticBasisType mAnalyticBasis;
+    GridBasis mGridBasis;
+    RadialBasis mRadialBasis;
+    RotatingBasis mRotatingBasis;
+    // Holds whether the tracer evaluates the basis instead of the grid
+    bool mAnalyticEvaluation;
+    // Elements summed by fillDesignElementsField()
+    QVector<DesignElement> mDesignElements;
     // Field size
     QSize mFieldSize;
+    // Version of the field, incremented by each edit
+    int mVersion;
+    // Last edits of the field, oldest first
+    QVector<FieldEdit> mEditLog;
+    // Version before the oldest logged edit
+    int mEditLogStartVersion;
 };
 
 
@@ -183,7 +510,104 @@ int sumMat3D(QMatrix3x3 matrix, QMatrix3x3 kernel);
 bool isSymetricalAndTraceless(QVector4D tensor);
 // Returns whether the tensor is degenerate or not
 bool isDegenerate(QVector4D tensor);
+// Returns the number of turns made by the (a,b) part of the tensors along
+// a closed loop. Twice the index of the degenerate points inside it
+int computeTensorWinding(const QVector<QVector4D>& loop);
+// Returns the tensor of the design element at a position in [0,1], multiplied by
+// its weight. Returns a null tensor if the weight is below the threshold
+QVector4D evaluateDesignElement(const DesignElement& element, QPointF position);
+// Returns the area, in [0,1], where the weight of the element is above the threshold
+QRectF getDesignElementBounds(const DesignElement& element);
+// Returns a grid element of direction theta
+DesignElement createGridElement(QPointF center, float decay, float theta, float amplitude = 1.0f);
+// Returns a radial element around its center
+DesignElement createRadialElement(QPointF center, float decay, float amplitude = 1.0f);
+// Returns an element following the contour lines of a heightmap
+DesignElement createHeightmapElement(QImage heightMap, QPointF center, float decay, float amplitude = 1.0f);
+// Returns an element following a polyline
+DesignElement createPolylineElement(const QVector<QPointF>& polyline, float decay, float amplitude = 1.0f);
+// Returns the normalized major and minor eigenvectors of a traceless,
+// symmetrical and non degenerate tensor, in closed form
+inline QVector4D getTracelessEigenVectors(QVector4D tensor)
+{
+    float phi = 0.5f*std::atan2(tensor.y(), tensor.x());
+    float c = std::cos(phi);
+    float s = std::sin(phi);
+    return QVector4D(c, s, -s, c);
+}
+// Squared Euclidean distance transform of the n samples of f (0 on the
+// features, infinite elsewhere) into d. v and z are work arrays of n and n+1 elements
+void squaredDistanceTransform1D(const float* f, float* d, int n, int* v, float* z);
 
 
+// Samples the eigenvectors of a level of the pyramid of a field at positions
+// of region, using the closest cell. size is the size of the field
+struct GridSampler {
+    const TensorField* field;
+    QRectF region;
+    QSize size;
+    int level;
+    // Holds whether the eigenvectors of level 0 are also computed in closed form
+    // from the tensors, like the ones of the other levels, so that traces switching
+    // levels are oriented the same way
+    bool isClosedForm;
+    // Returns false at a degenerate point
+    bool sample(QPointF position, QVector4D& eigenVectors) const
+    {
+        float i = (position.y()-region.top())/region.height()*(size.height()-1);
+        float j = (position.x()-region.left())/region.width()*(size.width()-1);
+        if(level > 0)
+        {
+            // Cell (I,J) of the level is centered on the cells 2^level*(I,J) + (2^level-1)/2
+            float cellSize = 1 << level;
+            QSize levelSize = field->getPyramidLevelSize(level);
+            i = qBound(0.0f, (i - 0.5f*(cellSize-1))/cellSize, levelSize.height()-1.0f);
+            j = qBound(0.0f, (j - 0.5f*(cellSize-1))/cellSize, levelSize.width()-1.0f);
+        }
+        else if(isClosedForm)
+        {
+            QVector4D tensor = field->getTensor(std::round(i), std::round(j));
+            if(isDegenerate(tensor))
+            {
+                return false;
+            }
+            eigenVectors = getTracelessEigenVectors(tensor);
+            return true;
+        }
+        // Only the eigenvectors are read: they are null at degenerate points
+        eigenVectors = field->getLevelEigenVectors(level, std::round(i), std::round(j));
+        return !isDegenerate(eigenVectors);
+    }
+};
+
+// Samples the eigenvectors of a basis at positions of region, the field
+// covering region. Tracers are specialized on it so that the basis inlines
+template<class Basis>
+struct AnalyticSampler {
+    Basis basis;
+    QRectF region;
+    // Returns false at a degenerate point
+    bool sample(QPointF position, QVector4D& eigenVectors) const
+    {
+        QPointF normalized((position.x()-region.left())/region.width(),
+                           (position.y()-region.top())/region.height());
+        QVector4D tensor = basis.tensor(normalized);
+        if(isDegenerate(tensor))
+        {
+            return false;
+        }
+        eigenVectors = getTracelessEigenVectors(tensor);
+        return true;
+    }
+};
+
+template<class Basis>
+AnalyticSampler<Basis> createAnalyticSampler(const Basis& basis, QRectF region)
+{
+    AnalyticSampler<Basis> sampler;
+    sampler.basis = basis;
+    sampler.region = region;
+    return sampler;
+}
 
 #endif // TENSORFIELD_H
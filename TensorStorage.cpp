@@ -0,0 +1,470 @@
+#include "TensorStorage.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+// Page of a sparse tiled storage a thread pinned to read it
+struct PinnedPage {
+    PinnedPage() : serial(0) {}
+    quint64 serial;
+    QSharedPointer<const QVector<QVector4D> > tensors;
+};
+// Pages each thread read last, by their serial. Reading a cell of one of them
+// takes no lock, so threads reading resident pages don't contend
+const int pinnedPageCount = 4;
+thread_local PinnedPage pinnedPages[pinnedPageCount];
+
+}
+
+TensorStorage::TensorStorage(FieldStorage storage, QSharedPointer<TileCache> cache) :
+    mStorage(storage), mTilesX(0)
+{
+    if(mStorage == SparseTiledStorage)
+    {
+        mCache = cache ? cache : QSharedPointer<TileCache>(new TileCache());
+    }
+}
+
+int TensorStorage::height() const
+{
+    if(mStorage == SparseTiledStorage)
+    {
+        return mSize.height();
+    }
+    return (mStorage == CompactStorage) ? mCompactRows.size() : mRows.size();
+}
+
+int TensorStorage::width() const
+{
+    if(mStorage == SparseTiledStorage)
+    {
+        return mSize.width();
+    }
+    if(height() == 0)
+    {
+        return 0;
+    }
+    return (mStorage == CompactStorage) ? mCompactRows.at(0).size() : mRows.at(0).size();
+}
+
+void TensorStorage::resize(QSize size)
+{
+    if(mStorage == SparseTiledStorage)
+    {
+        if(size != mSize)
+        {
+            mSize = size;
+            mTilesX = (size.width()+SPARSE_TILE_SIZE-1)/SPARSE_TILE_SIZE;
+            int tilesY = (size.height()+SPARSE_TILE_SIZE-1)/SPARSE_TILE_SIZE;
+            mTiles = QVector<SparseTile>(mTilesX*tilesY);
+        }
+    }
+    else if(mStorage == CompactStorage)
+    {
+        mCompactRows.resize(size.height());
+        for(int i=0 ; i<size.height() ; i++)
+        {
+            mCompactRows[i].resize(size.width());
+        }
+    }
+    else
+    {
+        mRows.resize(size.height());
+        for(int i=0 ; i<size.height() ; i++)
+        {
+            mRows[i].resize(size.width());
+        }
+    }
+}
+
+void TensorStorage::fill(QVector4D tensor)
+{
+    if(mStorage == SparseTiledStorage)
+    {
+        for(int t=0 ; t<mTiles.size() ; t++)
+        {
+            mTiles[t].tensor = tensor;
+            mTiles[t].page = QSharedDataPointer<TilePage>();
+        }
+        return;
+    }
+    for(int i=0 ; i<height() ; i++)
+    {
+        for(int j=0 ; j<width() ; j++)
+        {
+            set(i, j, tensor);
+        }
+    }
+}
+
+void TensorStorage::fillTile(int i, int j, QVector4D tensor)
+{
+    if(mStorage == SparseTiledStorage)
+    {
+        SparseTile& tile = mTiles[tileIndex(i,j)];
+        tile.tensor = tensor;
+        tile.page = QSharedDataPointer<TilePage>();
+        return;
+    }
+    int top = (i/SPARSE_TILE_SIZE)*SPARSE_TILE_SIZE;
+    int left = (j/SPARSE_TILE_SIZE)*SPARSE_TILE_SIZE;
+    for(int ti=top ; ti<qMin(top+SPARSE_TILE_SIZE, height()) ; ti++)
+    {
+        for(int tj=left ; tj<qMin(left+SPARSE_TILE_SIZE, width()) ; tj++)
+        {
+            set(ti, tj, tensor);
+        }
+    }
+}
+
+QVector4D TensorStorage::at(int i, int j) const
+{
+    if(mStorage == SparseTiledStorage)
+    {
+        const SparseTile& tile = mTiles.at(tileIndex(i,j));
+        if(!tile.page)
+        {
+            return tile.tensor;
+        }
+        PinnedPage& pinned = pinnedPages[tile.page->serial % pinnedPageCount];
+        if(pinned.serial != tile.page->serial)
+        {
+            pinned.tensors = mCache->pin(tile.page->index);
+            pinned.serial = tile.page->serial;
+        }
+        return pinned.tensors->at((i%SPARSE_TILE_SIZE)*SPARSE_TILE_SIZE + j%SPARSE_TILE_SIZE);
+    }
+    if(mStorage == CompactStorage)
+    {
+        quint32 packed = mCompactRows.at(i).at(j);
+        float a = halfToFloat(packed & 0xffff);
+        float b = halfToFloat(packed >> 16);
+        return QVector4D(a, b, b, -a);
+    }
+    return mRows.at(i).at(j);
+}
+
+void TensorStorage::set(int i, int j, QVector4D tensor)
+{
+    if(mStorage == SparseTiledStorage)
+    {
+        SparseTile& tile = mTiles[tileIndex(i,j)];
+        if(!tile.page)
+        {
+            if(tile.tensor == tensor)
+            {
+                return;
+            }
+            tile.page = new TilePage(mCache, tile.tensor);
+        }
+        // A page shared with a copy of the storage is copied first
+        mCache->write(tile.page->index, (i%SPARSE_TILE_SIZE)*SPARSE_TILE_SIZE + j%SPARSE_TILE_SIZE, tensor);
+    }
+    else if(mStorage == CompactStorage)
+    {
+        mCompactRows[i][j] = floatToHalf(tensor.x()) | ((quint32)floatToHalf(tensor.y()) << 16);
+    }
+    else
+    {
+        mRows[i][j] = tensor;
+    }
+}
+
+bool TensorStorage::sharesRow(int i, const TensorStorage& other) const
+{
+    if(mStorage == SparseTiledStorage)
+    {
+        int first = tileIndex(i,0);
+        for(int t=first ; t<first+mTilesX ; t++)
+        {
+            if(!isSameTile(mTiles.at(t), other.mTiles.at(t)))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    if(mStorage == CompactStorage)
+    {
+        return mCompactRows.at(i).constData() == other.mCompactRows.at(i).constData();
+    }
+    return mRows.at(i).constData() == other.mRows.at(i).constData();
+}
+
+void TensorStorage::detach()
+{
+    mTiles.detach();
+    mRows.detach();
+    mCompactRows.detach();
+    for(int i=0 ; i<mRows.size() ; i++)
+    {
+        mRows[i].detach();
+    }
+    for(int i=0 ; i<mCompactRows.size() ; i++)
+    {
+        mCompactRows[i].detach();
+    }
+}
+
+const uchar* TensorStorage::rowBytes(int i) const
+{
+    if(mStorage == CompactStorage)
+    {
+        return (const uchar*)mCompactRows.at(i).constData();
+    }
+    if(mStorage == SparseTiledStorage)
+    {
+        return 0;
+    }
+    return (const uchar*)mRows.at(i).constData();
+}
+
+int TensorStorage::rowByteCount(int i) const
+{
+    if(mStorage == CompactStorage)
+    {
+        return mCompactRows.at(i).size()*sizeof(quint32);
+    }
+    if(mStorage == SparseTiledStorage)
+    {
+        return 0;
+    }
+    return mRows.at(i).size()*sizeof(QVector4D);
+}
+
+int TensorStorage::uniformRun(int i, int j, QVector4D& tensor) const
+{
+    if(mStorage != SparseTiledStorage)
+    {
+        return 0;
+    }
+    const SparseTile& tile = mTiles.at(tileIndex(i,j));
+    if(tile.page)
+    {
+        return 0;
+    }
+    tensor = tile.tensor;
+    return qMin((j/SPARSE_TILE_SIZE+1)*SPARSE_TILE_SIZE, mSize.width()) - j;
+}
+
+bool TensorStorage::isUniform(QRect cells, QVector4D& tensor) const
+{
+    if(mStorage != SparseTiledStorage || cells.isEmpty())
+    {
+        return false;
+    }
+    const SparseTile& first = mTiles.at(tileIndex(cells.top(), cells.left()));
+    for(int ti=cells.top()/SPARSE_TILE_SIZE ; ti<=cells.bottom()/SPARSE_TILE_SIZE ; ti++)
+    {
+        for(int tj=cells.left()/SPARSE_TILE_SIZE ; tj<=cells.right()/SPARSE_TILE_SIZE ; tj++)
+        {
+            const SparseTile& tile = mTiles.at(ti*mTilesX + tj);
+            if(tile.page || tile.tensor != first.tensor)
+            {
+                return false;
+            }
+        }
+    }
+    tensor = first.tensor;
+    return true;
+}
+
+QVector<QRect> TensorStorage::squeezeChangedTiles(const TensorStorage& previous)
+{
+    QVector<QRect> changedTiles;
+    for(int t=0 ; t<mTiles.size() ; t++)
+    {
+        if(isSameTile(mTiles.at(t), previous.mTiles.at(t)))
+        {
+            continue;
+        }
+        // Cells written back to their previous value, or water
+        // filling a whole tile, leave a tile of a single tensor
+        QVector4D tensor;
+        if(mTiles.at(t).page && mCache->isUniform(mTiles.at(t).page->index, tensor))
+        {
+            mTiles[t].tensor = tensor;
+            mTiles[t].page = QSharedDataPointer<TilePage>();
+            if(isSameTile(mTiles.at(t), previous.mTiles.at(t)))
+            {
+                continue;
+            }
+        }
+        changedTiles.push_back(tileCells(t));
+    }
+    return changedTiles;
+}
+
+QRect TensorStorage::tileCells(int t) const
+{
+    QRect tile((t%mTilesX)*SPARSE_TILE_SIZE, (t/mTilesX)*SPARSE_TILE_SIZE,
+               SPARSE_TILE_SIZE, SPARSE_TILE_SIZE);
+    return tile.intersected(QRect(QPoint(0,0), mSize));
+}
+
+QSharedPointer<const QVector<QVector4D> > TensorStorage::tileTensors(int t, QVector4D& tensor) const
+{
+    const SparseTile& tile = mTiles.at(t);
+    if(!tile.page)
+    {
+        tensor = tile.tensor;
+        return QSharedPointer<const QVector<QVector4D> >();
+    }
+    return mCache->pin(tile.page->index);
+}
+
+qint64 TensorStorage::tileCacheMemoryCap() const
+{
+    return mCache ? mCache->memoryCap() : 0;
+}
+
+void TensorStorage::setTileCacheMemoryCap(qint64 memoryCap)
+{
+    if(mCache)
+    {
+        mCache->setMemoryCap(memoryCap);
+    }
+}
+
+bool TensorStorage::isSameTile(const SparseTile& tile1, const SparseTile& tile2)
+{
+    if(tile1.page || tile2.page)
+    {
+        return tile1.page.constData() == tile2.page.constData();
+    }
+    return tile1.tensor == tile2.tensor;
+}
+
+quint16 floatToHalf(float value)
+{
+#if defined(__F16C__)
+    return _cvtss_sh(value, 0);
+#else
+    quint32 bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    quint32 sign = (bits >> 16) & 0x8000;
+    quint32 floatExponent = (bits >> 23) & 0xff;
+    quint32 mantissa = bits & 0x7fffff;
+    if(floatExponent == 0xff)
+    {
+        // Infinity, or NaN
+        return sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0);
+    }
+    qint32 exponent = (qint32)floatExponent - 127 + 15;
+    if(exponent >= 31)
+    {
+        return sign | 0x7c00;
+    }
+    if(exponent <= 0)
+    {
+        // Subnormal half float, or zero
+        if(exponent < -10)
+        {
+            return sign;
+        }
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        quint32 half = mantissa >> shift;
+        quint32 remainder = mantissa & ((1u << shift) - 1);
+        quint32 halfway = 1u << (shift - 1);
+        if(remainder > halfway || (remainder == halfway && (half & 1)))
+        {
+            half++;
+        }
+        return sign | half;
+    }
+    // A carry out of the mantissa correctly increments the exponent
+    quint32 half = ((quint32)exponent << 10) | (mantissa >> 13);
+    quint32 remainder = mantissa & 0x1fff;
+    if(remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+    {
+        half++;
+    }
+    return sign | half;
+#endif
+}
+
+float halfToFloat(quint16 half)
+{
+#if defined(__F16C__)
+    return _cvtsh_ss(half);
+#else
+    quint32 sign = (quint32)(half & 0x8000) << 16;
+    quint32 exponent = (half >> 10) & 0x1f;
+    quint32 mantissa = half & 0x3ff;
+    quint32 bits;
+    if(exponent == 0)
+    {
+        if(mantissa == 0)
+        {
+            bits = sign;
+        }
+        else
+        {
+            // Subnormal half float: normalize it
+            exponent = 127 - 15 + 1;
+            while(!(mantissa & 0x400))
+            {
+                mantissa <<= 1;
+                exponent--;
+            }
+            mantissa &= 0x3ff;
+            bits = sign | (exponent << 23) | (mantissa << 13);
+        }
+    }
+    else if(exponent == 31)
+    {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else
+    {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+#endif
+}
+
+void encodeEigenData(QVector4D eigenVectors, QVector2D eigenValues, quint16& angle, quint16& magnitude)
+{
+    if(eigenVectors.isNull())
+    {
+        angle = 0;
+        magnitude = 0;
+        return;
+    }
+    // An eigenvector and its opposite are the same direction
+    double theta = std::atan2(eigenVectors.y(), eigenVectors.x());
+    if(theta < 0.0)
+    {
+        theta += M_PI;
+    }
+    angle = (quint16)((qint64)std::floor(theta/M_PI*65536.0 + 0.5) & 0xffff);
+    magnitude = floatToHalf(qMax(std::fabs(eigenValues.x()), std::fabs(eigenValues.y())));
+}
+
+QVector4D decodeEigenVectors(quint16 angle, quint16 magnitude)
+{
+    if(magnitude == 0)
+    {
+        return QVector4D(0,0,0,0);
+    }
+    float theta = angle*(float)M_PI/65536.0f;
+    float c = std::cos(theta);
+    float s = std::sin(theta);
+    return QVector4D(c, s, -s, c);
+}
+
+QVector2D decodeEigenValues(quint16 magnitude)
+{
+    float value = halfToFloat(magnitude);
+    return QVector2D(value, -value);
+}
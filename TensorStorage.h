@@ -0,0 +1,139 @@
+#ifndef TENSORSTORAGE_H
+#define TENSORSTORAGE_H
+
+#include <QRect>
+#include <QSharedDataPointer>
+#include <QSharedPointer>
+#include <QSize>
+#include <QVector>
+#include <QVector2D>
+#include <QVector4D>
+
+#include "TileCache.h"
+
+// Precision the tensors and eigen data of a field are stored with
+enum FieldStorage {
+    // 4 floats per tensor
+    FullPrecisionStorage,
+    // The (a,b) part of each traceless tensor as 2 half floats,
+    // and its eigenvectors as one quantized angle plus a half float eigenvalue
+    CompactStorage,
+    // Tiles of SPARSE_TILE_SIZE x SPARSE_TILE_SIZE tensors: a tile of equal
+    // tensors is a single one, the others are paged from a file through an LRU
+    // cache. The eigen data isn't stored, but computed when read
+    SparseTiledStorage
+};
+
+// Rows of real, symmetrical and traceless tensors, in full precision or as
+// 2 half floats per tensor, or sparse tiles. Copies share their rows (or tiles)
+// until they are written, so the parts an edit left untouched can be skipped
+// when comparing versions
+class TensorStorage
+{
+public:
+    // A sparse tiled storage pages its tiles through cache, which other storages
+    // may share, or through a cache of its own if cache is null
+    explicit TensorStorage(FieldStorage storage = FullPrecisionStorage,
+                           QSharedPointer<TileCache> cache = QSharedPointer<TileCache>());
+
+    // Returns the precision of the tensors
+    FieldStorage storage() const {return mStorage;}
+    // Returns the number of rows
+    int height() const;
+    // Returns the number of tensors per row
+    int width() const;
+    // Change the size. New tensors are null. In sparse tiled storage,
+    // all the tensors become null if the size changed
+    void resize(QSize size);
+    // Set all the tensors to tensor
+    void fill(QVector4D tensor);
+    // Set the tensors of the SPARSE_TILE_SIZE x SPARSE_TILE_SIZE tile of cell (i,j)
+    // to tensor. In sparse tiled storage, the tile becomes a single tensor
+    void fillTile(int i, int j, QVector4D tensor);
+
+    // Returns the tensor at (i,j). In sparse tiled storage, the thread keeps
+    // the last few pages it read pinned, and reads them without locking the cache
+    QVector4D at(int i, int j) const;
+    // Set the tensor at (i,j). In compact storage, only its (a,b) part is kept
+    void set(int i, int j, QVector4D tensor);
+
+    // Returns whether row i is still shared with row i of other
+    bool sharesRow(int i, const TensorStorage& other) const;
+    // Stop sharing the rows, so that different rows can then be written concurrently.
+    // In sparse tiled storage, the tensors of a tile can't be written concurrently
+    void detach();
+
+    // Returns the stored bytes of row i, and their number.
+    // Not available in sparse tiled storage
+    const uchar* rowBytes(int i) const;
+    int rowByteCount(int i) const;
+
+    // Returns the number of cells from (i,j) to the end of its tile on row i if
+    // its tile is made of a single tensor, and that tensor. Otherwise returns 0
+    int uniformRun(int i, int j, QVector4D& tensor) const;
+    // Returns whether the cells are known to hold the same tensor, and that tensor.
+    // Only tiles made of a single tensor are known to, so it is always false
+    // outside of sparse tiled storage
+    bool isUniform(QRect cells, QVector4D& tensor) const;
+    // Store the tiles that differ from previous and now hold a single tensor
+    // as that tensor, and returns the cells (x = j, y = i) of the tiles still
+    // differing. Both must be sparse tiled storages of the same size
+    QVector<QRect> squeezeChangedTiles(const TensorStorage& previous);
+    // Returns the number of tiles of a sparse tiled storage, row by row
+    int tileCount() const {return mTiles.size();}
+    // Returns the cells (x = j, y = i) of tile t
+    QRect tileCells(int t) const;
+    // Returns the tensors of tile t, SPARSE_TILE_SIZE per row, or null if the
+    // tile is made of a single tensor, which is then set
+    QSharedPointer<const QVector<QVector4D> > tileTensors(int t, QVector4D& tensor) const;
+
+    // Returns and change the number of bytes of tiles kept in memory
+    // by a sparse tiled storage, and its copies
+    qint64 tileCacheMemoryCap() const;
+    void setTileCacheMemoryCap(qint64 memoryCap);
+    // Returns the cache the tiles of a sparse tiled storage are paged through
+    QSharedPointer<TileCache> tileCache() const {return mCache;}
+
+private:
+
+    FieldStorage mStorage;
+    // Rows of full precision tensors
+    QVector<QVector<QVector4D> > mRows;
+    // Rows of compact tensors: a in the low half float, b in the high one
+    QVector<QVector<quint32> > mCompactRows;
+
+    // Tile of a sparse tiled storage: a single tensor, or a page of the cache
+    struct SparseTile {
+        QVector4D tensor;
+        QSharedDataPointer<TilePage> page;
+    };
+    // Returns the tile of cell (i,j)
+    int tileIndex(int i, int j) const
+    {
+        return (i/SPARSE_TILE_SIZE)*mTilesX + j/SPARSE_TILE_SIZE;
+    }
+    // Returns whether 2 tiles are known to hold the same tensors
+    static bool isSameTile(const SparseTile& tile1, const SparseTile& tile2);
+
+    // Size of a sparse tiled storage, and its number of tiles per row
+    QSize mSize;
+    int mTilesX;
+    // Tiles, row by row
+    QVector<SparseTile> mTiles;
+    // Pages of the tiles that aren't made of a single tensor
+    QSharedPointer<TileCache> mCache;
+};
+
+// Returns the half float closest to value, ties to even
+quint16 floatToHalf(float value);
+// Returns the value of a half float
+float halfToFloat(quint16 half);
+// Quantize the major eigenvector of a tensor to an angle in [0,pi[, and its
+// positive eigenvalue to a half float, which is 0 for a degenerate tensor
+void encodeEigenData(QVector4D eigenVectors, QVector2D eigenValues, quint16& angle, quint16& magnitude);
+// Returns the major and minor eigenvectors of compact eigen data
+QVector4D decodeEigenVectors(quint16 angle, quint16 magnitude);
+// Returns the eigenvalues of compact eigen data, the major one first
+QVector2D decodeEigenValues(quint16 magnitude);
+
+#endif // TENSORSTORAGE_H
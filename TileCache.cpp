@@ -0,0 +1,253 @@
+#include "TileCache.h"
+
+#include <QAtomicInteger>
+#include <QDebug>
+#include <QMutexLocker>
+
+namespace
+{
+
+const int pageTensors = SPARSE_TILE_SIZE*SPARSE_TILE_SIZE;
+const qint64 pageBytes = pageTensors*sizeof(QVector4D);
+
+// Last serial of a page. 0 is never given
+QAtomicInteger<quint64> lastSerial(0);
+
+}
+
+TileCache::TileCache(qint64 memoryCap) :
+    mMemoryCap(memoryCap), mPageCount(0), mUseCount(0), mLastPage(-1)
+{
+    if(!mFile.open())
+    {
+        qCritical()<<"TileCache(): Unable to create the page file:"<<mFile.errorString();
+    }
+}
+
+qint64 TileCache::memoryCap() const
+{
+    QMutexLocker locker(&mMutex);
+    return mMemoryCap;
+}
+
+void TileCache::setMemoryCap(qint64 memoryCap)
+{
+    QMutexLocker locker(&mMutex);
+    mMemoryCap = memoryCap;
+    evictPagesOverCap(0);
+}
+
+int TileCache::createPage(QVector4D tensor)
+{
+    QMutexLocker locker(&mMutex);
+    int page = allocatePage();
+    CachedPage& cachedPage = insertPage(page);
+    cachedPage.tensors = QSharedPointer<QVector<QVector4D> >(new QVector<QVector4D>(pageTensors, tensor));
+    return page;
+}
+
+int TileCache::copyPage(int page)
+{
+    QMutexLocker locker(&mMutex);
+    QSharedPointer<QVector<QVector4D> > tensors(new QVector<QVector4D>(*loadPage(page).tensors));
+    tensors->detach();
+    int copy = allocatePage();
+    insertPage(copy).tensors = tensors;
+    return copy;
+}
+
+void TileCache::releasePage(int page)
+{
+    QMutexLocker locker(&mMutex);
+    QHash<int, CachedPage>::iterator itr = mCachedPages.find(page);
+    if(itr != mCachedPages.end())
+    {
+        mRecentPages.remove(itr->lastUse);
+        mCachedPages.erase(itr);
+    }
+    mPinnedPages.remove(page);
+    if(mLastPage == page)
+    {
+        mLastPage = -1;
+    }
+    mFreePages.push_back(page);
+}
+
+QVector4D TileCache::read(int page, int index)
+{
+    QMutexLocker locker(&mMutex);
+    return loadPage(page).tensors->at(index);
+}
+
+QSharedPointer<const QVector<QVector4D> > TileCache::pin(int page)
+{
+    QMutexLocker locker(&mMutex);
+    QSharedPointer<QVector<QVector4D> > tensors = loadPage(page).tensors;
+    mPinnedPages.insert(page, tensors);
+    return tensors;
+}
+
+void TileCache::write(int page, int index, QVector4D tensor)
+{
+    QMutexLocker locker(&mMutex);
+    CachedPage& cachedPage = loadPage(page);
+    (*cachedPage.tensors)[index] = tensor;
+    cachedPage.isModified = true;
+}
+
+bool TileCache::isUniform(int page, QVector4D& tensor)
+{
+    QMutexLocker locker(&mMutex);
+    const QVector<QVector4D>& tensors = *loadPage(page).tensors;
+    for(int k=1 ; k<tensors.size() ; k++)
+    {
+        if(tensors[k] != tensors[0])
+        {
+            return false;
+        }
+    }
+    tensor = tensors[0];
+    return true;
+}
+
+TileCache::CachedPage& TileCache::loadPage(int page)
+{
+    QHash<int, CachedPage>::iterator itr = mCachedPages.find(page);
+    if(itr != mCachedPages.end())
+    {
+        // Most accesses stay on the same page, which is then already the most recent
+        if(page != mLastPage)
+        {
+            mRecentPages.remove(itr->lastUse);
+            itr->lastUse = ++mUseCount;
+            mRecentPages.insert(itr->lastUse, page);
+            mLastPage = page;
+        }
+        return itr.value();
+    }
+    CachedPage& cachedPage = insertPage(page);
+    cachedPage.isModified = false;
+    QHash<int, QWeakPointer<QVector<QVector4D> > >::iterator pinned = mPinnedPages.find(page);
+    if(pinned != mPinnedPages.end())
+    {
+        cachedPage.tensors = pinned->toStrongRef();
+        if(cachedPage.tensors)
+        {
+            return cachedPage;
+        }
+        mPinnedPages.erase(pinned);
+    }
+    cachedPage.tensors = QSharedPointer<QVector<QVector4D> >(new QVector<QVector4D>(pageTensors));
+    qint64 bytes = -1;
+    if(mFile.seek(page*pageBytes))
+    {
+        bytes = mFile.read(reinterpret_cast<char*>(cachedPage.tensors->data()), pageBytes);
+    }
+    if(bytes != pageBytes)
+    {
+        qCritical()<<"TileCache::loadPage(): Unable to read page"<<page<<":"<<mFile.errorString();
+    }
+    return cachedPage;
+}
+
+TileCache::CachedPage& TileCache::insertPage(int page)
+{
+    evictPagesOverCap(1);
+    CachedPage& cachedPage = mCachedPages[page];
+    // A new page isn't in the file yet
+    cachedPage.isModified = true;
+    cachedPage.lastUse = ++mUseCount;
+    mRecentPages.insert(cachedPage.lastUse, page);
+    mLastPage = page;
+    return cachedPage;
+}
+
+void TileCache::evictPagesOverCap(int extraPages)
+{
+    int pinnedPageCount = countPinnedPagesOutsideCache();
+    while(mCachedPages.size() > (extraPages == 0 ? 1 : 0)
+          && mCachedPages.size() + pinnedPageCount + extraPages > maxCachedPages())
+    {
+        if(evictPage())
+        {
+            pinnedPageCount++;
+        }
+    }
+}
+
+int TileCache::countPinnedPagesOutsideCache()
+{
+    int count = 0;
+    QHash<int, QWeakPointer<QVector<QVector4D> > >::iterator itr = mPinnedPages.begin();
+    while(itr != mPinnedPages.end())
+    {
+        if(itr->isNull())
+        {
+            itr = mPinnedPages.erase(itr);
+            continue;
+        }
+        if(!mCachedPages.contains(itr.key()))
+        {
+            count++;
+        }
+        itr++;
+    }
+    return count;
+}
+
+bool TileCache::evictPage()
+{
+    int page = mRecentPages.begin().value();
+    mRecentPages.erase(mRecentPages.begin());
+    QHash<int, CachedPage>::iterator itr = mCachedPages.find(page);
+    if(itr->isModified)
+    {
+        qint64 bytes = -1;
+        if(mFile.seek(page*pageBytes))
+        {
+            bytes = mFile.write(reinterpret_cast<const char*>(itr->tensors->constData()), pageBytes);
+        }
+        if(bytes != pageBytes)
+        {
+            qCritical()<<"TileCache::evictPage(): Unable to write page"<<page<<":"<<mFile.errorString();
+        }
+    }
+    mCachedPages.erase(itr);
+    if(mLastPage == page)
+    {
+        mLastPage = -1;
+    }
+    // The pin is only kept while someone else holds the tensors
+    QHash<int, QWeakPointer<QVector<QVector4D> > >::iterator pinned = mPinnedPages.find(page);
+    if(pinned == mPinnedPages.end())
+    {
+        return false;
+    }
+    if(pinned->isNull())
+    {
+        mPinnedPages.erase(pinned);
+        return false;
+    }
+    return true;
+}
+
+quint64 TileCache::createSerial()
+{
+    return lastSerial.fetchAndAddRelaxed(1) + 1;
+}
+
+int TileCache::allocatePage()
+{
+    if(!mFreePages.isEmpty())
+    {
+        int page = mFreePages.last();
+        mFreePages.pop_back();
+        return page;
+    }
+    return mPageCount++;
+}
+
+int TileCache::maxCachedPages() const
+{
+    return (int)qMax(Q_INT64_C(1), mMemoryCap/pageBytes);
+}
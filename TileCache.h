@@ -0,0 +1,126 @@
+#ifndef TILECACHE_H
+#define TILECACHE_H
+
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QSharedData>
+#include <QSharedPointer>
+#include <QTemporaryFile>
+#include <QVector>
+#include <QVector4D>
+#include <QWeakPointer>
+
+// Side of the tiles of a sparse tiled tensor field, in cells
+#define SPARSE_TILE_SIZE 64
+// Default number of bytes of pages a tile cache keeps in memory
+#define TILE_CACHE_DEFAULT_MEMORY_CAP (Q_INT64_C(1) << 32)
+
+// Pages of SPARSE_TILE_SIZE x SPARSE_TILE_SIZE tensors, row by row, stored in a
+// temporary file. The recently used pages stay in memory up to a memory cap,
+// past which the least recently used one is written back to the file.
+// Pages written back while pinned stay in memory, and count against the cap.
+// Shared by the copies of a sparse tiled field, so accesses are serialized,
+// but a pinned page is read without locking the cache
+class TileCache
+{
+public:
+    explicit TileCache(qint64 memoryCap = TILE_CACHE_DEFAULT_MEMORY_CAP);
+
+    // Returns the number of bytes of pages kept in memory at most
+    qint64 memoryCap() const;
+    // Change the memory cap. Pages are written back until it is respected,
+    // but the last used page always stays in memory
+    void setMemoryCap(qint64 memoryCap);
+
+    // Returns a new page filled with the tensor
+    int createPage(QVector4D tensor);
+    // Returns a new page holding the tensors of page
+    int copyPage(int page);
+    // Free a page. Its place in the file is reused
+    void releasePage(int page);
+
+    // Returns the tensor at index of a page
+    QVector4D read(int page, int index);
+    // Returns the tensors of a page, loaded in memory. They stay in memory while
+    // they are held, and see the later writes to the page, even if the cache
+    // writes it back to the file meanwhile
+    QSharedPointer<const QVector<QVector4D> > pin(int page);
+    // Set the tensor at index of a page
+    void write(int page, int index, QVector4D tensor);
+    // Returns whether all the tensors of a page are equal, and their value
+    bool isUniform(int page, QVector4D& tensor);
+
+    // Returns a number identifying a new page among the pages of all the caches,
+    // unlike its index which is reused once it is released
+    static quint64 createSerial();
+
+private:
+
+    // Page held in memory
+    struct CachedPage {
+        // Never shared with another vector, so that writes don't move them
+        QSharedPointer<QVector<QVector4D> > tensors;
+        // Holds whether the tensors differ from the file
+        bool isModified;
+        // Key of the page in mRecentPages
+        qint64 lastUse;
+    };
+
+    // Returns a page in memory, reading it from the file if needed
+    CachedPage& loadPage(int page);
+    // Add a page in memory, writing back the least recently used ones
+    // to make room for it
+    CachedPage& insertPage(int page);
+    // Write back the least recently used page and remove it from the cached pages.
+    // Returns whether it stays in memory because it is still pinned
+    bool evictPage();
+    // Write back pages until the cached pages and the pinned ones written back
+    // leave room for extraPages more under the memory cap.
+    // The last used page always stays in memory
+    void evictPagesOverCap(int extraPages);
+    // Returns the number of pages written back that are still pinned,
+    // and forget the pins that are no longer held
+    int countPinnedPagesOutsideCache();
+    // Returns a free page of the file
+    int allocatePage();
+    // Returns the number of pages kept in memory at most
+    int maxCachedPages() const;
+
+    mutable QMutex mMutex;
+    qint64 mMemoryCap;
+    // File holding the pages that left memory
+    QTemporaryFile mFile;
+    // Number of pages of the file, and the free ones
+    int mPageCount;
+    QVector<int> mFreePages;
+    // Pages in memory, and their indices from the least to the most recently used
+    QHash<int, CachedPage> mCachedPages;
+    QMap<qint64, int> mRecentPages;
+    // Tensors of the pages pinned since they were loaded. A page written back
+    // while pinned is loaded again from these, which the file matches
+    QHash<int, QWeakPointer<QVector<QVector4D> > > mPinnedPages;
+    qint64 mUseCount;
+    // Page of the last access, whose use isn't updated again
+    // while the accesses stay on it
+    int mLastPage;
+};
+
+// Page of a tile cache holding the tensors of a tile. It is shared by the copies
+// of a field until one of them writes the tile, which then gets its own copy
+struct TilePage : public QSharedData
+{
+    TilePage(QSharedPointer<TileCache> tileCache, QVector4D tensor) :
+        cache(tileCache), index(tileCache->createPage(tensor)), serial(TileCache::createSerial()) {}
+    TilePage(const TilePage& other) :
+        QSharedData(other), cache(other.cache), index(other.cache->copyPage(other.index)),
+        serial(TileCache::createSerial()) {}
+    ~TilePage() {cache->releasePage(index);}
+
+    QSharedPointer<TileCache> cache;
+    int index;
+    // Identifies the page while its index may be reused
+    quint64 serial;
+};
+
+#endif // TILECACHE_H
@@ -0,0 +1,74 @@
+#include "TraceCache.h"
+
+#include <QMutexLocker>
+
+TraceCache::TraceCache() :
+    mFieldVersion(-1), mFieldLevel(0), mIsCoarseTracing(false), mStep(0.0f), mPointCount(0)
+{
+}
+
+void TraceCache::setFieldVersion(int fieldVersion, QRectF fieldRegion, float step, int fieldLevel,
+                                 bool isCoarseTracing)
+{
+    QMutexLocker locker(&mMutex);
+    if(fieldVersion != mFieldVersion || fieldRegion != mFieldRegion || step != mStep
+            || fieldLevel != mFieldLevel || isCoarseTracing != mIsCoarseTracing)
+    {
+        mFieldVersion = fieldVersion;
+        mFieldRegion = fieldRegion;
+        mFieldLevel = fieldLevel;
+        mIsCoarseTracing = isCoarseTracing;
+        mStep = step;
+        mTraces.clear();
+        mPointCount = 0;
+    }
+}
+
+TraceKey TraceCache::key(QPointF seed, bool isMajor, bool isOpposite) const
+{
+    QMutexLocker locker(&mMutex);
+    float quantum = mStep/TRACE_CACHE_SEED_QUANTUM;
+    TraceKey key;
+    key.x = quantum > 0 ? qRound64(seed.x()/quantum) : 0;
+    key.y = quantum > 0 ? qRound64(seed.y()/quantum) : 0;
+    key.isMajor = isMajor;
+    key.isOpposite = isOpposite;
+    return key;
+}
+
+bool TraceCache::find(const TraceKey& key, StreamlineTrace& trace) const
+{
+    QMutexLocker locker(&mMutex);
+    QHash<TraceKey, StreamlineTrace>::const_iterator itr = mTraces.constFind(key);
+    if(itr == mTraces.constEnd())
+    {
+        return false;
+    }
+    trace = *itr;
+    return true;
+}
+
+void TraceCache::insert(const TraceKey& key, const StreamlineTrace& trace)
+{
+    QMutexLocker locker(&mMutex);
+    QHash<TraceKey, StreamlineTrace>::iterator itr = mTraces.find(key);
+    if(itr != mTraces.end())
+    {
+        mPointCount -= itr->points.size();
+    }
+    // Start again rather than growing without bound
+    if(mPointCount + trace.points.size() > TRACE_CACHE_MAX_POINTS)
+    {
+        mTraces.clear();
+        mPointCount = 0;
+    }
+    mTraces.insert(key, trace);
+    mPointCount += trace.points.size();
+}
+
+void TraceCache::clear()
+{
+    QMutexLocker locker(&mMutex);
+    mTraces.clear();
+    mPointCount = 0;
+}
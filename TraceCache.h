@@ -0,0 +1,85 @@
+#ifndef TRACECACHE_H
+#define TRACECACHE_H
+
+#include <QHash>
+#include <QMutex>
+#include <QPointF>
+#include <QRectF>
+#include <QVector>
+
+// Number of points kept in the cache before it is emptied
+#define TRACE_CACHE_MAX_POINTS 4000000
+// Quantization of the seed positions, as a fraction of the step
+#define TRACE_CACHE_SEED_QUANTUM 64.0f
+
+// Hyperstreamline traced from a seed, only depending on the tensor field.
+// Each point is followed by the next position computed from it,
+// so the last point is the one the field stopped at, if complete
+struct StreamlineTrace {
+    QVector<QPointF> points;
+    // Holds whether the trace reached the boundary of the field,
+    // a degenerate point, a loop, or the maximum number of steps
+    bool isComplete;
+};
+
+// Key of a trace: quantized seed position, eigenvector family,
+// and whether the first step goes against the eigenvector
+struct TraceKey {
+    qint64 x;
+    qint64 y;
+    bool isMajor;
+    bool isOpposite;
+    bool operator==(const TraceKey& other) const
+    {
+        return x == other.x && y == other.y
+                && isMajor == other.isMajor && isOpposite == other.isOpposite;
+    }
+};
+
+inline uint qHash(const TraceKey& key, uint seed = 0)
+{
+    return qHash(key.x, seed) ^ (qHash(key.y, seed) * 31) ^ (key.isMajor ? 0x9e3779b9 : 0) ^ (key.isOpposite ? 0x7f4a7c15 : 0);
+}
+
+// Traces of the seeds of the previous generations, reused as long as
+// the tensor field and the step are unchanged. Shared by the tiles of
+// a tiled generation, so accesses are serialized
+class TraceCache
+{
+public:
+    TraceCache();
+
+    // Empty the cache if the field version, the region the field covers,
+    // the level of the field pyramid the traces read, how the eigenvectors
+    // are read, or the step changed
+    void setFieldVersion(int fieldVersion, QRectF fieldRegion, float step, int fieldLevel = 0,
+                         bool isCoarseTracing = false);
+    // Returns the key of the trace starting at the seed
+    TraceKey key(QPointF seed, bool isMajor, bool isOpposite) const;
+
+    // Find a trace. Returns false if it isn't in the cache
+    bool find(const TraceKey& key, StreamlineTrace& trace) const;
+    // Add or replace a trace
+    void insert(const TraceKey& key, const StreamlineTrace& trace);
+    // Remove every trace
+    void clear();
+
+private:
+
+    mutable QMutex mMutex;
+    // Version of the tensor field the traces were computed from
+    int mFieldVersion;
+    // Region covered by the field, which places the traces
+    QRectF mFieldRegion;
+    // Level of the field pyramid the traces read
+    int mFieldLevel;
+    // Holds whether the eigenvectors were computed from the tensors at every level
+    bool mIsCoarseTracing;
+    // Integration step of the traces
+    float mStep;
+    QHash<TraceKey, StreamlineTrace> mTraces;
+    // Number of points in the cache
+    int mPointCount;
+};
+
+#endif // TRACECACHE_H
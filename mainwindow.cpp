@@ -1,6 +1,9 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
 
+#include <QPainter>
+#include <QStatusBar>
+
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::MainWindow)
@@ -14,9 +17,20 @@ MainWindow::MainWindow(QWidget *parent) :
     ui->comboBoxSeedInit->addItem("Regular Grid");
     ui->comboBoxSeedInit->addItem("Random distribution");
     ui->comboBoxSeedInit->addItem("Controlled random distribution");
+    ui->comboBoxSeedInit->addItem("Separatrices");
 
     ui->spinBoxDensity->setRange(0, 100);
     ui->spinBoxDensity->setValue(separationDistance);
+    ui->spinBoxShoreSetback->setRange(0, 100);
+    ui->spinBoxShoreSetback->setValue(0);
+
+    // In the order of FieldStorage
+    ui->comboBoxFieldStorage->addItem("Full precision");
+    ui->comboBoxFieldStorage->addItem("Compact");
+    ui->comboBoxFieldStorage->addItem("Sparse tiles");
+    ui->comboBoxFieldStorage->setCurrentIndex(mTensorField->getStorage());
+    ui->spinBoxFieldSize->setRange(2, FIELD_MAX_SIZE);
+    ui->spinBoxFieldSize->setValue(mTensorFieldSize.width());
 
     QObject::connect(ui->buttonAddWatermap, SIGNAL(clicked()),
                      mTensorField, SLOT(actionAddWatermap()));
@@ -26,20 +40,65 @@ MainWindow::MainWindow(QWidget *parent) :
                      mTensorField, SLOT(generateMultiRotationTensorField()));
     QObject::connect(ui->buttonGenerateRadialTF, SIGNAL(clicked()),
                      mTensorField, SLOT(generateRadialTensorField()));
+    QObject::connect(ui->buttonGenerateDesignTF, SIGNAL(clicked()),
+                     mTensorField, SLOT(generateDesignElementsTensorField()));
     QObject::connect(ui->buttonGenerateHeightmapTF, SIGNAL(clicked()),
                      mTensorField, SLOT(generateHeightmapTensorField()));
     QObject::connect(ui->buttonSmoothTF, SIGNAL(clicked()),
                      mTensorField, SLOT(smoothTensorField()));
+    QObject::connect(ui->checkBoxAnalyticField, SIGNAL(toggled(bool)),
+                     mTensorField, SLOT(setAnalyticEvaluation(bool)));
+    QObject::connect(ui->spinBoxFieldSize, SIGNAL(valueChanged(int)),
+                     this, SLOT(changeFieldSize(int)));
+    QObject::connect(ui->comboBoxFieldStorage, SIGNAL(currentIndexChanged(int)),
+                     this, SLOT(changeFieldStorage(int)));
     QObject::connect(mTensorField, SIGNAL(newTensorFieldImage(QPixmap)),
                      ui->labelTensorFieldDisplay,SLOT(setPixmap(QPixmap)));
     QObject::connect(ui->buttonGeneratePrincipalRG, SIGNAL(clicked()),
                      mStreetGraph, SLOT(generateStreetGraph()));
+    QObject::connect(ui->buttonUpdateStreetGraph, SIGNAL(clicked()),
+                     mStreetGraph, SLOT(updateStreetGraph()));
+    QObject::connect(ui->buttonSimplifyStreetGraph, SIGNAL(clicked()),
+                     mStreetGraph, SLOT(actionSimplifyStreetGraph()));
+    QObject::connect(ui->buttonExportStreetGraph, SIGNAL(clicked()),
+                     mStreetGraph, SLOT(actionExportStreetGraph()));
+    QObject::connect(ui->buttonLoadStreetGraph, SIGNAL(clicked()),
+                     mStreetGraph, SLOT(actionLoadStreetGraph()));
     QObject::connect(mStreetGraph, SIGNAL(newStreetGraphImage(QPixmap)),
                      ui->labelRoadmapDisplay, SLOT(setPixmap(QPixmap)));
+    QObject::connect(ui->buttonCancelGeneration, SIGNAL(clicked()),
+                     mStreetGraph, SLOT(cancelGeneration()));
+    QObject::connect(mStreetGraph, SIGNAL(generationStarted(QRectF)),
+                     this, SLOT(streetGraphGenerationStarted(QRectF)));
+    QObject::connect(mStreetGraph, SIGNAL(newRoads(QVector<QPolygonF>)),
+                     this, SLOT(drawNewRoads(QVector<QPolygonF>)));
+    QObject::connect(mStreetGraph, SIGNAL(generationProgress(int,int)),
+                     this, SLOT(showGenerationProgress(int,int)));
+    QObject::connect(mStreetGraph, SIGNAL(generationDone(bool)),
+                     this, SLOT(streetGraphGenerationDone(bool)));
+    QObject::connect(mStreetGraph, SIGNAL(exportStarted()),
+                     this, SLOT(streetGraphExportStarted()));
+    QObject::connect(mStreetGraph, SIGNAL(exportProgress(int,int)),
+                     this, SLOT(showExportProgress(int,int)));
+    QObject::connect(mStreetGraph, SIGNAL(exportDone(bool,bool)),
+                     this, SLOT(streetGraphExportDone(bool,bool)));
+    ui->buttonCancelGeneration->setEnabled(false);
     QObject::connect(ui->checkBoxShowNodes, SIGNAL(toggled(bool)),
                      mStreetGraph, SLOT(setDrawNodes(bool)));
+    QObject::connect(ui->checkBoxSecondaryRoads, SIGNAL(toggled(bool)),
+                     mStreetGraph, SLOT(setGenerateSecondaryRoads(bool)));
+    QObject::connect(ui->checkBoxTiledGeneration, SIGNAL(toggled(bool)),
+                     mStreetGraph, SLOT(setTiledGeneration(bool)));
+    QObject::connect(ui->checkBoxLockstepGrowth, SIGNAL(toggled(bool)),
+                     mStreetGraph, SLOT(setLockstepGrowth(bool)));
+    QObject::connect(ui->checkBoxCoarseTracing, SIGNAL(toggled(bool)),
+                     mStreetGraph, SLOT(setCoarseTracing(bool)));
     QObject::connect(ui->spinBoxDensity, SIGNAL(valueChanged(double)),
                      mStreetGraph, SLOT(setSeparationDistance(double)));
+    QObject::connect(ui->spinBoxShoreSetback, SIGNAL(valueChanged(double)),
+                     mStreetGraph, SLOT(setShoreSetback(double)));
+    QObject::connect(ui->buttonLoadSeparationMap, SIGNAL(clicked()),
+                     mStreetGraph, SLOT(actionLoadSeparationMap()));
     QObject::connect(ui->comboBoxSeedInit, SIGNAL(currentIndexChanged(int)),
                      mStreetGraph, SLOT(changeSeedInitMethod(int)));
 }
@@ -55,6 +114,138 @@ void MainWindow::displayVectorFieldImage(QPixmap image)
     ui->labelTensorFieldDisplay->setPixmap(image);
 }
 
+void MainWindow::changeFieldSize(int size)
+{
+    mTensorFieldSize = QSize(size,size);
+    // The storage is changed first, so that the tensors of a large
+    // field are never allocated cell by cell
+    if((qint64)size*size >= SPARSE_FIELD_MIN_CELLS && mTensorField->getStorage() != SparseTiledStorage)
+    {
+        ui->comboBoxFieldStorage->setCurrentIndex(SparseTiledStorage);
+        statusBar()->showMessage("Large field: switched to sparse tiles", 3000);
+    }
+    mTensorField->setFieldSize(mTensorFieldSize);
+}
+
+void MainWindow::changeFieldStorage(int index)
+{
+    mTensorField->setStorage((FieldStorage)index);
+}
+
+void MainWindow::streetGraphGenerationStarted(QRectF region)
+{
+    mPreviewRegion = region;
+    mStreetGraphPreview = QImage(QSize(512,512), QImage::Format_ARGB32);
+    mStreetGraphPreview.fill(QColor::fromRgb(230,230,230));
+    ui->labelRoadmapDisplay->setPixmap(QPixmap::fromImage(mStreetGraphPreview));
+    setGenerationControlsEnabled(false);
+    statusBar()->showMessage("Generating street graph...");
+}
+
+void MainWindow::drawNewRoads(QVector<QPolygonF> roads)
+{
+    if(mStreetGraphPreview.isNull())
+    {
+        return;
+    }
+    // Region coordinates to image coordinates, y pointing down
+    QTransform transform;
+    transform.translate(0, mStreetGraphPreview.height());
+    transform.scale(mStreetGraphPreview.width()/mPreviewRegion.width(),
+                    -mStreetGraphPreview.height()/mPreviewRegion.height());
+    transform.translate(-mPreviewRegion.left(), -mPreviewRegion.top());
+
+    QPainter painter(&mStreetGraphPreview);
+    painter.setTransform(transform);
+    QPen penRoad(Qt::yellow);
+    penRoad.setWidth(2);
+    penRoad.setCosmetic(true);
+    QPen penRoadBlack(Qt::black);
+    penRoadBlack.setWidth(4);
+    penRoadBlack.setCosmetic(true);
+    // Draw two times in different colors to create
+    // a road effect
+    painter.setPen(penRoadBlack);
+    for(int k=0 ; k<roads.size() ; k++)
+    {
+        painter.drawPolyline(roads[k]);
+    }
+    painter.setPen(penRoad);
+    for(int k=0 ; k<roads.size() ; k++)
+    {
+        painter.drawPolyline(roads[k]);
+    }
+    painter.end();
+    ui->labelRoadmapDisplay->setPixmap(QPixmap::fromImage(mStreetGraphPreview));
+}
+
+void MainWindow::showGenerationProgress(int value, int maximum)
+{
+    statusBar()->showMessage(QString("Generating street graph... %1/%2 seeds").arg(value).arg(maximum));
+}
+
+void MainWindow::streetGraphGenerationDone(bool canceled)
+{
+    mStreetGraphPreview = QImage();
+    setGenerationControlsEnabled(true);
+    statusBar()->showMessage(canceled ? "Street graph generation canceled" : "Street graph generated", 3000);
+}
+
+void MainWindow::streetGraphExportStarted()
+{
+    setGenerationControlsEnabled(false);
+    statusBar()->showMessage("Exporting street graph image...");
+}
+
+void MainWindow::showExportProgress(int value, int maximum)
+{
+    statusBar()->showMessage(QString("Exporting street graph image... %1/%2 strips").arg(value).arg(maximum));
+}
+
+void MainWindow::streetGraphExportDone(bool succeeded, bool canceled)
+{
+    setGenerationControlsEnabled(true);
+    if(canceled)
+    {
+        statusBar()->showMessage("Street graph image export canceled", 3000);
+    }
+    else
+    {
+        statusBar()->showMessage(succeeded ? "Street graph image exported" : "Street graph image export failed", 3000);
+    }
+}
+
+void MainWindow::setGenerationControlsEnabled(bool enabled)
+{
+    // The generation thread reads the field and the parameters,
+    // and owns the street graph until it is done
+    ui->buttonAddWatermap->setEnabled(enabled);
+    ui->buttonGenerateGridTF->setEnabled(enabled);
+    ui->buttonGenerateMultiRotTF->setEnabled(enabled);
+    ui->buttonGenerateRadialTF->setEnabled(enabled);
+    ui->buttonGenerateDesignTF->setEnabled(enabled);
+    ui->buttonGenerateHeightmapTF->setEnabled(enabled);
+    ui->buttonSmoothTF->setEnabled(enabled);
+    ui->checkBoxAnalyticField->setEnabled(enabled);
+    ui->spinBoxFieldSize->setEnabled(enabled);
+    ui->comboBoxFieldStorage->setEnabled(enabled);
+    ui->buttonGeneratePrincipalRG->setEnabled(enabled);
+    ui->buttonUpdateStreetGraph->setEnabled(enabled);
+    ui->buttonSimplifyStreetGraph->setEnabled(enabled);
+    ui->buttonExportStreetGraph->setEnabled(enabled);
+    ui->buttonLoadStreetGraph->setEnabled(enabled);
+    ui->buttonLoadSeparationMap->setEnabled(enabled);
+    ui->checkBoxShowNodes->setEnabled(enabled);
+    ui->checkBoxSecondaryRoads->setEnabled(enabled);
+    ui->checkBoxTiledGeneration->setEnabled(enabled);
+    ui->checkBoxLockstepGrowth->setEnabled(enabled);
+    ui->checkBoxCoarseTracing->setEnabled(enabled);
+    ui->spinBoxDensity->setEnabled(enabled);
+    ui->spinBoxShoreSetback->setEnabled(enabled);
+    ui->comboBoxSeedInit->setEnabled(enabled);
+    ui->buttonCancelGeneration->setEnabled(!enabled);
+}
+
 void MainWindow::keyPressEvent(QKeyEvent *event)
 {
     if (event->key()==Qt::Key_Escape)
@@ -4,10 +4,17 @@
 #include <QMainWindow>
 #include <QSize>
 #include <QKeyEvent>
+#include <QImage>
+#include <QRectF>
 
 #include "TensorField.h"
 #include "StreetGraph.h"
 
+// Number of cells from which a field is switched to sparse tiled storage
+#define SPARSE_FIELD_MIN_CELLS (Q_INT64_C(4096)*4096)
+// Largest field side that can be chosen, stored in sparse tiles
+#define FIELD_MAX_SIZE 131072
+
 namespace Ui {
 class MainWindow;
 }
@@ -25,12 +32,38 @@ protected:
 
 private slots:
     void displayVectorFieldImage(QPixmap image);
+    // Resize the tensor field to size x size cells. A large field
+    // is switched to sparse tiled storage first
+    void changeFieldSize(int size);
+    // Store the tensor field as the FieldStorage of index
+    void changeFieldStorage(int index);
+    // Start a new street graph preview, and lock the controls
+    void streetGraphGenerationStarted(QRectF region);
+    // Draw a batch of new roads on the street graph preview
+    void drawNewRoads(QVector<QPolygonF> roads);
+    // Show the generation progress in the status bar
+    void showGenerationProgress(int value, int maximum);
+    // Unlock the controls once the generation is over
+    void streetGraphGenerationDone(bool canceled);
+    // Lock the controls while an image is exported
+    void streetGraphExportStarted();
+    // Show the export progress in the status bar
+    void showExportProgress(int value, int maximum);
+    // Unlock the controls once the export is over
+    void streetGraphExportDone(bool succeeded, bool canceled);
 
 private:
+    // Enable or disable the controls that modify the field or the street graph
+    void setGenerationControlsEnabled(bool enabled);
+
     Ui::MainWindow *ui;
     TensorField * mTensorField;
     QSize mTensorFieldSize;
     StreetGraph * mStreetGraph;
+    // Street graph drawn progressively during the generation
+    QImage mStreetGraphPreview;
+    // Region covered by the street graph preview
+    QRectF mPreviewRegion;
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,92 @@
+#include <QtTest>
+
+#include "TensorField.h"
+
+// Time spent following the eigenvectors of analytic fields across the field,
+// with each memory layout of the eigen data
+class BenchFieldMemoryLayout : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void followEigenVectors_data();
+    void followEigenVectors();
+};
+
+void BenchFieldMemoryLayout::followEigenVectors_data()
+{
+    QTest::addColumn<int>("field");
+    QTest::addColumn<int>("layout");
+    const char* fieldNames[3] = {"grid", "radial", "rotating"};
+    const char* layoutNames[2] = {"row-major", "blocked"};
+    for(int f=0 ; f<3 ; f++)
+    {
+        for(int layout=RowMajorLayout ; layout<=BlockedLayout ; layout++)
+        {
+            QTest::newRow(QByteArray(fieldNames[f]) + " " + layoutNames[layout]) << f << layout;
+        }
+    }
+}
+
+void BenchFieldMemoryLayout::followEigenVectors()
+{
+    QFETCH(int, field);
+    QFETCH(int, layout);
+    QSize fieldSize(1024,1024);
+    TensorField tensorField(fieldSize);
+    switch(field)
+    {
+    case 0: tensorField.fillGridBasisField(M_PI/3, 1); break;
+    case 1: tensorField.fillRadialBasisField(QPointF(0.5,0.5)); break;
+    default: tensorField.fillRotatingField(); break;
+    }
+    tensorField.computeTensorsEigenDecomposition();
+    tensorField.setMemoryLayout((FieldMemoryLayout)layout);
+
+    // Follow both eigenvectors from seeds spread on the field,
+    // half a cell per step, like a tracer on a fine field
+    int seedSpacing = qMax(1, qMax(fieldSize.width(), fieldSize.height())/64);
+    float sum = 0.0f;
+    QBENCHMARK
+    {
+        for(int si=0 ; si<fieldSize.height() ; si+=seedSpacing)
+        {
+            for(int sj=0 ; sj<fieldSize.width() ; sj+=seedSpacing)
+            {
+                for(int major=0 ; major<2 ; major++)
+                {
+                    QVector2D position(sj, si);
+                    QVector2D previousDirection;
+                    for(int step=0 ; step<4*fieldSize.width() ; step++)
+                    {
+                        int i = qRound(position.y());
+                        int j = qRound(position.x());
+                        if(i < 0 || i >= fieldSize.height() || j < 0 || j >= fieldSize.width())
+                        {
+                            break;
+                        }
+                        QVector4D eigenVectors = tensorField.getEigenVectors(i,j);
+                        QVector2D direction = major ? getFirstVector(eigenVectors) : getSecondVector(eigenVectors);
+                        if(direction.isNull())
+                        {
+                            break;
+                        }
+                        if(QVector2D::dotProduct(direction, previousDirection) < 0)
+                        {
+                            direction *= -1;
+                        }
+                        position += 0.5f*direction;
+                        previousDirection = direction;
+                    }
+                    sum += position.x();
+                }
+            }
+        }
+    }
+    // Keep the walk from being optimized away
+    QVERIFY(sum == sum);
+}
+
+QTEST_MAIN(BenchFieldMemoryLayout)
+
+#include "bench_FieldMemoryLayout.moc"
@@ -0,0 +1,6 @@
+include(../tests.pri)
+
+TARGET = bench_FieldMemoryLayout
+TEMPLATE = app
+
+SOURCES += bench_FieldMemoryLayout.cpp
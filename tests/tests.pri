@@ -0,0 +1,17 @@
+# Sources of the field shared by the tests and the benchmarks
+
+QT       += core gui concurrent testlib
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+CONFIG += c++11
+
+INCLUDEPATH += $$PWD/..
+
+SOURCES += $$PWD/../TensorField.cpp \
+    $$PWD/../TensorStorage.cpp \
+    $$PWD/../TileCache.cpp
+
+HEADERS += $$PWD/../TensorField.h \
+    $$PWD/../TensorStorage.h \
+    $$PWD/../TileCache.h
@@ -0,0 +1,11 @@
+#-------------------------------------------------
+#
+# Tests and benchmarks: qmake tests.pro && make && make check
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS += tst_CompactStorage \
+    tst_TensorStorage \
+    bench_FieldMemoryLayout
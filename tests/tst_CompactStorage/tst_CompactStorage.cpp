@@ -0,0 +1,81 @@
+#include <QtTest>
+
+#include "TensorField.h"
+
+// Largest major eigenvector angle error (radians) allowed in compact storage
+#define COMPACT_STORAGE_MAX_ANGLE_ERROR 1e-3f
+// Largest eigenvalue error allowed in compact storage, relative to the eigenvalue
+#define COMPACT_STORAGE_MAX_EIGENVALUE_ERROR 2e-3f
+
+// Compares the eigen data of fields in compact storage to the same fields
+// in full precision, away from the degenerate points
+class TestCompactStorage : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void eigenData_data();
+    void eigenData();
+};
+
+void TestCompactStorage::eigenData_data()
+{
+    QTest::addColumn<int>("field");
+    QTest::newRow("grid") << 0;
+    QTest::newRow("radial") << 1;
+    QTest::newRow("rotating") << 2;
+}
+
+void TestCompactStorage::eigenData()
+{
+    QFETCH(int, field);
+    QSize fieldSize(256,256);
+    TensorField fullField(fieldSize, 0, FullPrecisionStorage);
+    TensorField compactField(fieldSize, 0, CompactStorage);
+    TensorField* fields[2] = {&fullField, &compactField};
+    for(int k=0 ; k<2 ; k++)
+    {
+        switch(field)
+        {
+        case 0: fields[k]->fillGridBasisField(M_PI/3, 1); break;
+        case 1: fields[k]->fillRadialBasisField(QPointF(0.5,0.5)); break;
+        default: fields[k]->fillRotatingField(); break;
+        }
+        fields[k]->computeTensorsEigenDecomposition();
+    }
+
+    float angleError = 0.0f;
+    float eigenValueError = 0.0f;
+    int comparedCells = 0;
+    for(int i=0 ; i<fieldSize.height() ; i++)
+    {
+        for(int j=0 ; j<fieldSize.width() ; j++)
+        {
+            // Close to a degenerate point, the direction is meaningless
+            if(fullField.getTensor(i,j).toVector2D().length() < 1e-3f)
+            {
+                continue;
+            }
+            comparedCells++;
+            QVector2D fullVector = fullField.getMajorEigenVector(i,j).normalized();
+            QVector2D compactVector = compactField.getMajorEigenVector(i,j).normalized();
+            float sine = fullVector.x()*compactVector.y() - fullVector.y()*compactVector.x();
+            float cosine = QVector2D::dotProduct(fullVector, compactVector);
+            angleError = qMax(angleError, std::atan2(std::fabs(sine), std::fabs(cosine)));
+
+            QVector2D fullValues = fullField.getEigenValues(i,j);
+            QVector2D compactValues = compactField.getEigenValues(i,j);
+            float magnitude = qMax(std::fabs(fullValues.x()), std::fabs(fullValues.y()));
+            eigenValueError = qMax(eigenValueError, (compactValues - fullValues).length()/magnitude);
+        }
+    }
+    QVERIFY(comparedCells > 0);
+    QVERIFY2(angleError <= COMPACT_STORAGE_MAX_ANGLE_ERROR,
+             qPrintable(QString("Angle error %1 rad").arg(angleError)));
+    QVERIFY2(eigenValueError <= COMPACT_STORAGE_MAX_EIGENVALUE_ERROR,
+             qPrintable(QString("Relative eigenvalue error %1").arg(eigenValueError)));
+}
+
+QTEST_MAIN(TestCompactStorage)
+
+#include "tst_CompactStorage.moc"
@@ -0,0 +1,7 @@
+include(../tests.pri)
+
+TARGET = tst_CompactStorage
+TEMPLATE = app
+CONFIG += testcase
+
+SOURCES += tst_CompactStorage.cpp
@@ -0,0 +1,227 @@
+#include <QtTest>
+#include <QtConcurrent>
+#include <cmath>
+
+#include "TensorStorage.h"
+
+// Number of bytes of a page of the tile cache
+#define TILE_PAGE_BYTES (SPARSE_TILE_SIZE*SPARSE_TILE_SIZE*(qint64)sizeof(QVector4D))
+
+// Compares sparse tiled storages to full precision storages written the same way.
+// The field size isn't a multiple of the tile size, so the edge tiles are partial
+class TestTensorStorage : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void fill_data();
+    void fill();
+    void setAndAt();
+    void squeezeChangedTiles();
+    void evictionAndReload();
+    void copyOnWrite();
+    void concurrentReads();
+
+private:
+    // Returns a traceless tensor varying with the cell and the seed
+    static QVector4D patternTensor(int i, int j, float seed);
+    // Set the cells to the pattern in both storages
+    static void writePattern(TensorStorage& sparse, TensorStorage& full, QRect cells, float seed);
+    // Returns the number of cells that differ between the storages
+    static int countDifferences(const TensorStorage& sparse, const TensorStorage& full);
+
+    static const QSize fieldSize;
+};
+
+const QSize TestTensorStorage::fieldSize(200,150);
+
+QVector4D TestTensorStorage::patternTensor(int i, int j, float seed)
+{
+    float a = std::sin(0.1f*i + seed);
+    float b = std::cos(0.07f*j - seed);
+    return QVector4D(a, b, b, -a);
+}
+
+void TestTensorStorage::writePattern(TensorStorage& sparse, TensorStorage& full, QRect cells, float seed)
+{
+    for(int i=cells.top() ; i<=cells.bottom() ; i++)
+    {
+        for(int j=cells.left() ; j<=cells.right() ; j++)
+        {
+            sparse.set(i, j, patternTensor(i, j, seed));
+            full.set(i, j, patternTensor(i, j, seed));
+        }
+    }
+}
+
+int TestTensorStorage::countDifferences(const TensorStorage& sparse, const TensorStorage& full)
+{
+    int differences = 0;
+    for(int i=0 ; i<full.height() ; i++)
+    {
+        for(int j=0 ; j<full.width() ; j++)
+        {
+            differences += (sparse.at(i,j) != full.at(i,j)) ? 1 : 0;
+        }
+    }
+    return differences;
+}
+
+void TestTensorStorage::fill_data()
+{
+    QTest::addColumn<QVector4D>("tensor");
+    QTest::newRow("null") << QVector4D(0,0,0,0);
+    QTest::newRow("grid") << QVector4D(0.5f,0.25f,0.25f,-0.5f);
+}
+
+void TestTensorStorage::fill()
+{
+    QFETCH(QVector4D, tensor);
+    TensorStorage sparse(SparseTiledStorage);
+    TensorStorage full(FullPrecisionStorage);
+    sparse.resize(fieldSize);
+    full.resize(fieldSize);
+    QCOMPARE(sparse.height(), full.height());
+    QCOMPARE(sparse.width(), full.width());
+
+    // Written cells are dropped by the fill
+    writePattern(sparse, full, QRect(10,20,100,50), 1.0f);
+    sparse.fill(tensor);
+    full.fill(tensor);
+    QCOMPARE(countDifferences(sparse, full), 0);
+    QVector4D uniform;
+    QVERIFY(sparse.isUniform(QRect(QPoint(0,0), fieldSize), uniform));
+    QCOMPARE(uniform, tensor);
+}
+
+void TestTensorStorage::setAndAt()
+{
+    TensorStorage sparse(SparseTiledStorage);
+    TensorStorage full(FullPrecisionStorage);
+    sparse.resize(fieldSize);
+    full.resize(fieldSize);
+    // Across tiles, and up to the partial edge tiles. The first column of tiles is left null
+    writePattern(sparse, full, QRect(QPoint(SPARSE_TILE_SIZE,30), QPoint(199,149)), 2.0f);
+    QCOMPARE(countDifferences(sparse, full), 0);
+    QVector4D tensor;
+    QVERIFY(sparse.isUniform(QRect(0,0,SPARSE_TILE_SIZE,fieldSize.height()), tensor));
+    QCOMPARE(tensor, QVector4D(0,0,0,0));
+    QVERIFY(!sparse.isUniform(QRect(0,0,2*SPARSE_TILE_SIZE,SPARSE_TILE_SIZE), tensor));
+}
+
+void TestTensorStorage::squeezeChangedTiles()
+{
+    QVector4D background(1,0,0,-1);
+    QVector4D other(0,1,1,0);
+    TensorStorage sparse(SparseTiledStorage);
+    TensorStorage full(FullPrecisionStorage);
+    sparse.resize(fieldSize);
+    full.resize(fieldSize);
+    sparse.fill(background);
+    full.fill(background);
+    TensorStorage previous = sparse;
+
+    // Tile (0,0) changes, tile (1,1) is written back to its tensor,
+    // and tiles (0,2) and (0,3) become another single tensor
+    writePattern(sparse, full, QRect(5,5,10,10), 3.0f);
+    sparse.set(70, 70, other);
+    sparse.set(70, 70, background);
+    for(int i=0 ; i<SPARSE_TILE_SIZE ; i++)
+    {
+        for(int j=2*SPARSE_TILE_SIZE ; j<fieldSize.width() ; j++)
+        {
+            sparse.set(i, j, other);
+            full.set(i, j, other);
+        }
+    }
+
+    QVector<QRect> changedTiles = sparse.squeezeChangedTiles(previous);
+    QCOMPARE(changedTiles.size(), 3);
+    QCOMPARE(changedTiles[0], QRect(0,0,SPARSE_TILE_SIZE,SPARSE_TILE_SIZE));
+    QCOMPARE(changedTiles[1], QRect(2*SPARSE_TILE_SIZE,0,SPARSE_TILE_SIZE,SPARSE_TILE_SIZE));
+    QCOMPARE(changedTiles[2], QRect(3*SPARSE_TILE_SIZE,0,fieldSize.width()-3*SPARSE_TILE_SIZE,SPARSE_TILE_SIZE));
+    QCOMPARE(countDifferences(sparse, full), 0);
+    QVector4D tensor;
+    QVERIFY(sparse.isUniform(QRect(SPARSE_TILE_SIZE,SPARSE_TILE_SIZE,SPARSE_TILE_SIZE,SPARSE_TILE_SIZE), tensor));
+    QCOMPARE(tensor, background);
+    QVERIFY(sparse.isUniform(changedTiles[1].united(changedTiles[2]), tensor));
+    QCOMPARE(tensor, other);
+    // The previous tiles are left as they were
+    QVERIFY(previous.isUniform(QRect(QPoint(0,0), fieldSize), tensor));
+    QCOMPARE(tensor, background);
+}
+
+void TestTensorStorage::evictionAndReload()
+{
+    TensorStorage sparse(SparseTiledStorage);
+    TensorStorage full(FullPrecisionStorage);
+    sparse.resize(fieldSize);
+    full.resize(fieldSize);
+    // Far fewer pages in memory than tiles
+    sparse.setTileCacheMemoryCap(2*TILE_PAGE_BYTES);
+    QCOMPARE(sparse.tileCacheMemoryCap(), 2*TILE_PAGE_BYTES);
+
+    writePattern(sparse, full, QRect(QPoint(0,0), fieldSize), 4.0f);
+    QCOMPARE(countDifferences(sparse, full), 0);
+    // Pages written back are loaded again, written, and written back again
+    writePattern(sparse, full, QRect(30,20,150,100), 5.0f);
+    QCOMPARE(countDifferences(sparse, full), 0);
+}
+
+void TestTensorStorage::copyOnWrite()
+{
+    TensorStorage sparse(SparseTiledStorage);
+    TensorStorage full(FullPrecisionStorage);
+    sparse.resize(fieldSize);
+    full.resize(fieldSize);
+    sparse.setTileCacheMemoryCap(4*TILE_PAGE_BYTES);
+    writePattern(sparse, full, QRect(QPoint(0,0), fieldSize), 6.0f);
+
+    TensorStorage sparseCopy = sparse;
+    TensorStorage fullCopy = full;
+    QVERIFY(sparseCopy.sharesRow(0, sparse));
+    writePattern(sparseCopy, fullCopy, QRect(40,40,60,60), 7.0f);
+    QVERIFY(!sparseCopy.sharesRow(40, sparse));
+    QCOMPARE(countDifferences(sparse, full), 0);
+    QCOMPARE(countDifferences(sparseCopy, fullCopy), 0);
+
+    // Writing the original after the copy leaves the copy unchanged
+    writePattern(sparse, full, QRect(120,10,50,50), 8.0f);
+    QCOMPARE(countDifferences(sparse, full), 0);
+    QCOMPARE(countDifferences(sparseCopy, fullCopy), 0);
+}
+
+void TestTensorStorage::concurrentReads()
+{
+    TensorStorage sparse(SparseTiledStorage);
+    TensorStorage full(FullPrecisionStorage);
+    sparse.resize(fieldSize);
+    full.resize(fieldSize);
+    writePattern(sparse, full, QRect(QPoint(0,0), fieldSize), 9.0f);
+    // Pages are written back while other threads still read them
+    sparse.setTileCacheMemoryCap(2*TILE_PAGE_BYTES);
+
+    QVector<int> rows(fieldSize.height());
+    for(int i=0 ; i<rows.size() ; i++)
+    {
+        rows[i] = i;
+    }
+    QAtomicInt differences(0);
+    const TensorStorage& sparseData = sparse;
+    const TensorStorage& fullData = full;
+    QtConcurrent::blockingMap(rows, [&sparseData, &fullData, &differences](int i)
+    {
+        for(int j=0 ; j<fullData.width() ; j++)
+        {
+            if(sparseData.at(i,j) != fullData.at(i,j))
+            {
+                differences.fetchAndAddRelaxed(1);
+            }
+        }
+    });
+    QCOMPARE(differences.load(), 0);
+}
+
+QTEST_MAIN(TestTensorStorage)
+
+#include "tst_TensorStorage.moc"
@@ -0,0 +1,7 @@
+include(../tests.pri)
+
+TARGET = tst_TensorStorage
+TEMPLATE = app
+CONFIG += testcase
+
+SOURCES += tst_TensorStorage.cpp